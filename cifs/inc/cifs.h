@@ -1,389 +1,1197 @@
-//////////////////////////////////////////////////////////////////////////
-///
-/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
-///
-//////////////////////////////////////////////////////////////////////////
-
-/*
- * Rafael Diaz
- * Spring 2025
- * COMP 362 Section 1 - Operating Systems
- */
-
-#ifndef __CIFS_H_
-#define __CIFS_H_
-
-#include <time.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-#include <limits.h>
-#include <unistd.h>
-
-// can also use -D flag to pass the flag to gcc: gcc -DNO_FUSE_DEBUG ...
-//#define NO_FUSE_DEBUG // TODO: comment out when integrated with FUSE
-
-#ifdef __linux__
-#ifndef FUSE_USE_VERSION
-#  define FUSE_USE_VERSION 35
-#endif
-#include <fuse.h>
-#else
-#include <sys/types.h>
-#include <sys/stat.h>
-typedef struct fuse_context
-{
-    void *fuse; // in place of struct fuse *fuse,
-    uid_t uid;
-    gid_t gid;
-    pid_t pid;
-    void * private_data;
-    mode_t umask;
-} fuse_context;
-#endif
-
-#ifndef FUSE_USE_VERSION
-#define FUSE_USE_VERSION 35
-#endif
-
-//////////////////////////////////////////////////////////////////////////
-/***
-
- defines sizes for the volume
-
- To accommodate less capable systems, the numbers are lower than desired
- that are commented out
-
-*/
-//////////////////////////////////////////////////////////////////////////
-
-#define CIFS_BLOCK_SIZE 256 // has to be large enough to hold the superblock
-#define CIFS_NUMBER_OF_BLOCKS 65535 // 2^16 - 1
-#define CIFS_MAX_NAME_LENGTH 128
-#define CIFS_DATA_SIZE 254 // CIFS_BLOCK_SIZE - sizeof(CIFS_CONTENT_TYPE)
-#define CIFS_INDEX_SIZE 127 // two bytes => x0000 - xFFFF => 2^16 range
-
-//////////////////////////////////////////////////////////////////////////
-/***
-
- each file/folder gets a unique identifier, and this is the initial value
- the unique identifier of the root folder will be assigned this value
-
-*/
-//////////////////////////////////////////////////////////////////////////
-
-#define CIFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER 0
-
-//////////////////////////////////////////////////////////////////////////
-/***
-
- defines for the in-memory data structures
-
-*/
-//////////////////////////////////////////////////////////////////////////
-
-#define CIFS_REGISTRY_SIZE 65537 // prime number for the size of the registry (it is larger than 2^16)
-
-//////////////////////////////////////////////////////////////////////////
-/***
-
- data structures for "physical" file system
-
-*/
-//////////////////////////////////////////////////////////////////////////
-
-enum
-{
-	CIFS_FOLDER_CONTENT_TYPE,
-	CIFS_FILE_CONTENT_TYPE,
-	CIFS_INDEX_CONTENT_TYPE,
-	CIFS_DATA_CONTENT_TYPE,
-	CIFS_INVALID_CONTENT_TYPE
-};
-
-typedef unsigned short CIFS_CONTENT_TYPE;
-
-typedef unsigned short CIFS_INDEX_TYPE; // is used to index blocks in the file system
-#define CIFS_INVALID_INDEX CIFS_NUMBER_OF_BLOCKS // must be excluded from the range for block indices
-
-/***
-
- superblock starting block in the whole file system
-
- cifsNextUniqueIdentifier
-        is the next available value fot the unique identifier for a new folder or file
-        it is a unique very large value from [0, UINTMAX_MAX] same as [0, -1]
-        UINTMAX_MAX == 2^64 - 1 == 18,446,744,073,709,551,615
- cifsRootNodeIndex points to the block which is the root folder of the files system
- numberOfBlock determines the size of the file system
- cifsDataBlockSize is the size of a single block of the file system
-
- */
-
-// superblock is located in the first block after the bitvector
-#define CIFS_SUPERBLOCK_INDEX CIFS_NUMBER_OF_BLOCKS/8/CIFS_BLOCK_SIZE
-
-typedef struct cifs_superblock_type
-{
-	unsigned long long cifsNextUniqueIdentifier; // unique identifier generator for files and folders
-	CIFS_INDEX_TYPE cifsNumberOfBlocks;
-	CIFS_INDEX_TYPE cifsDataBlockSize;
-	CIFS_INDEX_TYPE cifsRootNodeIndex; // should point to the first block after the last bitvector block
-} CIFS_SUPERBLOCK_TYPE;
-
-/***
-
- file descriptor node for blocks holding folder or file information
-
-   for files:
-       te size indicates the size of the file
-       the block reference is initialized to CIFS_INVALID_INDEX
-           - it will point to an index block when the file has content
-
-   for directories:
-       the size indicates the number of files or directories in this folder
-       the block reference points to an index block that holds references to the file and folder blocks
-
-*/
-typedef char CIFS_NAME_TYPE[CIFS_MAX_NAME_LENGTH]; // for folder and file names
-
-typedef struct cifs_file_descriptor_type
-{
-	unsigned long long identifier; // unique folder/file identifier
-	CIFS_CONTENT_TYPE type; // folder or file
-	CIFS_NAME_TYPE name;
-	time_t creationTime; // creation time
-	time_t lastAccessTime; // last access
-	time_t lastModificationTime; // last modification
-	mode_t accessRights; // access rights for the file
-	uid_t owner; // owner ID
-	size_t size;
-	CIFS_INDEX_TYPE block_ref; // reference to the data or index block
-   CIFS_INDEX_TYPE parent_block_ref; // reference to the holding folder
-	CIFS_INDEX_TYPE file_block_ref; // reference to the block itself
-} CIFS_FILE_DESCRIPTOR_TYPE;
-
-/***
-
- a block for holding data
-
-*/
-typedef char CIFS_DATA_TYPE[CIFS_DATA_SIZE];
-
-/***
-
- various interpretations of a file system block
-
-*/
-typedef struct cifs_block_type
-{
-	CIFS_CONTENT_TYPE type;
-	union
-	{ // content depends on the type
-		CIFS_FILE_DESCRIPTOR_TYPE fileDescriptor __attribute__((packed)); // for directories and files
-		CIFS_DATA_TYPE data; // for data
-		CIFS_INDEX_TYPE index[CIFS_INDEX_SIZE];  // for indices; all indices but the last point to data blocks
-		// the last points to another index block
-	} content;
-} CIFS_BLOCK_TYPE;
-
-//////////////////////////////////////////////////////////////////////////
-/***
-
- definitions for in-memory data structures supporting the file system
-
-*/
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * file handle is simply an index to the registry for that file
- */
-typedef int CIFS_FILE_HANDLE_TYPE;
-
-/***
-
- file system registry
-
- registry entry in the conflict resolution linked list with the head in the hash table slot for
- the corresponding name
-
-*/
-typedef struct cifs_registry_ent_type
-{
-    // a copy of the file descriptor node from the volume
-    CIFS_FILE_DESCRIPTOR_TYPE fileDescriptor;
-    // file handle of the holding folder
-    CIFS_FILE_HANDLE_TYPE parentFileHandle;
-	// reference count; increased on each new process opening the file; decreased on file close
-	int referenceCount; // if not zero, cannot delete file
-	struct cifs_registry_ent_type* next;
-} CIFS_REGISTRY_ENTRY_TYPE;
-
-/***
-
- registry implemented as a hash table
-
- slots are heads to resolution lists for conflicting names
-
- created on filesystem mount
-
-*/
-typedef CIFS_REGISTRY_ENTRY_TYPE* CIFS_REGISTRY;
-
-/***
- *
- * When a file is opened, an entry is added to this list.
- * When the file is closed, the corresponding entry is removed from the list.
- *
- */
-typedef struct open_file_type
-{
-    unsigned long long identifier; // unique folder/file identifier
-    CIFS_FILE_HANDLE_TYPE fileHandle; // index to the entry for the file in the in-memory registry; set on open
-    mode_t processAccessRights; // must be computed and set when opening the file
-    struct open_file_type *next;
-} OPEN_FILE_TYPE;
-
-/***
- *
- * In an actual OS, we would have access to the Process Control Block (PCB) that would have all
- * information about processes (including open files, etc.)
- *
- * The following is just a small subset that is needed to manage open files and keeping track of
- * the current directory.
- *
- */
-typedef struct cifs_process_control_block_type
-{
-    pid_t pid; // process identifier
-    // a list of references to all open files for the process
-    OPEN_FILE_TYPE *openFiles;
-    // arbitrarily, we assume that the first entry is always the current working directory 	// current directory of a process should be initialized to the root of the volume
-    // and then changed on each 'cd'
-    // 'cd' generates 'get attribute' system call for that directory that is redirected
-    // to the corresponding FUSE function
-    struct cifs_process_control_block_type* next;
-} CIFS_PROCESS_CONTROL_BLOCK_TYPE;
-
-/***
-
- file system context
-
- holds the registry and an in-memory copy of the volume bitvector
-
- the registry is created when mounting the system (through traversal)
- the bitvector is copied from the volume when mounting
-
- all access to the files is through the registry (create, delete, get info, read, write)
-
- the in-memory bitvector must be used when the system is mounted, but updated on the disc
- on every successful creation, deletion, write, and read
-
- elements are added to the list of processes when they successfully open files; when a file is closed
- (by the same process), then the entry is removed
-
-*/
-typedef struct cifs_context_type
-{
-	CIFS_SUPERBLOCK_TYPE* superblock; // holds a copy of the volume superblock
-	unsigned char* bitvector; // an in-memory copy of the bitvector of the volume
-	CIFS_REGISTRY* registry; // the hashtable-based in-memory registry
-	CIFS_PROCESS_CONTROL_BLOCK_TYPE* processList; // a list of processes that opened files
-} CIFS_CONTEXT_TYPE;
-
-//////////////////////////////////////////////////////////////////////////
-/***
-
- file system function declarations
-
-*/
-//////////////////////////////////////////////////////////////////////////
-
-typedef enum cifs_error
-{
-	CIFS_NO_ERROR,
-	CIFS_ALLOC_ERROR,
-	CIFS_DUPLICATE_ERROR,
-	CIFS_NOT_FOUND_ERROR,
-	CIFS_NOT_EMPTY_ERROR,
-	CIFS_ACCESS_ERROR,
-	CIFS_WRITE_ERROR,
-	CIFS_READ_ERROR,
-	CIFS_IN_USE_ERROR,
-	CIFS_OPEN_ERROR,
-	CIFS_SYSTEM_ERROR
-} CIFS_ERROR;
-
-CIFS_ERROR cifsCreateFileSystem(char* cifsFileSystemName);
-
-CIFS_ERROR cifsUmountFileSystem(char* cifsFileSystemName);
-
-CIFS_ERROR cifsMountFileSystem(char* cifsFileSystemName);
-
-CIFS_ERROR cifsCreateFile(CIFS_NAME_TYPE filePath, CIFS_CONTENT_TYPE type);
-
-CIFS_ERROR cifsDeleteFile(CIFS_NAME_TYPE filePath);
-
-CIFS_ERROR cifsOpenFile(CIFS_NAME_TYPE filePath, mode_t desiredAccessRights, CIFS_FILE_HANDLE_TYPE *fileHandle);
-
-CIFS_ERROR cifsCloseFile(CIFS_FILE_HANDLE_TYPE fileHandle);
-
-CIFS_ERROR cifsGetFileInfo(CIFS_NAME_TYPE filePath, CIFS_FILE_DESCRIPTOR_TYPE* infoBuffer);
-
-CIFS_ERROR cifsWriteFile(CIFS_FILE_HANDLE_TYPE fileHandle, char* writeBuffer);
-
-CIFS_ERROR cifsReadFile(CIFS_FILE_HANDLE_TYPE fileHandle, char** readBuffer);
-
-/***
- *
- * Functions for reading and writing a single block from and to a block device.
- *
- */
-size_t cifsWriteBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber);
-void cifsReadBlock(unsigned char* buffer, CIFS_INDEX_TYPE blockNumber);
-//unsigned char* cifsReadBlock(CIFS_INDEX_TYPE blockNumber);
-void cifsCheckIOError(const char* who, const char* what);
-void cifsPrintBlockContent(const unsigned char *str);
-
-
-/***
- *
- * the following are utility functions that will come handy in the implementation
- *
- */
-unsigned long hash(const char* str);
-
-CIFS_INDEX_TYPE cifsFindFreeBlock(const unsigned char* bitvector);
-
-void cifsFlipBit(unsigned char* bitvector, unsigned short bitIndex);
-
-void cifsSetBit(unsigned char* bitvector, unsigned short bitIndex);
-
-void cifsClearBit(unsigned char* bitvector, unsigned short bitIndex);
-
-
-// Extra Helper Functions
-void traverseDisk(CIFS_INDEX_TYPE* index, int size, char* path);
-void addToHashTable(long index, char* filePath, CIFS_FILE_DESCRIPTOR_TYPE* fd);
-int doesFileExist(char* filePath);
-void writeBvSb(void);
-
-
-/***
- * The following functions can be used to simulate FUSE context's user and process identifiers for testing.
- *
- * These identifiers are obtainable by calling fuse_get_context() the fuse library.
- */
-
-#ifdef NO_FUSE_DEBUG
-
-char* cifsGenerateContent(int size);
-void testSamples();
-void testStep1();
-void testStep2();
-void testStep3();
-
-#endif
-#endif
-
+//////////////////////////////////////////////////////////////////////////
+///
+/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
+///
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Rafael Diaz
+ * Spring 2025
+ * COMP 362 Section 1 - Operating Systems
+ */
+
+#ifndef __CIFS_H_
+#define __CIFS_H_
+
+#include <time.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+// can also use -D flag to pass the flag to gcc: gcc -DNO_FUSE_DEBUG ...
+//#define NO_FUSE_DEBUG // TODO: comment out when integrated with FUSE
+
+#ifdef __linux__
+#ifndef FUSE_USE_VERSION
+#  define FUSE_USE_VERSION 35
+#endif
+#include <fuse.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+typedef struct fuse_context
+{
+    void *fuse; // in place of struct fuse *fuse,
+    uid_t uid;
+    gid_t gid;
+    pid_t pid;
+    void * private_data;
+    mode_t umask;
+} fuse_context;
+#endif
+
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 35
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ tracing
+
+ CIFS_TRACE_LEVEL selects at compile time the most verbose level that is compiled in (by default only
+ errors); use -DCIFS_TRACE_LEVEL=CIFS_TRACE_BLOCK (or the CMake cache variable of the same name) to get
+ everything
+
+ cifsTraceLevel lowers the level at run time; messages above CIFS_TRACE_LEVEL are removed by the compiler,
+ so their arguments are never evaluated
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#define CIFS_TRACE_NONE 0
+#define CIFS_TRACE_ERROR 1 // failures of the volume
+#define CIFS_TRACE_INFO 2 // volume creation, mounting, and unmounting
+#define CIFS_TRACE_IO 3 // position and length of every block read from or written to the volume
+#define CIFS_TRACE_BLOCK 4 // the content of every block read from or written to the volume
+
+#ifndef CIFS_TRACE_LEVEL
+#define CIFS_TRACE_LEVEL CIFS_TRACE_ERROR
+#endif
+
+extern int cifsTraceLevel;
+
+#define CIFS_TRACE_ENABLED(level) ((level) <= CIFS_TRACE_LEVEL && (level) <= cifsTraceLevel)
+
+#define CIFS_TRACE(level, ...) \
+	do { if (CIFS_TRACE_ENABLED(level)) printf(__VA_ARGS__); } while (0)
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ defines sizes for the volume
+
+ To accommodate less capable systems, the numbers are lower than desired
+ that are commented out
+
+ The geometry is chosen when building: CIFS_BLOCK_SIZE, CIFS_INDEX_BITS (the width of the block numbers, 16 or
+ 32), and CIFS_NUMBER_OF_BLOCKS may be given on the command line (see CMakeLists.txt). The defaults are the
+ 256-byte blocks with 16-bit block numbers; e.g., -DCIFS_BLOCK_SIZE=4096 -DCIFS_INDEX_BITS=32 formats volumes
+ of 4 KiB blocks. The geometry is recorded in the superblock, and a volume is only mounted by a build of the
+ same geometry; the others are refused with CIFS_GEOMETRY_ERROR, and the refusal is traced with the build
+ options that mount the volume.
+
+ A build does not take its geometry from the superblock at mount: the block size and the width of the block
+ numbers fix the layout of every block, cache slot, and table, so a build mounting several geometries would
+ need all of them sized at run time, which is left to a separate change.
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef CIFS_BLOCK_SIZE
+#define CIFS_BLOCK_SIZE 256 // has to be large enough to hold the superblock
+#endif
+
+#ifndef CIFS_INDEX_BITS
+#define CIFS_INDEX_BITS 16
+#endif
+
+#ifndef CIFS_NUMBER_OF_BLOCKS
+#if CIFS_INDEX_BITS == 16
+#define CIFS_NUMBER_OF_BLOCKS 65535 // 2^16 - 1
+#else
+#define CIFS_NUMBER_OF_BLOCKS 1048575 // 2^20 - 1; the in-memory tables of the volume grow with it
+#endif
+#endif
+
+#define CIFS_MAX_NAME_LENGTH 128
+#define CIFS_DATA_SIZE (CIFS_BLOCK_SIZE - CIFS_INDEX_BITS / 8) // CIFS_BLOCK_SIZE - sizeof(CIFS_CONTENT_TYPE)
+#define CIFS_INDEX_SIZE (CIFS_BLOCK_SIZE / (CIFS_INDEX_BITS / 8) - 1) // 127 two-byte indices in 256-byte blocks
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ each file/folder gets a unique identifier, and this is the initial value
+ the unique identifier of the root folder will be assigned this value
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#define CIFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER 0
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ defines for the in-memory data structures
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+#define CIFS_REGISTRY_SIZE 65537 // prime number for the size of the registry (it is larger than 2^16)
+
+#define CIFS_CACHE_SIZE 1024 // number of blocks held in the in-memory block cache
+#define CIFS_CACHE_BUCKETS 2039 // prime number of hash slots for locating blocks in the cache
+#define CIFS_READ_AHEAD_MIN 4 // data blocks prefetched once a file is read sequentially
+#define CIFS_READ_AHEAD_MAX 64 // the read-ahead window doubles up to this many data blocks
+#define CIFS_CACHE_HELD_MAX (CIFS_CACHE_SIZE / 2) // slots that read vectors may hold at a time
+#define CIFS_READ_VECTOR_BLOCKS 128 // data blocks described by a single read vector at most
+
+#define CIFS_IOV_BATCH 1024 // maximum number of blocks in a single vectored read or write (UIO_MAXIOV on Linux)
+#define CIFS_MOUNT_THREADS 8 // workers reading file descriptors while the registry is built
+#define CIFS_MOUNT_CHUNK 64 // descriptors a mount worker reads in one go
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ data structures for "physical" file system
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+enum
+{
+	CIFS_FOLDER_CONTENT_TYPE,
+	CIFS_FILE_CONTENT_TYPE,
+	CIFS_INDEX_CONTENT_TYPE,
+	CIFS_DATA_CONTENT_TYPE,
+	CIFS_INVALID_CONTENT_TYPE
+};
+
+#if CIFS_INDEX_BITS == 16
+typedef unsigned short CIFS_CONTENT_TYPE;
+
+typedef unsigned short CIFS_INDEX_TYPE; // is used to index blocks in the file system
+#elif CIFS_INDEX_BITS == 32
+typedef unsigned int CIFS_CONTENT_TYPE; // as wide as the indices, so they are aligned in the index blocks
+
+typedef unsigned int CIFS_INDEX_TYPE;
+#else
+#error "CIFS_INDEX_BITS must be 16 or 32"
+#endif
+#define CIFS_INVALID_INDEX CIFS_NUMBER_OF_BLOCKS // must be excluded from the range for block indices
+
+_Static_assert(CIFS_NUMBER_OF_BLOCKS <= (1ULL << CIFS_INDEX_BITS) - 1, "block numbers do not fit in CIFS_INDEX_TYPE");
+_Static_assert(CIFS_NUMBER_OF_BLOCKS / 8 / CIFS_BLOCK_SIZE > 0, "the volume is too small for a bitvector block");
+
+/***
+
+ superblock starting block in the whole file system
+
+ cifsNextUniqueIdentifier
+        is the next available value fot the unique identifier for a new folder or file
+        it is a unique very large value from [0, UINTMAX_MAX] same as [0, -1]
+        UINTMAX_MAX == 2^64 - 1 == 18,446,744,073,709,551,615
+ cifsRootNodeIndex points to the block which is the root folder of the files system
+ numberOfBlock determines the size of the file system
+ cifsDataBlockSize is the size of a single block of the file system
+ cifsIndexBits is the width of the block numbers; together with the two above, it is the geometry of the volume
+
+ */
+
+// superblock is located in the first block after the bitvector
+#define CIFS_SUPERBLOCK_INDEX CIFS_NUMBER_OF_BLOCKS/8/CIFS_BLOCK_SIZE
+
+// the bitvector occupies all blocks in front of the superblock, so it can track this many blocks
+#define CIFS_BITVECTOR_SIZE (CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE) // in bytes
+#define CIFS_BITVECTOR_BITS (CIFS_BITVECTOR_SIZE * 8)
+
+// threads allocating blocks at once start their searches in this many separate regions of the volume
+#define CIFS_ALLOCATION_REGIONS 16
+
+typedef struct cifs_superblock_type
+{
+	unsigned long long cifsNextUniqueIdentifier; // unique identifier generator for files and folders
+	CIFS_INDEX_TYPE cifsNumberOfBlocks;
+	CIFS_INDEX_TYPE cifsDataBlockSize;
+	CIFS_INDEX_TYPE cifsRootNodeIndex; // the first block after the journal (or after the superblock without one)
+	unsigned long long cifsGeneration; // advanced on every clean unmount
+	unsigned long long cifsSnapshotGeneration; // generation of the registry snapshot matching the volume; 0 if none
+	CIFS_INDEX_TYPE cifsJournalIndex; // the first block of the metadata journal; follows the superblock
+	CIFS_INDEX_TYPE cifsJournalBlocks; // the length of the journal; 0 if the volume has none
+	CIFS_INDEX_TYPE cifsIndexBits; // CIFS_INDEX_BITS of the volume; 0 on volumes formatted before it was recorded
+} CIFS_SUPERBLOCK_TYPE;
+
+_Static_assert(sizeof(CIFS_SUPERBLOCK_TYPE) <= CIFS_BLOCK_SIZE, "the superblock does not fit in a block");
+
+
+/***
+
+ file descriptor node for blocks holding folder or file information
+
+   for files:
+       te size indicates the size of the file
+       the block reference is initialized to CIFS_INVALID_INDEX
+           - it will point to an index block when the file has content
+           - it stays CIFS_INVALID_INDEX if the content fits in the descriptor block (at most CIFS_INLINE_SIZE
+             bytes); the content is then stored inline, right after the descriptor
+
+   for directories:
+       the size indicates the number of files or directories in this folder
+       the block reference points to an index block that holds references to the file and folder blocks
+
+*/
+typedef char CIFS_NAME_TYPE[CIFS_MAX_NAME_LENGTH]; // for folder and file names
+
+typedef struct cifs_file_descriptor_type
+{
+	unsigned long long identifier; // unique folder/file identifier
+	CIFS_CONTENT_TYPE type; // folder or file
+	CIFS_NAME_TYPE name;
+	time_t creationTime; // creation time
+	time_t lastAccessTime; // last access
+	time_t lastModificationTime; // last modification
+	mode_t accessRights; // access rights for the file
+	uid_t owner; // owner ID
+	size_t size;
+	CIFS_INDEX_TYPE block_ref; // reference to the data or index block
+   CIFS_INDEX_TYPE parent_block_ref; // reference to the holding folder
+	CIFS_INDEX_TYPE file_block_ref; // reference to the block itself
+	unsigned char inlined; // the content is stored in the descriptor block; see CIFS_INLINE_SIZE
+} CIFS_FILE_DESCRIPTOR_TYPE;
+
+// the content of a file that fits in the rest of its descriptor block is stored there
+#define CIFS_INLINE_SIZE (CIFS_DATA_SIZE - sizeof(CIFS_FILE_DESCRIPTOR_TYPE))
+
+/***
+
+ a block for holding data
+
+*/
+typedef char CIFS_DATA_TYPE[CIFS_DATA_SIZE];
+
+/***
+
+ various interpretations of a file system block
+
+*/
+typedef struct cifs_block_type
+{
+	CIFS_CONTENT_TYPE type;
+	union
+	{ // content depends on the type
+		CIFS_FILE_DESCRIPTOR_TYPE fileDescriptor __attribute__((packed)); // for directories and files
+		CIFS_DATA_TYPE data; // for data
+		CIFS_INDEX_TYPE index[CIFS_INDEX_SIZE];  // for indices; all indices but the last point to data blocks
+		// the last points to another index block
+		struct
+		{
+			CIFS_FILE_DESCRIPTOR_TYPE descriptor;
+			char data[CIFS_INLINE_SIZE];
+		} __attribute__((packed)) inlineFile; // for files with the content stored inline
+	} content;
+} CIFS_BLOCK_TYPE;
+
+_Static_assert(sizeof(CIFS_BLOCK_TYPE) == CIFS_BLOCK_SIZE, "CIFS_BLOCK_TYPE must fill a block exactly");
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ definitions for in-memory data structures supporting the file system
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * file handle is simply an index to the registry for that file
+ *
+ * it is the number of the block holding the file descriptor, so it is unique and stable while the
+ * file exists; the context maps it to the registry entry
+ */
+typedef int CIFS_FILE_HANDLE_TYPE;
+
+/***
+
+ flattened block map of a file
+
+ the data blocks of the file in their logical order, and the index blocks of its chain, so that any data
+ block is found without reading the index blocks in front of it; one allocation holds the map and both arrays
+
+*/
+typedef struct cifs_block_map_type
+{
+	unsigned int dataBlocks; // the length of data
+	unsigned int indexBlocks; // the length of index
+	CIFS_INDEX_TYPE* index; // the index blocks in the order of the chain
+	CIFS_INDEX_TYPE data[]; // the data blocks in the order of the content
+} CIFS_BLOCK_MAP_TYPE;
+
+/***
+
+ file system registry
+
+ registry entry holding the in-memory copy of a descriptor; entries are located through the file handle
+ (see handles in CIFS_CONTEXT_TYPE) once the registry has found them by name
+
+ entries are keyed on the pair (parent file handle, name), so resolving a name in a folder takes a single
+ hash probe and no block reads
+
+*/
+typedef struct cifs_registry_ent_type
+{
+    // a copy of the file descriptor node from the volume
+    CIFS_FILE_DESCRIPTOR_TYPE fileDescriptor;
+    // file handle of the holding folder
+    CIFS_FILE_HANDLE_TYPE parentFileHandle;
+	// reference count; increased on each new process opening the file; decreased on file close
+	int referenceCount; // if not zero, cannot delete file
+	// the open file of the process holding the file open; NULL while the file is closed
+	struct open_file_type* openFile;
+	// guards the descriptor copy and the content of the file
+	pthread_rwlock_t lock;
+	// the block map of an open file; built by the first range read, and dropped when the blocks of the file
+	// change or its last process closes it; NULL if not built
+	CIFS_BLOCK_MAP_TYPE* blockMap;
+	// sequential read-ahead through the block map; readers update it concurrently, with atomic accesses
+	size_t readAheadOffset; // where the next sequential read starts
+	unsigned int readAheadWindow; // data blocks prefetched at a time; 0 while the reads are not sequential
+	unsigned int readAheadEnd; // the first data block that is not prefetched yet
+} CIFS_REGISTRY_ENTRY_TYPE;
+
+/***
+
+ registry implemented as an open-addressing hash table
+
+ the slots are kept apart from the entries and hold only what a lookup compares: the hash of the key, the
+ parent, and the offset of the name in a pool of interned names; the file handle of a matching slot leads to
+ the entry, so a probe touches 12 bytes and the name instead of a whole descriptor
+
+ probing is linear; the table doubles when it is three quarters full, and a removal shifts the following
+ slots of its probe run back instead of leaving a tombstone
+
+ every distinct name is stored once in the pool as a NUL-terminated string, found through a small hash set
+ of its own; names stay in the pool until the volume is unmounted
+
+ created on filesystem mount
+
+*/
+#define CIFS_REGISTRY_INITIAL_SLOTS 1024 // power of two
+#define CIFS_NAME_POOL_INITIAL_SIZE 16384 // bytes of names before the pool grows
+
+typedef struct cifs_registry_slot_type
+{
+	unsigned int hash; // cifsRegistryHash() of the key
+	unsigned int nameOffset; // the name in the pool
+	CIFS_INDEX_TYPE parentFileHandle;
+	CIFS_INDEX_TYPE fileHandle; // CIFS_INVALID_INDEX for an empty slot
+} CIFS_REGISTRY_SLOT_TYPE;
+
+typedef struct cifs_name_pool_type
+{
+	char* text; // the interned names one after another
+	size_t used;
+	size_t capacity;
+	unsigned int* set; // 1 + offset of a name in the text; 0 for an empty slot
+	unsigned int setSize; // power of two
+	unsigned int count;
+} CIFS_NAME_POOL_TYPE;
+
+typedef struct cifs_registry_type
+{
+	CIFS_REGISTRY_SLOT_TYPE* slots;
+	unsigned int slotCount; // power of two
+	unsigned int count;
+	CIFS_NAME_POOL_TYPE names;
+} CIFS_REGISTRY;
+
+/***
+
+ path cache (dentry cache)
+
+ a direct-mapped table of resolved paths; an entry holds the path as given and the file handle it resolves to,
+ or CIFS_INVALID_INDEX when the path is known not to exist
+
+ entries are stamped with a generation rather than being looked for and removed: creating a file or folder
+ advances the negative generation, invalidating every cached miss, and deleting one advances the positive
+ generation, invalidating every cached hit
+
+*/
+#define CIFS_DENTRY_CACHE_SIZE 1024 // power of two
+
+typedef struct cifs_dentry_type
+{
+	unsigned int hash;
+	unsigned int generation; // 0 for an unused entry
+	CIFS_INDEX_TYPE fileHandle; // CIFS_INVALID_INDEX for a missing path
+	char path[CIFS_MAX_NAME_LENGTH];
+} CIFS_DENTRY_TYPE;
+
+/***
+
+ registry snapshot
+
+ a clean unmount saves the registry next to the volume in <volume>CIFS_SNAPSHOT_SUFFIX, so the next mount can
+ load it with one sequential read instead of traversing the tree; the file holds a header, one record per
+ registry entry, and the names of all entries as NUL-terminated strings
+
+ the snapshot is valid only while its generation equals cifsSnapshotGeneration in the superblock; a mount
+ clears that field before anything changes, so after an unclean shutdown the snapshot is ignored and the
+ registry is rebuilt from the volume
+
+*/
+#define CIFS_SNAPSHOT_SUFFIX ".registry"
+#define CIFS_SNAPSHOT_MAGIC 0x43494653534E5032ULL // "CIFSSNP2"
+
+extern int cifsRegistrySnapshot; // set to 0 to neither load nor save snapshots
+
+typedef struct cifs_snapshot_header_type
+{
+	unsigned long long magic;
+	unsigned long long generation;
+	unsigned int recordCount;
+	unsigned int namesSize; // bytes of names following the records
+} CIFS_SNAPSHOT_HEADER_TYPE;
+
+typedef struct cifs_snapshot_record_type
+{
+	unsigned long long identifier;
+	CIFS_FILE_HANDLE_TYPE parentFileHandle;
+	unsigned int nameOffset; // where the name starts in the names
+	CIFS_INDEX_TYPE descriptorBlock; // the block holding the descriptor; also the file handle
+	CIFS_CONTENT_TYPE type;
+	time_t creationTime;
+	time_t lastAccessTime;
+	time_t lastModificationTime;
+	mode_t accessRights;
+	uid_t owner;
+	size_t size;
+	CIFS_INDEX_TYPE block_ref;
+	unsigned char inlined;
+} CIFS_SNAPSHOT_RECORD_TYPE;
+
+/***
+
+ a run of consecutive blocks taken from the bitvector
+
+*/
+typedef struct cifs_extent_type
+{
+	CIFS_INDEX_TYPE start; // the first block of the run
+	CIFS_INDEX_TYPE length; // the number of blocks in the run
+} CIFS_EXTENT_TYPE;
+
+/***
+ *
+ * When a file is opened, an entry is added to the open file table of the process, and the registry entry of
+ * the file points to it. When the file is closed, the entry is removed from the table.
+ *
+ */
+typedef struct open_file_type
+{
+    unsigned long long identifier; // unique folder/file identifier
+    CIFS_FILE_HANDLE_TYPE fileHandle; // index to the entry for the file in the in-memory registry; set on open
+    mode_t processAccessRights; // must be computed and set when opening the file
+    struct cifs_process_control_block_type* process; // the process that opened the file
+    int slot; // position of the entry in the open file table of the process
+} OPEN_FILE_TYPE;
+
+/***
+ *
+ * In an actual OS, we would have access to the Process Control Block (PCB) that would have all
+ * information about processes (including open files, etc.)
+ *
+ * The following is just a small subset that is needed to manage open files and keeping track of
+ * the current directory.
+ *
+ */
+#define CIFS_PROCESS_BUCKETS 64 // initial size of the process table; doubled when more processes open files
+
+typedef struct cifs_process_control_block_type
+{
+    pid_t pid; // process identifier
+    // the open file table of the process: references to all its open files, densely packed in no particular
+    // order; a file is closed by moving the last reference into its slot
+    OPEN_FILE_TYPE **openFiles;
+    int openFileCount;
+    int openFileCapacity;
+    // arbitrarily, we assume that the first entry is always the current working directory 	// current directory of a process should be initialized to the root of the volume
+    // and then changed on each 'cd'
+    // 'cd' generates 'get attribute' system call for that directory that is redirected
+    // to the corresponding FUSE function
+    struct cifs_process_control_block_type* next; // the next process in the same bucket of the process table
+} CIFS_PROCESS_CONTROL_BLOCK_TYPE;
+
+/***
+
+ write-back block cache
+
+ a fixed number of slots, each holding the content of one volume block; slots are located through a small
+ hash table keyed by the block number (collisions are chained through the slot indices)
+
+ blocks written through cifsWriteBlock() are only marked dirty; they reach the volume when they are evicted
+ or when the cache is flushed by cifsSyncFileSystem() or cifsUmountFileSystem()
+
+ eviction uses the CLOCK (second chance) algorithm: the hand sweeps over the slots clearing the referenced
+ bits until it finds a slot that has not been used since the last sweep
+
+ with a journal, metadata blocks are pinned in the cache until the transaction logging them commits (see
+ CIFS_JOURNAL_TYPE); the clock hand passes pinned slots, unless it finds nothing else in two sweeps
+
+ the block functions hold the cache lock while they look up and change the slots, but not while they access the
+ volume: a slot is reserved as loading while its block is read into it, and marked as writing while its dirty content
+ is written back; the content of a loading slot is used only once it is loaded, the content of a writing slot is
+ read but not changed, and the clock hand passes both; threads waiting for such a slot sleep on the settled condition
+
+ callers of cifsCacheLookup() and cifsCacheAcquireSlot() must hold the lock themselves; cifsCacheAcquireSlot()
+ releases it to write a dirty victim back, or to wait for a slot, and then returns -1, so that the caller looks the
+ block up again
+
+ the slots referenced by read vectors (see cifsPreadv()) are held: the clock hand passes them, and their content
+ never changes; a write to a held block detaches the slot from its hash chain and puts the new content into
+ another slot, and the detached slot becomes empty when its last holder releases it; at most
+ CIFS_CACHE_HELD_MAX slots are held at a time, so the hand always finds a victim
+
+*/
+typedef struct cifs_cache_entry_type
+{
+	CIFS_INDEX_TYPE blockNumber; // CIFS_INVALID_INDEX if the slot is empty
+	unsigned char dirty; // content differs from the block on the volume
+	unsigned char referenced; // set on every access; cleared by the clock hand
+	unsigned char pinned; // logged in the running journal transaction; not written back before it commits
+	unsigned char detached; // no longer in its hash chain; emptied when the last holder releases it
+	unsigned char loading; // the block is being read into the slot; the content is not there yet
+	unsigned char writing; // the content is being written back, so it must not change
+	int holders; // read vectors referencing the content
+	int next; // next slot in the same hash chain; -1 terminates the chain
+	unsigned char content[CIFS_BLOCK_SIZE];
+} CIFS_CACHE_ENTRY_TYPE;
+
+typedef struct cifs_block_cache_type
+{
+	CIFS_CACHE_ENTRY_TYPE* slots; // CIFS_CACHE_SIZE slots
+	int buckets[CIFS_CACHE_BUCKETS]; // heads of the hash chains; -1 for empty chains
+	int hand; // the clock hand
+	CIFS_INDEX_TYPE* logged; // the blocks pinned by the running journal transaction, in the order of logging
+	unsigned int loggedCount;
+	unsigned int loggedCapacity;
+	time_t loggedSince; // when the first block of the running transaction was logged
+	int heldSlots; // slots with holders
+	int busySlots; // slots loading or writing
+	int writingSlots; // slots writing
+	pthread_mutex_t lock;
+	pthread_cond_t settled; // signalled when slots stop loading or writing, or lose their last holder
+} CIFS_BLOCK_CACHE_TYPE;
+
+/***
+
+ write-ahead metadata journal
+
+ a region of cifsJournalBlocks blocks following the superblock; metadata blocks (the bitvector, the superblock,
+ descriptors, and index blocks) changed by the operations are not written in place right away, but collected
+ into a transaction that is written to the journal as a whole:
+
+    header block      - the sequence number of the transaction
+    descriptor blocks - the block numbers of the logged blocks, CIFS_JOURNAL_TAGS per descriptor
+    logged blocks     - the new contents, in the order of the block numbers
+    commit block      - the number of blocks, and a checksum of the block numbers and the contents
+
+ one write and one fdatasync() commit all operations of a transaction (group commit); the logged blocks stay
+ pinned in the block cache until then, and reach their home locations later through the usual write-back
+
+ before a transaction is logged, all other dirty blocks, including the data blocks of the transaction and the
+ blocks of the previous transaction, are written to the volume and synchronized; so a committed transaction
+ never points at data that is not on the volume, and the journal only needs to hold the last transaction,
+ which every commit overwrites from the start of the region
+
+ a mount replays the transaction if its sequence number matches the header and its checksum is valid, and
+ discards it otherwise (a torn commit); a transaction that does not fit in the journal is written in place
+ without the guarantee of atomicity
+
+ a transaction is committed when CIFS_JOURNAL_BATCH blocks are logged, when the oldest logged block is
+ CIFS_JOURNAL_INTERVAL seconds old (by a background thread), and by cifsSyncFileSystem(); operations enter
+ through cifsJournalBegin() and leave through cifsJournalEnd(), so a commit never logs half of an operation
+
+ a block freed by a transaction stays taken in the in-memory bitvector until the transaction commits (even
+ though the bitvector saved with the transaction shows it free); otherwise another file could take it, and have
+ its data written over the block before the commit, while the committed file on the volume still refers to it
+
+ the journal is not used while the volume is mapped (there is no cache to hold the logged blocks back), but
+ the replay runs before mapping
+
+ the journal lock is taken before the cache lock, and never while holding any lock of the file system
+
+*/
+#define CIFS_JOURNAL_BLOCKS 1024 // the length of the journal of new volumes; see cifsJournalBlocks
+#define CIFS_JOURNAL_MAGIC 0x43494653574C4F47ULL // "CIFSWLOG"
+#define CIFS_JOURNAL_BATCH 256 // logged blocks that commit the transaction when an operation leaves
+#define CIFS_JOURNAL_INTERVAL 1 // seconds a logged block waits for the commit at most
+
+extern int cifsJournalBlocks; // the length of the journal of volumes created from now on; 0 for none
+
+typedef struct cifs_journal_header_type
+{
+	unsigned long long magic;
+	unsigned long long sequence; // of the transaction following the header
+} CIFS_JOURNAL_HEADER_TYPE;
+
+typedef struct cifs_journal_record_type // the descriptor and the commit blocks
+{
+	unsigned long long magic;
+	unsigned long long sequence;
+	unsigned long long checksum; // in the commit block
+	unsigned int count; // the number of blocks logged by the transaction
+} CIFS_JOURNAL_RECORD_TYPE;
+
+#define CIFS_JOURNAL_TAGS ((CIFS_BLOCK_SIZE - sizeof(CIFS_JOURNAL_RECORD_TYPE)) / sizeof(CIFS_INDEX_TYPE))
+
+typedef struct cifs_journal_type
+{
+	CIFS_BLOCK_CACHE_TYPE* cache; // holds the logged blocks
+	CIFS_INDEX_TYPE start; // the header block
+	CIFS_INDEX_TYPE length; // including the header
+	unsigned long long sequence; // of the next transaction
+	int active; // operations between cifsJournalBegin() and cifsJournalEnd()
+	int committing; // new operations wait until the commit is done
+	int stopping; // tells the commit thread to finish
+	unsigned char* freed; // a bitvector of the blocks freed by the running transaction; they stay taken until it commits
+	pthread_t thread; // commits the transactions that are not filled by the operations in time
+	pthread_mutex_t lock;
+	pthread_cond_t idle; // signalled when no operation is active, and when a commit is done
+	pthread_cond_t wake; // wakes the commit thread up
+} CIFS_JOURNAL_TYPE;
+
+/***
+
+ deferred block reclamation
+
+ deleting a file, or replacing the blocks of its content, hands the blocks it no longer needs to the reclaimer
+ thread instead of freeing them before returning; the reclaimer walks the index chains, frees the blocks in the
+ in-memory bitvector, and saves the changed bitvector blocks every CIFS_RECLAIM_BATCH blocks
+
+ queued blocks stay taken until the reclaimer frees them, so none is reused while its index block may still be
+ read; a crash loses the queue, which leaves its blocks taken but no longer referenced by any file; the freed
+ blocks are reused only after the transaction of the batch that freed them commits (see the journal)
+
+ cifsReclaimWait() waits until everything queued so far is free; synchronizing and unmounting do
+
+ the reclaim lock only guards the queue, and is taken after all other locks; the reclaimer holds no lock
+ while it enters the journal and frees blocks
+
+*/
+#define CIFS_RECLAIM_BATCH 1024 // blocks freed between two saves of the bitvector
+
+extern int cifsDeferredReclaim; // set to 0 to free the blocks before the operations return
+
+typedef struct cifs_reclaim_item_type
+{
+	struct cifs_reclaim_item_type* next;
+	CIFS_INDEX_TYPE chain; // an index chain to free with all its data blocks; CIFS_INVALID_INDEX for none
+	unsigned int count; // of the blocks
+	CIFS_INDEX_TYPE blocks[]; // single blocks to free
+} CIFS_RECLAIM_ITEM_TYPE;
+
+typedef struct cifs_reclaimer_type
+{
+	CIFS_RECLAIM_ITEM_TYPE* head; // the queue, oldest first
+	CIFS_RECLAIM_ITEM_TYPE* tail;
+	unsigned long long queued; // items queued since the volume was mounted
+	unsigned long long reclaimed; // items freed since the volume was mounted
+	int stopping; // tells the reclaimer to finish once the queue is empty
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; // wakes the reclaimer up
+	pthread_cond_t done; // signalled when an item is freed
+} CIFS_RECLAIMER_TYPE;
+
+/***
+
+ pluggable I/O backends
+
+ the device functions hand the runs of consecutive blocks to the backend of the mounted volume; a backend
+ gets all runs of a batch at once (up to CIFS_IO_QUEUE_DEPTH of them), may keep them all in flight, and calls
+ the completion callback of every run, in any order, before the transfer returns
+
+ a backend repeats short and interrupted transfers for the rest of the run (changing the entries of its vector),
+ so the callback gets less than the whole run only at the end of the volume, or an error
+
+    posix    - one preadv()/pwritev() per run; used when nothing else is mounted
+    io_uring - the runs are queued in a submission ring and submitted with a single io_uring_enter()
+
+ a backend may be called by several threads at the same time (the mount workers, the journal thread)
+
+ the volume mapping of CIFS_MOUNT_MMAP is not a backend, since its blocks are accessed in place
+
+*/
+#define CIFS_IO_QUEUE_DEPTH 64 // runs a backend is given in one transfer
+
+typedef struct cifs_io_run_type
+{
+	int writing;
+	off_t offset; // in the volume
+	struct iovec* iov; // one entry per block
+	int iovCount;
+	void (*complete)(struct cifs_io_run_type* run, ssize_t result); // bytes transferred, or -errno
+	void* arg; // for the completion callback
+} CIFS_IO_RUN_TYPE;
+
+typedef struct cifs_io_backend_type
+{
+	const char* name;
+	void (*transfer)(struct cifs_io_backend_type* backend, int fd, CIFS_IO_RUN_TYPE* runs, int count);
+	void (*close)(struct cifs_io_backend_type* backend);
+	void* state; // private to the backend
+} CIFS_IO_BACKEND_TYPE;
+
+/***
+
+ slab allocator for the in-memory nodes
+
+ registry entries, open files, and process control blocks are carved out of chunks of CIFS_SLAB_CHUNK equal
+ nodes instead of being allocated one by one; released nodes are kept on a free list for reuse, and all
+ chunks of a slab are released together when the volume is unmounted
+
+*/
+#define CIFS_SLAB_CHUNK 512 // nodes per chunk
+
+typedef struct cifs_slab_type
+{
+	size_t nodeSize; // rounded up so that every node is suitably aligned
+	void* chunks; // each chunk starts with a link to the previously allocated one
+	void* freeNodes; // each released node starts with a link to the next released one
+	char* unused; // the part of the newest chunk not handed out yet
+	char* end; // the end of the newest chunk
+	pthread_mutex_t lock; // the mount workers allocate concurrently
+} CIFS_SLAB_TYPE;
+
+/***
+
+ instrumentation
+
+ counters of the mounted volume; they are only ever added to, with relaxed atomic operations, so keeping them
+ takes no lock; cifsGetStats() takes a snapshot, and cifsReadStatsFile() renders one as the text of the virtual
+ file CIFS_STATS_FILE_NAME
+
+ an operation that took [2^b, 2^(b+1)) nanoseconds is counted in bucket b of its latency histogram; the last
+ bucket also takes everything longer
+
+*/
+#define CIFS_STATS_FILE_NAME "/.cifs_stats"
+#define CIFS_STATS_BUCKETS 32
+
+typedef enum cifs_stats_operation
+{
+	CIFS_STATS_CREATE_FILE,
+	CIFS_STATS_DELETE_FILE,
+	CIFS_STATS_OPEN_FILE,
+	CIFS_STATS_CLOSE_FILE,
+	CIFS_STATS_GET_FILE_INFO,
+	CIFS_STATS_READ_FILE,
+	CIFS_STATS_WRITE_FILE,
+	CIFS_STATS_PREAD,
+	CIFS_STATS_PWRITE,
+	CIFS_STATS_OPERATIONS
+} CIFS_STATS_OPERATION;
+
+typedef struct cifs_operation_stats_type
+{
+	unsigned long long calls;
+	unsigned long long nanoseconds; // of all calls
+	unsigned long long latency[CIFS_STATS_BUCKETS];
+} CIFS_OPERATION_STATS_TYPE;
+
+typedef struct cifs_stats_type // only unsigned long long counters, so a snapshot can load them one by one
+{
+	CIFS_OPERATION_STATS_TYPE operations[CIFS_STATS_OPERATIONS];
+	unsigned long long blockReads; // blocks transferred from the volume
+	unsigned long long blockWrites; // blocks transferred to the volume, including the journal
+	unsigned long long cacheHits;
+	unsigned long long cacheMisses;
+	unsigned long long prefetchedBlocks; // loaded into the cache by the read-ahead
+	unsigned long long bitvectorScans; // searches for free blocks
+	unsigned long long bitvectorScanBits; // bits passed over by the searches
+	unsigned long long registryLookups;
+	unsigned long long registryProbes; // slots compared by the lookups, the lengths of their chains
+} CIFS_STATS_TYPE;
+
+/***
+
+ offline check of a volume
+
+ cifsCheckVolume() checks a volume that is not mounted, without building the registry: the workers read the
+ whole volume in transfers of CIFS_FSCK_CHUNK_SIZE bytes and keep copies of the folder, file, and index blocks;
+ then the tree is walked from the root one level at a time, like the mount does, with the descriptors of a level
+ shared by the workers
+
+ every block the tree refers to is marked in a shadow bitvector; a block marked twice is cross-linked, so the
+ walk does not follow it again (which also ends the cycles); at the end the shadow is compared with the bitvector
+ of the volume: a block taken on the volume but referenced by nothing is leaked (e.g., its reclamation was still
+ queued when the system crashed), and a referenced block that is free would be handed out a second time
+
+ with repair, the journal is replayed first; then the bitvector is rewritten from the shadow, the back-pointers of
+ the descriptors are set to the blocks they are found in, and the next unique identifier is moved past the ones
+ in use; cross-linked blocks, bad references, and chains that do not match the sizes are only reported
+
+ the problems are traced at CIFS_TRACE_ERROR as they are found
+
+*/
+#define CIFS_FSCK_CHUNK_SIZE (4 << 20) // bytes read by a worker at a time
+#define CIFS_FSCK_THREADS 8 // workers of a check if the caller does not choose
+#define CIFS_FSCK_MAX_THREADS 64 // workers of a check at most
+
+typedef struct cifs_fsck_report_type
+{
+	unsigned long long folders;
+	unsigned long long files;
+	unsigned long long referencedBlocks; // including the bitvector, the superblock, and the journal
+	unsigned long long leakedBlocks; // taken on the volume, but referenced by nothing
+	unsigned long long freeReferencedBlocks; // referenced, but free on the volume
+	unsigned long long crossLinkedBlocks; // referenced more than once
+	unsigned long long badReferences; // outside of the bitvector, reserved, or not of the expected type
+	unsigned long long badBackPointers; // descriptors naming the wrong block or parent
+	unsigned long long badSizes; // index chains that do not match the sizes of the files and folders
+	unsigned long long badIdentifiers; // identifiers not below the next unique identifier
+	unsigned long long repaired; // of the problems above
+	int pendingJournal; // the journal held a committed transaction; it was replayed if repairing
+} CIFS_FSCK_REPORT_TYPE;
+
+/***
+
+ file system context
+
+ holds the registry and an in-memory copy of the volume bitvector
+
+ the registry is created when mounting the system (through traversal)
+ the bitvector is copied from the volume when mounting
+
+ all access to the files is through the registry (create, delete, get info, read, write)
+
+ the in-memory bitvector must be used when the system is mounted, but updated on the disc
+ on every successful creation, deletion, write, and read; blocks are taken and released through
+ cifsTakeBlock() and cifsReleaseBlock(), which track the changed bitvector blocks, so only those
+ are written
+
+ processes are added to the process table when they successfully open files; when a file is closed
+ (by the same process), then its entry is removed, and the process with its last file; finding a process, and
+ the open file of a process, take constant time (see cifsFindOpenFile())
+
+ the functions of the file system may be called from many threads at once; the locks are always taken in
+ this order, and none is held when returning:
+
+    namespaceLock - shared by every operation on a path or a handle, exclusive for creating and deleting;
+                    registry entries are not released while it is shared
+    processLock   - the process table, the open files, and the reference counts
+    entry lock    - the descriptor copy and the content of a file; shared for reading, exclusive for writing
+    bitvectorLock - saving the bitvector, and the superblock; blocks are taken and released without a lock
+                    through atomic operations on the bitvector words (see cifsAllocateBlock())
+    cache lock    - the block cache (see CIFS_BLOCK_CACHE_TYPE)
+
+ the journal lock is outside of this order; the operations enter and leave the journal before taking any of
+ the locks (see CIFS_JOURNAL_TYPE)
+
+ mounting and unmounting must not run concurrently with anything else
+
+*/
+typedef struct cifs_context_type
+{
+	CIFS_SUPERBLOCK_TYPE* superblock; // holds a copy of the volume superblock
+	unsigned char* bitvector; // an in-memory copy of the bitvector of the volume; changed only atomically
+	CIFS_REGISTRY* registry; // the hashtable-based in-memory registry
+	pthread_rwlock_t namespaceLock; // shared by lookups; exclusive for creating and deleting files
+	pthread_mutex_t registryLock; // serializes changes of the registry by the mount workers
+	CIFS_DENTRY_TYPE* dentries; // CIFS_DENTRY_CACHE_SIZE recently resolved paths
+	pthread_mutex_t dentryLock; // lookups fill the path cache concurrently
+	unsigned int dentryPositiveGeneration; // advanced when a file or folder is deleted
+	unsigned int dentryNegativeGeneration; // advanced when a file or folder is created
+	CIFS_REGISTRY_ENTRY_TYPE** handles; // registry entries indexed by file handle
+	CIFS_SLAB_TYPE registrySlab; // CIFS_REGISTRY_ENTRY_TYPE nodes
+	CIFS_SLAB_TYPE openFileSlab; // OPEN_FILE_TYPE nodes
+	CIFS_SLAB_TYPE processSlab; // CIFS_PROCESS_CONTROL_BLOCK_TYPE nodes
+	CIFS_PROCESS_CONTROL_BLOCK_TYPE** processTable; // processes that have files open, chained in buckets by pid
+	unsigned int processBuckets; // a power of two, at least as large as the number of processes
+	unsigned int processCount;
+	pthread_mutex_t processLock; // guards the process table, the open files, and the reference counts
+	CIFS_BLOCK_CACHE_TYPE* blockCache; // write-back cache of volume blocks; NULL when not mounted
+	unsigned char bitvectorDirty[CIFS_SUPERBLOCK_INDEX]; // bitvector blocks changed since they were last saved
+	pthread_mutex_t bitvectorLock; // serializes saving the bitvector, and guards the superblock
+	CIFS_JOURNAL_TYPE* journal; // NULL if the volume has no journal, or is mapped
+	CIFS_RECLAIMER_TYPE* reclaimer; // NULL if blocks are freed by the operations themselves
+	CIFS_STATS_TYPE stats; // since the volume was mounted
+} CIFS_CONTEXT_TYPE;
+
+//////////////////////////////////////////////////////////////////////////
+/***
+
+ file system function declarations
+
+*/
+//////////////////////////////////////////////////////////////////////////
+
+typedef enum cifs_error
+{
+	CIFS_NO_ERROR,
+	CIFS_ALLOC_ERROR,
+	CIFS_DUPLICATE_ERROR,
+	CIFS_NOT_FOUND_ERROR,
+	CIFS_NOT_EMPTY_ERROR,
+	CIFS_ACCESS_ERROR,
+	CIFS_WRITE_ERROR,
+	CIFS_READ_ERROR,
+	CIFS_IN_USE_ERROR,
+	CIFS_OPEN_ERROR,
+	CIFS_SYSTEM_ERROR,
+	CIFS_GEOMETRY_ERROR // the volume was formatted by a build of another geometry
+} CIFS_ERROR;
+
+CIFS_ERROR cifsCreateFileSystem(char* cifsFileSystemName);
+
+extern int cifsFormatDiscard; // set to discard the storage blocks when formatting a block device
+
+CIFS_ERROR cifsUmountFileSystem(char* cifsFileSystemName);
+
+CIFS_ERROR cifsMountFileSystem(char* cifsFileSystemName);
+
+/***
+ *
+ * volume access modes for mounting
+ *
+ *    CIFS_MOUNT_STDIO - blocks are read and written through the stdio stream and held in the block cache
+ *    CIFS_MOUNT_MMAP  - the whole volume is mapped into memory; blocks are accessed directly in the mapping
+ *    CIFS_MOUNT_URING - like CIFS_MOUNT_STDIO, but the transfers of the block cache go through io_uring;
+ *                       the posix backend is used if the kernel does not provide io_uring
+ *
+ */
+typedef enum cifs_mount_mode
+{
+	CIFS_MOUNT_STDIO,
+	CIFS_MOUNT_MMAP,
+	CIFS_MOUNT_URING
+} CIFS_MOUNT_MODE;
+
+CIFS_ERROR cifsMountFileSystemMode(char* cifsFileSystemName, CIFS_MOUNT_MODE mode);
+
+CIFS_ERROR cifsSyncFileSystem(void);
+
+CIFS_ERROR cifsCreateFile(CIFS_NAME_TYPE filePath, CIFS_CONTENT_TYPE type);
+
+CIFS_ERROR cifsDeleteFile(CIFS_NAME_TYPE filePath);
+
+CIFS_ERROR cifsOpenFile(CIFS_NAME_TYPE filePath, mode_t desiredAccessRights, CIFS_FILE_HANDLE_TYPE *fileHandle);
+
+CIFS_ERROR cifsCloseFile(CIFS_FILE_HANDLE_TYPE fileHandle);
+
+CIFS_ERROR cifsGetFileInfo(CIFS_NAME_TYPE filePath, CIFS_FILE_DESCRIPTOR_TYPE* infoBuffer);
+
+CIFS_ERROR cifsWriteFile(CIFS_FILE_HANDLE_TYPE fileHandle, char* writeBuffer);
+
+CIFS_ERROR cifsReadFile(CIFS_FILE_HANDLE_TYPE fileHandle, char** readBuffer);
+
+CIFS_ERROR cifsPread(CIFS_FILE_HANDLE_TYPE fileHandle, void* buffer, size_t size, size_t offset, size_t* bytesRead);
+
+CIFS_ERROR cifsPwrite(CIFS_FILE_HANDLE_TYPE fileHandle, const void* buffer, size_t size, size_t offset);
+
+/***
+ *
+ * A read vector describes a range of a file in place: each entry of iov points at the data of one block held
+ * in the block cache, so the content can be handed on, e.g. by the read_buf operation of FUSE, without copying
+ * it into a buffer of the size of the range.
+ *
+ * The held cache slots keep their content until cifsReleaseReadVector(); every vector must be released
+ * before the volume is unmounted. A mapped volume has no slots to hold, so its vectors point at a copy of the
+ * blocks that they own instead, which stays the same just as well.
+ *
+ */
+typedef struct cifs_read_vector_type
+{
+	struct iovec* iov;
+	int count; // entries of iov
+	size_t length; // bytes described by iov
+	CIFS_BLOCK_CACHE_TYPE* cache; // holding the slots; NULL if none are held
+	int* slots; // the held slot of each entry of iov
+	char inlineData[CIFS_INLINE_SIZE]; // a copy of the content of an inline file
+} CIFS_READ_VECTOR_TYPE;
+
+CIFS_ERROR cifsPreadv(CIFS_FILE_HANDLE_TYPE fileHandle, size_t size, size_t offset, CIFS_READ_VECTOR_TYPE** vector);
+
+void cifsReleaseReadVector(CIFS_READ_VECTOR_TYPE* vector);
+
+CIFS_ERROR cifsGetStats(CIFS_STATS_TYPE* stats);
+
+CIFS_ERROR cifsReadStatsFile(char** readBuffer);
+
+CIFS_ERROR cifsCheckVolume(char* cifsFileName, int repair, int threads, CIFS_FSCK_REPORT_TYPE* report);
+
+/***
+ *
+ * Functions for reading and writing a single block from and to a block device.
+ *
+ * When the file system is mounted, they are served from the block cache; the device functions
+ * bypass the cache.
+ *
+ */
+size_t cifsWriteBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber);
+void cifsReadBlock(unsigned char* buffer, CIFS_INDEX_TYPE blockNumber);
+size_t cifsDeviceWriteBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber);
+void cifsDeviceReadBlock(unsigned char* buffer, CIFS_INDEX_TYPE blockNumber);
+unsigned char* cifsGetBlockPtr(CIFS_INDEX_TYPE blockNumber);
+
+/***
+ *
+ * Functions for reading and writing many blocks at once.
+ *
+ * The requests are sorted by block number, and runs of consecutive blocks are handed to the I/O backend as
+ * single vectored transfers, so the number of requests depends on the number of runs rather than blocks.
+ * The block numbers in a single call must be distinct. cifsPrefetchBlocks() only loads the blocks that are not
+ * in the block cache yet, without copying them anywhere.
+ *
+ */
+void cifsReadBlocks(const CIFS_INDEX_TYPE* blockNumbers, unsigned char* const* buffers, int count);
+void cifsWriteBlocks(const CIFS_INDEX_TYPE* blockNumbers, const unsigned char* const* contents, int count);
+void cifsPrefetchBlocks(const CIFS_INDEX_TYPE* blockNumbers, int count);
+void cifsDeviceReadBlocks(const CIFS_INDEX_TYPE* blockNumbers, unsigned char* const* buffers, int count);
+void cifsDeviceWriteBlocks(const CIFS_INDEX_TYPE* blockNumbers, const unsigned char* const* contents, int count);
+//unsigned char* cifsReadBlock(CIFS_INDEX_TYPE blockNumber);
+void cifsCheckIOError(const char* who, const char* what);
+void cifsIOError(const char* who, const char* what);
+void cifsPrintBlockContent(const unsigned char *str);
+void cifsTraceBlock(const char* who, CIFS_INDEX_TYPE blockNumber, size_t length, const unsigned char* content);
+
+/***
+ *
+ * Functions of the I/O backends; cifsIOBackend() returns the backend of the mounted volume.
+ *
+ */
+CIFS_IO_BACKEND_TYPE* cifsIOBackend(void);
+CIFS_IO_BACKEND_TYPE* cifsOpenUringBackend(void);
+void cifsCloseIOBackend(CIFS_IO_BACKEND_TYPE* backend);
+
+/***
+ *
+ * Functions managing the write-back block cache.
+ *
+ */
+CIFS_BLOCK_CACHE_TYPE* cifsCreateBlockCache(void);
+int cifsCacheLookup(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber);
+int cifsCacheAcquireSlot(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber);
+int cifsFlushBlockCache(CIFS_BLOCK_CACHE_TYPE* cache);
+void cifsDestroyBlockCache(CIFS_BLOCK_CACHE_TYPE* cache);
+
+/***
+ *
+ * Functions of the metadata journal.
+ *
+ */
+CIFS_ERROR cifsJournalReplay(unsigned long long* sequence);
+CIFS_ERROR cifsJournalOpen(unsigned long long sequence);
+void cifsJournalClose(void);
+void cifsJournalBegin(void);
+void cifsJournalEnd(void);
+CIFS_ERROR cifsJournalCommit(void);
+
+CIFS_ERROR cifsReclaimerOpen(void);
+void cifsReclaimerClose(void);
+void cifsReclaimWait(void);
+CIFS_RECLAIM_ITEM_TYPE* cifsReclaimItem(unsigned int capacity);
+void cifsQueueReclaim(CIFS_RECLAIM_ITEM_TYPE* item);
+
+void cifsSlabInit(CIFS_SLAB_TYPE* slab, size_t nodeSize);
+void* cifsSlabAlloc(CIFS_SLAB_TYPE* slab);
+void cifsSlabFree(CIFS_SLAB_TYPE* slab, void* node);
+void cifsSlabDestroy(CIFS_SLAB_TYPE* slab);
+
+
+/***
+ *
+ * the following are utility functions that will come handy in the implementation
+ *
+ */
+unsigned long hash(const char* str);
+
+CIFS_REGISTRY* cifsCreateRegistry(void);
+void cifsDestroyRegistry(CIFS_REGISTRY* registry);
+unsigned long cifsRegistryHash(CIFS_FILE_HANDLE_TYPE parentFileHandle, const char* name);
+
+CIFS_REGISTRY_ENTRY_TYPE* cifsRegistryFind(CIFS_FILE_HANDLE_TYPE parentFileHandle, const char* name);
+
+void cifsRegistryRemove(CIFS_REGISTRY_ENTRY_TYPE* entry);
+
+CIFS_REGISTRY_ENTRY_TYPE* cifsResolvePath(const char* filePath);
+CIFS_REGISTRY_ENTRY_TYPE* cifsResolveParent(const char* filePath, CIFS_NAME_TYPE name);
+
+CIFS_INDEX_TYPE cifsFindFreeBlock(const unsigned char* bitvector);
+
+CIFS_INDEX_TYPE cifsFindFreeBlockInRange(const unsigned char* bitvector, unsigned int first, unsigned int last);
+
+CIFS_INDEX_TYPE cifsFindFreeBlockFrom(const unsigned char* bitvector, unsigned int start);
+
+unsigned int cifsFindTakenBlockInRange(const unsigned char* bitvector, unsigned int first, unsigned int last);
+
+int cifsTestBit(const unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex);
+
+void cifsFlipBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex);
+
+void cifsSetBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex);
+
+void cifsClearBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex);
+
+
+// Extra Helper Functions
+CIFS_ERROR traverseDisk(CIFS_FILE_DESCRIPTOR_TYPE* root);
+CIFS_ERROR cifsSaveRegistrySnapshot(char* cifsFileName);
+CIFS_ERROR cifsLoadRegistrySnapshot(char* cifsFileName);
+CIFS_REGISTRY_ENTRY_TYPE* addToHashTable(CIFS_FILE_HANDLE_TYPE parentFileHandle, CIFS_FILE_DESCRIPTOR_TYPE* fd);
+int doesFileExist(char* filePath);
+void writeBvSb(void);
+void cifsTakeBlock(CIFS_INDEX_TYPE blockNumber);
+void cifsReleaseBlock(CIFS_INDEX_TYPE blockNumber);
+void cifsWriteFileDescriptor(const CIFS_FILE_DESCRIPTOR_TYPE* fd);
+CIFS_INDEX_TYPE cifsAllocateBlock(void);
+CIFS_EXTENT_TYPE* cifsAllocateExtents(unsigned int numberOfBlocks, int* numberOfExtents);
+void cifsFreeExtents(const CIFS_EXTENT_TYPE* extents, int numberOfExtents);
+OPEN_FILE_TYPE* cifsFindOpenFile(CIFS_FILE_HANDLE_TYPE fileHandle);
+mode_t cifsOpenFileAccessRights(CIFS_FILE_HANDLE_TYPE fileHandle);
+CIFS_ERROR cifsAddToFolder(CIFS_FILE_DESCRIPTOR_TYPE* folder, CIFS_INDEX_TYPE blockNumber);
+void cifsRemoveFromFolder(CIFS_FILE_DESCRIPTOR_TYPE* folder, CIFS_INDEX_TYPE blockNumber);
+void cifsFreeIndexChain(CIFS_INDEX_TYPE indexBlock);
+mode_t cifsGrantedAccessRights(const CIFS_FILE_DESCRIPTOR_TYPE* fd);
+
+
+/***
+ * The following functions can be used to simulate FUSE context's user and process identifiers for testing.
+ *
+ * These identifiers are obtainable by calling fuse_get_context() the fuse library.
+ */
+
+#ifdef NO_FUSE_DEBUG
+
+char* cifsGenerateContent(int size);
+void testSamples();
+void testStep1();
+void testStep2();
+void testStep3();
+void testBlockCache();
+void testRegistry();
+void testHierarchy();
+void testMappedVolume();
+void testIOBackend();
+void testRegistrySnapshot();
+void testJournal();
+void testGeometry();
+void testRangeIO();
+void testReadAhead();
+void testReadVector();
+void testInlineData();
+void testStats();
+void testOpenFileTable();
+void testReclaim();
+void testFsck();
+void testConcurrency();
+
+#endif
+#endif
+
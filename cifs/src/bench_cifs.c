@@ -0,0 +1,681 @@
+//////////////////////////////////////////////////////////////////////////
+///
+/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
+///
+//////////////////////////////////////////////////////////////////////////
+/*
+ * Rafael Diaz
+ * Spring 2025
+ * COMP 362 Section 1 - Operating Systems
+ */
+///
+/// This source contains a benchmark of the file system that runs without
+/// FUSE.
+///
+/// Every workload formats and mounts a fresh volume, runs its warm-up
+/// operations untimed, then times each of its operations; a result reports
+/// the operations per second and the median and 99th percentile latency.
+///
+//////////////////////////////////////////////////////////////////////////
+///
+/// The program is run with a volume file and optionally the workloads to run:
+///
+///      ./cifs_bench [-n files] [-w warmup] [-r repetitions] [-m mode] [-f format] [-s seed] [-v volume]
+///                   [workload ...]
+///
+///    -n  the number of files (and of operations) of a workload; 1000 by default
+///    -w  the number of untimed operations before the timed ones; 100 by default
+///    -r  the number of timed mounts per file count of the "mount" workload; 5 by default
+///    -m  the mount mode: stdio (the default), mmap, or uring
+///    -f  the output format: text (the default), csv, or json (one object per line)
+///    -s  the seed of the random offsets and file choices
+///    -v  the volume file; bench.vol by default (it is formatted by every workload)
+///
+/// The workloads are:
+///
+///    create      creates n files in the root folder
+///    stat        gets the information of random files among n files
+///    openclose   opens and closes random files among n files
+///    seqwrite    writes files of 10 B to the size of the volume sequentially
+///    seqread     reads them sequentially
+///    randwrite   overwrites them at random offsets
+///    randread    reads them at random offsets
+///    mount       mounts volumes holding from 0 to n files
+///    fragmented  writes a file on a volume whose free blocks are scattered among small files
+///
+/// All of them run by default.
+///
+//////////////////////////////////////////////////////////////////////////
+#define NO_FUSE_DEBUG
+#ifdef NO_FUSE_DEBUG
+
+#include "cifs.h"
+
+extern _Thread_local struct fuse_context* fuseContext;
+extern CIFS_CONTEXT_TYPE* cifsContext;
+
+/***
+ *
+ * the largest single transfer of the read and write workloads; files are read and written in units of this
+ * size (or of the file size, if smaller)
+ *
+ */
+#define CIFS_BENCH_IO_SIZE 4096
+
+// the part of the free blocks of a volume that a volume-filling file takes; the rest is left for its index blocks
+#define CIFS_BENCH_FILL_PERCENT 90
+
+typedef enum cifs_bench_format
+{
+	CIFS_BENCH_TEXT,
+	CIFS_BENCH_CSV,
+	CIFS_BENCH_JSON
+} CIFS_BENCH_FORMAT;
+
+typedef struct cifs_bench_config
+{
+	int files;
+	int warmup;
+	int repetitions;
+	CIFS_MOUNT_MODE mode;
+	CIFS_BENCH_FORMAT format;
+	char* volume;
+} CIFS_BENCH_CONFIG;
+
+/***
+ *
+ * latencies of the timed operations of a workload, in nanoseconds
+ *
+ */
+typedef struct cifs_bench_timer
+{
+	unsigned long long* latencies;
+	size_t count;
+	size_t capacity;
+	unsigned long long total;
+} CIFS_BENCH_TIMER;
+
+static CIFS_BENCH_CONFIG benchConfig = { 1000, 100, 5, CIFS_MOUNT_STDIO, CIFS_BENCH_TEXT, "bench.vol" };
+static int benchFailures = 0;
+
+/***
+ *
+ * simulates the FUSE context (see test_cifs.c); cifsUmountFileSystem() releases it
+ *
+ */
+static void simulateFuseContext()
+{
+	fuseContext = (struct fuse_context*)malloc(sizeof(struct fuse_context));
+	fuseContext->fuse = NULL;
+	fuseContext->uid = 1000 + (uid_t)rand() % 10 + 1;
+	fuseContext->gid = 1000 + (gid_t)rand() % 10 + 1;
+	fuseContext->pid = 1000 + (pid_t)rand() % 10 + 1;
+	fuseContext->private_data = NULL;
+	fuseContext->umask = S_IRUSR | S_IWUSR;
+}
+
+static unsigned long long benchClock(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (unsigned long long)time.tv_sec * 1000000000ULL + (unsigned long long)time.tv_nsec;
+}
+
+/***
+ *
+ * Records the latency of an operation that started at the given time (see benchClock()).
+ *
+ */
+static void benchRecord(CIFS_BENCH_TIMER* timer, unsigned long long started)
+{
+	unsigned long long latency = benchClock() - started;
+
+	if (timer->count == timer->capacity)
+	{
+		timer->capacity = timer->capacity == 0 ? 1024 : 2 * timer->capacity;
+		timer->latencies = realloc(timer->latencies, timer->capacity * sizeof *timer->latencies);
+		if (timer->latencies == NULL)
+		{
+			perror("cifs_bench");
+			exit(EXIT_FAILURE);
+		}
+	}
+	timer->latencies[timer->count++] = latency;
+	timer->total += latency;
+}
+
+/***
+ *
+ * Counts a failed operation; the failures are reported, and make the benchmark exit with a failure.
+ *
+ */
+static void benchCheck(CIFS_ERROR err, const char* what)
+{
+	if (err == CIFS_NO_ERROR)
+		return;
+
+	if (benchFailures++ < 10)
+		fprintf(stderr, "cifs_bench: %s failed with error %d\n", what, err);
+}
+
+static int benchCompareLatencies(const void* a, const void* b)
+{
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+	return (x > y) - (x < y);
+}
+
+static unsigned long long benchPercentile(const CIFS_BENCH_TIMER* timer, int percent)
+{
+	if (timer->count == 0)
+		return 0;
+	return timer->latencies[(timer->count - 1) * (size_t)percent / 100];
+}
+
+/***
+ *
+ * Takes a snapshot of the counters of the mounted volume, or zeroes if it is not mounted.
+ *
+ */
+static void benchSnapshot(CIFS_STATS_TYPE* stats)
+{
+	if (cifsGetStats(stats) != CIFS_NO_ERROR)
+		memset(stats, 0, sizeof *stats);
+}
+
+/***
+ *
+ * Prints the result of a workload and releases its latencies.
+ *
+ * The counters of the volume are reported as the differences between the snapshots taken before and
+ * after the timed operations; both are zero for workloads that are not timed on a single mount.
+ *
+ */
+static void benchReport(const char* workload, const char* parameter, CIFS_BENCH_TIMER* timer,
+	const CIFS_STATS_TYPE* before, const CIFS_STATS_TYPE* after)
+{
+	static int header = 0;
+
+	qsort(timer->latencies, timer->count, sizeof *timer->latencies, benchCompareLatencies);
+	double seconds = (double)timer->total / 1e9;
+	double opsPerSecond = seconds > 0 ? (double)timer->count / seconds : 0;
+	unsigned long long p50 = benchPercentile(timer, 50);
+	unsigned long long p99 = benchPercentile(timer, 99);
+	unsigned long long blockReads = after->blockReads - before->blockReads;
+	unsigned long long blockWrites = after->blockWrites - before->blockWrites;
+	unsigned long long cacheMisses = after->cacheMisses - before->cacheMisses;
+
+	switch (benchConfig.format)
+	{
+		case CIFS_BENCH_CSV:
+			if (!header++)
+				printf("workload,parameter,ops,seconds,ops_per_sec,p50_ns,p99_ns,block_reads,block_writes,cache_misses\n");
+			printf("%s,%s,%zu,%.6f,%.1f,%llu,%llu,%llu,%llu,%llu\n", workload, parameter, timer->count, seconds,
+				opsPerSecond, p50, p99, blockReads, blockWrites, cacheMisses);
+			break;
+		case CIFS_BENCH_JSON:
+			printf("{\"workload\":\"%s\",\"parameter\":\"%s\",\"ops\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+				"\"p50_ns\":%llu,\"p99_ns\":%llu,\"block_reads\":%llu,\"block_writes\":%llu,\"cache_misses\":%llu}\n",
+				workload, parameter, timer->count, seconds, opsPerSecond, p50, p99, blockReads, blockWrites, cacheMisses);
+			break;
+		default:
+			if (!header++)
+				printf("%-11s %-14s %9s %12s %12s %12s %12s %12s\n", "workload", "parameter", "ops", "ops/sec",
+					"p50 (ns)", "p99 (ns)", "blk reads", "blk writes");
+			printf("%-11s %-14s %9zu %12.1f %12llu %12llu %12llu %12llu\n", workload, parameter, timer->count,
+				opsPerSecond, p50, p99, blockReads, blockWrites);
+			break;
+	}
+	fflush(stdout);
+
+	free(timer->latencies);
+	memset(timer, 0, sizeof *timer);
+}
+
+/***
+ *
+ * Formats and mounts a fresh volume.
+ *
+ */
+static void benchFreshVolume()
+{
+	if (cifsCreateFileSystem(benchConfig.volume) != CIFS_NO_ERROR)
+	{
+		fprintf(stderr, "cifs_bench: cannot format %s\n", benchConfig.volume);
+		exit(EXIT_FAILURE);
+	}
+	if (cifsMountFileSystemMode(benchConfig.volume, benchConfig.mode) != CIFS_NO_ERROR)
+	{
+		fprintf(stderr, "cifs_bench: cannot mount %s\n", benchConfig.volume);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void benchUmount()
+{
+	benchCheck(cifsUmountFileSystem(benchConfig.volume), "unmounting");
+	simulateFuseContext(); // unmounting released the context
+}
+
+static void benchFileName(char* name, int number)
+{
+	sprintf(name, "bench%06d", number);
+}
+
+/***
+ *
+ * Creates the files numbered [first, last) in the root folder.
+ *
+ */
+static void benchCreateFiles(int first, int last)
+{
+	char name[32];
+	for (int i = first; i < last; i++)
+	{
+		benchFileName(name, i);
+		benchCheck(cifsCreateFile(name, CIFS_FILE_CONTENT_TYPE), "creating a file");
+	}
+}
+
+/***
+ *
+ * Returns the number of free blocks of the mounted volume.
+ *
+ */
+static size_t benchFreeBlocks()
+{
+	size_t free = 0;
+	for (unsigned int block = 0; block < CIFS_BITVECTOR_BITS; block++) // the blocks the bitvector can allocate
+		free += !cifsTestBit(cifsContext->bitvector, (CIFS_INDEX_TYPE)block);
+	return free;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Workloads
+///
+//////////////////////////////////////////////////////////////////////////
+
+static void benchCreate()
+{
+	CIFS_BENCH_TIMER timer = { 0 };
+	CIFS_STATS_TYPE before, after;
+	char name[32];
+
+	benchFreshVolume();
+
+	// the warm-up files are deleted again, so the timed files go into an empty folder
+	benchCreateFiles(benchConfig.files, benchConfig.files + benchConfig.warmup);
+	for (int i = benchConfig.files; i < benchConfig.files + benchConfig.warmup; i++)
+	{
+		benchFileName(name, i);
+		benchCheck(cifsDeleteFile(name), "deleting a file");
+	}
+
+	benchSnapshot(&before);
+	for (int i = 0; i < benchConfig.files; i++)
+	{
+		benchFileName(name, i);
+		unsigned long long started = benchClock();
+		CIFS_ERROR err = cifsCreateFile(name, CIFS_FILE_CONTENT_TYPE);
+		benchRecord(&timer, started);
+		benchCheck(err, "creating a file");
+	}
+	benchSnapshot(&after);
+
+	char parameter[32];
+	sprintf(parameter, "files=%d", benchConfig.files);
+	benchReport("create", parameter, &timer, &before, &after);
+	benchUmount();
+}
+
+/***
+ *
+ * Runs the warm-up and then the timed operations on random files among benchConfig.files; opening means
+ * opening and closing a file, otherwise the information of the file is fetched.
+ *
+ */
+static void benchLookup(int opening)
+{
+	CIFS_BENCH_TIMER timer = { 0 };
+	CIFS_STATS_TYPE before, after;
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+	CIFS_FILE_HANDLE_TYPE handle;
+	char name[32];
+
+	benchFreshVolume();
+	benchCreateFiles(0, benchConfig.files);
+
+	int operations = benchConfig.warmup + 10 * benchConfig.files;
+	for (int i = 0; i < operations; i++)
+	{
+		if (i == benchConfig.warmup)
+			benchSnapshot(&before);
+
+		benchFileName(name, rand() % benchConfig.files);
+		unsigned long long started = benchClock();
+		CIFS_ERROR err;
+		if (opening)
+		{
+			err = cifsOpenFile(name, S_IRUSR | S_IWUSR, &handle);
+			if (err == CIFS_NO_ERROR)
+				err = cifsCloseFile(handle);
+		}
+		else
+			err = cifsGetFileInfo(name, &info);
+		if (i >= benchConfig.warmup)
+			benchRecord(&timer, started);
+		benchCheck(err, opening ? "opening and closing a file" : "getting file information");
+	}
+	benchSnapshot(&after);
+
+	char parameter[32];
+	sprintf(parameter, "files=%d", benchConfig.files);
+	benchReport(opening ? "openclose" : "stat", parameter, &timer, &before, &after);
+	benchUmount();
+}
+
+/***
+ *
+ * Reads or writes a file of the given size (the size of the volume if zero) in units of at most
+ * CIFS_BENCH_IO_SIZE bytes, sequentially from the start (wrapping around at the end) or at random
+ * unit-aligned offsets.
+ *
+ * The file is written completely before reading, and before overwriting it at random offsets; sequential
+ * writing starts from an empty file, so its first pass also allocates the blocks. There are as many timed
+ * operations as units in the file, but at least benchConfig.files.
+ *
+ */
+static void benchTransfer(int writing, int random, size_t size)
+{
+	CIFS_BENCH_TIMER timer = { 0 };
+	CIFS_STATS_TYPE before, after;
+	CIFS_FILE_HANDLE_TYPE handle;
+
+	benchFreshVolume();
+
+	char parameter[32];
+	if (size == 0)
+	{
+		size = benchFreeBlocks() * CIFS_DATA_SIZE / 100 * CIFS_BENCH_FILL_PERCENT;
+		sprintf(parameter, "size=fill");
+	}
+	else
+		sprintf(parameter, "size=%zu", size);
+
+	size_t unit = size < CIFS_BENCH_IO_SIZE ? size : CIFS_BENCH_IO_SIZE;
+	size_t units = size / unit;
+	unsigned char* buffer = malloc(unit);
+	memset(buffer, 'b', unit);
+
+	benchCheck(cifsCreateFile("bench.bin", CIFS_FILE_CONTENT_TYPE), "creating a file");
+	benchCheck(cifsOpenFile("bench.bin", S_IRUSR | S_IWUSR, &handle), "opening a file");
+	if (!writing || random)
+		for (size_t i = 0; i < units; i++)
+			benchCheck(cifsPwrite(handle, buffer, unit, i * unit), "writing a file");
+
+	size_t operations = (size_t)benchConfig.warmup + (units > (size_t)benchConfig.files ? units : (size_t)benchConfig.files);
+	for (size_t i = 0; i < operations; i++)
+	{
+		size_t timed = i - (size_t)benchConfig.warmup; // counts from 0 again, so sequential writing starts empty
+		if (i == (size_t)benchConfig.warmup)
+			benchSnapshot(&before);
+
+		size_t offset = random ? (size_t)rand() % units * unit : (i < (size_t)benchConfig.warmup ? i : timed) % units * unit;
+		unsigned long long started = benchClock();
+		CIFS_ERROR err;
+		if (writing)
+			err = cifsPwrite(handle, buffer, unit, offset);
+		else
+		{
+			size_t bytesRead = 0;
+			err = cifsPread(handle, buffer, unit, offset, &bytesRead);
+		}
+		if (i >= (size_t)benchConfig.warmup)
+			benchRecord(&timer, started);
+		benchCheck(err, writing ? "writing a file" : "reading a file");
+	}
+	benchSnapshot(&after);
+
+	benchReport(writing ? (random ? "randwrite" : "seqwrite") : (random ? "randread" : "seqread"), parameter, &timer,
+		&before, &after);
+	benchCheck(cifsCloseFile(handle), "closing a file");
+	free(buffer);
+	benchUmount();
+}
+
+/***
+ *
+ * Times mounting volumes with 0, n/4, n/2, and n files.
+ *
+ */
+static void benchMount()
+{
+	static const int quarters[] = { 0, 1, 2, 4 };
+	CIFS_STATS_TYPE none = { 0 };
+	int created = 0;
+
+	benchFreshVolume();
+	for (int q = 0; q < (int)(sizeof quarters / sizeof quarters[0]); q++)
+	{
+		CIFS_BENCH_TIMER timer = { 0 };
+		int files = benchConfig.files * quarters[q] / 4;
+		benchCreateFiles(created, files);
+		created = files;
+
+		for (int r = -1; r < benchConfig.repetitions; r++) // the first mount is a warm-up
+		{
+			benchUmount();
+			unsigned long long started = benchClock();
+			CIFS_ERROR err = cifsMountFileSystemMode(benchConfig.volume, benchConfig.mode);
+			if (r >= 0)
+				benchRecord(&timer, started);
+			if (err != CIFS_NO_ERROR)
+			{
+				fprintf(stderr, "cifs_bench: cannot mount %s\n", benchConfig.volume);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		char parameter[32];
+		sprintf(parameter, "files=%d", files);
+		benchReport("mount", parameter, &timer, &none, &none);
+	}
+	benchUmount();
+}
+
+/***
+ *
+ * Fills most of the volume with small files, deletes every other one, and then times appending units of
+ * CIFS_BENCH_IO_SIZE bytes to a new file; every unit needs blocks from the holes the deleted files left.
+ *
+ */
+static void benchFragmented()
+{
+	CIFS_BENCH_TIMER timer = { 0 };
+	CIFS_STATS_TYPE before, after;
+	CIFS_FILE_HANDLE_TYPE handle;
+	char name[32];
+
+	benchFreshVolume();
+
+	// each small file takes its descriptor, an index block, and two data blocks
+	size_t smallSize = 2 * CIFS_DATA_SIZE;
+	unsigned char* buffer = malloc(CIFS_BENCH_IO_SIZE > smallSize ? CIFS_BENCH_IO_SIZE : smallSize);
+	memset(buffer, 'f', CIFS_BENCH_IO_SIZE > smallSize ? CIFS_BENCH_IO_SIZE : smallSize);
+	int smallFiles = (int)(benchFreeBlocks() / 4 * 3 / 4);
+	for (int i = 0; i < smallFiles; i++)
+	{
+		benchFileName(name, i);
+		benchCheck(cifsCreateFile(name, CIFS_FILE_CONTENT_TYPE), "creating a file");
+		benchCheck(cifsOpenFile(name, S_IRUSR | S_IWUSR, &handle), "opening a file");
+		benchCheck(cifsPwrite(handle, buffer, smallSize, 0), "writing a file");
+		benchCheck(cifsCloseFile(handle), "closing a file");
+	}
+	for (int i = 0; i < smallFiles; i += 2)
+	{
+		benchFileName(name, i);
+		benchCheck(cifsDeleteFile(name), "deleting a file");
+	}
+
+	// appending stops short of the freed blocks, so every timed unit still allocates
+	size_t freedBlocks = (size_t)(smallFiles + 1) / 2 * 4;
+	size_t unitBlocks = (CIFS_BENCH_IO_SIZE + CIFS_DATA_SIZE - 1) / CIFS_DATA_SIZE + 1;
+	size_t operations = (size_t)benchConfig.warmup + (size_t)benchConfig.files;
+	if (operations > freedBlocks / unitBlocks)
+		operations = freedBlocks / unitBlocks;
+
+	benchCheck(cifsCreateFile("bench.bin", CIFS_FILE_CONTENT_TYPE), "creating a file");
+	benchCheck(cifsOpenFile("bench.bin", S_IRUSR | S_IWUSR, &handle), "opening a file");
+	for (size_t i = 0; i < operations; i++)
+	{
+		if (i == (size_t)benchConfig.warmup)
+			benchSnapshot(&before);
+
+		unsigned long long started = benchClock();
+		CIFS_ERROR err = cifsPwrite(handle, buffer, CIFS_BENCH_IO_SIZE, i * CIFS_BENCH_IO_SIZE);
+		if (i >= (size_t)benchConfig.warmup)
+			benchRecord(&timer, started);
+		benchCheck(err, "appending to a file");
+	}
+	if (operations <= (size_t)benchConfig.warmup)
+		benchSnapshot(&before);
+	benchSnapshot(&after);
+
+	char parameter[32];
+	sprintf(parameter, "holes=%d", (smallFiles + 1) / 2);
+	benchReport("fragmented", parameter, &timer, &before, &after);
+	benchCheck(cifsCloseFile(handle), "closing a file");
+	free(buffer);
+	benchUmount();
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Command line
+///
+//////////////////////////////////////////////////////////////////////////
+
+static const size_t benchSizes[] = { 10, 1024, 64 * 1024, 1024 * 1024, 0 }; // 0 fills the volume
+
+static void benchTransfers(int writing, int random)
+{
+	for (int i = 0; i < (int)(sizeof benchSizes / sizeof benchSizes[0]); i++)
+		benchTransfer(writing, random, benchSizes[i]);
+}
+
+static void benchSeqWrite() { benchTransfers(1, 0); }
+static void benchSeqRead() { benchTransfers(0, 0); }
+static void benchRandWrite() { benchTransfers(1, 1); }
+static void benchRandRead() { benchTransfers(0, 1); }
+static void benchStat() { benchLookup(0); }
+static void benchOpenClose() { benchLookup(1); }
+
+static const struct
+{
+	const char* name;
+	void (*run)(void);
+} benchWorkloads[] = {
+	{ "create", benchCreate },
+	{ "stat", benchStat },
+	{ "openclose", benchOpenClose },
+	{ "seqwrite", benchSeqWrite },
+	{ "seqread", benchSeqRead },
+	{ "randwrite", benchRandWrite },
+	{ "randread", benchRandRead },
+	{ "mount", benchMount },
+	{ "fragmented", benchFragmented }
+};
+
+#define CIFS_BENCH_WORKLOADS (int)(sizeof benchWorkloads / sizeof benchWorkloads[0])
+
+static void benchUsage()
+{
+	fprintf(stderr, "usage: cifs_bench [-n files] [-w warmup] [-r repetitions] [-m stdio|mmap|uring] "
+		"[-f text|csv|json] [-s seed] [-v volume] [workload ...]\nworkloads:");
+	for (int i = 0; i < CIFS_BENCH_WORKLOADS; i++)
+		fprintf(stderr, " %s", benchWorkloads[i].name);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int seed = 362;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:w:r:m:f:s:v:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n':
+				benchConfig.files = atoi(optarg);
+				break;
+			case 'w':
+				benchConfig.warmup = atoi(optarg);
+				break;
+			case 'r':
+				benchConfig.repetitions = atoi(optarg);
+				break;
+			case 'm':
+				if (strcmp(optarg, "stdio") == 0)
+					benchConfig.mode = CIFS_MOUNT_STDIO;
+				else if (strcmp(optarg, "mmap") == 0)
+					benchConfig.mode = CIFS_MOUNT_MMAP;
+				else if (strcmp(optarg, "uring") == 0)
+					benchConfig.mode = CIFS_MOUNT_URING;
+				else
+					benchUsage();
+				break;
+			case 'f':
+				if (strcmp(optarg, "text") == 0)
+					benchConfig.format = CIFS_BENCH_TEXT;
+				else if (strcmp(optarg, "csv") == 0)
+					benchConfig.format = CIFS_BENCH_CSV;
+				else if (strcmp(optarg, "json") == 0)
+					benchConfig.format = CIFS_BENCH_JSON;
+				else
+					benchUsage();
+				break;
+			case 's':
+				seed = (unsigned int)strtoul(optarg, NULL, 10);
+				break;
+			case 'v':
+				benchConfig.volume = optarg;
+				break;
+			default:
+				benchUsage();
+		}
+	}
+	if (benchConfig.files < 1 || benchConfig.warmup < 0 || benchConfig.repetitions < 1)
+		benchUsage();
+
+	for (int i = optind; i < argc; i++)
+	{
+		int known = 0;
+		for (int w = 0; w < CIFS_BENCH_WORKLOADS; w++)
+			known |= strcmp(argv[i], benchWorkloads[w].name) == 0;
+		if (!known)
+			benchUsage();
+	}
+
+	srand(seed);
+	simulateFuseContext(); // and again after every unmount
+	for (int w = 0; w < CIFS_BENCH_WORKLOADS; w++)
+	{
+		int selected = optind == argc;
+		for (int i = optind; i < argc; i++)
+			selected |= strcmp(argv[i], benchWorkloads[w].name) == 0;
+		if (selected)
+			benchWorkloads[w].run();
+	}
+
+	if (benchFailures > 0)
+	{
+		fprintf(stderr, "cifs_bench: %d operations failed\n", benchFailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+#endif
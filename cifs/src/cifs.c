@@ -1,830 +1,6630 @@
-//////////////////////////////////////////////////////////////////////////
-///
-/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
-///
-//////////////////////////////////////////////////////////////////////////
-/*
- * Rafael Diaz
- * Spring 2025
- * COMP 362 Section 1 - Operating Systems
- */
-///
-/// This source contains code suitable for testing without FUSE.
-///
-/// Integration with fuse requires that you must modify the code as needed
-/// to work inside the kernel and with the FUSE framework.
-///
-//////////////////////////////////////////////////////////////////////////
-
-#include "cifs.h"
-
-//////////////////////////////////////////////////////////////////////////
-///
-/// cifs global variables
-///
-//////////////////////////////////////////////////////////////////////////
-
-/***
-
- A file handle of the file system volume residing on a physical device (peripheral).
-
- File system structure:
-
- bitvector - one bit per block; i.e., (CIFS_NUMBER_OF_BLOCKS / 8 / CIFS_BLOCK_SIZE) blocks
- superblock - one block
- root descriptor block - one block
- root index block - one block (there might be more if the number of files in the root is large)
- storage blocks (folder, file, data, or index) - all remaining blocks
-
-*/
-FILE* cifsVolume;
-
-/***
-
- A pointer to the in-memory file system context that holds critical information about the volume.
-
- The in-memory data structures are fast as they reside in the
- computer memory, and not on an external storage device;
- therefore, they are used a fast gateway to the elements of the peripheral volume.
-
- The context will hold:
- - a copy of the volume superblock
- - a copy of the volume bitvector
- - a hash-table-based registry of all volume files the registry is created when mounting the file system
- - a list of processes currently interacting with cifs.
-
- All in-memory data must be diligently synchronized with the external volume;
- for example, to find a free block this bitvector MUST be searched (for speed), and if
- a block is allocated (or deallocated), then the block that contains
- the bit flips (and NOT the whole bitvector!) must be copied to the disk.
-
-*/
-
-CIFS_CONTEXT_TYPE* cifsContext;
-
-/***
-
- FUSE has "context" that holds a number of parameters of the process that accesses it
-
-struct fuse *fuse {
-uid_t 	uid,
-gid_t 	gid,
-pid_t 	pid,
-void * 	private_data,
-mode_t 	umask }
-
-
-We need to simulate the context as long as we debug without FUSE, so for convenience we will use
-an auxiliary pointer that either points to the real FUSE context or to the simulated
-version.
-
-*/
-
-struct fuse_context* fuseContext;
-/// must use
-// fuseContext = fuse_get_context();
-/// when the cifs is integrated with FUSE !!!
-
-//////////////////////////////////////////////////////////////////////////
-///
-/// cifs function implementations
-///
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * Allocates space for the file system and saves it to disk.
- *
- * cifsFileName must be either of the three:
- *
- *    1) a regular file
- *    2) a loop interface to a real file
- *    3) a block device name
- *
- */
-CIFS_ERROR cifsCreateFileSystem(char* cifsFileName)
-{
-	// --- create the OS context --- needed here, since writeBlock and cifsReadBlock need the context's superblock
-
-	printf("Size of CIFS_CONTEXT_TYPE: %ld\n", sizeof(CIFS_CONTEXT_TYPE));
-	cifsContext = malloc(sizeof(CIFS_CONTEXT_TYPE));
-	if (cifsContext == NULL)
-		return CIFS_ALLOC_ERROR;
-
-	// open the volume for the file system
-
-	cifsVolume = fopen(cifsFileName, "w+"); //"w+" write and append; just for the creation of the volume
-	if (cifsVolume == NULL)
-		return CIFS_ALLOC_ERROR;
-
-	// --- put the file system on the volume ---
-
-	// initialize the bitvector
-
-	// allocate space for the in-memory bitvector
-	cifsContext->bitvector = calloc(CIFS_NUMBER_OF_BLOCKS / 8, sizeof(char)); // initially all content blocks are free
-
-	// mark as unavailable the blocks used for the bitvector
-	memset(cifsContext->bitvector, 0xFF, CIFS_SUPERBLOCK_INDEX / 8);
-
-	// let's postpone writing of the in-memory version of the bitvector to the volume until we also set
-	// the bits for the superblock and the two blocks for the root folder
-
-	// initialize the superblock
-
-	cifsContext->superblock = malloc(CIFS_BLOCK_SIZE); // ASSUMES: sizeof(CIFS_SUPERBLOCK_TYPE) <= CIFS_BLOCK_SIZE
-
-	cifsContext->superblock->cifsNextUniqueIdentifier = CIFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER;
-	cifsContext->superblock->cifsDataBlockSize = CIFS_BLOCK_SIZE;
-	cifsContext->superblock->cifsNumberOfBlocks = CIFS_NUMBER_OF_BLOCKS - 1; // excludes the invalid block number 0xFF
-	cifsContext->superblock->cifsRootNodeIndex = CIFS_SUPERBLOCK_INDEX + 1; // root file descriptor is in the next block
-
-    // ...and set the corresponding bit in the bitvector
-	cifsSetBit(cifsContext->bitvector, CIFS_SUPERBLOCK_INDEX);
-
-	// initialize the block holding the root folders; there sre two of them: folder descriptor and the index block
-
-	// first, initialize the folder description block
-	CIFS_BLOCK_TYPE rootFolderBlock;
-	rootFolderBlock.type = CIFS_FOLDER_CONTENT_TYPE;
-	// root folder always has "0" as the identifier; it's incremented for the files created later
-	rootFolderBlock.content.fileDescriptor.identifier = cifsContext->superblock->cifsNextUniqueIdentifier++;
-	rootFolderBlock.content.fileDescriptor.type = CIFS_FOLDER_CONTENT_TYPE;
-	strcpy(rootFolderBlock.content.fileDescriptor.name, "/");
-	rootFolderBlock.content.fileDescriptor.accessRights = 0666;
-	rootFolderBlock.content.fileDescriptor.owner = getuid(); // forgot to change this so no more seg fault in the beginning so now need to find next seg fault
-	rootFolderBlock.content.fileDescriptor.size = 0;
-	struct timespec time;
-	clock_gettime(CLOCK_MONOTONIC, &time);
-	rootFolderBlock.content.fileDescriptor.creationTime = time.tv_sec;
-	rootFolderBlock.content.fileDescriptor.lastAccessTime = time.tv_sec;
-	rootFolderBlock.content.fileDescriptor.lastModificationTime = time.tv_sec;
-	rootFolderBlock.content.fileDescriptor.block_ref = cifsContext->superblock->cifsRootNodeIndex + 1; // next block
-
-	// then, initialize the index block of the root folder
-	CIFS_BLOCK_TYPE rootFolderIndexBlock;
-	rootFolderIndexBlock.type = CIFS_INDEX_CONTENT_TYPE;
-	// no files in the root folder yet, so all entries are free
-	//memset(&(rootFolderIndexBlock.content), CIFS_INVALID_INDEX, CIFS_INDEX_SIZE);
-	for(int i = 0; i < CIFS_INDEX_SIZE; i++) {
-		rootFolderIndexBlock.content.index[i] = CIFS_INVALID_INDEX;
-	}
-
-	// now, write the two blocks for the root folder and set the corresponding bits in the bitvector
-   cifsWriteBlock((const unsigned char *) &rootFolderBlock, cifsContext->superblock->cifsRootNodeIndex);
-	cifsSetBit(cifsContext->bitvector, cifsContext->superblock->cifsRootNodeIndex);
-
-   cifsWriteBlock((const unsigned char *) &rootFolderIndexBlock, cifsContext->superblock->cifsRootNodeIndex + 1);
-	cifsSetBit(cifsContext->bitvector, cifsContext->superblock->cifsRootNodeIndex + 1);
-	
-	// write the superblock to the volume
-    cifsWriteBlock((const unsigned char *) cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
-
-	// now we can write the blocks holding the in-memory version of the bitvector to the volume
-
-	unsigned char block[CIFS_BLOCK_SIZE];
-	for (int i = 0; i < CIFS_SUPERBLOCK_INDEX; i++) // superblock is the first block after the bitvector
-	{
-		for (int j = 0; j < CIFS_BLOCK_SIZE; j++)
-			block[j] = cifsContext->bitvector[i * CIFS_BLOCK_SIZE + j];
-
-        cifsWriteBlock((const unsigned char *) block, i);
-	}
-
-	// create all other blocks
-	memset(block, 0, CIFS_BLOCK_SIZE);
-	cifsWriteBlock((const unsigned char *) block, CIFS_NUMBER_OF_BLOCKS - 1);
-
-	fflush(cifsVolume);
-	fclose(cifsVolume);
-
-	printf("CREATED CIFS VOLUME\n%d bytes\n%d blocks\nBlock size %d bytes\n",
-			CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE,
-			CIFS_NUMBER_OF_BLOCKS,
-			CIFS_BLOCK_SIZE);
-
-	return CIFS_NO_ERROR;
-}
-
-/***
- *
- * Loads the file system from a disk and constructs in-memory registry of all files is the system.
- *
- * There are two things to do:
- *    - creating an in-memory hash-table-based registry of the files in the volume
- *    - copying the bitvector from the volume to its in-memory mirror
- *
- * The creation of the registry is realized through the traversal of the whole volume:
- *
- * Starting with the file system root (pointed to from the superblock) traverses the hierarchy of directories
- * and adds an entry for each folder or file to the registry by hashing the name and adding a registry
- * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
- * the only element of that list. If the list contains more than one element, then multiple files hashed to
- * the same value (hash conflict). In this case, the unique file identifier can be used to resolve the conflict.
- * The identifier must be the same as the identifier in the file descriptor pointed to by the node reference.
- *
- * The function must also capture the parenthood relationship by setting the parent file handle field for
- * the file being added to the registry to the file handle of the parent folder (whish is already available since
- * the traversal is top down; i.e., parent folders are always added before their content).
- *
- * The function sets the current working directory to refer to the block holding the root of the volume. This will
- * be changed as the user navigates the file system hierarchy.
- *
- */
-CIFS_ERROR cifsMountFileSystem(char* cifsFileName)
-{
-	cifsContext = calloc(1, sizeof *cifsContext);
-    if (!cifsContext) return CIFS_ALLOC_ERROR;
-
-	cifsVolume = fopen(cifsFileName, "rw+"); // now we will be reading, writing, and appending
-    if (!cifsVolume) return CIFS_SYSTEM_ERROR;
-
-	// --- create the OS context ---
-
-	//printf("Size of CIFS_CONTEXT_TYPE: %ld\n", sizeof(CIFS_CONTEXT_TYPE));
-	cifsContext->superblock = malloc(sizeof(*cifsContext->superblock));
-	if (!cifsContext->superblock)
-		return CIFS_ALLOC_ERROR;
-	cifsWriteBlock((const unsigned char*)cifsContext->superblock, 0);
-
-// TODO: read the bitvector from the volume (copying block after block and freeing memory as needed after copying)
-
-{
-  unsigned bits_per_block = CIFS_BLOCK_SIZE * 8;
-  unsigned bv_blocks = (cifsContext->superblock->cifsNumberOfBlocks + bits_per_block - 1)
-                       / bits_per_block;
-  size_t bv_bytes = bv_blocks * CIFS_BLOCK_SIZE;
-  cifsContext->bitvector = malloc(bv_bytes);
-  if (!cifsContext->bitvector) return CIFS_ALLOC_ERROR;
-  for (unsigned i = 0; i < bv_blocks; i++) {
-    cifsReadBlock(cifsContext->bitvector + i * CIFS_BLOCK_SIZE, 1 + i);
-  }
-}
-
-// TODO: NOTE THIS HAS TO BE DONE BEFORE CREATING A FILE!!!
-
-// TODO: traverse the file system starting with the root and populate the registry
-
-// 3) Build in‑RAM registry of root’s children
-   cifsContext->registry = calloc(CIFS_REGISTRY_SIZE, sizeof(*cifsContext->registry));
-   if (!cifsContext->registry) return CIFS_ALLOC_ERROR;
-
-   // read the root folder block
-   CIFS_BLOCK_TYPE rootBlk;
-   cifsReadBlock((unsigned char*)&rootBlk, cifsContext->superblock->cifsRootNodeIndex);
-
-   for (int i = 0; i < rootBlk.content.fileDescriptor.size; i++) {
-     CIFS_INDEX_TYPE idx = rootBlk.content.index[i];
-     CIFS_BLOCK_TYPE entryBlk;
-     cifsReadBlock((unsigned char*)&entryBlk, idx);
-
-     // use the provided hash() helper and the registry size:
-     unsigned bucket = hash(entryBlk.content.fileDescriptor.name) % CIFS_REGISTRY_SIZE;
-
-     CIFS_REGISTRY_ENTRY_TYPE* node = malloc(sizeof(*node));
-     if (!node) return CIFS_ALLOC_ERROR;
-     node->fileDescriptor = entryBlk.content.fileDescriptor;
-     node->parentFileHandle = cifsContext->superblock->cifsRootNodeIndex;
-     node->referenceCount = 0;
-
-     // push node onto bucket’s linked list
-     node->next = cifsContext->registry[bucket];
-     cifsContext->registry[bucket] = node;
-   }
-
-
-
-	return CIFS_NO_ERROR;
-	// get the superblock of the volume
-	//cifsReadBlock((unsigned char*)cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
-
-	// get the bitvector of the volume
-
-	// this is stuff for part 2 need to traversedisk(index, size, present index in registry)
-    // for registry entry
-	// file descriptor copy of fd
-	// parent -> index of the parent folder
-	// next ->
-
-
-}
-
-/***
- *
- * Saves the file system to a disk and de-allocates the memory.
- *
- * Assumes that all synchronization has been done.
- *
- */
-CIFS_ERROR cifsUmountFileSystem(char* cifsFileName)
-{
-
-#ifdef NO_FUSE_DEBUG
-	if (fuseContext->fuse != NULL)
-		free(fuseContext->fuse);
-
-	if (fuseContext->private_data != NULL)
-		free(fuseContext->private_data);
-
-	if (fuseContext != NULL)
-		free(fuseContext);
-#endif
-
-
-	// save the current superblock
-    cifsWriteBlock((const unsigned char *) cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
-	// note that all bitvector writes need to be done as needed on an ongoing basis as blocks are
-	// acquired and released, so any change should have been saved already
-
-	// TODO: make sure that all information is written off to the volume prior to closing it
-	// If all is done correctly in other places, then no other writing should be needed
-	fflush(cifsVolume);
-
-	fclose(cifsVolume);
-
-	free(cifsContext);
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * Depending on the type parameter the function creates a file or a folder in the current directory
- * of the process.
- *
- * A file can be created only in an open folder, so there must be a corresponding entry
- * in the list of processes. If not, then the function returns CIFS_OPEN_ERROR.
- *
- * Just after creation of the file system, there is only one directory, the root, and it must be opened
- * to create a file in it.
- *
- * If a file with the same name already exists in the current directory, it returns CIFS_DUPLICATE_ERROR.
- *
- * Otherwise:
- *    - sets the folder/file's identifier to the current value of the next unique identifier from the superblock;
- *      then it increments the next available value in the superblock (to prepare it for the next created file)
- *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
- *      that the block is taken
- *    - creates an entry in the conflict resolution list for the corresponding in-memory registry entry
- *      that includes a file descriptor and fills all information about the file in the registry (including
- *      a backpointer to the parent directory that is the reference number of the block holding the file
- *      descriptor of the current working directory)
- *    - copies the local file descriptor to the disk block that was found to be free (the one that will hold
- *      the on-volume file descriptor)
- *    - copies the relevant block of the in-memory bitvector to the corresponding bitevector blocks on the volume
- *
- *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
- *
- */
-CIFS_ERROR cifsCreateFile(CIFS_NAME_TYPE filePath, CIFS_CONTENT_TYPE type)
-{
-
-if (!cifsContext) return CIFS_SYSTEM_ERROR;
-
-    if (strchr(filePath, '/')) return CIFS_NOT_FOUND_ERROR;
-
-    CIFS_BLOCK_TYPE rootBlk;
-    cifsReadBlock((unsigned char*)&rootBlk, cifsContext->superblock->cifsRootNodeIndex);
-    for (int i = 0; i < rootBlk.content.fileDescriptor.size; i++) {
-        CIFS_INDEX_TYPE idx = rootBlk.content.index[i];
-        CIFS_BLOCK_TYPE entry;
-        cifsReadBlock((unsigned char*)&entry, idx);
-        if (strcmp(entry.content.fileDescriptor.name, filePath) == 0)
-            return CIFS_DUPLICATE_ERROR;
-    }
-
-    // find free block
-    CIFS_INDEX_TYPE freeBlk = cifsFindFreeBlock(cifsContext->bitvector);
-    if (freeBlk >= CIFS_NUMBER_OF_BLOCKS) return CIFS_SYSTEM_ERROR;
-    cifsSetBit(cifsContext->bitvector, freeBlk);
-
-    // info for desc
-    CIFS_FILE_DESCRIPTOR_TYPE fDesc;
-    memset(&fDesc, 0, sizeof(fDesc));
-    fDesc.identifier               = cifsContext->superblock->cifsNextUniqueIdentifier++;
-    fDesc.type                     = type;
-    strncpy(fDesc.name, filePath, CIFS_MAX_NAME_LENGTH-1);
-    time(&fDesc.creationTime);
-    fDesc.lastAccessTime           = fDesc.creationTime;
-    fDesc.lastModificationTime     = fDesc.creationTime;
-    fDesc.accessRights             = 0666;
-    fDesc.owner                    = getuid();
-    fDesc.size                     = 0;
-    fDesc.block_ref                = CIFS_INVALID_INDEX;
-    fDesc.parent_block_ref         = cifsContext->superblock->cifsRootNodeIndex;
-    fDesc.file_block_ref           = freeBlk;
-
-    // descriptor block
-    unsigned char buf[CIFS_BLOCK_SIZE] = {0};
-    memcpy(buf, &fDesc, sizeof(fDesc));
-    cifsWriteBlock(buf, freeBlk);
-
-    // link root indx
-    rootBlk.content.index[rootBlk.content.fileDescriptor.size++] = freeBlk;
-    memcpy(buf, &rootBlk.content.fileDescriptor, sizeof(rootBlk.content.fileDescriptor));
-    cifsWriteBlock((const unsigned char*)cifsContext->superblock, 0);
-
-    // update superblock
-    cifsWriteBlock(cifsContext->superblock->cifsRootNodeIndex, 0);
-    for (unsigned i = 0; i * CIFS_BLOCK_SIZE * 8 < CIFS_NUMBER_OF_BLOCKS; i++) {
-        cifsWriteBlock(cifsContext->bitvector + i*CIFS_BLOCK_SIZE, 1 + i);
-    }
-
-    return CIFS_NO_ERROR;
-
-}
-
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- * 
- * Deletes a file from the filesystem
- * 
- * Hashes the file nameto check if the file is in the registry, if not, return CIFS_NOT_FOUND_ERROR
- * 
- * If the file is found, but the reference count is non-zero (that means a process has the file opened),
- * then return CIFS_IN_USE_ERROR
- * 
- * Otherwise,
- * - if it is a non-empty folder, return CIFS_NOT_EMPTY_ERROR
- * - check if process owner has write permission to file or folder, if not, return CIFS_ACCESS_ERROR
- * - free all blocks belonging to the file by flipping the correpsonding bits in the in-memory bitvector
- *    - data blocks, index block(s), file descriptor block
- *    - note, you don't have to clear the data
- * - clear the entry in the parent folder's index
- * - decrement the size of the parent's folder
- * - write the parent folder's file descriptor and index block to the disk
- *    - update the in-memory registry with the new information
- * - write the bitvector to the volume
- * 
-*/
-CIFS_ERROR cifsDeleteFile(CIFS_NAME_TYPE filePath)
-{
-	// TODO: implement
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * Opens a file for reading or writing.
- *
- * If the file is not found in the in-memory registry, then the function returns CIFS_NOT_FOUND_ERROR (since only
- * existing files can be opened).
- *
- * Checks if the file is already open by any process by examining the list of processes in the context.
- * If so, then the function returns CIFS_OPEN_ERROR.
- *
- * Otherwise, a check is made whether the user can be granted the desired access. For that the file descriptor
- * that holds the user id of the owner and the file access rights must be examined and compared with the user id
- * of the owner of the process calling this function (available in the FUSE context) and the desired access passed
- * in the parameter. If the user is not granted the desired access, then the function returns CIFS_ACCESS_ERROR.
- *
- * Otherwise, an entry for the process is added to the list of processes with the file handle and the granted
- * access rights for the process. Each access to the file (read, write, get info) will need to verify that
- * the requested operation is allowed for the requesting user.
- *
- * Finally, the function increments the reference count for the file, sets the output parameter to the handle
- * for the file and returns CIFS_NO_ERROR.
- *
- */
-CIFS_ERROR cifsOpenFile(CIFS_NAME_TYPE filePath, mode_t desiredAccessRights, CIFS_FILE_HANDLE_TYPE *fileHandle)
-{
-	// TODO: implement
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * The function closes the file with the specified file handle for a specific process (obtained through
- * the FUSE context).
- *
- * If the process does not have the file with the passed file handle opened (i.e., it is not an element
- * of the process list with the file passed handle), then the function returns CIFS_ACCESS_ERROR.
- *
- * Removes the entry for the process and the file from the list of processes, and then decreases the reference
- * count for the file.
- *
- */
-CIFS_ERROR cifsCloseFile(CIFS_FILE_HANDLE_TYPE fileHandle)
-{
-	// TODO: implement
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * Finds the file in the in-memory registry and obtains the information about the file from the file descriptor
- * block referenced from the registry.
- *
- * If the file is not found, then it returns CIFS_NOT_FOUND_ERROR
- *
- */
-CIFS_ERROR cifsGetFileInfo(CIFS_NAME_TYPE filePath, CIFS_FILE_DESCRIPTOR_TYPE* infoBuffer)
-{
-	// TODO: implement
-
-	if (!cifsContext) return CIFS_SYSTEM_ERROR;
-
-	// only root children for now
-	if (strchr(filePath, '/')) return CIFS_NOT_FOUND_ERROR;
-
-	// read root block and scan
-	CIFS_BLOCK_TYPE rootBlk;
-	cifsReadBlock((unsigned char*)&rootBlk, cifsContext->superblock->cifsRootNodeIndex);
-
-	for (int i = 0; i < rootBlk.content.fileDescriptor.size; i++) {
-		CIFS_INDEX_TYPE idx = rootBlk.content.index[i];
-		CIFS_BLOCK_TYPE entry;
-		cifsReadBlock((unsigned char*)&entry, idx);
-		if (strcmp(entry.content.fileDescriptor.name, filePath) == 0) {
-			*infoBuffer = entry.content.fileDescriptor;
-			return CIFS_NO_ERROR;
-		}
-	}
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
- *
- * The file must be opened by the process trying to write, so the process must have a file handle of the file
- * while attempting this operation.
- *
- * Otherwise, it checks the access rights for writing by examining the entry for the process and the file
- * in the list of processes. If the process owner (from the fuse context) is not allowed
- * to write to the file, then the function returns CIFS_ACCESS_ERROR.
- *
- * Then, the function calculates the space needed for the new content and checks if the write buffer can fit into
- * the remaining free space in the file system. If not, then the CIFS_ALLOC_ERROR is returned.
- *
- * Otherwise, the function:
- *    - acquires as many new blocks as needed to hold the new content modifying the corresponding bits in
- *      the in-memory bitvector,
- *    - copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
- *      new just acquired blocks,
- *    - copies any modified block of the in-memory bitvector to the corresponding bitvector block on the disk.
- *
- * If the new content has been written successfully, the function then removes all blocks currently held by
- * this file and modifies the file descriptor to reflect the new location, the new size of the file, and the new
- * times of last modification and access.
- *
- * This order of actions prevents file corruption, since in case of any error with writing new content, the file's
- * old version is intact. This technique is called copy-on-write and is an alternative to journalling.
- *
- * The content of the in-memory file descriptor must be replaced by the new data.
- *
- * The function returns CIFS_WRITE_ERROR in response to exception not specified earlier.
- *
- */
-CIFS_ERROR cifsWriteFile(CIFS_FILE_HANDLE_TYPE fileHandle, char* writeBuffer)
-{
-	// TODO: implement
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * The function returns the complete content of the file to the caller through the parameter readBuffer.
- *
- * The file must be opened by the process trying to read, so the process must have a file handle of the file
- * while attempting this operation.
- *
- * Otherwise, it checks the access rights for reading by examining the entry for the process and the file
- * in the list of processes. If the process owner is not allowed to read from the file, then the function
- * returns CIFS_ACCESS_ERROR.
- *
- * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
- * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
- * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
- * the concatenated content.
- *
- * The function returns CIFS_READ_ERROR in response to exception not specified earlier.
- *
- */
-CIFS_ERROR cifsReadFile(CIFS_FILE_HANDLE_TYPE fileHandle, char** readBuffer)
-{
-	// TODO: implement
-
-	return CIFS_NO_ERROR;
-}
-
-//////////////////////////////////////////////////////////////////////////
-///
-/// Functions to write and read block to and from block devices
-///
-//////////////////////////////////////////////////////////////////////////
-
-void cifsCheckIOError(const char* who, const char* what)
-{
-	int errCode = ferror(cifsVolume);
-	if (errCode == 0)
-		return;
-	printf("%s: %s returned \"%s\"\n", who, what, strerror(errCode));
-	exit(errCode);
-}
-
-void cifsPrintBlockContent(const unsigned char *str)
-{
-	for (int i=0; i < CIFS_BLOCK_SIZE; i++)
-		printf("0x%02x ", *(str + i));
-}
-
-/***
- *
- * Write a single block to the block device.
- *
- */
-size_t cifsWriteBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber)
-{
-	fseek(cifsVolume, blockNumber * CIFS_BLOCK_SIZE, SEEK_SET);
-    cifsCheckIOError("WRITE", "fseek");
-	printf("WRITE: POSITION=%6ld, ", ftell(cifsVolume));
-    cifsCheckIOError("WRITE", "ftell");
-	size_t len = fwrite((const void *)content, sizeof(unsigned char), CIFS_BLOCK_SIZE, cifsVolume);
-    cifsCheckIOError("WRITE", "fwrite");
-	printf("LENGTH=%4ld, CONTENT=", len); // %s will ussually not work
-	cifsPrintBlockContent(content);
-	printf("\n");
-
-	return len;
-}
-
-/***
- *
- * Read a single block from a block device.
- *
- */
-void cifsReadBlock(unsigned char* buffer, CIFS_INDEX_TYPE blockNumber)
-{
-	unsigned char* content = malloc(CIFS_BLOCK_SIZE);
-
-	fseek(cifsVolume, blockNumber * CIFS_BLOCK_SIZE, SEEK_SET);
-	cifsCheckIOError("READ","fseek");
-	size_t r = fread(buffer, 1, CIFS_BLOCK_SIZE, cifsVolume);
-	cifsCheckIOError("READ","fread");
-	// (optional) debug print buffer
-    return;
-
-	//fseek(cifsVolume, blockNumber * CIFS_BLOCK_SIZE, SEEK_SET);
-    //cifsCheckIOError("READ", "fseek");
-	//printf("READ : POSITION=%6ld, ", ftell(cifsVolume));
-    //cifsCheckIOError("READ", "ftell");
-	//size_t len = fread((void * restrict)content, sizeof(unsigned char), CIFS_BLOCK_SIZE, cifsVolume);
-    //cifsCheckIOError("READ", "fread");
-	//printf("LENGTH=%4ld, CONTENT=", len); // %s will usually not work
-	//cifsPrintBlockContent(content);
-	//printf("\n");
-
-	//return content;
-}
-
-//////////////////////////////////////////////////////////////////////////
-///
-/// some helper functions
-///
-//////////////////////////////////////////////////////////////////////////
-
-/***
- *
- * Returns a hash value within the limits of the registry.
- *
- */
-
-inline unsigned long hash(const char* str)
-{
-
-	register unsigned long hash = 5381;
-	register unsigned char c;
-
-	while ((c = *str++) != '\0')
-		hash = ((hash << 5) + hash) ^ c; /* hash * 33 + c */
-
-	return hash % CIFS_REGISTRY_SIZE;
-}
-
-/***
- *
- * Find a free block in a bit vector.
- *
- */
-inline CIFS_INDEX_TYPE cifsFindFreeBlock(const unsigned char* bitvector)
-{
-
-	unsigned int i = 0;
-	while (bitvector[i] == 0xFF)
-		i += 1;
-
-	register unsigned char mask = 0x80;
-	CIFS_INDEX_TYPE j = 0;
-	while (bitvector[i] & mask)
-	{
-		mask >>= 1;
-		++j;
-	}
-
-	return (i * 8) + j; // i bytes and j bits are all "1", so this formula points to the first "0"
-}
-
-/***
- *
- * Three functions for bit manipulation.
- *
- */
-inline void cifsFlipBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
-{
-
-	CIFS_INDEX_TYPE blockIndex = bitIndex / 8;
-	CIFS_INDEX_TYPE bitShift = bitIndex % 8;
-
-	register unsigned char mask = 0x80;
-	bitvector[blockIndex] ^= (mask >> bitShift);
-}
-
-inline void cifsSetBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
-{
-
-	CIFS_INDEX_TYPE blockIndex = bitIndex / 8;
-	CIFS_INDEX_TYPE bitShift = bitIndex % 8;
-
-	register unsigned char mask = 0x80;
-	bitvector[blockIndex] |= (mask >> bitShift);
-}
-
-inline void cifsClearBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
-{
-
-	CIFS_INDEX_TYPE blockIndex = bitIndex / 8;
-	CIFS_INDEX_TYPE bitShift = bitIndex % 8;
-
-	register unsigned char mask = 0x80;
-	bitvector[blockIndex] &= ~(mask >> bitShift);
-}
-
-/***
- *
- * Generates random readable/printable content for testing
- *
- */
-
-char* cifsGenerateContent(int size)
-{
-
-	size = (size <= 0 ? rand() % 1000 : size); // arbitrarily chosen as an example
-
-	char* content = malloc(size);
-
-	int firstPrintable = ' ';
-	int len = '~' - firstPrintable;
-
-	for (int i = 0; i < size - 1; i++)
-		*(content + i) = firstPrintable + rand() % len;
-
-	content[size - 1] = '\0';
-	return content;
-}
-
-
-/*******
- * Some extra helper functions
- */
-int doesFileExist(char* filePath) {
-	// TODO: implement
-	return CIFS_NO_ERROR;
-}
-
-void traverseDisk(CIFS_INDEX_TYPE* index, int size, char* path) {
-	// TODO: implement
-}
-
-void addToHashTable(long index, char* filePath, CIFS_FILE_DESCRIPTOR_TYPE* fd)
-{
-	// TODO: implement
-}
-
-void writeBvSb(void) {
-	// TODO: implement
-
-	// write bitvector (Bv)
-	
-	// write superblock (Sb)
-	
-}
+//////////////////////////////////////////////////////////////////////////
+///
+/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
+///
+//////////////////////////////////////////////////////////////////////////
+/*
+ * Rafael Diaz
+ * Spring 2025
+ * COMP 362 Section 1 - Operating Systems
+ */
+///
+/// This source contains code suitable for testing without FUSE.
+///
+/// Integration with fuse requires that you must modify the code as needed
+/// to work inside the kernel and with the FUSE framework.
+///
+//////////////////////////////////////////////////////////////////////////
+
+#include "cifs.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// cifs global variables
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+
+ A file handle of the file system volume residing on a physical device (peripheral).
+
+ File system structure:
+
+ bitvector - one bit per block; i.e., (CIFS_NUMBER_OF_BLOCKS / 8 / CIFS_BLOCK_SIZE) blocks
+ superblock - one block
+ root descriptor block - one block
+ root index block - one block (there might be more if the number of files in the root is large)
+ storage blocks (folder, file, data, or index) - all remaining blocks
+
+*/
+FILE* cifsVolume;
+
+/***
+
+ The memory mapping of the whole volume when it is mounted with CIFS_MOUNT_MMAP; NULL otherwise.
+
+ While the volume is mapped, all block accesses copy to and from the mapping, and the block cache is
+ not used (the mapping is served from the page cache of the OS, so a second cache would only add copies).
+
+*/
+unsigned char* cifsVolumeMap;
+
+/***
+
+ The I/O backend the volume is mounted with (see CIFS_MOUNT_URING); NULL selects the posix backend.
+
+*/
+CIFS_IO_BACKEND_TYPE* cifsVolumeBackend;
+
+/***
+
+ A pointer to the in-memory file system context that holds critical information about the volume.
+
+ The in-memory data structures are fast as they reside in the
+ computer memory, and not on an external storage device;
+ therefore, they are used a fast gateway to the elements of the peripheral volume.
+
+ The context will hold:
+ - a copy of the volume superblock
+ - a copy of the volume bitvector
+ - a hash-table-based registry of all volume files the registry is created when mounting the file system
+ - a list of processes currently interacting with cifs.
+
+ All in-memory data must be diligently synchronized with the external volume;
+ for example, to find a free block this bitvector MUST be searched (for speed), and if
+ a block is allocated (or deallocated), then the block that contains
+ the bit flips (and NOT the whole bitvector!) must be copied to the disk.
+
+*/
+
+CIFS_CONTEXT_TYPE* cifsContext;
+
+/***
+
+ FUSE has "context" that holds a number of parameters of the process that accesses it
+
+struct fuse *fuse {
+uid_t 	uid,
+gid_t 	gid,
+pid_t 	pid,
+void * 	private_data,
+mode_t 	umask }
+
+
+We need to simulate the context as long as we debug without FUSE, so for convenience we will use
+an auxiliary pointer that either points to the real FUSE context or to the simulated
+version.
+
+*/
+
+_Thread_local struct fuse_context* fuseContext; // each FUSE worker thread has its own
+
+/***
+
+ The run-time trace level; only levels up to CIFS_TRACE_LEVEL are compiled in, so raising it above that
+ has no effect.
+
+*/
+int cifsTraceLevel = CIFS_TRACE_LEVEL;
+
+/***
+
+ Registry snapshots are saved at clean unmounts and loaded at mounts unless this is 0.
+
+*/
+int cifsRegistrySnapshot = 1;
+
+/***
+
+ The number of blocks reserved for the metadata journal by cifsCreateFileSystem(); 0 creates volumes without one.
+
+*/
+int cifsJournalBlocks = CIFS_JOURNAL_BLOCKS;
+
+/***
+
+ If not 0, cifsCreateFileSystem() discards the storage blocks of a block device (BLKDISCARD), so the device
+ knows that their old content is not needed any more.
+
+*/
+int cifsFormatDiscard = 0;
+
+/***
+
+ If not 0, the blocks released by deleting files and by replacing their content are freed by the reclaimer
+ thread of the mounted volume (see CIFS_RECLAIMER_TYPE); 0 frees them before the operations return.
+
+*/
+int cifsDeferredReclaim = 1;
+
+/***
+
+ Adds to a counter of the instrumentation (see CIFS_STATS_TYPE) while a volume is mounted.
+
+*/
+#define CIFS_STATS_ADD(counter, n) \
+	do { if (cifsContext != NULL) __atomic_fetch_add(&cifsContext->stats.counter, (n), __ATOMIC_RELAXED); } while (0)
+
+static CIFS_ERROR cifsCreateEntry(const char* filePath, CIFS_CONTENT_TYPE type);
+static CIFS_ERROR cifsDeleteEntry(const char* filePath);
+static CIFS_ERROR cifsOpenEntry(const char* filePath, mode_t desiredAccessRights, CIFS_FILE_HANDLE_TYPE* fileHandle);
+static CIFS_ERROR cifsCloseEntry(CIFS_FILE_HANDLE_TYPE fileHandle);
+static CIFS_ERROR cifsReadContent(const CIFS_FILE_DESCRIPTOR_TYPE* fd, char** readBuffer);
+static CIFS_ERROR cifsReadRange(const CIFS_FILE_DESCRIPTOR_TYPE* fd, const CIFS_BLOCK_MAP_TYPE* map, void* buffer,
+								size_t size, size_t offset, size_t* bytesRead);
+static CIFS_ERROR cifsCopyOnWrite(CIFS_REGISTRY_ENTRY_TYPE* entry, const void* buffer, size_t size, size_t offset,
+								  int truncate);
+static CIFS_BLOCK_MAP_TYPE* cifsBuildBlockMap(const CIFS_FILE_DESCRIPTOR_TYPE* fd);
+static const CIFS_BLOCK_MAP_TYPE* cifsEntryBlockMap(CIFS_REGISTRY_ENTRY_TYPE* entry);
+static void cifsDropBlockMap(CIFS_REGISTRY_ENTRY_TYPE* entry);
+static void cifsReadAhead(CIFS_REGISTRY_ENTRY_TYPE* entry, const CIFS_BLOCK_MAP_TYPE* map, size_t offset,
+						  size_t length);
+static CIFS_ERROR cifsVectorRange(const CIFS_FILE_DESCRIPTOR_TYPE* fd, const CIFS_BLOCK_MAP_TYPE* map, size_t size,
+								  size_t offset, CIFS_READ_VECTOR_TYPE** vector);
+static CIFS_ERROR cifsWriteInline(CIFS_REGISTRY_ENTRY_TYPE* entry, const void* buffer, size_t size, size_t offset,
+								  size_t newSize);
+static CIFS_ERROR cifsWriteBarrier(void);
+static int cifsIsMetadataBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber);
+static void cifsCacheLogBlock(CIFS_BLOCK_CACHE_TYPE* cache, int slot);
+static void cifsCacheDetachSlot(CIFS_BLOCK_CACHE_TYPE* cache, int slot);
+static int cifsCacheFindLoaded(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber);
+static int cifsCacheLoadBlock(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber);
+static int cifsCacheGather(CIFS_BLOCK_CACHE_TYPE* cache, const CIFS_INDEX_TYPE* blockNumbers, int count,
+						   unsigned char* const* buffers);
+static int cifsCacheHoldBlocks(CIFS_BLOCK_CACHE_TYPE* cache, const CIFS_INDEX_TYPE* blockNumbers, int count,
+							   int* slots);
+static void cifsCacheReleaseSlots(CIFS_BLOCK_CACHE_TYPE* cache, const int* slots, int count);
+static void cifsJournalStop(CIFS_JOURNAL_TYPE* journal);
+static int cifsCheckGeometry(void);
+static CIFS_ERROR cifsAbandonMount(CIFS_ERROR error);
+static void cifsReleaseMount(void);
+static void cifsJournalDestroy(CIFS_JOURNAL_TYPE* journal);
+static unsigned long long cifsStatsClock(void);
+static void cifsStatsRecord(CIFS_STATS_OPERATION operation, unsigned long long started);
+static void cifsDeviceTransferBlock(int writing, CIFS_INDEX_TYPE blockNumber, unsigned char* buffer);
+static CIFS_PROCESS_CONTROL_BLOCK_TYPE* cifsFindProcess(pid_t pid, int adding);
+static void cifsReleaseProcess(CIFS_PROCESS_CONTROL_BLOCK_TYPE* pcb);
+static int cifsReclaimChain(CIFS_INDEX_TYPE indexBlock);
+static void cifsMarkBitvectorDirty(unsigned int first, unsigned int last);
+
+/// must use
+// fuseContext = fuse_get_context();
+/// when the cifs is integrated with FUSE !!!
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// cifs function implementations
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Allocates space for the file system and saves it to disk.
+ *
+ * cifsFileName must be either of the three:
+ *
+ *    1) a regular file
+ *    2) a loop interface to a real file
+ *    3) a block device name
+ *
+ * All blocks in front of the storage blocks (the bitvector, the superblock, the journal, and the two blocks of
+ * the root folder) are composed in one buffer and written with a single pwrite(); a regular file is then sized
+ * with ftruncate(), so the storage blocks take no space until they are written. On a block device, the storage
+ * blocks are discarded if cifsFormatDiscard is set.
+ *
+ */
+CIFS_ERROR cifsCreateFileSystem(char* cifsFileName)
+{
+	// a volume left mounted is abandoned; neither its reclaimer nor its journal may go on writing into the new one,
+	// and the reclaimer goes first, since its batches are journaled
+	if (cifsContext != NULL)
+	{
+		cifsReclaimerClose();
+		if (cifsContext->journal != NULL)
+			cifsJournalStop(cifsContext->journal);
+	}
+	cifsContext = NULL; // no context and no block cache; the blocks are composed in memory
+
+	// open the volume for the file system
+
+	cifsVolume = fopen(cifsFileName, "w+"); //"w+" write and append; just for the creation of the volume
+	if (cifsVolume == NULL)
+		return CIFS_ALLOC_ERROR;
+
+	// --- put the file system on the volume ---
+
+	CIFS_INDEX_TYPE journalBlocks = cifsJournalBlocks > 0 ? cifsJournalBlocks : 0;
+	CIFS_INDEX_TYPE rootNodeIndex = CIFS_SUPERBLOCK_INDEX + 1 + journalBlocks; // the root follows the journal
+	size_t imageSize = (size_t)(rootNodeIndex + 2) * CIFS_BLOCK_SIZE;
+	unsigned char* image = calloc(imageSize, 1); // initially all content blocks are free, and the journal empty
+	if (image == NULL)
+	{
+		fclose(cifsVolume);
+		return CIFS_ALLOC_ERROR;
+	}
+
+	// initialize the bitvector; it is at the front of the volume
+
+	unsigned char* bitvector = image;
+
+	// mark as unavailable the blocks used for the bitvector, the superblock, the journal, and the root folder
+	for (CIFS_INDEX_TYPE i = 0; i < rootNodeIndex + 2; i++)
+		cifsSetBit(bitvector, i);
+
+	// initialize the superblock
+
+	CIFS_SUPERBLOCK_TYPE* superblock = (CIFS_SUPERBLOCK_TYPE*)(image + (size_t)CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE);
+	// no generation and no registry snapshot yet
+
+	superblock->cifsNextUniqueIdentifier = CIFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER;
+	superblock->cifsDataBlockSize = CIFS_BLOCK_SIZE;
+	superblock->cifsNumberOfBlocks = CIFS_NUMBER_OF_BLOCKS - 1; // excludes the invalid block number 0xFF
+	superblock->cifsIndexBits = CIFS_INDEX_BITS;
+	superblock->cifsJournalIndex = CIFS_SUPERBLOCK_INDEX + 1;
+	superblock->cifsJournalBlocks = journalBlocks;
+	superblock->cifsRootNodeIndex = rootNodeIndex;
+
+	// an empty journal; no transaction has the sequence number following the header
+	if (journalBlocks > 0)
+	{
+		CIFS_JOURNAL_HEADER_TYPE* journalHeader =
+			(CIFS_JOURNAL_HEADER_TYPE*)(image + (size_t)superblock->cifsJournalIndex * CIFS_BLOCK_SIZE);
+		journalHeader->magic = CIFS_JOURNAL_MAGIC;
+		journalHeader->sequence = 1;
+	}
+
+	// initialize the block holding the root folders; there sre two of them: folder descriptor and the index block
+
+	// first, initialize the folder description block
+	CIFS_BLOCK_TYPE* rootFolderBlock = (CIFS_BLOCK_TYPE*)(image + (size_t)rootNodeIndex * CIFS_BLOCK_SIZE);
+	rootFolderBlock->type = CIFS_FOLDER_CONTENT_TYPE;
+	// root folder always has "0" as the identifier; it's incremented for the files created later
+	rootFolderBlock->content.fileDescriptor.identifier = superblock->cifsNextUniqueIdentifier++;
+	rootFolderBlock->content.fileDescriptor.type = CIFS_FOLDER_CONTENT_TYPE;
+	strcpy(rootFolderBlock->content.fileDescriptor.name, "/");
+	rootFolderBlock->content.fileDescriptor.accessRights = 0666;
+	rootFolderBlock->content.fileDescriptor.owner = getuid(); // forgot to change this so no more seg fault in the beginning so now need to find next seg fault
+	rootFolderBlock->content.fileDescriptor.size = 0;
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	rootFolderBlock->content.fileDescriptor.creationTime = time.tv_sec;
+	rootFolderBlock->content.fileDescriptor.lastAccessTime = time.tv_sec;
+	rootFolderBlock->content.fileDescriptor.lastModificationTime = time.tv_sec;
+	rootFolderBlock->content.fileDescriptor.block_ref = rootNodeIndex + 1; // next block
+	rootFolderBlock->content.fileDescriptor.parent_block_ref = CIFS_INVALID_INDEX; // the root has no parent
+	rootFolderBlock->content.fileDescriptor.file_block_ref = rootNodeIndex;
+
+	// then, initialize the index block of the root folder
+	CIFS_BLOCK_TYPE* rootFolderIndexBlock = rootFolderBlock + 1;
+	rootFolderIndexBlock->type = CIFS_INDEX_CONTENT_TYPE;
+	// no files in the root folder yet, so all entries are free
+	for(int i = 0; i < CIFS_INDEX_SIZE; i++) {
+		rootFolderIndexBlock->content.index[i] = CIFS_INVALID_INDEX;
+	}
+
+	// now, write all of it at once, and give the volume its size
+	int fd = fileno(cifsVolume);
+	CIFS_ERROR error = CIFS_NO_ERROR;
+	if (pwrite(fd, image, imageSize, 0) != (ssize_t)imageSize)
+		error = CIFS_WRITE_ERROR;
+	free(image);
+
+	off_t volumeSize = (off_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE;
+	struct stat status;
+	if (error == CIFS_NO_ERROR && fstat(fd, &status) == 0 && S_ISBLK(status.st_mode))
+	{
+		if (cifsFormatDiscard)
+		{
+			// the old content of the device is of no use; a failure only costs the device some work later
+			unsigned long long range[2] = { imageSize, volumeSize - imageSize };
+			ioctl(fd, BLKDISCARD, range);
+		}
+	}
+	else if (error == CIFS_NO_ERROR && ftruncate(fd, volumeSize) != 0)
+		error = CIFS_WRITE_ERROR;
+
+	fclose(cifsVolume);
+	if (error != CIFS_NO_ERROR)
+		return error;
+
+	CIFS_TRACE(CIFS_TRACE_INFO, "CREATED CIFS VOLUME\n%zu bytes\n%d blocks\nBlock size %d bytes\n",
+			(size_t)volumeSize,
+			CIFS_NUMBER_OF_BLOCKS,
+			CIFS_BLOCK_SIZE);
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Loads the file system from a disk and constructs in-memory registry of all files is the system.
+ *
+ * There are two things to do:
+ *    - creating an in-memory hash-table-based registry of the files in the volume
+ *    - copying the bitvector from the volume to its in-memory mirror
+ *
+ * The creation of the registry is realized through the traversal of the whole volume:
+ *
+ * Starting with the file system root (pointed to from the superblock) traverses the hierarchy of directories
+ * and adds an entry for each folder or file to the registry by hashing the name and adding a registry
+ * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
+ * the only element of that list. If the list contains more than one element, then multiple files hashed to
+ * the same value (hash conflict). In this case, the unique file identifier can be used to resolve the conflict.
+ * The identifier must be the same as the identifier in the file descriptor pointed to by the node reference.
+ *
+ * The function must also capture the parenthood relationship by setting the parent file handle field for
+ * the file being added to the registry to the file handle of the parent folder (whish is already available since
+ * the traversal is top down; i.e., parent folders are always added before their content).
+ *
+ * The function sets the current working directory to refer to the block holding the root of the volume. This will
+ * be changed as the user navigates the file system hierarchy.
+ *
+ */
+CIFS_ERROR cifsMountFileSystem(char* cifsFileName)
+{
+	return cifsMountFileSystemMode(cifsFileName, CIFS_MOUNT_STDIO);
+}
+
+/***
+ *
+ * Mounts the file system accessing the volume in the given mode.
+ *
+ * With CIFS_MOUNT_MMAP the whole volume is mapped into memory, so it must be at least
+ * CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE bytes long.
+ *
+ */
+CIFS_ERROR cifsMountFileSystemMode(char* cifsFileName, CIFS_MOUNT_MODE mode)
+{
+	cifsContext = calloc(1, sizeof *cifsContext);
+    if (!cifsContext) return CIFS_ALLOC_ERROR;
+
+	cifsVolume = fopen(cifsFileName, "rw+"); // now we will be reading, writing, and appending
+    if (!cifsVolume) return cifsAbandonMount(CIFS_SYSTEM_ERROR);
+
+	// the layout of everything on the volume follows from its geometry
+	if (!cifsCheckGeometry())
+		return cifsAbandonMount(CIFS_GEOMETRY_ERROR);
+
+	// a transaction committed before a crash is completed before anything else reads the volume
+	unsigned long long journalSequence;
+	CIFS_ERROR journalError = cifsJournalReplay(&journalSequence);
+	if (journalError != CIFS_NO_ERROR)
+		return cifsAbandonMount(journalError);
+
+	// --- create the OS context ---
+
+	//printf("Size of CIFS_CONTEXT_TYPE: %ld\n", sizeof(CIFS_CONTEXT_TYPE));
+	if (mode == CIFS_MOUNT_MMAP)
+	{
+		size_t volumeSize = (size_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE;
+		int fd = fileno(cifsVolume);
+		off_t end = lseek(fd, 0, SEEK_END); // also works for block devices whose st_size is 0
+		if (end < 0 || (size_t)end < volumeSize)
+			return cifsAbandonMount(CIFS_SYSTEM_ERROR);
+
+		void* map = mmap(NULL, volumeSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			return cifsAbandonMount(CIFS_SYSTEM_ERROR);
+		cifsVolumeMap = map;
+	}
+	else
+	{
+		cifsContext->blockCache = cifsCreateBlockCache();
+		if (!cifsContext->blockCache)
+			return cifsAbandonMount(CIFS_ALLOC_ERROR);
+
+		// a backend left by an abandoned mount is of no use to this one
+		cifsCloseIOBackend(cifsVolumeBackend);
+		cifsVolumeBackend = NULL;
+		if (mode == CIFS_MOUNT_URING)
+		{
+			cifsVolumeBackend = cifsOpenUringBackend();
+			if (cifsVolumeBackend == NULL)
+				CIFS_TRACE(CIFS_TRACE_INFO, "io_uring is not available; using the posix backend\n");
+		}
+	}
+
+	cifsContext->superblock = malloc(CIFS_BLOCK_SIZE); // ASSUMES: sizeof(CIFS_SUPERBLOCK_TYPE) <= CIFS_BLOCK_SIZE
+	if (!cifsContext->superblock)
+		return cifsAbandonMount(CIFS_ALLOC_ERROR);
+	cifsReadBlock((unsigned char*)cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
+
+// read the bitvector from the volume; it occupies the blocks in front of the superblock
+
+{
+  cifsContext->bitvector = malloc(CIFS_BITVECTOR_SIZE);
+  if (!cifsContext->bitvector) return cifsAbandonMount(CIFS_ALLOC_ERROR);
+  CIFS_INDEX_TYPE blockNumbers[CIFS_SUPERBLOCK_INDEX];
+  unsigned char* buffers[CIFS_SUPERBLOCK_INDEX];
+  for (unsigned i = 0; i < CIFS_SUPERBLOCK_INDEX; i++) {
+    blockNumbers[i] = i;
+    buffers[i] = cifsContext->bitvector + i * CIFS_BLOCK_SIZE;
+  }
+  cifsReadBlocks(blockNumbers, buffers, CIFS_SUPERBLOCK_INDEX); // a single read of consecutive blocks
+}
+
+// TODO: NOTE THIS HAS TO BE DONE BEFORE CREATING A FILE!!!
+
+// TODO: traverse the file system starting with the root and populate the registry
+
+// 3) Build in‑RAM registry of the root and its children
+   cifsContext->registry = cifsCreateRegistry();
+   if (!cifsContext->registry) return cifsAbandonMount(CIFS_ALLOC_ERROR);
+   pthread_mutex_init(&cifsContext->registryLock, NULL);
+   pthread_rwlock_init(&cifsContext->namespaceLock, NULL);
+   pthread_mutex_init(&cifsContext->processLock, NULL);
+   pthread_mutex_init(&cifsContext->bitvectorLock, NULL);
+   pthread_mutex_init(&cifsContext->dentryLock, NULL);
+   cifsSlabInit(&cifsContext->registrySlab, sizeof(CIFS_REGISTRY_ENTRY_TYPE));
+   cifsSlabInit(&cifsContext->openFileSlab, sizeof(OPEN_FILE_TYPE));
+   cifsSlabInit(&cifsContext->processSlab, sizeof(CIFS_PROCESS_CONTROL_BLOCK_TYPE));
+   cifsContext->dentries = calloc(CIFS_DENTRY_CACHE_SIZE, sizeof(CIFS_DENTRY_TYPE));
+   if (!cifsContext->dentries) return cifsAbandonMount(CIFS_ALLOC_ERROR);
+   cifsContext->dentryPositiveGeneration = 1; // unused entries have generation 0
+   cifsContext->dentryNegativeGeneration = 1;
+   cifsContext->handles = calloc(CIFS_NUMBER_OF_BLOCKS, sizeof(*cifsContext->handles));
+   if (!cifsContext->handles) return cifsAbandonMount(CIFS_ALLOC_ERROR);
+
+   cifsContext->processTable = calloc(CIFS_PROCESS_BUCKETS, sizeof(*cifsContext->processTable));
+   if (!cifsContext->processTable) return cifsAbandonMount(CIFS_ALLOC_ERROR);
+   cifsContext->processBuckets = CIFS_PROCESS_BUCKETS;
+
+   // a snapshot saved by the last clean unmount spares the traversal
+   CIFS_ERROR error = cifsRegistrySnapshot ? cifsLoadRegistrySnapshot(cifsFileName) : CIFS_NOT_FOUND_ERROR;
+   if (error == CIFS_ALLOC_ERROR) return cifsAbandonMount(error);
+   if (error != CIFS_NO_ERROR) {
+     // read the root folder block
+     CIFS_BLOCK_TYPE rootBlk;
+     cifsReadBlock((unsigned char*)&rootBlk, cifsContext->superblock->cifsRootNodeIndex);
+     CIFS_FILE_DESCRIPTOR_TYPE rootDesc = rootBlk.content.fileDescriptor;
+     CIFS_REGISTRY_ENTRY_TYPE* rootEntry = addToHashTable(CIFS_INVALID_INDEX, &rootDesc);
+     if (!rootEntry) return cifsAbandonMount(CIFS_ALLOC_ERROR);
+
+     // everything below the root
+     error = traverseDisk(&rootEntry->fileDescriptor);
+     if (error != CIFS_NO_ERROR) return cifsAbandonMount(error);
+   }
+
+   error = cifsJournalOpen(journalSequence);
+   if (error != CIFS_NO_ERROR) return cifsAbandonMount(error);
+   error = cifsReclaimerOpen();
+   if (error != CIFS_NO_ERROR) return cifsAbandonMount(error);
+
+   // the snapshot goes stale with the first change; make sure a crash from now on does not trust it
+   if (cifsContext->superblock->cifsSnapshotGeneration != 0) {
+     cifsContext->superblock->cifsSnapshotGeneration = 0;
+     cifsWriteBlock((const unsigned char*)cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
+     cifsSyncFileSystem();
+   }
+
+	return CIFS_NO_ERROR;
+	// get the superblock of the volume
+	//cifsReadBlock((unsigned char*)cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
+
+	// get the bitvector of the volume
+
+	// this is stuff for part 2 need to traversedisk(index, size, present index in registry)
+    // for registry entry
+	// file descriptor copy of fd
+	// parent -> index of the parent folder
+	// next ->
+
+
+}
+
+/***
+ *
+ * Undoes a mount that failed at any point after the context was allocated, so the volume can be mounted (or
+ * checked) again; nothing is written to the volume. Returns the error.
+ *
+ */
+static CIFS_ERROR cifsAbandonMount(CIFS_ERROR error)
+{
+	cifsReleaseMount();
+
+	return error;
+}
+
+/***
+ *
+ * Stops the threads of the mounted volume, closes the volume, and releases everything the mount keeps in memory;
+ * every part is released only if the mount got as far as setting it up.
+ *
+ * Nothing is written to the volume, so whatever has to be saved must be saved first; the reclaimer must have
+ * nothing queued, and the journal must not need a reset.
+ *
+ */
+static void cifsReleaseMount(void)
+{
+	cifsReclaimerClose();
+	CIFS_JOURNAL_TYPE* journal = cifsContext->journal;
+	if (journal != NULL)
+	{
+		cifsJournalStop(journal);
+		cifsContext->journal = NULL;
+		cifsJournalDestroy(journal);
+	}
+
+	if (cifsVolumeMap != NULL)
+	{
+		munmap(cifsVolumeMap, (size_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE);
+		cifsVolumeMap = NULL;
+	}
+
+	cifsCloseIOBackend(cifsVolumeBackend);
+	cifsVolumeBackend = NULL;
+
+	if (cifsVolume != NULL)
+		fclose(cifsVolume);
+	cifsVolume = NULL;
+
+	// the nodes of the registry and the process table all live in the slabs
+	cifsDestroyBlockCache(cifsContext->blockCache);
+	if (cifsContext->registry != NULL)
+	{
+		if (cifsContext->handles != NULL)
+			for (CIFS_INDEX_TYPE handle = 0; handle < CIFS_NUMBER_OF_BLOCKS; handle++)
+				if (cifsContext->handles[handle] != NULL)
+				{
+					pthread_rwlock_destroy(&cifsContext->handles[handle]->lock);
+					free(cifsContext->handles[handle]->blockMap);
+				}
+		if (cifsContext->processTable != NULL)
+			for (unsigned int bucket = 0; bucket < cifsContext->processBuckets; bucket++)
+				for (CIFS_PROCESS_CONTROL_BLOCK_TYPE* pcb = cifsContext->processTable[bucket]; pcb != NULL;
+					 pcb = pcb->next)
+					free(pcb->openFiles);
+		cifsDestroyRegistry(cifsContext->registry);
+		cifsSlabDestroy(&cifsContext->registrySlab);
+		cifsSlabDestroy(&cifsContext->openFileSlab);
+		cifsSlabDestroy(&cifsContext->processSlab);
+		pthread_mutex_destroy(&cifsContext->registryLock);
+		pthread_rwlock_destroy(&cifsContext->namespaceLock);
+		pthread_mutex_destroy(&cifsContext->processLock);
+		pthread_mutex_destroy(&cifsContext->bitvectorLock);
+		pthread_mutex_destroy(&cifsContext->dentryLock);
+	}
+	free(cifsContext->processTable);
+	free(cifsContext->handles);
+	free(cifsContext->dentries);
+	free(cifsContext->bitvector);
+	free(cifsContext->superblock);
+	free(cifsContext);
+	cifsContext = NULL;
+}
+
+/***
+ *
+ * Tells whether the volume has the geometry of this build; volumes formatted before the index width was recorded
+ * have 16-bit block numbers.
+ *
+ */
+static int cifsCheckGeometry(void)
+{
+	unsigned char block[CIFS_BLOCK_SIZE];
+	CIFS_SUPERBLOCK_TYPE superblock;
+	cifsDeviceReadBlock(block, CIFS_SUPERBLOCK_INDEX);
+	memcpy(&superblock, block, sizeof superblock);
+
+	CIFS_INDEX_TYPE indexBits = superblock.cifsIndexBits != 0 ? superblock.cifsIndexBits : 16;
+	if (superblock.cifsDataBlockSize == CIFS_BLOCK_SIZE && superblock.cifsNumberOfBlocks == CIFS_NUMBER_OF_BLOCKS - 1
+		&& indexBits == CIFS_INDEX_BITS)
+		return 1;
+
+	CIFS_TRACE(CIFS_TRACE_ERROR, "MOUNT: the volume has %u blocks of %u bytes with %u-bit block numbers; build with "
+			   "-DCIFS_BLOCK_SIZE=%u -DCIFS_INDEX_BITS=%u -DCIFS_NUMBER_OF_BLOCKS=%u to mount it\n",
+			   (unsigned)superblock.cifsNumberOfBlocks + 1, (unsigned)superblock.cifsDataBlockSize, (unsigned)indexBits,
+			   (unsigned)superblock.cifsDataBlockSize, (unsigned)indexBits, (unsigned)superblock.cifsNumberOfBlocks + 1);
+	return 0;
+}
+
+/***
+ *
+ * Saves the file system to a disk and de-allocates the memory.
+ *
+ * Assumes that all synchronization has been done.
+ *
+ */
+CIFS_ERROR cifsUmountFileSystem(char* cifsFileName)
+{
+
+#ifdef NO_FUSE_DEBUG
+	if (fuseContext != NULL)
+	{
+		if (fuseContext->fuse != NULL)
+			free(fuseContext->fuse);
+
+		if (fuseContext->private_data != NULL)
+			free(fuseContext->private_data);
+
+		free(fuseContext);
+		fuseContext = NULL;
+	}
+#endif
+
+	// the reclaimer frees what is still queued first; the bitvector must be final before it is saved
+	cifsReclaimerClose();
+
+	// save the registry for the next mount; the superblock names the snapshot only once it is on the disk
+	cifsContext->superblock->cifsGeneration++;
+	cifsContext->superblock->cifsSnapshotGeneration = 0;
+	if (cifsRegistrySnapshot && cifsSaveRegistrySnapshot(cifsFileName) == CIFS_NO_ERROR)
+		cifsContext->superblock->cifsSnapshotGeneration = cifsContext->superblock->cifsGeneration;
+
+	// save the current superblock
+    cifsWriteBlock((const unsigned char *) cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
+	// note that all bitvector writes need to be done as needed on an ongoing basis as blocks are
+	// acquired and released, so any change should have been saved already
+
+	// write off all dirty blocks held in the cache prior to closing the volume
+	cifsSyncFileSystem();
+	cifsJournalClose();
+
+	// release the in-memory structures
+	cifsReleaseMount();
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Writes all blocks modified since the last synchronization to the volume.
+ *
+ * Blocks written while the file system is mounted are held in the block cache; this is the point
+ * at which they are saved on the volume. With a journal, the running transaction is committed first,
+ * and the volume is synchronized with the device.
+ *
+ */
+CIFS_ERROR cifsSyncFileSystem(void)
+{
+	if (cifsContext == NULL || cifsVolume == NULL)
+		return CIFS_SYSTEM_ERROR;
+
+	cifsReclaimWait();
+
+	if (cifsVolumeMap != NULL)
+	{
+		if (msync(cifsVolumeMap, (size_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE, MS_SYNC) != 0)
+			return CIFS_WRITE_ERROR;
+		return CIFS_NO_ERROR;
+	}
+
+	CIFS_ERROR error = cifsJournalCommit();
+	if (error != CIFS_NO_ERROR)
+		return error;
+
+	cifsFlushBlockCache(cifsContext->blockCache);
+	if (fflush(cifsVolume) != 0)
+		return CIFS_WRITE_ERROR;
+	if (cifsContext->journal != NULL && fdatasync(fileno(cifsVolume)) != 0)
+		return CIFS_WRITE_ERROR;
+
+	return CIFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Depending on the type parameter the function creates a file or a folder in the current directory
+ * of the process.
+ *
+ * A file can be created only in an open folder, so there must be a corresponding entry
+ * in the list of processes. If not, then the function returns CIFS_OPEN_ERROR.
+ *
+ * Just after creation of the file system, there is only one directory, the root, and it must be opened
+ * to create a file in it.
+ *
+ * If a file with the same name already exists in the current directory, it returns CIFS_DUPLICATE_ERROR.
+ *
+ * Otherwise:
+ *    - sets the folder/file's identifier to the current value of the next unique identifier from the superblock;
+ *      then it increments the next available value in the superblock (to prepare it for the next created file)
+ *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
+ *      that the block is taken
+ *    - creates an entry in the conflict resolution list for the corresponding in-memory registry entry
+ *      that includes a file descriptor and fills all information about the file in the registry (including
+ *      a backpointer to the parent directory that is the reference number of the block holding the file
+ *      descriptor of the current working directory)
+ *    - copies the local file descriptor to the disk block that was found to be free (the one that will hold
+ *      the on-volume file descriptor)
+ *    - copies the relevant block of the in-memory bitvector to the corresponding bitevector blocks on the volume
+ *
+ *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
+ *
+ */
+CIFS_ERROR cifsCreateFile(CIFS_NAME_TYPE filePath, CIFS_CONTENT_TYPE type)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	cifsJournalBegin();
+	pthread_rwlock_wrlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = cifsCreateEntry(filePath, type);
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+	cifsJournalEnd();
+
+	cifsStatsRecord(CIFS_STATS_CREATE_FILE, started);
+	return error;
+}
+
+/***
+ *
+ * Creates the file or folder (see cifsCreateFile()); the caller holds the namespace lock exclusively.
+ *
+ */
+static CIFS_ERROR cifsCreateEntry(const char* filePath, CIFS_CONTENT_TYPE type)
+{
+
+    // the holding folder must exist
+    CIFS_NAME_TYPE name;
+    CIFS_REGISTRY_ENTRY_TYPE* parent = cifsResolveParent(filePath, name);
+    if (parent == NULL) return CIFS_NOT_FOUND_ERROR;
+    if (cifsRegistryFind(parent->fileDescriptor.file_block_ref, name))
+        return CIFS_DUPLICATE_ERROR;
+
+    // find free block
+    CIFS_INDEX_TYPE freeBlk = cifsAllocateBlock();
+    if (freeBlk == CIFS_INVALID_INDEX) return CIFS_ALLOC_ERROR;
+
+    // info for desc
+    CIFS_FILE_DESCRIPTOR_TYPE fDesc;
+    memset(&fDesc, 0, sizeof(fDesc));
+    pthread_mutex_lock(&cifsContext->bitvectorLock); // also guards the superblock
+    fDesc.identifier               = cifsContext->superblock->cifsNextUniqueIdentifier++;
+    pthread_mutex_unlock(&cifsContext->bitvectorLock);
+    fDesc.type                     = type;
+    strcpy(fDesc.name, name);
+    time(&fDesc.creationTime);
+    fDesc.lastAccessTime           = fDesc.creationTime;
+    fDesc.lastModificationTime     = fDesc.creationTime;
+    fDesc.accessRights             = 0666;
+    fDesc.owner                    = getuid();
+    fDesc.size                     = 0;
+    fDesc.block_ref                = CIFS_INVALID_INDEX;
+    fDesc.parent_block_ref         = parent->fileDescriptor.file_block_ref;
+    fDesc.file_block_ref           = freeBlk;
+
+    // link the descriptor into the parent's index; this also saves the parent's descriptor
+    CIFS_ERROR err = cifsAddToFolder(&parent->fileDescriptor, freeBlk);
+    if (err != CIFS_NO_ERROR) {
+        cifsReleaseBlock(freeBlk);
+        return err;
+    }
+
+    // descriptor block
+    cifsWriteFileDescriptor(&fDesc);
+
+    if (!addToHashTable(parent->fileDescriptor.file_block_ref, &fDesc)) {
+        // take the descriptor out of the folder again, so the volume does not list a file the registry lacks
+        cifsRemoveFromFolder(&parent->fileDescriptor, freeBlk);
+        cifsReleaseBlock(freeBlk);
+        writeBvSb();
+        return CIFS_ALLOC_ERROR;
+    }
+
+    // update superblock and bitvector
+    writeBvSb();
+
+    return CIFS_NO_ERROR;
+
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * 
+ * Deletes a file from the filesystem
+ * 
+ * Hashes the file nameto check if the file is in the registry, if not, return CIFS_NOT_FOUND_ERROR
+ * 
+ * If the file is found, but the reference count is non-zero (that means a process has the file opened),
+ * then return CIFS_IN_USE_ERROR
+ * 
+ * Otherwise,
+ * - if it is a non-empty folder, return CIFS_NOT_EMPTY_ERROR
+ * - check if process owner has write permission to file or folder, if not, return CIFS_ACCESS_ERROR
+ * - free all blocks belonging to the file by flipping the correpsonding bits in the in-memory bitvector
+ *    - data blocks, index block(s), file descriptor block
+ *    - note, you don't have to clear the data
+ * - clear the entry in the parent folder's index
+ * - decrement the size of the parent's folder
+ * - write the parent folder's file descriptor and index block to the disk
+ *    - update the in-memory registry with the new information
+ * - write the bitvector to the volume
+ * 
+*/
+CIFS_ERROR cifsDeleteFile(CIFS_NAME_TYPE filePath)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	cifsJournalBegin();
+	pthread_rwlock_wrlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = cifsDeleteEntry(filePath);
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+	cifsJournalEnd();
+
+	cifsStatsRecord(CIFS_STATS_DELETE_FILE, started);
+	return error;
+}
+
+/***
+ *
+ * Deletes the file or folder (see cifsDeleteFile()); the caller holds the namespace lock exclusively.
+ *
+ */
+static CIFS_ERROR cifsDeleteEntry(const char* filePath)
+{
+
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsResolvePath(filePath);
+	if (entry == NULL)
+		return CIFS_NOT_FOUND_ERROR;
+
+	if (entry->referenceCount != 0)
+		return CIFS_IN_USE_ERROR;
+
+	CIFS_FILE_DESCRIPTOR_TYPE* fd = &entry->fileDescriptor;
+	if (fd->type == CIFS_FOLDER_CONTENT_TYPE && fd->size != 0)
+		return CIFS_NOT_EMPTY_ERROR;
+
+	if (fd->parent_block_ref == CIFS_INVALID_INDEX) // the root cannot be deleted
+		return CIFS_ACCESS_ERROR;
+
+	if (!(cifsGrantedAccessRights(fd) & S_IWUSR))
+		return CIFS_ACCESS_ERROR;
+
+	// free the data and index blocks (in the background if there is a reclaimer), and then the descriptor block
+	cifsReclaimChain(fd->block_ref);
+	cifsReleaseBlock(fd->file_block_ref);
+
+	// unlink the file from the parent folder; this also saves the parent's descriptor
+	CIFS_REGISTRY_ENTRY_TYPE* parent = cifsContext->handles[entry->parentFileHandle];
+	cifsRemoveFromFolder(&parent->fileDescriptor, fd->file_block_ref);
+
+	cifsRegistryRemove(entry);
+
+	writeBvSb();
+
+	return CIFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Opens a file for reading or writing.
+ *
+ * If the file is not found in the in-memory registry, then the function returns CIFS_NOT_FOUND_ERROR (since only
+ * existing files can be opened).
+ *
+ * Checks if the file is already open by any process by examining the list of processes in the context.
+ * If so, then the function returns CIFS_OPEN_ERROR.
+ *
+ * Otherwise, a check is made whether the user can be granted the desired access. For that the file descriptor
+ * that holds the user id of the owner and the file access rights must be examined and compared with the user id
+ * of the owner of the process calling this function (available in the FUSE context) and the desired access passed
+ * in the parameter. If the user is not granted the desired access, then the function returns CIFS_ACCESS_ERROR.
+ *
+ * Otherwise, an entry for the process is added to the list of processes with the file handle and the granted
+ * access rights for the process. Each access to the file (read, write, get info) will need to verify that
+ * the requested operation is allowed for the requesting user.
+ *
+ * Finally, the function increments the reference count for the file, sets the output parameter to the handle
+ * for the file and returns CIFS_NO_ERROR.
+ *
+ */
+CIFS_ERROR cifsOpenFile(CIFS_NAME_TYPE filePath, mode_t desiredAccessRights, CIFS_FILE_HANDLE_TYPE *fileHandle)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	pthread_mutex_lock(&cifsContext->processLock);
+	CIFS_ERROR error = cifsOpenEntry(filePath, desiredAccessRights, fileHandle);
+	pthread_mutex_unlock(&cifsContext->processLock);
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+
+	cifsStatsRecord(CIFS_STATS_OPEN_FILE, started);
+	return error;
+}
+
+/***
+ *
+ * Opens the file (see cifsOpenFile()); the caller holds the namespace lock and the process lock.
+ *
+ */
+static CIFS_ERROR cifsOpenEntry(const char* filePath, mode_t desiredAccessRights, CIFS_FILE_HANDLE_TYPE* fileHandle)
+{
+
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsResolvePath(filePath);
+	if (entry == NULL)
+		return CIFS_NOT_FOUND_ERROR;
+
+	// a non-zero reference count means that some process holds the file open
+	if (entry->referenceCount != 0)
+		return CIFS_OPEN_ERROR;
+
+	mode_t granted = cifsGrantedAccessRights(&entry->fileDescriptor);
+	if ((desiredAccessRights & S_IRWXU) & ~granted)
+		return CIFS_ACCESS_ERROR;
+
+	// find the process in the process table, or add it if this is its first open file
+	CIFS_PROCESS_CONTROL_BLOCK_TYPE* pcb = cifsFindProcess(fuseContext->pid, 1);
+	if (pcb == NULL)
+		return CIFS_ALLOC_ERROR;
+
+	if (pcb->openFileCount == pcb->openFileCapacity)
+	{
+		int capacity = pcb->openFileCapacity == 0 ? 8 : 2 * pcb->openFileCapacity;
+		OPEN_FILE_TYPE** openFiles = realloc(pcb->openFiles, (size_t)capacity * sizeof(*openFiles));
+		if (openFiles == NULL)
+		{
+			if (pcb->openFileCount == 0)
+				cifsReleaseProcess(pcb);
+			return CIFS_ALLOC_ERROR;
+		}
+		pcb->openFiles = openFiles;
+		pcb->openFileCapacity = capacity;
+	}
+
+	OPEN_FILE_TYPE* openFile = cifsSlabAlloc(&cifsContext->openFileSlab);
+	if (openFile == NULL)
+	{
+		if (pcb->openFileCount == 0)
+			cifsReleaseProcess(pcb);
+		return CIFS_ALLOC_ERROR;
+	}
+	openFile->identifier = entry->fileDescriptor.identifier;
+	openFile->fileHandle = entry->fileDescriptor.file_block_ref;
+	openFile->processAccessRights = desiredAccessRights & S_IRWXU;
+	openFile->process = pcb;
+	openFile->slot = pcb->openFileCount;
+	pcb->openFiles[pcb->openFileCount++] = openFile;
+
+	entry->openFile = openFile;
+	entry->referenceCount++;
+	*fileHandle = openFile->fileHandle;
+
+	return CIFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * The function closes the file with the specified file handle for a specific process (obtained through
+ * the FUSE context).
+ *
+ * If the process does not have the file with the passed file handle opened (i.e., it is not an element
+ * of the process list with the file passed handle), then the function returns CIFS_ACCESS_ERROR.
+ *
+ * Removes the entry for the process and the file from the list of processes, and then decreases the reference
+ * count for the file.
+ *
+ */
+CIFS_ERROR cifsCloseFile(CIFS_FILE_HANDLE_TYPE fileHandle)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	pthread_mutex_lock(&cifsContext->processLock);
+	CIFS_ERROR error = cifsCloseEntry(fileHandle);
+	pthread_mutex_unlock(&cifsContext->processLock);
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+
+	cifsStatsRecord(CIFS_STATS_CLOSE_FILE, started);
+	return error;
+}
+
+/***
+ *
+ * Closes the file (see cifsCloseFile()); the caller holds the namespace lock and the process lock.
+ *
+ */
+static CIFS_ERROR cifsCloseEntry(CIFS_FILE_HANDLE_TYPE fileHandle)
+{
+
+	OPEN_FILE_TYPE* openFile = cifsFindOpenFile(fileHandle);
+	if (openFile == NULL)
+		return CIFS_ACCESS_ERROR;
+
+	// the last open file of the process takes the slot of the closed one
+	CIFS_PROCESS_CONTROL_BLOCK_TYPE* pcb = openFile->process;
+	OPEN_FILE_TYPE* last = pcb->openFiles[--pcb->openFileCount];
+	pcb->openFiles[openFile->slot] = last;
+	last->slot = openFile->slot;
+	cifsSlabFree(&cifsContext->openFileSlab, openFile);
+
+	// the process no longer interacts with cifs once its last file is closed
+	if (pcb->openFileCount == 0)
+		cifsReleaseProcess(pcb);
+
+	// the block map is only kept while the file is open
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[fileHandle];
+	entry->openFile = NULL;
+	if (--entry->referenceCount == 0)
+	{
+		pthread_rwlock_wrlock(&entry->lock);
+		cifsDropBlockMap(entry);
+		pthread_rwlock_unlock(&entry->lock);
+	}
+
+	return CIFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Finds the file in the in-memory registry and obtains the information about the file from the file descriptor
+ * block referenced from the registry.
+ *
+ * If the file is not found, then it returns CIFS_NOT_FOUND_ERROR
+ *
+ */
+CIFS_ERROR cifsGetFileInfo(CIFS_NAME_TYPE filePath, CIFS_FILE_DESCRIPTOR_TYPE* infoBuffer)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	// the registry holds a copy of every descriptor, so no blocks are read
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsResolvePath(filePath);
+	if (entry != NULL)
+	{
+		pthread_rwlock_rdlock(&entry->lock);
+		*infoBuffer = entry->fileDescriptor;
+		pthread_rwlock_unlock(&entry->lock);
+	}
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+
+	cifsStatsRecord(CIFS_STATS_GET_FILE_INFO, started);
+	return entry != NULL ? CIFS_NO_ERROR : CIFS_NOT_FOUND_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
+ *
+ * The file must be opened by the process trying to write, so the process must have a file handle of the file
+ * while attempting this operation.
+ *
+ * Otherwise, it checks the access rights for writing by examining the entry for the process and the file
+ * in the list of processes. If the process owner (from the fuse context) is not allowed
+ * to write to the file, then the function returns CIFS_ACCESS_ERROR.
+ *
+ * Then, the function calculates the space needed for the new content and checks if the write buffer can fit into
+ * the remaining free space in the file system. If not, then the CIFS_ALLOC_ERROR is returned.
+ *
+ * Otherwise, the function:
+ *    - acquires as many new blocks as needed to hold the new content modifying the corresponding bits in
+ *      the in-memory bitvector,
+ *    - copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
+ *      new just acquired blocks,
+ *    - copies any modified block of the in-memory bitvector to the corresponding bitvector block on the disk.
+ *
+ * If the new content has been written successfully, the function then removes all blocks currently held by
+ * this file and modifies the file descriptor to reflect the new location, the new size of the file, and the new
+ * times of last modification and access.
+ *
+ * This order of actions prevents file corruption, since in case of any error with writing new content, the file's
+ * old version is intact. This technique is called copy-on-write and is an alternative to journalling.
+ *
+ * Copying is done at the granularity of blocks (see cifsCopyOnWrite()): data blocks whose content does not
+ * change are kept, so rewriting a file with a small change costs a few block writes.
+ *
+ * The content of the in-memory file descriptor must be replaced by the new data.
+ *
+ * The function returns CIFS_WRITE_ERROR in response to exception not specified earlier.
+ *
+ */
+CIFS_ERROR cifsWriteFile(CIFS_FILE_HANDLE_TYPE fileHandle, char* writeBuffer)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	cifsJournalBegin();
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = CIFS_ACCESS_ERROR;
+	if (cifsOpenFileAccessRights(fileHandle) & S_IWUSR)
+	{
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[fileHandle];
+		pthread_rwlock_wrlock(&entry->lock);
+		error = cifsCopyOnWrite(entry, writeBuffer, strlen(writeBuffer), 0, 1);
+		pthread_rwlock_unlock(&entry->lock);
+	}
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+	cifsJournalEnd();
+
+	cifsStatsRecord(CIFS_STATS_WRITE_FILE, started);
+	return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * The function returns the complete content of the file to the caller through the parameter readBuffer.
+ *
+ * The file must be opened by the process trying to read, so the process must have a file handle of the file
+ * while attempting this operation.
+ *
+ * Otherwise, it checks the access rights for reading by examining the entry for the process and the file
+ * in the list of processes. If the process owner is not allowed to read from the file, then the function
+ * returns CIFS_ACCESS_ERROR.
+ *
+ * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
+ * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
+ * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
+ * the concatenated content.
+ *
+ * The function returns CIFS_READ_ERROR in response to exception not specified earlier.
+ *
+ */
+CIFS_ERROR cifsReadFile(CIFS_FILE_HANDLE_TYPE fileHandle, char** readBuffer)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = CIFS_ACCESS_ERROR;
+	if (cifsOpenFileAccessRights(fileHandle) & S_IRUSR)
+	{
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[fileHandle];
+		pthread_rwlock_rdlock(&entry->lock);
+		error = cifsReadContent(&entry->fileDescriptor, readBuffer);
+		pthread_rwlock_unlock(&entry->lock);
+	}
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+
+	cifsStatsRecord(CIFS_STATS_READ_FILE, started);
+	return error;
+}
+
+/***
+ *
+ * Reads the whole content of the file (see cifsReadFile()); the caller holds the file's lock.
+ *
+ */
+static CIFS_ERROR cifsReadContent(const CIFS_FILE_DESCRIPTOR_TYPE* fd, char** readBuffer)
+{
+	if (fd->type != CIFS_FILE_CONTENT_TYPE)
+		return CIFS_READ_ERROR;
+
+	char* content = malloc(fd->size + 1);
+	if (content == NULL)
+		return CIFS_ALLOC_ERROR;
+
+	size_t copied;
+	CIFS_ERROR error = cifsReadRange(fd, NULL, content, fd->size, 0, &copied);
+	if (error == CIFS_NO_ERROR && copied != fd->size)
+		error = CIFS_READ_ERROR;
+	if (error != CIFS_NO_ERROR)
+	{
+		free(content);
+		return error;
+	}
+
+	content[copied] = '\0';
+	*readBuffer = content;
+
+	return CIFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * The function reads up to size bytes of the file starting at offset into the buffer, and passes the
+ * number of bytes read back through the parameter bytesRead; it is less than size only at the end of the
+ * file, and 0 if the offset is at or past the end.
+ *
+ * The file must be opened by the process for reading, as for cifsReadFile(). The content is copied as
+ * it is, so it may hold any binary data, and nothing is appended to it.
+ *
+ * Only the blocks that overlap the requested range are read: the index chain is followed to the index
+ * block of the first requested data block, and then the data blocks of the range are read in one batch
+ * for each index block. While the reads of the file follow each other, the following data blocks are
+ * prefetched into the block cache (see cifsReadAhead()).
+ *
+ * The function returns CIFS_READ_ERROR in response to exception not specified earlier.
+ *
+ */
+CIFS_ERROR cifsPread(CIFS_FILE_HANDLE_TYPE fileHandle, void* buffer, size_t size, size_t offset, size_t* bytesRead)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = CIFS_ACCESS_ERROR;
+	if (cifsOpenFileAccessRights(fileHandle) & S_IRUSR)
+	{
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[fileHandle];
+		pthread_rwlock_rdlock(&entry->lock);
+		const CIFS_BLOCK_MAP_TYPE* map = cifsEntryBlockMap(entry);
+		error = cifsReadRange(&entry->fileDescriptor, map, buffer, size, offset, bytesRead);
+		if (error == CIFS_NO_ERROR)
+			cifsReadAhead(entry, map, offset, *bytesRead);
+		pthread_rwlock_unlock(&entry->lock);
+	}
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+
+	cifsStatsRecord(CIFS_STATS_PREAD, started);
+	return error;
+}
+
+/***
+ *
+ * Reads a range of the file (see cifsPread()); the caller holds the file's lock.
+ *
+ * With the block map of the file, the data blocks of the range are read directly; without it (NULL), the
+ * index chain is followed.
+ *
+ */
+static CIFS_ERROR cifsReadRange(const CIFS_FILE_DESCRIPTOR_TYPE* fd, const CIFS_BLOCK_MAP_TYPE* map, void* buffer,
+								size_t size, size_t offset, size_t* bytesRead)
+{
+	*bytesRead = 0;
+	if (fd->type != CIFS_FILE_CONTENT_TYPE)
+		return CIFS_READ_ERROR;
+	if (offset >= fd->size || size == 0)
+		return CIFS_NO_ERROR;
+
+	size_t end = size < fd->size - offset ? offset + size : fd->size;
+	if (fd->inlined)
+	{
+		if (fd->size > CIFS_INLINE_SIZE)
+			return CIFS_READ_ERROR;
+
+		// the descriptor block is the only one
+		CIFS_BLOCK_TYPE block;
+		cifsReadBlock((unsigned char*)&block, fd->file_block_ref);
+		memcpy(buffer, block.content.inlineFile.data + offset, end - offset);
+		*bytesRead = end - offset;
+		return CIFS_NO_ERROR;
+	}
+
+	unsigned int firstBlock = offset / CIFS_DATA_SIZE;
+	unsigned int lastBlock = (end - 1) / CIFS_DATA_SIZE;
+	unsigned int perIndexBlock = CIFS_INDEX_SIZE - 1;
+
+	// the data blocks of each index block are read in one batch
+	unsigned int batch = lastBlock - firstBlock + 1 < perIndexBlock ? lastBlock - firstBlock + 1 : perIndexBlock;
+	CIFS_BLOCK_TYPE* dataBlocks = malloc(batch * sizeof(CIFS_BLOCK_TYPE));
+	if (dataBlocks == NULL)
+		return CIFS_ALLOC_ERROR;
+	unsigned char* buffers[CIFS_INDEX_SIZE]; // and the next index block
+	for (unsigned int i = 0; i < batch; i++)
+		buffers[i] = (unsigned char*)&dataBlocks[i];
+
+	// skip the index blocks in front of the range
+	CIFS_INDEX_TYPE indexRef = fd->block_ref;
+	CIFS_BLOCK_TYPE indexBlock;
+	CIFS_BLOCK_TYPE nextIndexBlock;
+	int indexRead = 0; // indexBlock already holds the block of indexRef
+	for (unsigned int k = 0; map == NULL && k < firstBlock / perIndexBlock && indexRef != CIFS_INVALID_INDEX; k++)
+	{
+		cifsReadBlock((unsigned char*)&indexBlock, indexRef);
+		indexRef = indexBlock.content.index[CIFS_INDEX_SIZE - 1];
+	}
+
+	unsigned char* target = buffer;
+	unsigned int block = firstBlock;
+	while (block <= lastBlock && (map != NULL ? block < map->dataBlocks : indexRef != CIFS_INVALID_INDEX))
+	{
+		unsigned int slot = block % perIndexBlock;
+		unsigned int count = lastBlock - block + 1 < perIndexBlock - slot ? lastBlock - block + 1 : perIndexBlock - slot;
+		if (map != NULL)
+		{
+			if (count > map->dataBlocks - block)
+				count = map->dataBlocks - block;
+			cifsReadBlocks(map->data + block, buffers, count);
+		}
+		else
+		{
+			if (!indexRead)
+				cifsReadBlock((unsigned char*)&indexBlock, indexRef);
+
+			// the next index block of the chain comes in the same batch as the data blocks
+			CIFS_INDEX_TYPE blockNumbers[CIFS_INDEX_SIZE];
+			memcpy(blockNumbers, indexBlock.content.index + slot, count * sizeof(CIFS_INDEX_TYPE));
+			indexRef = indexBlock.content.index[CIFS_INDEX_SIZE - 1];
+			indexRead = block + count <= lastBlock && indexRef != CIFS_INVALID_INDEX;
+			if (indexRead)
+			{
+				blockNumbers[count] = indexRef;
+				buffers[count] = (unsigned char*)&nextIndexBlock;
+			}
+			cifsReadBlocks(blockNumbers, buffers, count + indexRead);
+			if (indexRead)
+			{
+				indexBlock = nextIndexBlock;
+				if (count < batch)
+					buffers[count] = (unsigned char*)&dataBlocks[count]; // a data block of the next batch
+			}
+		}
+
+		for (unsigned int i = 0; i < count; i++, block++)
+		{
+			size_t blockStart = (size_t)block * CIFS_DATA_SIZE;
+			size_t from = offset > blockStart ? offset : blockStart;
+			size_t to = end < blockStart + CIFS_DATA_SIZE ? end : blockStart + CIFS_DATA_SIZE;
+			memcpy(target + (from - offset), dataBlocks[i].content.data + (from - blockStart), to - from);
+		}
+	}
+	free(dataBlocks);
+
+	if (block <= lastBlock)
+		return CIFS_READ_ERROR; // the index chain is shorter than the size of the file
+
+	*bytesRead = end - offset;
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Prefetches the data blocks following a read of the file that starts where the previous one ended; the
+ * caller holds the file's lock for reading.
+ *
+ * The first sequential read prefetches CIFS_READ_AHEAD_MIN blocks. When the reads come within half a window
+ * of the end of the prefetched blocks, the window doubles (up to CIFS_READ_AHEAD_MAX) and is refilled, so a
+ * long sequential read finds its blocks in the cache and the device gets few large batches. A read anywhere
+ * else closes the window.
+ *
+ */
+static void cifsReadAhead(CIFS_REGISTRY_ENTRY_TYPE* entry, const CIFS_BLOCK_MAP_TYPE* map, size_t offset,
+						  size_t length)
+{
+	size_t previous = __atomic_exchange_n(&entry->readAheadOffset, offset + length, __ATOMIC_RELAXED);
+	if (map == NULL || length == 0)
+		return;
+
+	if (offset != previous)
+	{
+		__atomic_store_n(&entry->readAheadWindow, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->readAheadEnd, 0, __ATOMIC_RELAXED);
+		return;
+	}
+
+	unsigned int next = (offset + length - 1) / CIFS_DATA_SIZE + 1; // the first block not read yet
+	unsigned int window = __atomic_load_n(&entry->readAheadWindow, __ATOMIC_RELAXED);
+	unsigned int end = __atomic_load_n(&entry->readAheadEnd, __ATOMIC_RELAXED);
+	if (end < next)
+		end = next;
+	if (end >= map->dataBlocks || (window > 0 && end - next >= window / 2))
+		return; // nothing left to prefetch, or enough of it ahead of the reads
+
+	window = window == 0 ? CIFS_READ_AHEAD_MIN : window * 2 < CIFS_READ_AHEAD_MAX ? window * 2 : CIFS_READ_AHEAD_MAX;
+	unsigned int last = next + window < map->dataBlocks ? next + window : map->dataBlocks;
+	if (last > end)
+		cifsPrefetchBlocks(map->data + end, last - end);
+
+	__atomic_store_n(&entry->readAheadWindow, window, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->readAheadEnd, last, __ATOMIC_RELAXED);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * The function describes up to size bytes of the file starting at offset without copying them: the read vector
+ * passed back through the parameter vector points at the data of the blocks held in the block cache, one entry
+ * per block. The vector must be released with cifsReleaseReadVector(). Nothing holds a block of a mapped volume,
+ * which may be freed and reused as soon as the file's lock is released, so there the vector keeps a copy.
+ *
+ * The file must be opened by the process for reading, as for cifsPread(). A vector describes at most
+ * CIFS_READ_VECTOR_BLOCKS data blocks, and fewer while other vectors hold many cache slots, so its length may
+ * be less than size before the end of the file; it is 0 if the offset is at or past the end.
+ *
+ * The function returns CIFS_IN_USE_ERROR if other vectors hold all slots that may be held, CIFS_ALLOC_ERROR if
+ * there is no memory for the vector or for loading its blocks, and CIFS_READ_ERROR in response to exception not
+ * specified earlier.
+ *
+ */
+CIFS_ERROR cifsPreadv(CIFS_FILE_HANDLE_TYPE fileHandle, size_t size, size_t offset, CIFS_READ_VECTOR_TYPE** vector)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	*vector = NULL;
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = CIFS_ACCESS_ERROR;
+	if (cifsOpenFileAccessRights(fileHandle) & S_IRUSR)
+	{
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[fileHandle];
+		pthread_rwlock_rdlock(&entry->lock);
+		const CIFS_BLOCK_MAP_TYPE* map = cifsEntryBlockMap(entry);
+		error = cifsVectorRange(&entry->fileDescriptor, map, size, offset, vector);
+		if (error == CIFS_NO_ERROR)
+			cifsReadAhead(entry, map, offset, (*vector)->length);
+		pthread_rwlock_unlock(&entry->lock);
+	}
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+
+	return error;
+}
+
+/***
+ *
+ * Builds the read vector of a range of the file (see cifsPreadv()); the caller holds the file's lock.
+ *
+ */
+static CIFS_ERROR cifsVectorRange(const CIFS_FILE_DESCRIPTOR_TYPE* fd, const CIFS_BLOCK_MAP_TYPE* map, size_t size,
+								  size_t offset, CIFS_READ_VECTOR_TYPE** vector)
+{
+	if (fd->type != CIFS_FILE_CONTENT_TYPE || (fd->inlined && fd->size > CIFS_INLINE_SIZE))
+		return CIFS_READ_ERROR;
+
+	size_t end = offset >= fd->size ? offset : size < fd->size - offset ? offset + size : fd->size;
+	unsigned int firstBlock = offset / CIFS_DATA_SIZE;
+	unsigned int count = 0;
+	if (end > offset && !fd->inlined)
+	{
+		if (map == NULL)
+			return CIFS_ALLOC_ERROR;
+
+		count = (end - 1) / CIFS_DATA_SIZE - firstBlock + 1;
+		if (count > CIFS_READ_VECTOR_BLOCKS)
+			count = CIFS_READ_VECTOR_BLOCKS;
+		if (firstBlock + count > map->dataBlocks)
+			return CIFS_READ_ERROR; // the index chain is shorter than the size of the file
+	}
+
+	unsigned int entries = fd->inlined ? 1 : count;
+	size_t copySize = cifsVolumeMap != NULL && !fd->inlined ? (size_t)count * CIFS_DATA_SIZE : 0;
+	CIFS_READ_VECTOR_TYPE* v = malloc(sizeof *v + entries * (sizeof(struct iovec) + sizeof(int)) + copySize);
+	if (v == NULL)
+		return CIFS_ALLOC_ERROR;
+	v->iov = (struct iovec*)(v + 1);
+	v->slots = (int*)(v->iov + entries);
+	unsigned char* copy = (unsigned char*)(v->slots + entries); // of the mapped blocks
+	v->count = 0;
+	v->length = 0;
+	v->cache = NULL;
+	*vector = v;
+	if (end <= offset)
+		return CIFS_NO_ERROR;
+
+	if (fd->inlined)
+	{
+		// too small to be worth holding the descriptor block, which the journal may also pin
+		CIFS_BLOCK_TYPE block;
+		cifsReadBlock((unsigned char*)&block, fd->file_block_ref);
+		memcpy(v->inlineData, block.content.inlineFile.data + offset, end - offset);
+		v->iov[0].iov_base = v->inlineData;
+		v->iov[0].iov_len = end - offset;
+		v->count = 1;
+		v->length = end - offset;
+		return CIFS_NO_ERROR;
+	}
+
+	CIFS_BLOCK_CACHE_TYPE* cache = cifsContext->blockCache;
+	if (cifsVolumeMap == NULL)
+	{
+		int held = cifsCacheHoldBlocks(cache, map->data + firstBlock, count, v->slots);
+		if (held <= 0)
+		{
+			free(v);
+			*vector = NULL;
+			return held < 0 ? CIFS_ALLOC_ERROR : CIFS_IN_USE_ERROR;
+		}
+		count = held;
+		v->cache = cache;
+	}
+
+	if (end > (size_t)(firstBlock + count) * CIFS_DATA_SIZE)
+		end = (size_t)(firstBlock + count) * CIFS_DATA_SIZE;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		size_t blockStart = (size_t)(firstBlock + i) * CIFS_DATA_SIZE;
+		size_t from = offset > blockStart ? offset : blockStart;
+		size_t to = end < blockStart + CIFS_DATA_SIZE ? end : blockStart + CIFS_DATA_SIZE;
+		if (v->cache != NULL)
+			v->iov[i].iov_base = cache->slots[v->slots[i]].content + offsetof(CIFS_BLOCK_TYPE, content.data)
+								 + (from - blockStart);
+		else
+		{
+			v->iov[i].iov_base = copy + (size_t)i * CIFS_DATA_SIZE;
+			memcpy(v->iov[i].iov_base, cifsGetBlockPtr(map->data[firstBlock + i])
+					+ offsetof(CIFS_BLOCK_TYPE, content.data) + (from - blockStart), to - from);
+		}
+		v->iov[i].iov_len = to - from;
+	}
+	v->count = count;
+	v->length = end - offset;
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Releases the cache slots held by a read vector of cifsPreadv(), and the vector itself.
+ *
+ */
+void cifsReleaseReadVector(CIFS_READ_VECTOR_TYPE* vector)
+{
+	if (vector == NULL)
+		return;
+
+	if (vector->cache != NULL)
+		cifsCacheReleaseSlots(vector->cache, vector->slots, vector->count);
+	free(vector);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * The function writes size bytes from the buffer into the file starting at offset; the buffer may hold
+ * any binary data.
+ *
+ * The file must be opened by the process for writing, as for cifsWriteFile(). The bytes outside of the
+ * range are kept. If the range ends past the end of the file, the file grows; if it starts past the end,
+ * the gap is filled with zeros.
+ *
+ * Only the blocks that overlap the range are written, and the file is never modified in place: the data blocks
+ * whose content changes are copied to new blocks together with the index blocks that refer to them, and the
+ * switch to the new blocks is the single write of the file descriptor (see cifsCopyOnWrite()). So, after a
+ * failure the file holds either the old or the new content; without a journal, that costs two synchronizations
+ * of the volume per write (see cifsWriteBarrier()).
+ *
+ * The function returns CIFS_ALLOC_ERROR if there is not enough free space for growing the file, and
+ * CIFS_WRITE_ERROR in response to exception not specified earlier.
+ *
+ */
+CIFS_ERROR cifsPwrite(CIFS_FILE_HANDLE_TYPE fileHandle, const void* buffer, size_t size, size_t offset)
+{
+	if (!cifsContext) return CIFS_SYSTEM_ERROR;
+
+	unsigned long long started = cifsStatsClock();
+	cifsJournalBegin();
+	pthread_rwlock_rdlock(&cifsContext->namespaceLock);
+	CIFS_ERROR error = CIFS_ACCESS_ERROR;
+	if (cifsOpenFileAccessRights(fileHandle) & S_IWUSR)
+	{
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[fileHandle];
+		pthread_rwlock_wrlock(&entry->lock);
+		error = cifsCopyOnWrite(entry, buffer, size, offset, 0);
+		pthread_rwlock_unlock(&entry->lock);
+	}
+	pthread_rwlock_unlock(&cifsContext->namespaceLock);
+	cifsJournalEnd();
+
+	cifsStatsRecord(CIFS_STATS_PWRITE, started);
+	return error;
+}
+
+/***
+ *
+ * Returns the next block of a set of runs taken by cifsAllocateExtents(); extent and position track how far
+ * the runs have been used.
+ *
+ */
+static CIFS_INDEX_TYPE cifsNextExtentBlock(const CIFS_EXTENT_TYPE* extents, int* extent, unsigned int* position)
+{
+	CIFS_INDEX_TYPE blockNumber = extents[*extent].start + *position;
+	if (++*position == extents[*extent].length)
+	{
+		(*extent)++;
+		*position = 0;
+	}
+
+	return blockNumber;
+}
+
+/***
+ *
+ * Makes a data block of the new content of the file: the old block (or zeros for a new one), cut at the new
+ * size of the file, with the bytes of the written range [offset, end) copied over it.
+ *
+ */
+static void cifsComposeBlock(CIFS_BLOCK_TYPE* block, unsigned int logicalBlock, size_t newSize,
+							 const unsigned char* source, size_t offset, size_t end)
+{
+	size_t blockStart = (size_t)logicalBlock * CIFS_DATA_SIZE;
+	if (newSize < blockStart + CIFS_DATA_SIZE)
+		memset(block->content.data + (newSize - blockStart), 0, blockStart + CIFS_DATA_SIZE - newSize);
+
+	size_t from = offset > blockStart ? offset : blockStart;
+	size_t to = end < blockStart + CIFS_DATA_SIZE ? end : blockStart + CIFS_DATA_SIZE;
+	if (from < to)
+		memcpy(block->content.data + (from - blockStart), source + (from - offset), to - from);
+	block->type = CIFS_DATA_CONTENT_TYPE;
+}
+
+/***
+ *
+ * Writes the range [offset, offset + size) of the file from the buffer by copy-on-write at the granularity of
+ * blocks; with truncate, the file ends at the end of the range. The caller holds the file's lock exclusively.
+ *
+ * The data blocks overlapping the range are composed and compared with their old content; only those that
+ * change, and the new ones when the file grows, are written to newly allocated blocks. An index block is
+ * copied if it refers to a copied data block, or its list or link changes; since the chain is linked from the
+ * front, all index blocks in front of the last copied one are copied as well, and the rest of the chain is kept.
+ *
+ * The new blocks are written before the descriptor, whose single block write switches the file to the new
+ * chain; only then are the replaced blocks released. So, until the descriptor is written, the old content is
+ * intact on the volume. The block cache may write the blocks back in any order, so the journal commits them
+ * together (see cifsJournalWrite()); without one, the volume is synchronized before the descriptor is written
+ * and before the replaced blocks may be reused.
+ *
+ * The block map of the file follows the new blocks; it is dropped if the number of blocks changes.
+ *
+ * Content of at most CIFS_INLINE_SIZE bytes is stored in the descriptor block instead (see cifsWriteInline());
+ * when inline content grows past that, it is moved to blocks together with the written range.
+ *
+ */
+static CIFS_ERROR cifsCopyOnWrite(CIFS_REGISTRY_ENTRY_TYPE* entry, const void* buffer, size_t size, size_t offset,
+								  int truncate)
+{
+	CIFS_FILE_DESCRIPTOR_TYPE* fd = &entry->fileDescriptor;
+	if (fd->type != CIFS_FILE_CONTENT_TYPE)
+		return CIFS_ACCESS_ERROR;
+	if (size == 0 && !truncate)
+		return CIFS_NO_ERROR;
+
+	size_t end = offset + size;
+	if (end < offset || end / CIFS_DATA_SIZE >= CIFS_NUMBER_OF_BLOCKS)
+		return CIFS_ALLOC_ERROR; // larger than the volume
+
+	size_t newSize = truncate || end > fd->size ? end : fd->size;
+	if (newSize <= CIFS_INLINE_SIZE)
+		return cifsWriteInline(entry, buffer, size, offset, newSize);
+	if (fd->inlined && !(truncate && offset == 0))
+	{
+		// the new content is written as a whole, starting with the inline bytes
+		unsigned char* merged = calloc(newSize, 1);
+		if (merged == NULL)
+			return CIFS_ALLOC_ERROR;
+		size_t kept;
+		CIFS_ERROR error = cifsReadRange(fd, NULL, merged, fd->size, 0, &kept);
+		if (error == CIFS_NO_ERROR)
+		{
+			memcpy(merged + offset, buffer, size);
+			error = cifsCopyOnWrite(entry, merged, newSize, 0, 1);
+		}
+		free(merged);
+		return error;
+	}
+
+	// the old blocks of the file (none if the content is inline)
+	CIFS_BLOCK_MAP_TYPE* map = entry->blockMap;
+	CIFS_BLOCK_MAP_TYPE* built = NULL;
+	if (map == NULL && (map = built = cifsBuildBlockMap(fd)) == NULL)
+		return CIFS_WRITE_ERROR;
+
+	unsigned int perIndexBlock = CIFS_INDEX_SIZE - 1;
+	unsigned int oldBlocks = map->dataBlocks;
+	unsigned int oldIndexBlocks = map->indexBlocks;
+	unsigned int newBlocks = (newSize + CIFS_DATA_SIZE - 1) / CIFS_DATA_SIZE;
+	unsigned int newIndexBlocks = (newBlocks + perIndexBlock - 1) / perIndexBlock;
+
+	// the blocks of the new content, and which of the data blocks are copied
+	CIFS_INDEX_TYPE* newData = malloc((newBlocks + newIndexBlocks) * sizeof(CIFS_INDEX_TYPE) + newBlocks + 1);
+	if (newData == NULL)
+	{
+		free(built);
+		return CIFS_ALLOC_ERROR;
+	}
+	CIFS_INDEX_TYPE* newIndex = newData + newBlocks;
+	unsigned char* copied = (unsigned char*)(newIndex + newIndexBlocks);
+	memset(copied, 0, newBlocks);
+
+	// find the data blocks that change; the gap between the old end and the range is filled with new blocks
+	const unsigned char* source = buffer;
+	unsigned int first = offset / CIFS_DATA_SIZE < oldBlocks ? offset / CIFS_DATA_SIZE : oldBlocks;
+	unsigned int limit = truncate ? newBlocks : (end - 1) / CIFS_DATA_SIZE + 1;
+	unsigned int copiedData = 0;
+	int lastCopiedIndex = -1;
+	CIFS_BLOCK_TYPE block, oldBlock;
+	for (unsigned int i = first; i < limit; i++)
+	{
+		if (i < oldBlocks)
+		{
+			cifsReadBlock((unsigned char*)&oldBlock, map->data[i]);
+			memcpy(&block, &oldBlock, sizeof(block));
+			cifsComposeBlock(&block, i, newSize, source, offset, end);
+			if (memcmp(&block, &oldBlock, sizeof(block)) == 0)
+				continue;
+		}
+		copied[i] = 1;
+		copiedData++;
+		lastCopiedIndex = i / perIndexBlock;
+	}
+	// a shorter file ends in a different index block, or with fewer entries in its last one
+	if (newBlocks < oldBlocks && newIndexBlocks > 0 && (int)newIndexBlocks - 1 > lastCopiedIndex)
+		lastCopiedIndex = newIndexBlocks - 1;
+
+	unsigned int needed = copiedData + (lastCopiedIndex + 1);
+	CIFS_EXTENT_TYPE* extents = NULL;
+	if (needed > 0)
+	{
+		int numberOfExtents;
+		extents = cifsAllocateExtents(needed, &numberOfExtents);
+		if (extents == NULL)
+		{
+			free(newData);
+			free(built);
+			return CIFS_ALLOC_ERROR;
+		}
+	}
+
+	// assign the new blocks in the order of the chain, so each copied index block is followed by the data
+	// blocks it refers to
+	int extent = 0;
+	unsigned int position = 0;
+	for (unsigned int k = 0; k < newIndexBlocks; k++)
+	{
+		newIndex[k] = (int)k <= lastCopiedIndex ? cifsNextExtentBlock(extents, &extent, &position) : map->index[k];
+		for (unsigned int i = k * perIndexBlock; i < newBlocks && i < (k + 1) * perIndexBlock; i++)
+			newData[i] = copied[i] ? cifsNextExtentBlock(extents, &extent, &position) : map->data[i];
+	}
+	free(extents);
+
+	// write the new blocks
+	for (unsigned int i = first; i < limit; i++)
+	{
+		if (!copied[i])
+			continue;
+		if (i < oldBlocks)
+			cifsReadBlock((unsigned char*)&block, map->data[i]);
+		else
+			memset(&block, 0, sizeof(block));
+		cifsComposeBlock(&block, i, newSize, source, offset, end);
+		cifsWriteBlock((const unsigned char*)&block, newData[i]);
+	}
+	for (int k = 0; k <= lastCopiedIndex; k++)
+	{
+		memset(&block, 0, sizeof(block));
+		block.type = CIFS_INDEX_CONTENT_TYPE;
+		for (int j = 0; j < CIFS_INDEX_SIZE; j++)
+		{
+			unsigned int i = k * perIndexBlock + j;
+			block.content.index[j] = j < CIFS_INDEX_SIZE - 1 && i < newBlocks ? newData[i] : CIFS_INVALID_INDEX;
+		}
+		if ((unsigned int)k + 1 < newIndexBlocks)
+			block.content.index[CIFS_INDEX_SIZE - 1] = newIndex[k + 1];
+		cifsWriteBlock((const unsigned char*)&block, newIndex[k]);
+	}
+	if (cifsWriteBarrier() != CIFS_NO_ERROR)
+	{
+		for (unsigned int i = first; i < limit; i++)
+			if (copied[i])
+				cifsReleaseBlock(newData[i]);
+		for (int k = 0; k <= lastCopiedIndex; k++)
+			cifsReleaseBlock(newIndex[k]);
+		writeBvSb();
+		free(newData);
+		free(built);
+		return CIFS_WRITE_ERROR;
+	}
+
+	// switch the file to the new blocks
+	fd->inlined = 0;
+	fd->block_ref = newIndexBlocks > 0 ? newIndex[0] : CIFS_INVALID_INDEX;
+	fd->size = newSize;
+	time(&fd->lastModificationTime);
+	fd->lastAccessTime = fd->lastModificationTime;
+	cifsWriteFileDescriptor(fd);
+
+	// and release the replaced ones, in the background if there is a reclaimer; if the switch may not be on
+	// the volume, they are left taken rather than reused
+	CIFS_ERROR error = cifsWriteBarrier();
+	CIFS_RECLAIM_ITEM_TYPE* reclaim = error == CIFS_NO_ERROR ? cifsReclaimItem(oldBlocks + oldIndexBlocks) : NULL;
+	int released = 0;
+	for (unsigned int i = 0; i < oldBlocks && error == CIFS_NO_ERROR; i++)
+		if (i >= newBlocks || copied[i])
+		{
+			if (reclaim != NULL)
+				reclaim->blocks[reclaim->count++] = map->data[i];
+			else
+			{
+				cifsReleaseBlock(map->data[i]);
+				released = 1;
+			}
+		}
+	for (unsigned int k = 0; k < oldIndexBlocks && error == CIFS_NO_ERROR; k++)
+		if ((int)k <= lastCopiedIndex || k >= newIndexBlocks)
+		{
+			if (reclaim != NULL)
+				reclaim->blocks[reclaim->count++] = map->index[k];
+			else
+			{
+				cifsReleaseBlock(map->index[k]);
+				released = 1;
+			}
+		}
+	if (reclaim != NULL)
+		cifsQueueReclaim(reclaim);
+
+	if (built == NULL && newBlocks == oldBlocks)
+	{
+		memcpy(map->data, newData, newBlocks * sizeof(CIFS_INDEX_TYPE));
+		memcpy(map->index, newIndex, newIndexBlocks * sizeof(CIFS_INDEX_TYPE));
+	}
+	else if (built == NULL)
+		cifsDropBlockMap(entry);
+	free(built);
+	free(newData);
+
+	if (needed > 0 || released)
+		writeBvSb();
+
+	return error;
+}
+
+/***
+ *
+ * Writes the range of the file like cifsCopyOnWrite() when the new size is at most CIFS_INLINE_SIZE: all of the
+ * content goes in the descriptor block, so the single write of that block switches the file to the new content,
+ * and the blocks that held the old one, if any, are released after it. The caller holds the file's lock
+ * exclusively.
+ *
+ */
+static CIFS_ERROR cifsWriteInline(CIFS_REGISTRY_ENTRY_TYPE* entry, const void* buffer, size_t size, size_t offset,
+								  size_t newSize)
+{
+	CIFS_FILE_DESCRIPTOR_TYPE* fd = &entry->fileDescriptor;
+	CIFS_BLOCK_TYPE block;
+	memset(&block, 0, sizeof(block));
+
+	// the old bytes that are kept; a gap in front of the range stays zeros
+	size_t kept = fd->size < newSize ? fd->size : newSize;
+	size_t bytesRead;
+	CIFS_ERROR error = cifsReadRange(fd, entry->blockMap, block.content.inlineFile.data, kept, 0, &bytesRead);
+	if (error != CIFS_NO_ERROR)
+		return error;
+	memcpy(block.content.inlineFile.data + offset, buffer, size);
+
+	CIFS_INDEX_TYPE oldChain = fd->block_ref;
+	fd->inlined = 1;
+	fd->block_ref = CIFS_INVALID_INDEX;
+	fd->size = newSize;
+	time(&fd->lastModificationTime);
+	fd->lastAccessTime = fd->lastModificationTime;
+	block.type = fd->type;
+	block.content.inlineFile.descriptor = *fd;
+	cifsWriteBlock((const unsigned char*)&block, fd->file_block_ref);
+
+	cifsDropBlockMap(entry);
+	if (oldChain != CIFS_INVALID_INDEX && cifsWriteBarrier() != CIFS_NO_ERROR)
+		return CIFS_WRITE_ERROR; // the old blocks are left taken
+	if (cifsReclaimChain(oldChain))
+		writeBvSb();
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Without a journal, writes all blocks held in the block cache to the volume and synchronizes it (or the mapped
+ * volume), so no block written after the call reaches the volume before them. With a journal, the commit orders
+ * the writes instead, and the function does nothing.
+ *
+ */
+static CIFS_ERROR cifsWriteBarrier(void)
+{
+	if (cifsContext->journal != NULL)
+		return CIFS_NO_ERROR;
+
+	if (cifsVolumeMap != NULL)
+		return msync(cifsVolumeMap, (size_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE, MS_SYNC) == 0
+			   ? CIFS_NO_ERROR : CIFS_WRITE_ERROR;
+
+	cifsFlushBlockCache(cifsContext->blockCache);
+	if (fflush(cifsVolume) != 0 || fdatasync(fileno(cifsVolume)) != 0)
+		return CIFS_WRITE_ERROR;
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Builds the block map of a file by reading its index chain; returns NULL if there is not enough memory or
+ * the chain is shorter than the size of the file.
+ *
+ */
+static CIFS_BLOCK_MAP_TYPE* cifsBuildBlockMap(const CIFS_FILE_DESCRIPTOR_TYPE* fd)
+{
+	unsigned int perIndexBlock = CIFS_INDEX_SIZE - 1;
+	unsigned int dataBlocks = fd->inlined ? 0 : (fd->size + CIFS_DATA_SIZE - 1) / CIFS_DATA_SIZE;
+	unsigned int indexBlocks = (dataBlocks + perIndexBlock - 1) / perIndexBlock;
+
+	CIFS_BLOCK_MAP_TYPE* map = malloc(sizeof(CIFS_BLOCK_MAP_TYPE)
+									  + (dataBlocks + indexBlocks) * sizeof(CIFS_INDEX_TYPE));
+	if (map == NULL)
+		return NULL;
+	map->dataBlocks = dataBlocks;
+	map->indexBlocks = indexBlocks;
+	map->index = map->data + dataBlocks;
+
+	CIFS_BLOCK_TYPE indexBlock;
+	CIFS_INDEX_TYPE indexRef = fd->block_ref;
+	for (unsigned int k = 0; k < indexBlocks; k++)
+	{
+		if (indexRef == CIFS_INVALID_INDEX)
+		{
+			free(map);
+			return NULL;
+		}
+		cifsReadBlock((unsigned char*)&indexBlock, indexRef);
+		map->index[k] = indexRef;
+
+		unsigned int count = dataBlocks - k * perIndexBlock < perIndexBlock ? dataBlocks - k * perIndexBlock : perIndexBlock;
+		memcpy(map->data + k * perIndexBlock, indexBlock.content.index, count * sizeof(CIFS_INDEX_TYPE));
+		indexRef = indexBlock.content.index[CIFS_INDEX_SIZE - 1];
+	}
+
+	return map;
+}
+
+/***
+ *
+ * Returns the block map of the file, building it on first use; NULL if it cannot be built, and the index chain
+ * has to be followed instead.
+ *
+ * The caller holds the file's lock, possibly shared with other readers; the first of them to build the map
+ * publishes it, and the others discard theirs.
+ *
+ */
+static const CIFS_BLOCK_MAP_TYPE* cifsEntryBlockMap(CIFS_REGISTRY_ENTRY_TYPE* entry)
+{
+	CIFS_BLOCK_MAP_TYPE* map = __atomic_load_n(&entry->blockMap, __ATOMIC_ACQUIRE);
+	if (map != NULL)
+		return map;
+
+	map = cifsBuildBlockMap(&entry->fileDescriptor);
+	if (map == NULL)
+		return NULL;
+
+	CIFS_BLOCK_MAP_TYPE* published = NULL;
+	if (!__atomic_compare_exchange_n(&entry->blockMap, &published, map, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		free(map);
+		return published;
+	}
+
+	return map;
+}
+
+/***
+ *
+ * Drops the block map of the file after its blocks changed; the caller holds the file's lock exclusively.
+ *
+ */
+static void cifsDropBlockMap(CIFS_REGISTRY_ENTRY_TYPE* entry)
+{
+	free(entry->blockMap);
+	entry->blockMap = NULL;
+	__atomic_store_n(&entry->readAheadEnd, 0, __ATOMIC_RELAXED); // the prefetched blocks may not be the file's anymore
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Instrumentation of the mounted volume
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Returns the monotonic time in nanoseconds.
+ *
+ */
+static unsigned long long cifsStatsClock(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (unsigned long long)time.tv_sec * 1000000000ULL + (unsigned long long)time.tv_nsec;
+}
+
+/***
+ *
+ * Counts a call of the operation that started at the given time (see cifsStatsClock()).
+ *
+ */
+static void cifsStatsRecord(CIFS_STATS_OPERATION operation, unsigned long long started)
+{
+	if (cifsContext == NULL) // the call unmounted the volume, or found it unmounted
+		return;
+
+	unsigned long long nanoseconds = cifsStatsClock() - started;
+	int bucket = 63 - __builtin_clzll(nanoseconds | 1);
+	if (bucket >= CIFS_STATS_BUCKETS)
+		bucket = CIFS_STATS_BUCKETS - 1;
+
+	CIFS_OPERATION_STATS_TYPE* stats = &cifsContext->stats.operations[operation];
+	__atomic_fetch_add(&stats->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->nanoseconds, nanoseconds, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->latency[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/***
+ *
+ * Copies the counters of the mounted volume into the given structure.
+ *
+ * The counters are loaded one at a time while other threads may be adding to them, so the snapshot is not
+ * a single instant; every counter in it is a value the counter actually had.
+ *
+ */
+CIFS_ERROR cifsGetStats(CIFS_STATS_TYPE* stats)
+{
+	_Static_assert(sizeof(CIFS_STATS_TYPE) % sizeof(unsigned long long) == 0,
+		"CIFS_STATS_TYPE must hold unsigned long long counters only");
+
+	if (cifsContext == NULL)
+		return CIFS_SYSTEM_ERROR;
+
+	const unsigned long long* counters = (const unsigned long long*)&cifsContext->stats;
+	unsigned long long* snapshot = (unsigned long long*)stats;
+	for (size_t i = 0; i < sizeof(CIFS_STATS_TYPE) / sizeof(unsigned long long); i++)
+		snapshot[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+
+	return CIFS_NO_ERROR;
+}
+
+static const char* cifsStatsOperationNames[CIFS_STATS_OPERATIONS] = {
+	[CIFS_STATS_CREATE_FILE] = "createFile",
+	[CIFS_STATS_DELETE_FILE] = "deleteFile",
+	[CIFS_STATS_OPEN_FILE] = "openFile",
+	[CIFS_STATS_CLOSE_FILE] = "closeFile",
+	[CIFS_STATS_GET_FILE_INFO] = "getFileInfo",
+	[CIFS_STATS_READ_FILE] = "readFile",
+	[CIFS_STATS_WRITE_FILE] = "writeFile",
+	[CIFS_STATS_PREAD] = "pread",
+	[CIFS_STATS_PWRITE] = "pwrite"
+};
+
+/***
+ *
+ * Renders a snapshot of the counters as the text of the virtual file CIFS_STATS_FILE_NAME.
+ *
+ * There is one "name value" line per volume counter, then one line per operation:
+ *
+ *     pread calls=12 nanoseconds=48213 latency=0,0,0,0,0,0,0,0,0,0,0,9,3,0,...
+ *
+ * where the latency list holds the CIFS_STATS_BUCKETS buckets of the histogram. The text is allocated and
+ * terminated with '\0'; the caller must free it.
+ *
+ */
+CIFS_ERROR cifsReadStatsFile(char** readBuffer)
+{
+	CIFS_STATS_TYPE stats;
+	if (cifsGetStats(&stats) != CIFS_NO_ERROR)
+		return CIFS_SYSTEM_ERROR;
+
+	// every number takes at most 20 digits and a separator
+	size_t capacity = 512 + CIFS_STATS_OPERATIONS * (64 + 3 * 21 + CIFS_STATS_BUCKETS * 21);
+	char* text = malloc(capacity);
+	if (text == NULL)
+		return CIFS_ALLOC_ERROR;
+
+	size_t length = (size_t)snprintf(text, capacity,
+		"blockReads %llu\n"
+		"blockWrites %llu\n"
+		"cacheHits %llu\n"
+		"cacheMisses %llu\n"
+		"prefetchedBlocks %llu\n"
+		"bitvectorScans %llu\n"
+		"bitvectorScanBits %llu\n"
+		"registryLookups %llu\n"
+		"registryProbes %llu\n",
+		stats.blockReads, stats.blockWrites, stats.cacheHits, stats.cacheMisses, stats.prefetchedBlocks,
+		stats.bitvectorScans, stats.bitvectorScanBits, stats.registryLookups, stats.registryProbes);
+
+	for (int operation = 0; operation < CIFS_STATS_OPERATIONS; operation++)
+	{
+		const CIFS_OPERATION_STATS_TYPE* op = &stats.operations[operation];
+		length += (size_t)snprintf(text + length, capacity - length, "%s calls=%llu nanoseconds=%llu latency=",
+			cifsStatsOperationNames[operation], op->calls, op->nanoseconds);
+		for (int bucket = 0; bucket < CIFS_STATS_BUCKETS; bucket++)
+			length += (size_t)snprintf(text + length, capacity - length, "%llu%c",
+				op->latency[bucket], bucket == CIFS_STATS_BUCKETS - 1 ? '\n' : ',');
+	}
+
+	*readBuffer = text;
+	return CIFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Functions to write and read block to and from block devices
+///
+//////////////////////////////////////////////////////////////////////////
+
+void cifsCheckIOError(const char* who, const char* what)
+{
+	int errCode = ferror(cifsVolume);
+	if (errCode == 0)
+		return;
+	CIFS_TRACE(CIFS_TRACE_ERROR, "%s: %s returned \"%s\"\n", who, what, strerror(errCode));
+	exit(errCode);
+}
+
+/***
+ *
+ * Reports a failed system call of the positional I/O (errno tells why) and exits, like cifsCheckIOError().
+ *
+ */
+void cifsIOError(const char* who, const char* what)
+{
+	int errCode = errno;
+	CIFS_TRACE(CIFS_TRACE_ERROR, "%s: %s returned \"%s\"\n", who, what, strerror(errCode));
+	exit(errCode);
+}
+
+void cifsPrintBlockContent(const unsigned char *str)
+{
+	for (int i=0; i < CIFS_BLOCK_SIZE; i++)
+		printf("0x%02x ", *(str + i));
+}
+
+/***
+ *
+ * Traces a block access at the CIFS_TRACE_IO level, and the block content at the CIFS_TRACE_BLOCK level.
+ *
+ * Callers should test CIFS_TRACE_ENABLED(CIFS_TRACE_IO) first, so nothing is called when tracing is off.
+ *
+ */
+void cifsTraceBlock(const char* who, CIFS_INDEX_TYPE blockNumber, size_t length, const unsigned char* content)
+{
+	printf("%-5s: POSITION=%6ld, LENGTH=%4ld", who, (long)blockNumber * CIFS_BLOCK_SIZE, length);
+	if (CIFS_TRACE_ENABLED(CIFS_TRACE_BLOCK))
+	{
+		printf(", CONTENT="); // %s will usually not work
+		cifsPrintBlockContent(content);
+	}
+	printf("\n");
+}
+
+/***
+ *
+ * Write a single block to the block device.
+ *
+ * While the file system is mounted, the block is only stored in the block cache and marked dirty;
+ * it is written to the volume when it is evicted or when the cache is flushed. With a journal, a metadata
+ * block is also logged in the running transaction.
+ *
+ */
+size_t cifsWriteBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber)
+{
+	if (cifsContext == NULL || cifsContext->blockCache == NULL)
+		return cifsDeviceWriteBlock(content, blockNumber);
+
+	CIFS_BLOCK_CACHE_TYPE* cache = cifsContext->blockCache;
+	pthread_mutex_lock(&cache->lock);
+	int slot;
+	for (;;)
+	{
+		slot = cifsCacheLookup(cache, blockNumber);
+		if (slot >= 0 && (cache->slots[slot].loading || cache->slots[slot].writing))
+		{
+			// the content must not change under the transfer
+			pthread_cond_wait(&cache->settled, &cache->lock);
+			continue;
+		}
+		if (slot >= 0 && cache->slots[slot].holders > 0)
+		{
+			cifsCacheDetachSlot(cache, slot); // the read vectors keep the old content
+			slot = -1;
+		}
+		if (slot < 0)
+			slot = cifsCacheAcquireSlot(cache, blockNumber); // the whole block is replaced, so no need to read it
+		if (slot >= 0)
+			break;
+	}
+
+	memcpy(cache->slots[slot].content, content, CIFS_BLOCK_SIZE);
+	cache->slots[slot].dirty = 1;
+	cache->slots[slot].referenced = 1;
+	if (cifsContext->journal != NULL && !cache->slots[slot].pinned && cifsIsMetadataBlock(content, blockNumber))
+		cifsCacheLogBlock(cache, slot);
+	pthread_mutex_unlock(&cache->lock);
+
+	return CIFS_BLOCK_SIZE;
+}
+
+/***
+ *
+ * Read a single block from a block device.
+ *
+ * While the file system is mounted, the block is served from the block cache; a miss loads it into the cache,
+ * without holding the cache lock while the block is read.
+ *
+ */
+void cifsReadBlock(unsigned char* buffer, CIFS_INDEX_TYPE blockNumber)
+{
+	if (cifsContext == NULL || cifsContext->blockCache == NULL)
+	{
+		cifsDeviceReadBlock(buffer, blockNumber);
+		return;
+	}
+
+	CIFS_BLOCK_CACHE_TYPE* cache = cifsContext->blockCache;
+	pthread_mutex_lock(&cache->lock);
+	int slot = cifsCacheFindLoaded(cache, blockNumber);
+	if (slot < 0)
+	{
+		CIFS_STATS_ADD(cacheMisses, 1);
+		slot = cifsCacheLoadBlock(cache, blockNumber);
+	}
+	else
+		CIFS_STATS_ADD(cacheHits, 1);
+
+	cache->slots[slot].referenced = 1;
+	memcpy(buffer, cache->slots[slot].content, CIFS_BLOCK_SIZE);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/***
+ *
+ * Write a single block directly to the block device bypassing the cache.
+ *
+ */
+size_t cifsDeviceWriteBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber)
+{
+	if (cifsVolumeMap == NULL)
+	{
+		// a run of one block for the backend
+		cifsDeviceTransferBlock(1, blockNumber, (unsigned char*)content);
+		return CIFS_BLOCK_SIZE;
+	}
+
+	memcpy(cifsVolumeMap + (size_t)blockNumber * CIFS_BLOCK_SIZE, content, CIFS_BLOCK_SIZE);
+	CIFS_STATS_ADD(blockWrites, 1);
+	if (CIFS_TRACE_ENABLED(CIFS_TRACE_IO))
+		cifsTraceBlock("WRITE", blockNumber, CIFS_BLOCK_SIZE, content);
+
+	return CIFS_BLOCK_SIZE;
+}
+
+/***
+ *
+ * Read a single block directly from the block device bypassing the cache.
+ *
+ */
+void cifsDeviceReadBlock(unsigned char* buffer, CIFS_INDEX_TYPE blockNumber)
+{
+	if (cifsVolumeMap == NULL)
+	{
+		cifsDeviceTransferBlock(0, blockNumber, buffer);
+		return;
+	}
+
+	memcpy(buffer, cifsVolumeMap + (size_t)blockNumber * CIFS_BLOCK_SIZE, CIFS_BLOCK_SIZE);
+	CIFS_STATS_ADD(blockReads, 1);
+	if (CIFS_TRACE_ENABLED(CIFS_TRACE_IO))
+		cifsTraceBlock("READ", blockNumber, CIFS_BLOCK_SIZE, buffer);
+}
+
+/***
+ *
+ * Read many blocks; the blocks found in the cache are copied from there, and the others are read from the
+ * device in batches and added to the cache.
+ *
+ */
+void cifsReadBlocks(const CIFS_INDEX_TYPE* blockNumbers, unsigned char* const* buffers, int count)
+{
+	if (cifsContext == NULL || cifsContext->blockCache == NULL)
+	{
+		cifsDeviceReadBlocks(blockNumbers, buffers, count);
+		return;
+	}
+
+	int missed = cifsCacheGather(cifsContext->blockCache, blockNumbers, count, buffers);
+	if (missed < 0)
+	{
+		// fall back to one block at a time
+		for (int i = 0; i < count; i++)
+			cifsReadBlock(buffers[i], blockNumbers[i]);
+		return;
+	}
+
+	CIFS_STATS_ADD(cacheHits, count - missed);
+	CIFS_STATS_ADD(cacheMisses, missed);
+}
+
+/***
+ *
+ * Loads the blocks that are not in the cache yet in batches; they enter the cache unreferenced, so the clock
+ * hand takes them first if they are never read. Nothing happens if there is no block cache.
+ *
+ */
+void cifsPrefetchBlocks(const CIFS_INDEX_TYPE* blockNumbers, int count)
+{
+	if (cifsContext == NULL || cifsContext->blockCache == NULL || count <= 0)
+		return;
+
+	// only a hint; if there is no memory, the reads will load the blocks
+	int missed = cifsCacheGather(cifsContext->blockCache, blockNumbers, count, NULL);
+	if (missed > 0)
+		CIFS_STATS_ADD(prefetchedBlocks, missed);
+}
+
+/***
+ *
+ * Write many blocks; while the file system is mounted, they are only stored in the cache (like cifsWriteBlock()),
+ * and the cache flush writes them in batches.
+ *
+ */
+void cifsWriteBlocks(const CIFS_INDEX_TYPE* blockNumbers, const unsigned char* const* contents, int count)
+{
+	if (cifsContext == NULL || cifsContext->blockCache == NULL)
+	{
+		cifsDeviceWriteBlocks(blockNumbers, contents, count);
+		return;
+	}
+
+	for (int i = 0; i < count; i++)
+		cifsWriteBlock(contents[i], blockNumbers[i]);
+}
+
+/***
+ *
+ * A single block of a batched transfer; the position in the batch keeps the order of equal
+ * block numbers when sorting.
+ *
+ */
+typedef struct cifs_block_request_type
+{
+	CIFS_INDEX_TYPE blockNumber;
+	int position;
+	unsigned char* buffer;
+	int missing; // set by a read if the block is past the end of the volume (and cleared)
+} CIFS_BLOCK_REQUEST_TYPE;
+
+static int cifsCompareBlockRequests(const void* a, const void* b)
+{
+	const CIFS_BLOCK_REQUEST_TYPE* x = a;
+	const CIFS_BLOCK_REQUEST_TYPE* y = b;
+	if (x->blockNumber != y->blockNumber)
+		return x->blockNumber < y->blockNumber ? -1 : 1;
+	return x->position - y->position;
+}
+
+/***
+ *
+ * The completion callback of a run of blocks: fails like the synchronous calls would, and clears the part of
+ * a read past the end of the volume; the backends finish short transfers, so a read falls short of the run
+ * only where the volume ends.
+ *
+ */
+static void cifsCompleteBlockRun(CIFS_IO_RUN_TYPE* run, ssize_t result)
+{
+	CIFS_BLOCK_REQUEST_TYPE* requests = run->arg;
+	if (result < 0)
+	{
+		errno = (int)-result;
+		cifsIOError(run->writing ? "WRITE" : "READ", cifsIOBackend()->name);
+	}
+
+	if (run->writing)
+		CIFS_STATS_ADD(blockWrites, run->iovCount);
+	else
+		CIFS_STATS_ADD(blockReads, run->iovCount);
+
+	for (int i = 0; i < run->iovCount; i++)
+		requests[i].missing = !run->writing && (ssize_t)(i + 1) * CIFS_BLOCK_SIZE > result;
+
+	if (!run->writing && result < (ssize_t)run->iovCount * CIFS_BLOCK_SIZE)
+	{
+		// past the end of the volume; behave as if the missing part was never written
+		for (int i = 0; i < run->iovCount; i++)
+		{
+			ssize_t start = (ssize_t)i * CIFS_BLOCK_SIZE;
+			if (start >= result)
+				memset(requests[i].buffer, 0, CIFS_BLOCK_SIZE);
+			else if (start + CIFS_BLOCK_SIZE > result)
+				memset(requests[i].buffer + (result - start), 0, CIFS_BLOCK_SIZE - (result - start));
+		}
+	}
+
+	if (CIFS_TRACE_ENABLED(CIFS_TRACE_IO))
+		for (int i = 0; i < run->iovCount; i++)
+			cifsTraceBlock(run->writing ? "WRITE" : "READ", requests[i].blockNumber, CIFS_BLOCK_SIZE,
+				requests[i].buffer);
+}
+
+/***
+ *
+ * Transfers blocks already sorted by the block number through the file descriptor: the runs of consecutive
+ * blocks are handed to the I/O backend CIFS_IO_QUEUE_DEPTH at a time; iov must hold count entries. It does not
+ * touch the stream, so the mount workers may call it concurrently.
+ *
+ */
+static void cifsTransferSortedBlocks(int writing, int fd, CIFS_BLOCK_REQUEST_TYPE* requests, int count,
+	struct iovec* iov)
+{
+	CIFS_IO_BACKEND_TYPE* backend = cifsIOBackend();
+	CIFS_IO_RUN_TYPE runs[CIFS_IO_QUEUE_DEPTH];
+	int queued = 0;
+	struct iovec* unused = iov;
+	for (int first = 0; first < count; )
+	{
+		int length = 1;
+		while (first + length < count && length < CIFS_IOV_BATCH
+			&& requests[first + length].blockNumber == requests[first].blockNumber + length)
+			length++;
+
+		for (int i = 0; i < length; i++)
+		{
+			unused[i].iov_base = requests[first + i].buffer;
+			unused[i].iov_len = CIFS_BLOCK_SIZE;
+		}
+
+		runs[queued].writing = writing;
+		runs[queued].offset = (off_t)requests[first].blockNumber * CIFS_BLOCK_SIZE;
+		runs[queued].iov = unused;
+		runs[queued].iovCount = length;
+		runs[queued].complete = cifsCompleteBlockRun;
+		runs[queued++].arg = &requests[first];
+		unused += length;
+		first += length;
+
+		if (queued == CIFS_IO_QUEUE_DEPTH || first == count)
+		{
+			backend->transfer(backend, fd, runs, queued);
+			queued = 0;
+			unused = iov;
+		}
+	}
+}
+
+/***
+ *
+ * Transfers a single block through the I/O backend.
+ *
+ */
+static void cifsDeviceTransferBlock(int writing, CIFS_INDEX_TYPE blockNumber, unsigned char* buffer)
+{
+	CIFS_BLOCK_REQUEST_TYPE request = { .blockNumber = blockNumber, .position = 0, .buffer = buffer };
+	struct iovec iov;
+	cifsTransferSortedBlocks(writing, fileno(cifsVolume), &request, 1, &iov);
+}
+
+/***
+ *
+ * Transfers many blocks between memory and the device: sorts them by the block number, merges the runs of
+ * consecutive blocks, and hands the runs to the I/O backend.
+ *
+ */
+static void cifsDeviceTransferBlocks(int writing, const CIFS_INDEX_TYPE* blockNumbers, unsigned char* const* buffers,
+	int count)
+{
+	if (count <= 0)
+		return;
+
+	if (cifsVolumeMap != NULL)
+	{
+		for (int i = 0; i < count; i++)
+			if (writing)
+				cifsDeviceWriteBlock(buffers[i], blockNumbers[i]);
+			else
+				cifsDeviceReadBlock(buffers[i], blockNumbers[i]);
+		return;
+	}
+
+	CIFS_BLOCK_REQUEST_TYPE* requests = malloc(count * sizeof(CIFS_BLOCK_REQUEST_TYPE));
+	struct iovec* iov = malloc(count * sizeof(struct iovec));
+	if (requests == NULL || iov == NULL)
+	{
+		// fall back to one block at a time
+		free(requests);
+		free(iov);
+		for (int i = 0; i < count; i++)
+			if (writing)
+				cifsDeviceWriteBlock(buffers[i], blockNumbers[i]);
+			else
+				cifsDeviceReadBlock(buffers[i], blockNumbers[i]);
+		return;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		requests[i].blockNumber = blockNumbers[i];
+		requests[i].position = i;
+		requests[i].buffer = buffers[i];
+	}
+	qsort(requests, count, sizeof(CIFS_BLOCK_REQUEST_TYPE), cifsCompareBlockRequests);
+
+	cifsTransferSortedBlocks(writing, fileno(cifsVolume), requests, count, iov);
+
+	free(requests);
+	free(iov);
+}
+
+void cifsDeviceReadBlocks(const CIFS_INDEX_TYPE* blockNumbers, unsigned char* const* buffers, int count)
+{
+	cifsDeviceTransferBlocks(0, blockNumbers, buffers, count);
+}
+
+void cifsDeviceWriteBlocks(const CIFS_INDEX_TYPE* blockNumbers, const unsigned char* const* contents, int count)
+{
+	cifsDeviceTransferBlocks(1, blockNumbers, (unsigned char* const*)contents, count);
+}
+
+/***
+ *
+ * Returns a pointer to the block inside the volume mapping, so it can be read or modified in place
+ * without copying; the modifications reach the volume on the next synchronization.
+ *
+ * Returns NULL if the volume is not mounted with CIFS_MOUNT_MMAP; cifsReadBlock() and cifsWriteBlock()
+ * must be used then.
+ *
+ */
+unsigned char* cifsGetBlockPtr(CIFS_INDEX_TYPE blockNumber)
+{
+	if (cifsVolumeMap == NULL || blockNumber >= CIFS_NUMBER_OF_BLOCKS)
+		return NULL;
+
+	return cifsVolumeMap + (size_t)blockNumber * CIFS_BLOCK_SIZE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// I/O backends
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Skips the bytes of a vector that a short transfer got through; returns the first entry left, and the number of
+ * entries left in count. The entry the transfer stopped in is shortened in place.
+ *
+ */
+static struct iovec* cifsAdvanceVector(struct iovec* iov, int* count, size_t transferred)
+{
+	while (*count > 0 && transferred >= iov->iov_len)
+	{
+		transferred -= iov->iov_len;
+		iov++;
+		(*count)--;
+	}
+	if (*count > 0)
+	{
+		iov->iov_base = (unsigned char*)iov->iov_base + transferred;
+		iov->iov_len -= transferred;
+	}
+
+	return iov;
+}
+
+/***
+ *
+ * The posix backend: one vectored system call per run, completed right away; a short or interrupted call is
+ * repeated for the rest of the run, until the end of the volume.
+ *
+ */
+static void cifsPosixTransfer(CIFS_IO_BACKEND_TYPE* backend, int fd, CIFS_IO_RUN_TYPE* runs, int count)
+{
+	(void)backend;
+	for (int i = 0; i < count; i++)
+	{
+		struct iovec* iov = runs[i].iov;
+		int left = runs[i].iovCount;
+		off_t offset = runs[i].offset;
+		ssize_t done = 0, len = 0;
+		while (left > 0)
+		{
+			len = runs[i].writing ? pwritev(fd, iov, left, offset) : preadv(fd, iov, left, offset);
+			if (len < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if (len <= 0)
+				break;
+			done += len;
+			offset += len;
+			iov = cifsAdvanceVector(iov, &left, (size_t)len);
+		}
+		runs[i].complete(&runs[i], len < 0 ? -errno : done);
+	}
+}
+
+static CIFS_IO_BACKEND_TYPE cifsPosixBackend = { .name = "posix", .transfer = cifsPosixTransfer };
+
+/***
+ *
+ * Returns the backend of the mounted volume; the posix backend if the volume was not mounted with another one.
+ *
+ */
+CIFS_IO_BACKEND_TYPE* cifsIOBackend(void)
+{
+	return cifsVolumeBackend != NULL ? cifsVolumeBackend : &cifsPosixBackend;
+}
+
+/***
+ *
+ * The rings shared with the kernel by the io_uring backend; there is no liburing, so they are set up with the
+ * raw system calls.
+ *
+ */
+typedef struct cifs_uring_type
+{
+	int ringFd;
+	unsigned entries; // of the submission ring
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing; // the same mapping as sqRing with IORING_FEAT_SINGLE_MMAP
+	size_t cqRingSize;
+	struct io_uring_sqe* sqes;
+	size_t sqesSize;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	struct io_uring_cqe* cqes;
+	pthread_mutex_t lock; // one transfer at a time owns the rings
+} CIFS_URING_TYPE;
+
+/***
+ *
+ * The part of a run that the io_uring backend still has to transfer.
+ *
+ */
+typedef struct cifs_uring_run_type
+{
+	struct iovec* iov;
+	int iovCount;
+	off_t offset;
+	ssize_t done; // bytes transferred so far
+} CIFS_URING_RUN_TYPE;
+
+/***
+ *
+ * Queues a submission entry for the rest of the run; the entry is submitted by the next io_uring_enter().
+ *
+ */
+static void cifsUringQueue(CIFS_URING_TYPE* ring, int fd, int writing, const CIFS_URING_RUN_TYPE* rest, int tag)
+{
+	unsigned tail = *ring->sqTail; // only this side moves the tail
+	unsigned index = tail & *ring->sqMask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = writing ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)(uintptr_t)rest->iov;
+	sqe->len = rest->iovCount;
+	sqe->off = rest->offset;
+	sqe->user_data = tag;
+	ring->sqArray[index] = index;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/***
+ *
+ * The io_uring backend: queues a submission entry per run, submits the whole batch with one io_uring_enter(),
+ * and calls the completion callbacks as the completions arrive. A short or interrupted transfer is queued
+ * again for the rest of its run, until the end of the volume.
+ *
+ */
+static void cifsUringTransfer(CIFS_IO_BACKEND_TYPE* backend, int fd, CIFS_IO_RUN_TYPE* runs, int count)
+{
+	CIFS_URING_TYPE* ring = backend->state;
+	CIFS_URING_RUN_TYPE rest[CIFS_IO_QUEUE_DEPTH];
+	pthread_mutex_lock(&ring->lock);
+	for (int first = 0; first < count; )
+	{
+		int batch = count - first < (int)ring->entries ? count - first : (int)ring->entries;
+		if (batch > CIFS_IO_QUEUE_DEPTH)
+			batch = CIFS_IO_QUEUE_DEPTH;
+
+		// every run has one entry in flight at most, so the submission ring never overflows
+		for (int i = 0; i < batch; i++)
+		{
+			CIFS_IO_RUN_TYPE* run = &runs[first + i];
+			rest[i] = (CIFS_URING_RUN_TYPE){ run->iov, run->iovCount, run->offset, 0 };
+			cifsUringQueue(ring, fd, run->writing, &rest[i], i);
+		}
+
+		int unsubmitted = batch;
+		int completed = 0;
+		while (completed < batch)
+		{
+			int submitted = syscall(__NR_io_uring_enter, ring->ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (submitted < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				cifsIOError("IO", "io_uring_enter");
+			}
+			unsubmitted -= submitted;
+
+			unsigned head = *ring->cqHead;
+			while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+			{
+				struct io_uring_cqe* cqe = &ring->cqes[head++ & *ring->cqMask];
+				int tag = (int)cqe->user_data;
+				ssize_t result = cqe->res;
+				__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE); // the entry may be reused now
+
+				CIFS_IO_RUN_TYPE* run = &runs[first + tag];
+				if (result > 0)
+				{
+					rest[tag].done += result;
+					rest[tag].offset += result;
+					rest[tag].iov = cifsAdvanceVector(rest[tag].iov, &rest[tag].iovCount, (size_t)result);
+				}
+				if ((result > 0 && rest[tag].iovCount > 0) || result == -EINTR || result == -EAGAIN)
+				{
+					cifsUringQueue(ring, fd, run->writing, &rest[tag], tag);
+					unsubmitted++;
+					continue;
+				}
+				run->complete(run, result < 0 ? result : rest[tag].done);
+				completed++;
+			}
+		}
+
+		first += batch;
+	}
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static void cifsUringClose(CIFS_IO_BACKEND_TYPE* backend)
+{
+	CIFS_URING_TYPE* ring = backend->state;
+	if (ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing)
+		munmap(ring->cqRing, ring->cqRingSize);
+	if (ring->sqRing != MAP_FAILED)
+		munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->ringFd);
+	pthread_mutex_destroy(&ring->lock);
+	free(ring);
+	free(backend);
+}
+
+/***
+ *
+ * Sets up an io_uring of CIFS_IO_QUEUE_DEPTH entries; returns NULL if the kernel does not provide it
+ * (or forbids it), so the caller can stay with the posix backend.
+ *
+ */
+CIFS_IO_BACKEND_TYPE* cifsOpenUringBackend(void)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof params);
+	int ringFd = syscall(__NR_io_uring_setup, CIFS_IO_QUEUE_DEPTH, &params);
+	if (ringFd < 0)
+		return NULL;
+
+	CIFS_IO_BACKEND_TYPE* backend = calloc(1, sizeof *backend);
+	CIFS_URING_TYPE* ring = calloc(1, sizeof *ring);
+	if (backend == NULL || ring == NULL)
+	{
+		free(backend);
+		free(ring);
+		close(ringFd);
+		return NULL;
+	}
+
+	ring->ringFd = ringFd;
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single && ring->cqRingSize > ring->sqRingSize)
+		ring->sqRingSize = ring->cqRingSize;
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+		IORING_OFF_SQ_RING);
+	ring->cqRing = single ? ring->sqRing : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+		IORING_OFF_SQES);
+	pthread_mutex_init(&ring->lock, NULL);
+	backend->name = "io_uring";
+	backend->transfer = cifsUringTransfer;
+	backend->close = cifsUringClose;
+	backend->state = ring;
+	if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		cifsUringClose(backend);
+		return NULL;
+	}
+
+	unsigned char* sq = ring->sqRing;
+	ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+	unsigned char* cq = ring->cqRing;
+	ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return backend;
+}
+
+/***
+ *
+ * Releases a backend opened by cifsOpenUringBackend(); NULL and the posix backend are ignored.
+ *
+ */
+void cifsCloseIOBackend(CIFS_IO_BACKEND_TYPE* backend)
+{
+	if (backend != NULL && backend->close != NULL)
+		backend->close(backend);
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Write-back block cache
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Allocates an empty block cache.
+ *
+ */
+CIFS_BLOCK_CACHE_TYPE* cifsCreateBlockCache(void)
+{
+	CIFS_BLOCK_CACHE_TYPE* cache = malloc(sizeof(CIFS_BLOCK_CACHE_TYPE));
+	if (cache == NULL)
+		return NULL;
+
+	cache->slots = malloc(CIFS_CACHE_SIZE * sizeof(CIFS_CACHE_ENTRY_TYPE));
+	if (cache->slots == NULL)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	for (int i = 0; i < CIFS_CACHE_BUCKETS; i++)
+		cache->buckets[i] = -1;
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->settled, NULL);
+
+	for (int i = 0; i < CIFS_CACHE_SIZE; i++)
+	{
+		cache->slots[i].blockNumber = CIFS_INVALID_INDEX;
+		cache->slots[i].dirty = 0;
+		cache->slots[i].referenced = 0;
+		cache->slots[i].pinned = 0;
+		cache->slots[i].detached = 0;
+		cache->slots[i].loading = 0;
+		cache->slots[i].writing = 0;
+		cache->slots[i].holders = 0;
+		cache->slots[i].next = -1;
+	}
+
+	cache->hand = 0;
+	cache->logged = NULL;
+	cache->loggedCount = 0;
+	cache->loggedCapacity = 0;
+	cache->loggedSince = 0;
+	cache->heldSlots = 0;
+	cache->busySlots = 0;
+	cache->writingSlots = 0;
+
+	return cache;
+}
+
+/***
+ *
+ * Returns the slot holding the block, or -1 if the block is not cached.
+ *
+ */
+int cifsCacheLookup(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber)
+{
+	int slot = cache->buckets[blockNumber % CIFS_CACHE_BUCKETS];
+	while (slot >= 0 && cache->slots[slot].blockNumber != blockNumber)
+		slot = cache->slots[slot].next;
+
+	return slot;
+}
+
+/***
+ *
+ * Assigns a slot to a block that is not in the cache yet, and returns its index.
+ *
+ * The clock hand selects the victim. A dirty victim is written back without the cache lock first, and -1 is
+ * returned instead of a slot, as it is if every slot is held or busy, after waiting for one to settle; the
+ * caller must then look the block up again, since another thread may have cached it meanwhile.
+ * The content of the returned slot is undefined, so the caller must fill it.
+ *
+ * Pinned slots are passed over; only if the hand has passed them 2 * CIFS_CACHE_SIZE times, a pinned
+ * block is written back before its transaction commits. Held and busy slots are always passed over.
+ *
+ */
+int cifsCacheAcquireSlot(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber)
+{
+	if (cache->heldSlots + cache->busySlots >= CIFS_CACHE_SIZE)
+	{
+		pthread_cond_wait(&cache->settled, &cache->lock);
+		return -1;
+	}
+
+	int slot;
+	int passed = 0; // pinned slots passed over
+	for (;;)
+	{
+		slot = cache->hand;
+		cache->hand = (cache->hand + 1) % CIFS_CACHE_SIZE;
+
+		if (cache->slots[slot].holders > 0 || cache->slots[slot].loading || cache->slots[slot].writing)
+			continue;
+
+		if (cache->slots[slot].blockNumber == CIFS_INVALID_INDEX)
+			break;
+
+		if (cache->slots[slot].pinned && passed++ < 2 * CIFS_CACHE_SIZE)
+			continue;
+
+		if (!cache->slots[slot].referenced)
+			break;
+
+		cache->slots[slot].referenced = 0; // second chance
+	}
+
+	CIFS_CACHE_ENTRY_TYPE* victim = &cache->slots[slot];
+	if (victim->blockNumber != CIFS_INVALID_INDEX && victim->dirty)
+	{
+		// the victim stays in the cache while it is written, and is clean when the hand comes back to it
+		victim->writing = 1;
+		victim->dirty = 0;
+		cache->busySlots++;
+		cache->writingSlots++;
+		cache->hand = slot;
+		pthread_mutex_unlock(&cache->lock);
+		cifsDeviceWriteBlock(victim->content, victim->blockNumber);
+		pthread_mutex_lock(&cache->lock);
+		victim->writing = 0;
+		cache->busySlots--;
+		cache->writingSlots--;
+		pthread_cond_broadcast(&cache->settled);
+		return -1;
+	}
+
+	if (victim->blockNumber != CIFS_INVALID_INDEX)
+	{
+		// unlink the victim from its hash chain
+		int* link = &cache->buckets[victim->blockNumber % CIFS_CACHE_BUCKETS];
+		while (*link != slot)
+			link = &cache->slots[*link].next;
+		*link = victim->next;
+	}
+
+	int bucket = blockNumber % CIFS_CACHE_BUCKETS;
+	victim->blockNumber = blockNumber;
+	victim->dirty = 0;
+	victim->referenced = 0;
+	victim->pinned = 0; // a logged block that is evicted is read from the volume by the commit
+	victim->next = cache->buckets[bucket];
+	cache->buckets[bucket] = slot;
+
+	return slot;
+}
+
+/***
+ *
+ * Takes a held slot out of its hash chain, so the block can get new content in another slot; the caller holds
+ * the cache lock.
+ *
+ */
+static void cifsCacheDetachSlot(CIFS_BLOCK_CACHE_TYPE* cache, int slot)
+{
+	CIFS_CACHE_ENTRY_TYPE* entry = &cache->slots[slot];
+	int* link = &cache->buckets[entry->blockNumber % CIFS_CACHE_BUCKETS];
+	while (*link != slot)
+		link = &cache->slots[*link].next;
+	*link = entry->next;
+
+	entry->next = -1;
+	entry->detached = 1;
+	entry->dirty = 0; // the content is superseded; the new one is written back from the other slot
+}
+
+/***
+ *
+ * Returns the slot holding the block once it is loaded, or -1 if the block is not cached; the caller holds the
+ * cache lock, which is released while a loading slot is waited for.
+ *
+ */
+static int cifsCacheFindLoaded(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber)
+{
+	int slot;
+	while ((slot = cifsCacheLookup(cache, blockNumber)) >= 0 && cache->slots[slot].loading)
+		pthread_cond_wait(&cache->settled, &cache->lock);
+
+	return slot;
+}
+
+/***
+ *
+ * Reads the blocks of slots reserved as loading into them with the cache lock released, and wakes the threads
+ * waiting for them; the caller holds the lock, and provides room for the block numbers and the buffers.
+ *
+ */
+static void cifsCacheLoadSlots(CIFS_BLOCK_CACHE_TYPE* cache, const int* slots, int count,
+							   CIFS_INDEX_TYPE* blockNumbers, unsigned char** buffers)
+{
+	for (int i = 0; i < count; i++)
+	{
+		blockNumbers[i] = cache->slots[slots[i]].blockNumber;
+		buffers[i] = cache->slots[slots[i]].content;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+	cifsDeviceReadBlocks(blockNumbers, buffers, count);
+	pthread_mutex_lock(&cache->lock);
+
+	for (int i = 0; i < count; i++)
+		cache->slots[slots[i]].loading = 0;
+	cache->busySlots -= count;
+	pthread_cond_broadcast(&cache->settled);
+}
+
+/***
+ *
+ * Loads a block that was not found in the cache into a slot, and returns the slot; the caller holds the cache
+ * lock, which is released while the block is read. The block may have been loaded by another thread meanwhile.
+ *
+ */
+static int cifsCacheLoadBlock(CIFS_BLOCK_CACHE_TYPE* cache, CIFS_INDEX_TYPE blockNumber)
+{
+	int slot;
+	while ((slot = cifsCacheAcquireSlot(cache, blockNumber)) < 0)
+		if ((slot = cifsCacheFindLoaded(cache, blockNumber)) >= 0)
+			return slot;
+
+	cache->slots[slot].loading = 1;
+	cache->busySlots++;
+	CIFS_INDEX_TYPE number;
+	unsigned char* buffer;
+	cifsCacheLoadSlots(cache, &slot, 1, &number, &buffer);
+
+	return slot;
+}
+
+/***
+ *
+ * Copies the blocks from the cache into the buffers, loading the missing ones in batches that are read without the
+ * cache lock; with no buffers, the blocks are only loaded, unreferenced, and the blocks that other threads are
+ * loading are left to them. Returns the number of blocks missing at first, or -1 if there is no memory.
+ *
+ * Each batch takes the slots that are neither held nor busy; a thread waits for other slots to settle only while
+ * it has none reserved, so the threads loading blocks never wait for each other.
+ *
+ */
+static int cifsCacheGather(CIFS_BLOCK_CACHE_TYPE* cache, const CIFS_INDEX_TYPE* blockNumbers, int count,
+						   unsigned char* const* buffers)
+{
+	int* pending = malloc(count * sizeof(int));
+	int* reserved = malloc(count * sizeof(int));
+	CIFS_INDEX_TYPE* loadNumbers = malloc(count * sizeof(CIFS_INDEX_TYPE));
+	unsigned char** loadBuffers = malloc(count * sizeof(unsigned char*));
+	if (pending == NULL || reserved == NULL || loadNumbers == NULL || loadBuffers == NULL)
+	{
+		free(pending);
+		free(reserved);
+		free(loadNumbers);
+		free(loadBuffers);
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++)
+		pending[i] = i;
+	int pendingCount = count;
+	int missed = -1;
+
+	pthread_mutex_lock(&cache->lock);
+	while (pendingCount > 0)
+	{
+		int reservedCount = 0;
+		int left = 0;
+		int released = 0; // the lock was released on the way, so the slots may have settled
+		for (int p = 0; p < pendingCount; p++)
+		{
+			int i = pending[p];
+			int slot = cifsCacheLookup(cache, blockNumbers[i]);
+			if (slot >= 0 && !cache->slots[slot].loading)
+			{
+				if (buffers != NULL)
+				{
+					cache->slots[slot].referenced = 1;
+					memcpy(buffers[i], cache->slots[slot].content, CIFS_BLOCK_SIZE);
+				}
+				continue;
+			}
+			if (slot >= 0 && buffers == NULL)
+				continue;
+
+			// a block listed again is loading into the slot reserved for it already
+			if (slot < 0 && cache->heldSlots + cache->busySlots < CIFS_CACHE_SIZE)
+			{
+				slot = cifsCacheAcquireSlot(cache, blockNumbers[i]);
+				if (slot >= 0)
+				{
+					cache->slots[slot].loading = 1;
+					cache->busySlots++;
+					reserved[reservedCount++] = slot;
+				}
+				else
+					released = 1;
+			}
+			pending[left++] = i;
+		}
+		if (missed < 0)
+			missed = left;
+		pendingCount = left;
+
+		if (reservedCount > 0)
+			cifsCacheLoadSlots(cache, reserved, reservedCount, loadNumbers, loadBuffers);
+		else if (pendingCount > 0 && !released)
+			pthread_cond_wait(&cache->settled, &cache->lock);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	free(pending);
+	free(reserved);
+	free(loadNumbers);
+	free(loadBuffers);
+
+	return missed;
+}
+
+/***
+ *
+ * Holds the slots of the blocks, loading the missing ones in batches first, and returns the number of blocks
+ * held; it is less than count if CIFS_CACHE_HELD_MAX would be exceeded, and -1 if there is no memory for the batch.
+ *
+ * A block evicted again before it is held is loaded on its own; the slots held by then stay in the cache meanwhile.
+ *
+ */
+static int cifsCacheHoldBlocks(CIFS_BLOCK_CACHE_TYPE* cache, const CIFS_INDEX_TYPE* blockNumbers, int count,
+							   int* slots)
+{
+	int missed = cifsCacheGather(cache, blockNumbers, count, NULL);
+	if (missed < 0)
+		return -1;
+
+	CIFS_STATS_ADD(cacheHits, count - missed);
+	CIFS_STATS_ADD(cacheMisses, missed);
+
+	pthread_mutex_lock(&cache->lock);
+	int held = 0;
+	for (; held < count; held++)
+	{
+		int slot = cifsCacheFindLoaded(cache, blockNumbers[held]);
+		if (slot >= 0 ? cache->slots[slot].holders == 0 && cache->heldSlots >= CIFS_CACHE_HELD_MAX
+					  : cache->heldSlots >= CIFS_CACHE_HELD_MAX)
+			break;
+		if (slot < 0)
+			slot = cifsCacheLoadBlock(cache, blockNumbers[held]);
+
+		cache->slots[slot].referenced = 1;
+		if (cache->slots[slot].holders++ == 0)
+			cache->heldSlots++;
+		slots[held] = slot;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return held;
+}
+
+/***
+ *
+ * Releases slots held by cifsCacheHoldBlocks(); a detached slot becomes empty with its last holder.
+ *
+ */
+static void cifsCacheReleaseSlots(CIFS_BLOCK_CACHE_TYPE* cache, const int* slots, int count)
+{
+	pthread_mutex_lock(&cache->lock);
+	for (int i = 0; i < count; i++)
+	{
+		CIFS_CACHE_ENTRY_TYPE* entry = &cache->slots[slots[i]];
+		if (--entry->holders > 0)
+			continue;
+
+		cache->heldSlots--;
+		if (entry->detached)
+		{
+			entry->blockNumber = CIFS_INVALID_INDEX;
+			entry->detached = 0;
+			entry->referenced = 0;
+		}
+	}
+	pthread_cond_broadcast(&cache->settled);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/***
+ *
+ * Writes all dirty blocks that are not pinned to the volume, and returns their number; the blocks stay
+ * in the cache.
+ *
+ * The blocks are marked as writing and written without the cache lock; the flush returns only once the victims
+ * that other threads are writing back meanwhile are on the volume, too.
+ *
+ */
+int cifsFlushBlockCache(CIFS_BLOCK_CACHE_TYPE* cache)
+{
+	if (cache == NULL)
+		return 0;
+
+	// all dirty blocks go out in one batch, so neighbouring blocks are merged into single writes
+	CIFS_INDEX_TYPE blockNumbers[CIFS_CACHE_SIZE];
+	const unsigned char* contents[CIFS_CACHE_SIZE];
+	int slots[CIFS_CACHE_SIZE];
+	int count = 0;
+	pthread_mutex_lock(&cache->lock);
+	for (int i = 0; i < CIFS_CACHE_SIZE; i++)
+	{
+		CIFS_CACHE_ENTRY_TYPE* entry = &cache->slots[i];
+		if (entry->blockNumber != CIFS_INVALID_INDEX && entry->dirty && !entry->pinned && !entry->writing)
+		{
+			blockNumbers[count] = entry->blockNumber;
+			contents[count] = entry->content;
+			slots[count++] = i;
+			entry->dirty = 0;
+			entry->writing = 1;
+		}
+	}
+	cache->busySlots += count;
+	cache->writingSlots += count;
+	pthread_mutex_unlock(&cache->lock);
+
+	cifsDeviceWriteBlocks(blockNumbers, contents, count);
+
+	pthread_mutex_lock(&cache->lock);
+	for (int i = 0; i < count; i++)
+		cache->slots[slots[i]].writing = 0;
+	cache->busySlots -= count;
+	cache->writingSlots -= count;
+	pthread_cond_broadcast(&cache->settled);
+	while (cache->writingSlots > 0)
+		pthread_cond_wait(&cache->settled, &cache->lock);
+	pthread_mutex_unlock(&cache->lock);
+
+	return count;
+}
+
+/***
+ *
+ * Releases the cache memory. Dirty blocks are NOT written back, so the cache must be flushed first.
+ *
+ */
+void cifsDestroyBlockCache(CIFS_BLOCK_CACHE_TYPE* cache)
+{
+	if (cache == NULL)
+		return;
+
+	pthread_mutex_destroy(&cache->lock);
+	pthread_cond_destroy(&cache->settled);
+	free(cache->logged);
+	free(cache->slots);
+	free(cache);
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Metadata journal
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Tells whether the block holds metadata: the bitvector, the superblock, a descriptor, or an index block.
+ *
+ */
+static int cifsIsMetadataBlock(const unsigned char* content, CIFS_INDEX_TYPE blockNumber)
+{
+	if (blockNumber <= CIFS_SUPERBLOCK_INDEX)
+		return 1;
+
+	CIFS_CONTENT_TYPE type;
+	memcpy(&type, content + offsetof(CIFS_BLOCK_TYPE, type), sizeof type);
+	return type != CIFS_DATA_CONTENT_TYPE;
+}
+
+/***
+ *
+ * Pins the block held by the slot, and adds it to the running transaction; the caller holds the cache lock.
+ *
+ * If the list of logged blocks cannot grow, the block is left to the usual write-back.
+ *
+ */
+static void cifsCacheLogBlock(CIFS_BLOCK_CACHE_TYPE* cache, int slot)
+{
+	if (cache->loggedCount == cache->loggedCapacity)
+	{
+		unsigned int capacity = cache->loggedCapacity ? 2 * cache->loggedCapacity : CIFS_JOURNAL_BATCH;
+		CIFS_INDEX_TYPE* logged = realloc(cache->logged, capacity * sizeof(CIFS_INDEX_TYPE));
+		if (logged == NULL)
+			return;
+		cache->logged = logged;
+		cache->loggedCapacity = capacity;
+	}
+
+	if (cache->loggedCount == 0)
+		cache->loggedSince = time(NULL);
+	cache->logged[cache->loggedCount++] = cache->slots[slot].blockNumber;
+	cache->slots[slot].pinned = 1;
+}
+
+/***
+ *
+ * Releases the blocks of the running transaction to the usual write-back; the caller holds the cache lock.
+ *
+ */
+static void cifsCacheUnpinLogged(CIFS_BLOCK_CACHE_TYPE* cache)
+{
+	for (unsigned int i = 0; i < cache->loggedCount; i++)
+	{
+		int slot = cifsCacheLookup(cache, cache->logged[i]);
+		if (slot >= 0)
+			cache->slots[slot].pinned = 0;
+	}
+	cache->loggedCount = 0;
+}
+
+/***
+ *
+ * FNV-1a hash of the block numbers and the contents of a transaction.
+ *
+ */
+static unsigned long long cifsJournalChecksum(const CIFS_INDEX_TYPE* blockNumbers, const unsigned char* contents,
+											  unsigned int count)
+{
+	unsigned long long checksum = 14695981039346656037ULL;
+	const unsigned char* bytes = (const unsigned char*)blockNumbers;
+	for (size_t i = 0; i < count * sizeof(CIFS_INDEX_TYPE); i++)
+		checksum = (checksum ^ bytes[i]) * 1099511628211ULL;
+	for (size_t i = 0; i < (size_t)count * CIFS_BLOCK_SIZE; i++)
+		checksum = (checksum ^ contents[i]) * 1099511628211ULL;
+
+	return checksum;
+}
+
+/***
+ *
+ * Writes the header of an empty journal; the transaction following it, if any, is stale.
+ *
+ */
+static CIFS_ERROR cifsJournalReset(CIFS_INDEX_TYPE start, unsigned long long sequence)
+{
+	unsigned char block[CIFS_BLOCK_SIZE] = {0};
+	CIFS_JOURNAL_HEADER_TYPE* header = (CIFS_JOURNAL_HEADER_TYPE*)block;
+	header->magic = CIFS_JOURNAL_MAGIC;
+	header->sequence = sequence;
+	cifsDeviceWriteBlock(block, start);
+
+	return fdatasync(fileno(cifsVolume)) == 0 ? CIFS_NO_ERROR : CIFS_WRITE_ERROR;
+}
+
+/***
+ *
+ * Completes the transaction committed to the journal before the volume was last closed.
+ *
+ * Must be called when the volume is open, but not mapped or cached yet; the blocks are accessed on the device.
+ * Returns the sequence number for the next transaction; a torn or stale transaction is ignored.
+ *
+ */
+CIFS_ERROR cifsJournalReplay(unsigned long long* sequence)
+{
+	*sequence = 1;
+
+	unsigned char block[CIFS_BLOCK_SIZE];
+	CIFS_SUPERBLOCK_TYPE superblock;
+	cifsDeviceReadBlock(block, CIFS_SUPERBLOCK_INDEX);
+	memcpy(&superblock, block, sizeof superblock);
+	if (superblock.cifsJournalBlocks == 0)
+		return CIFS_NO_ERROR;
+
+	CIFS_INDEX_TYPE start = superblock.cifsJournalIndex;
+	CIFS_JOURNAL_HEADER_TYPE header;
+	cifsDeviceReadBlock(block, start);
+	memcpy(&header, block, sizeof header);
+	if (header.magic != CIFS_JOURNAL_MAGIC)
+		return CIFS_NO_ERROR;
+	*sequence = header.sequence + 1;
+
+	CIFS_JOURNAL_RECORD_TYPE record;
+	cifsDeviceReadBlock(block, start + 1);
+	memcpy(&record, block, sizeof record);
+	if (record.magic != CIFS_JOURNAL_MAGIC || record.sequence != header.sequence || record.count == 0)
+		return CIFS_NO_ERROR;
+
+	unsigned int count = record.count;
+	unsigned int descriptors = (count + CIFS_JOURNAL_TAGS - 1) / CIFS_JOURNAL_TAGS;
+	unsigned int total = descriptors + count + 1;
+	if (total >= superblock.cifsJournalBlocks)
+		return CIFS_NO_ERROR;
+
+	// the whole transaction in one batch
+	unsigned char* blocks = malloc((size_t)total * CIFS_BLOCK_SIZE);
+	CIFS_INDEX_TYPE* numbers = malloc((total + count) * sizeof(CIFS_INDEX_TYPE));
+	unsigned char** buffers = malloc(total * sizeof(unsigned char*));
+	if (blocks == NULL || numbers == NULL || buffers == NULL)
+	{
+		free(blocks);
+		free(numbers);
+		free(buffers);
+		return CIFS_ALLOC_ERROR;
+	}
+	for (unsigned int i = 0; i < total; i++)
+	{
+		numbers[i] = start + 1 + i;
+		buffers[i] = blocks + (size_t)i * CIFS_BLOCK_SIZE;
+	}
+	cifsDeviceReadBlocks(numbers, buffers, total);
+
+	// the block numbers follow the transaction blocks
+	CIFS_INDEX_TYPE* homes = numbers + total;
+	int valid = 1;
+	for (unsigned int i = 0; i < count && valid; i++)
+	{
+		const unsigned char* descriptor = buffers[i / CIFS_JOURNAL_TAGS];
+		memcpy(&record, descriptor, sizeof record);
+		memcpy(&homes[i], descriptor + sizeof record + (i % CIFS_JOURNAL_TAGS) * sizeof(CIFS_INDEX_TYPE),
+			   sizeof(CIFS_INDEX_TYPE));
+		valid = record.magic == CIFS_JOURNAL_MAGIC && record.sequence == header.sequence
+				&& homes[i] < CIFS_NUMBER_OF_BLOCKS && (homes[i] < start || homes[i] >= start + superblock.cifsJournalBlocks);
+	}
+
+	const unsigned char* contents = buffers[descriptors];
+	memcpy(&record, buffers[total - 1], sizeof record);
+	valid = valid && record.magic == CIFS_JOURNAL_MAGIC && record.sequence == header.sequence && record.count == count
+			&& record.checksum == cifsJournalChecksum(homes, contents, count);
+
+	CIFS_ERROR error = CIFS_NO_ERROR;
+	if (valid)
+	{
+		// a block logged more than once has the same content in every copy
+		for (unsigned int i = 0; i < count; i++)
+			cifsDeviceWriteBlock(contents + (size_t)i * CIFS_BLOCK_SIZE, homes[i]);
+
+		CIFS_TRACE(CIFS_TRACE_INFO, "REPLAYED JOURNAL TRANSACTION %llu (%u blocks)\n", header.sequence, count);
+
+		// the blocks are at home before the journal forgets them
+		if (fdatasync(fileno(cifsVolume)) != 0)
+			error = CIFS_WRITE_ERROR;
+		else
+			error = cifsJournalReset(start, *sequence);
+	}
+
+	free(blocks);
+	free(numbers);
+	free(buffers);
+
+	return error;
+}
+
+/***
+ *
+ * Frees the blocks freed by the transaction that was just committed in the in-memory bitvector, where other
+ * files may take them now.
+ *
+ */
+static void cifsJournalRelease(CIFS_JOURNAL_TYPE* journal)
+{
+	unsigned long long* freed = (unsigned long long*)journal->freed;
+	unsigned long long* bits = (unsigned long long*)cifsContext->bitvector;
+	for (unsigned int j = 0; j < CIFS_BITVECTOR_SIZE / sizeof(unsigned long long); j++)
+	{
+		unsigned long long word = __atomic_exchange_n(&freed[j], 0, __ATOMIC_ACQ_REL);
+		if (word != 0)
+			__atomic_fetch_and(&bits[j], ~word, __ATOMIC_ACQ_REL);
+	}
+}
+
+/***
+ *
+ * Writes the running transaction to the journal; the caller holds the journal lock, and no operation is active.
+ *
+ */
+static CIFS_ERROR cifsJournalWrite(CIFS_JOURNAL_TYPE* journal)
+{
+	CIFS_BLOCK_CACHE_TYPE* cache = journal->cache;
+
+	pthread_mutex_lock(&cache->lock);
+	unsigned int count = cache->loggedCount;
+	pthread_mutex_unlock(&cache->lock);
+	if (count == 0)
+	{
+		cifsJournalRelease(journal); // nothing was saved that still refers to them
+		return CIFS_NO_ERROR;
+	}
+
+	// the data of the transaction, and the blocks of the previous one, are on the volume before it is replaced
+	cifsFlushBlockCache(cache);
+	if (fdatasync(fileno(cifsVolume)) != 0)
+		return CIFS_WRITE_ERROR;
+
+	unsigned int descriptors = (count + CIFS_JOURNAL_TAGS - 1) / CIFS_JOURNAL_TAGS;
+	unsigned int total = 1 + descriptors + count + 1; // with the header and the commit block
+	unsigned char* blocks = NULL;
+	CIFS_INDEX_TYPE* numbers = NULL;
+	const unsigned char** contents = NULL;
+	if (total <= journal->length)
+	{
+		blocks = calloc(total, CIFS_BLOCK_SIZE);
+		numbers = malloc(total * sizeof(CIFS_INDEX_TYPE));
+		contents = malloc(total * sizeof(unsigned char*));
+	}
+	if (blocks == NULL || numbers == NULL || contents == NULL)
+	{
+		// too large for the journal; the blocks are written in place
+		free(blocks);
+		free(numbers);
+		free(contents);
+		pthread_mutex_lock(&cache->lock);
+		cifsCacheUnpinLogged(cache);
+		pthread_mutex_unlock(&cache->lock);
+		cifsFlushBlockCache(cache);
+		if (fdatasync(fileno(cifsVolume)) != 0)
+			return CIFS_WRITE_ERROR;
+		cifsJournalRelease(journal);
+		return CIFS_NO_ERROR;
+	}
+
+	// the contents follow the descriptors; a block evicted early is already at home, and is read from there
+	// with the journal's own arrays, before they are set
+	unsigned char* logged = blocks + (size_t)(1 + descriptors) * CIFS_BLOCK_SIZE;
+	unsigned char** evicted = (unsigned char**)contents;
+	CIFS_INDEX_TYPE* evictedNumbers = numbers;
+	int evictedCount = 0;
+	pthread_mutex_lock(&cache->lock);
+	const CIFS_INDEX_TYPE* homes = cache->logged;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		int slot = cifsCacheFindLoaded(cache, homes[i]);
+		if (slot >= 0)
+			memcpy(logged + (size_t)i * CIFS_BLOCK_SIZE, cache->slots[slot].content, CIFS_BLOCK_SIZE);
+		else
+		{
+			evictedNumbers[evictedCount] = homes[i];
+			evicted[evictedCount++] = logged + (size_t)i * CIFS_BLOCK_SIZE;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	cifsDeviceReadBlocks(evictedNumbers, evicted, evictedCount);
+	// the list does not change while no operation is active
+
+	for (unsigned int i = 0; i < total; i++)
+	{
+		numbers[i] = journal->start + i;
+		contents[i] = blocks + (size_t)i * CIFS_BLOCK_SIZE;
+	}
+
+	CIFS_JOURNAL_HEADER_TYPE header = {CIFS_JOURNAL_MAGIC, journal->sequence};
+	memcpy(blocks, &header, sizeof header);
+
+	CIFS_JOURNAL_RECORD_TYPE record = {CIFS_JOURNAL_MAGIC, journal->sequence, 0, count};
+	for (unsigned int d = 0; d < descriptors; d++)
+	{
+		unsigned char* descriptor = blocks + (size_t)(1 + d) * CIFS_BLOCK_SIZE;
+		unsigned int first = d * CIFS_JOURNAL_TAGS;
+		unsigned int tags = count - first < CIFS_JOURNAL_TAGS ? count - first : CIFS_JOURNAL_TAGS;
+		memcpy(descriptor, &record, sizeof record);
+		memcpy(descriptor + sizeof record, homes + first, tags * sizeof(CIFS_INDEX_TYPE));
+	}
+
+	record.checksum = cifsJournalChecksum(homes, logged, count);
+	memcpy(blocks + (size_t)(total - 1) * CIFS_BLOCK_SIZE, &record, sizeof record);
+
+	// the commit point
+	cifsDeviceWriteBlocks(numbers, contents, total);
+	CIFS_ERROR error = fdatasync(fileno(cifsVolume)) == 0 ? CIFS_NO_ERROR : CIFS_WRITE_ERROR;
+	journal->sequence++;
+	if (error == CIFS_NO_ERROR)
+		cifsJournalRelease(journal);
+
+	free(blocks);
+	free(numbers);
+	free(contents);
+
+	// the logged blocks may go home now
+	pthread_mutex_lock(&cache->lock);
+	cifsCacheUnpinLogged(cache);
+	pthread_mutex_unlock(&cache->lock);
+
+	return error;
+}
+
+/***
+ *
+ * Commits the running transaction as soon as the active operations leave; the caller holds the journal lock.
+ *
+ */
+static CIFS_ERROR cifsJournalCommitLocked(CIFS_JOURNAL_TYPE* journal)
+{
+	while (journal->committing)
+		pthread_cond_wait(&journal->idle, &journal->lock);
+
+	journal->committing = 1;
+	while (journal->active > 0)
+		pthread_cond_wait(&journal->idle, &journal->lock);
+
+	CIFS_ERROR error = cifsJournalWrite(journal);
+
+	journal->committing = 0;
+	pthread_cond_broadcast(&journal->idle);
+
+	return error;
+}
+
+/***
+ *
+ * Tells whether the running transaction has enough blocks, or has waited long enough, to be committed.
+ *
+ */
+static int cifsJournalDue(CIFS_JOURNAL_TYPE* journal)
+{
+	CIFS_BLOCK_CACHE_TYPE* cache = journal->cache;
+	pthread_mutex_lock(&cache->lock);
+	int due = cache->loggedCount >= CIFS_JOURNAL_BATCH
+			  || (cache->loggedCount > 0 && time(NULL) - cache->loggedSince >= CIFS_JOURNAL_INTERVAL);
+	pthread_mutex_unlock(&cache->lock);
+
+	return due;
+}
+
+/***
+ *
+ * Commits the transactions that the operations do not fill in time.
+ *
+ */
+static void* cifsJournalThread(void* arg)
+{
+	CIFS_JOURNAL_TYPE* journal = arg;
+
+	pthread_mutex_lock(&journal->lock);
+	while (!journal->stopping)
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += CIFS_JOURNAL_INTERVAL;
+		pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline);
+
+		if (!journal->stopping && cifsJournalDue(journal))
+			cifsJournalCommitLocked(journal);
+	}
+	pthread_mutex_unlock(&journal->lock);
+
+	return NULL;
+}
+
+/***
+ *
+ * Starts journaling the mounted volume; sequence is the number returned by cifsJournalReplay().
+ *
+ * Nothing is journaled if the volume has no journal, or is mapped.
+ *
+ */
+CIFS_ERROR cifsJournalOpen(unsigned long long sequence)
+{
+	if (cifsContext->superblock->cifsJournalBlocks == 0 || cifsContext->blockCache == NULL)
+		return CIFS_NO_ERROR;
+
+	CIFS_JOURNAL_TYPE* journal = calloc(1, sizeof(CIFS_JOURNAL_TYPE));
+	if (journal == NULL)
+		return CIFS_ALLOC_ERROR;
+
+	journal->cache = cifsContext->blockCache;
+	journal->start = cifsContext->superblock->cifsJournalIndex;
+	journal->length = cifsContext->superblock->cifsJournalBlocks;
+	journal->sequence = sequence;
+	journal->freed = calloc(1, CIFS_BITVECTOR_SIZE);
+	if (journal->freed == NULL)
+	{
+		free(journal);
+		return CIFS_ALLOC_ERROR;
+	}
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->idle, NULL);
+	pthread_cond_init(&journal->wake, NULL);
+
+	if (pthread_create(&journal->thread, NULL, cifsJournalThread, journal) != 0)
+	{
+		pthread_mutex_destroy(&journal->lock);
+		pthread_cond_destroy(&journal->idle);
+		pthread_cond_destroy(&journal->wake);
+		free(journal->freed);
+		free(journal);
+		return CIFS_SYSTEM_ERROR;
+	}
+
+	cifsContext->journal = journal;
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Finishes the commit thread.
+ *
+ */
+static void cifsJournalStop(CIFS_JOURNAL_TYPE* journal)
+{
+	pthread_mutex_lock(&journal->lock);
+	journal->stopping = 1;
+	pthread_cond_signal(&journal->wake);
+	pthread_mutex_unlock(&journal->lock);
+	pthread_join(journal->thread, NULL);
+}
+
+/***
+ *
+ * Stops journaling; the volume must be synchronized first, so nothing in the journal needs a replay.
+ *
+ */
+void cifsJournalClose(void)
+{
+	CIFS_JOURNAL_TYPE* journal = cifsContext->journal;
+	if (journal == NULL)
+		return;
+
+	cifsJournalStop(journal);
+
+	cifsJournalReset(journal->start, journal->sequence);
+
+	cifsContext->journal = NULL;
+	cifsJournalRelease(journal);
+	cifsJournalDestroy(journal);
+}
+
+/***
+ *
+ * Releases the journal of a stopped commit thread.
+ *
+ */
+static void cifsJournalDestroy(CIFS_JOURNAL_TYPE* journal)
+{
+	pthread_mutex_destroy(&journal->lock);
+	pthread_cond_destroy(&journal->idle);
+	pthread_cond_destroy(&journal->wake);
+	free(journal->freed);
+	free(journal);
+}
+
+/***
+ *
+ * Enters an operation that changes the volume; the caller must not hold any lock of the file system.
+ *
+ */
+void cifsJournalBegin(void)
+{
+	CIFS_JOURNAL_TYPE* journal = cifsContext->journal;
+	if (journal == NULL)
+		return;
+
+	pthread_mutex_lock(&journal->lock);
+	while (journal->committing)
+		pthread_cond_wait(&journal->idle, &journal->lock);
+	journal->active++;
+	pthread_mutex_unlock(&journal->lock);
+}
+
+/***
+ *
+ * Leaves the operation entered by cifsJournalBegin(); commits the transaction if it is due.
+ *
+ */
+void cifsJournalEnd(void)
+{
+	CIFS_JOURNAL_TYPE* journal = cifsContext->journal;
+	if (journal == NULL)
+		return;
+
+	pthread_mutex_lock(&journal->lock);
+	if (--journal->active == 0)
+		pthread_cond_broadcast(&journal->idle);
+	if (!journal->committing && cifsJournalDue(journal))
+		cifsJournalCommitLocked(journal);
+	pthread_mutex_unlock(&journal->lock);
+}
+
+/***
+ *
+ * Commits the running transaction.
+ *
+ */
+CIFS_ERROR cifsJournalCommit(void)
+{
+	CIFS_JOURNAL_TYPE* journal = cifsContext->journal;
+	if (journal == NULL)
+		return CIFS_NO_ERROR;
+
+	pthread_mutex_lock(&journal->lock);
+	CIFS_ERROR error = cifsJournalCommitLocked(journal);
+	pthread_mutex_unlock(&journal->lock);
+
+	return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Deferred block reclamation
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Frees the blocks of the item a word of the bitvector at a time, saving the bitvector every
+ * CIFS_RECLAIM_BATCH blocks; each batch is a journaled operation of its own.
+ *
+ */
+static void cifsReclaimBlocks(const CIFS_RECLAIM_ITEM_TYPE* item)
+{
+	CIFS_INDEX_TYPE indexBlock = item->chain;
+	unsigned int next = 0; // of the single blocks
+	CIFS_BLOCK_TYPE block;
+
+	while (indexBlock != CIFS_INVALID_INDEX || next < item->count)
+	{
+		cifsJournalBegin();
+		unsigned int freed = 0;
+		while (freed < CIFS_RECLAIM_BATCH && indexBlock != CIFS_INVALID_INDEX)
+		{
+			// the index block is read before its own bit is cleared, so nobody can have reused it yet
+			cifsReadBlock((unsigned char*)&block, indexBlock);
+			int i;
+			for (i = 0; i < CIFS_INDEX_SIZE - 1 && block.content.index[i] != CIFS_INVALID_INDEX; i++)
+				cifsReleaseBlock(block.content.index[i]);
+			cifsReleaseBlock(indexBlock);
+			freed += (unsigned int)i + 1;
+			indexBlock = block.content.index[CIFS_INDEX_SIZE - 1];
+		}
+		for (; freed < CIFS_RECLAIM_BATCH && next < item->count; next++, freed++)
+			cifsReleaseBlock(item->blocks[next]);
+		writeBvSb();
+		cifsJournalEnd();
+	}
+}
+
+/***
+ *
+ * Frees the queued blocks until the reclaimer is stopped and the queue is empty.
+ *
+ */
+static void* cifsReclaimerThread(void* arg)
+{
+	CIFS_RECLAIMER_TYPE* reclaimer = arg;
+
+	pthread_mutex_lock(&reclaimer->lock);
+	for (;;)
+	{
+		while (reclaimer->head == NULL && !reclaimer->stopping)
+			pthread_cond_wait(&reclaimer->wake, &reclaimer->lock);
+		if (reclaimer->head == NULL)
+			break;
+
+		CIFS_RECLAIM_ITEM_TYPE* item = reclaimer->head;
+		reclaimer->head = item->next;
+		if (reclaimer->head == NULL)
+			reclaimer->tail = NULL;
+		pthread_mutex_unlock(&reclaimer->lock);
+
+		cifsReclaimBlocks(item);
+		free(item);
+
+		pthread_mutex_lock(&reclaimer->lock);
+		reclaimer->reclaimed++;
+		pthread_cond_broadcast(&reclaimer->done);
+	}
+	pthread_mutex_unlock(&reclaimer->lock);
+
+	return NULL;
+}
+
+/***
+ *
+ * Starts the reclaimer thread of the mounted volume, unless cifsDeferredReclaim is 0.
+ *
+ */
+CIFS_ERROR cifsReclaimerOpen(void)
+{
+	if (!cifsDeferredReclaim)
+		return CIFS_NO_ERROR;
+
+	CIFS_RECLAIMER_TYPE* reclaimer = calloc(1, sizeof(CIFS_RECLAIMER_TYPE));
+	if (reclaimer == NULL)
+		return CIFS_ALLOC_ERROR;
+
+	pthread_mutex_init(&reclaimer->lock, NULL);
+	pthread_cond_init(&reclaimer->wake, NULL);
+	pthread_cond_init(&reclaimer->done, NULL);
+
+	if (pthread_create(&reclaimer->thread, NULL, cifsReclaimerThread, reclaimer) != 0)
+	{
+		pthread_mutex_destroy(&reclaimer->lock);
+		pthread_cond_destroy(&reclaimer->wake);
+		pthread_cond_destroy(&reclaimer->done);
+		free(reclaimer);
+		return CIFS_SYSTEM_ERROR;
+	}
+
+	cifsContext->reclaimer = reclaimer;
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Frees everything that is still queued, and finishes the reclaimer thread.
+ *
+ */
+void cifsReclaimerClose(void)
+{
+	CIFS_RECLAIMER_TYPE* reclaimer = cifsContext->reclaimer;
+	if (reclaimer == NULL)
+		return;
+
+	pthread_mutex_lock(&reclaimer->lock);
+	reclaimer->stopping = 1;
+	pthread_cond_signal(&reclaimer->wake);
+	pthread_mutex_unlock(&reclaimer->lock);
+	pthread_join(reclaimer->thread, NULL);
+
+	cifsContext->reclaimer = NULL;
+	pthread_mutex_destroy(&reclaimer->lock);
+	pthread_cond_destroy(&reclaimer->wake);
+	pthread_cond_destroy(&reclaimer->done);
+	free(reclaimer);
+}
+
+/***
+ *
+ * Waits until the reclaimer has freed everything queued before the call; the caller must not hold any lock
+ * of the file system.
+ *
+ */
+void cifsReclaimWait(void)
+{
+	CIFS_RECLAIMER_TYPE* reclaimer = cifsContext->reclaimer;
+	if (reclaimer == NULL)
+		return;
+
+	pthread_mutex_lock(&reclaimer->lock);
+	unsigned long long target = reclaimer->queued;
+	while (reclaimer->reclaimed < target)
+		pthread_cond_wait(&reclaimer->done, &reclaimer->lock);
+	pthread_mutex_unlock(&reclaimer->lock);
+}
+
+/***
+ *
+ * Returns an empty item with room for the given number of single blocks, for cifsQueueReclaim(); NULL if the
+ * blocks are not reclaimed in the background, or there is not enough memory, and the caller must free them.
+ *
+ */
+CIFS_RECLAIM_ITEM_TYPE* cifsReclaimItem(unsigned int capacity)
+{
+	if (cifsContext->reclaimer == NULL)
+		return NULL;
+
+	CIFS_RECLAIM_ITEM_TYPE* item = malloc(sizeof(CIFS_RECLAIM_ITEM_TYPE) + capacity * sizeof(CIFS_INDEX_TYPE));
+	if (item == NULL)
+		return NULL;
+	item->next = NULL;
+	item->chain = CIFS_INVALID_INDEX;
+	item->count = 0;
+
+	return item;
+}
+
+/***
+ *
+ * Hands the blocks of the item (see cifsReclaimItem()) to the reclaimer, which releases the item.
+ *
+ */
+void cifsQueueReclaim(CIFS_RECLAIM_ITEM_TYPE* item)
+{
+	if (item->chain == CIFS_INVALID_INDEX && item->count == 0)
+	{
+		free(item);
+		return;
+	}
+
+	CIFS_RECLAIMER_TYPE* reclaimer = cifsContext->reclaimer;
+	pthread_mutex_lock(&reclaimer->lock);
+	if (reclaimer->tail != NULL)
+		reclaimer->tail->next = item;
+	else
+		reclaimer->head = item;
+	reclaimer->tail = item;
+	reclaimer->queued++;
+	pthread_cond_signal(&reclaimer->wake);
+	pthread_mutex_unlock(&reclaimer->lock);
+}
+
+/***
+ *
+ * Releases the index chain and all data blocks it refers to, in the background if there is a reclaimer.
+ * Returns 1 if the blocks were freed already, and the bitvector needs to be saved.
+ *
+ */
+static int cifsReclaimChain(CIFS_INDEX_TYPE indexBlock)
+{
+	if (indexBlock == CIFS_INVALID_INDEX)
+		return 0;
+
+	CIFS_RECLAIM_ITEM_TYPE* item = cifsReclaimItem(0);
+	if (item == NULL)
+	{
+		cifsFreeIndexChain(indexBlock);
+		return 1;
+	}
+
+	item->chain = indexBlock;
+	cifsQueueReclaim(item);
+
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Slab allocator
+///
+//////////////////////////////////////////////////////////////////////////
+
+#define CIFS_SLAB_ALIGNMENT _Alignof(max_align_t)
+#define CIFS_SLAB_ROUND(size) (((size) + CIFS_SLAB_ALIGNMENT - 1) / CIFS_SLAB_ALIGNMENT * CIFS_SLAB_ALIGNMENT)
+
+/***
+ *
+ * Prepares an empty slab of nodes of the given size; no memory is taken until the first allocation.
+ *
+ */
+void cifsSlabInit(CIFS_SLAB_TYPE* slab, size_t nodeSize)
+{
+	slab->nodeSize = CIFS_SLAB_ROUND(nodeSize < sizeof(void*) ? sizeof(void*) : nodeSize);
+	slab->chunks = NULL;
+	slab->freeNodes = NULL;
+	slab->unused = NULL;
+	slab->end = NULL;
+	pthread_mutex_init(&slab->lock, NULL);
+}
+
+/***
+ *
+ * Hands out a node: a released one if there is any, otherwise the next one of the newest chunk; a new
+ * chunk is allocated when that one is used up. Returns NULL if there is no memory.
+ *
+ */
+void* cifsSlabAlloc(CIFS_SLAB_TYPE* slab)
+{
+	void* node = NULL;
+
+	pthread_mutex_lock(&slab->lock);
+	if (slab->freeNodes != NULL)
+	{
+		node = slab->freeNodes;
+		slab->freeNodes = *(void**)node;
+	}
+	else
+	{
+		if (slab->unused == slab->end)
+		{
+			char* chunk = malloc(CIFS_SLAB_ROUND(sizeof(void*)) + CIFS_SLAB_CHUNK * slab->nodeSize);
+			if (chunk != NULL)
+			{
+				*(void**)chunk = slab->chunks;
+				slab->chunks = chunk;
+				slab->unused = chunk + CIFS_SLAB_ROUND(sizeof(void*));
+				slab->end = slab->unused + CIFS_SLAB_CHUNK * slab->nodeSize;
+			}
+		}
+		if (slab->unused != slab->end)
+		{
+			node = slab->unused;
+			slab->unused += slab->nodeSize;
+		}
+	}
+	pthread_mutex_unlock(&slab->lock);
+
+	return node;
+}
+
+/***
+ *
+ * Returns a node to the slab for reuse.
+ *
+ */
+void cifsSlabFree(CIFS_SLAB_TYPE* slab, void* node)
+{
+	if (node == NULL)
+		return;
+
+	pthread_mutex_lock(&slab->lock);
+	*(void**)node = slab->freeNodes;
+	slab->freeNodes = node;
+	pthread_mutex_unlock(&slab->lock);
+}
+
+/***
+ *
+ * Releases all chunks of the slab at once, together with every node still in use.
+ *
+ */
+void cifsSlabDestroy(CIFS_SLAB_TYPE* slab)
+{
+	while (slab->chunks != NULL)
+	{
+		void* chunk = slab->chunks;
+		slab->chunks = *(void**)chunk;
+		free(chunk);
+	}
+	slab->freeNodes = NULL;
+	slab->unused = NULL;
+	slab->end = NULL;
+	pthread_mutex_destroy(&slab->lock);
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// some helper functions
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Returns a hash value within the limits of the registry.
+ *
+ */
+
+inline unsigned long hash(const char* str)
+{
+
+	register unsigned long hash = 5381;
+	register unsigned char c;
+
+	while ((c = *str++) != '\0')
+		hash = ((hash << 5) + hash) ^ c; /* hash * 33 + c */
+
+	return hash % CIFS_REGISTRY_SIZE;
+}
+
+/***
+ *
+ * Find a free block in a bit vector of the volume size (CIFS_BITVECTOR_BITS bits).
+ *
+ * Returns CIFS_INVALID_INDEX if all blocks are taken.
+ *
+ */
+inline CIFS_INDEX_TYPE cifsFindFreeBlock(const unsigned char* bitvector)
+{
+	return cifsFindFreeBlockInRange(bitvector, 0, CIFS_BITVECTOR_BITS);
+}
+
+/***
+ *
+ * Converts between a 64-bit word of the bitvector as it is in memory and its logical value, in which the bit
+ * for the lowest block is the most significant bit (the bitvector stores the bit for the lowest block in the
+ * most significant bit of each byte). The conversion is its own inverse.
+ *
+ */
+static inline unsigned long long cifsBitvectorWordOrder(unsigned long long word)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+/***
+ *
+ * Returns the 64-bit word of the bitvector holding the bit for the block.
+ *
+ * The bitvector must be aligned for unsigned long long (malloc() guarantees it), since all changes of the
+ * bits are atomic operations on whole words; that is what lets threads allocate blocks without a lock.
+ *
+ */
+static inline unsigned long long* cifsBitvectorWord(const unsigned char* bitvector, unsigned int bitIndex)
+{
+	return (unsigned long long*)(bitvector + bitIndex / 64 * sizeof(unsigned long long));
+}
+
+/***
+ *
+ * Returns the in-memory mask of the bits for the blocks [first, last) within one 64-bit word of the bitvector;
+ * both are offsets in the word, with first < last <= 64.
+ *
+ */
+static inline unsigned long long cifsBitvectorMask(unsigned int first, unsigned int last)
+{
+	unsigned long long mask = ~0ULL >> first;
+	if (last < 64)
+		mask &= ~(~0ULL >> last);
+	return cifsBitvectorWordOrder(mask);
+}
+
+/***
+ *
+ * Loads the 64 bits of the bitvector starting at a multiple of 64 as a logical value; concurrent allocation
+ * may change the bits, so the load is atomic.
+ *
+ */
+static inline unsigned long long cifsLoadBitvectorWord(const unsigned char* bytes)
+{
+	return cifsBitvectorWordOrder(__atomic_load_n((const unsigned long long*)bytes, __ATOMIC_RELAXED));
+}
+
+/***
+ *
+ * The scan of cifsFindFreeBlockInRange(), without the instrumentation.
+ *
+ */
+static CIFS_INDEX_TYPE cifsScanFreeBlockInRange(const unsigned char* bitvector, unsigned int first, unsigned int last)
+{
+	unsigned int bit = first;
+
+	// single bits up to the first word boundary
+	while (bit < last && bit % 64 != 0)
+	{
+		if (!cifsTestBit(bitvector, bit))
+			return bit;
+		bit++;
+	}
+
+	for (; bit + 64 <= last; bit += 64)
+	{
+		unsigned long long taken = cifsLoadBitvectorWord(bitvector + bit / 8);
+		if (taken != ~0ULL)
+			return bit + __builtin_clzll(~taken);
+	}
+
+	// single bits after the last full word
+	for (; bit < last; bit++)
+		if (!cifsTestBit(bitvector, bit))
+			return bit;
+
+	return CIFS_INVALID_INDEX;
+}
+
+/***
+ *
+ * Find the first free block in [first, last) of a bit vector.
+ *
+ * Whole 64-bit words are scanned at a time, and the first "0" in a word that is not all "1" is
+ * located with a count-leading-zeros instruction. Only the bytes covering [first, last) are read.
+ *
+ * Returns CIFS_INVALID_INDEX if all blocks in the range are taken.
+ *
+ */
+CIFS_INDEX_TYPE cifsFindFreeBlockInRange(const unsigned char* bitvector, unsigned int first, unsigned int last)
+{
+	CIFS_INDEX_TYPE found = cifsScanFreeBlockInRange(bitvector, first, last);
+	CIFS_STATS_ADD(bitvectorScans, 1);
+	CIFS_STATS_ADD(bitvectorScanBits, (found == CIFS_INVALID_INDEX ? last : found) - first);
+
+	return found;
+}
+
+/***
+ *
+ * Find the first taken block in [first, last) of a bit vector; the same word-at-a-time scan as
+ * cifsFindFreeBlockInRange() but looking for a "1".
+ *
+ * Returns last if all blocks in the range are free, so [first, result) is a run of free blocks
+ * when first is free.
+ *
+ */
+unsigned int cifsFindTakenBlockInRange(const unsigned char* bitvector, unsigned int first, unsigned int last)
+{
+	unsigned int bit = first;
+
+	while (bit < last && bit % 64 != 0)
+	{
+		if (cifsTestBit(bitvector, bit))
+			return bit;
+		bit++;
+	}
+
+	for (; bit + 64 <= last; bit += 64)
+	{
+		unsigned long long taken = cifsLoadBitvectorWord(bitvector + bit / 8);
+		if (taken != 0)
+			return bit + __builtin_clzll(taken);
+	}
+
+	for (; bit < last; bit++)
+		if (cifsTestBit(bitvector, bit))
+			return bit;
+
+	return last;
+}
+
+/***
+ *
+ * Find a free block searching from the given block to the end of the bit vector, and then wrapping
+ * around from its beginning.
+ *
+ * Returns CIFS_INVALID_INDEX if all blocks are taken.
+ *
+ */
+CIFS_INDEX_TYPE cifsFindFreeBlockFrom(const unsigned char* bitvector, unsigned int start)
+{
+	if (start >= CIFS_BITVECTOR_BITS)
+		start = 0;
+
+	CIFS_INDEX_TYPE found = cifsFindFreeBlockInRange(bitvector, start, CIFS_BITVECTOR_BITS);
+	if (found == CIFS_INVALID_INDEX && start > 0)
+		found = cifsFindFreeBlockInRange(bitvector, 0, start);
+
+	return found;
+}
+
+/***
+ *
+ * Three functions for bit manipulation.
+ *
+ * Each is a single atomic operation on the 64-bit word holding the bit (see cifsBitvectorWord()), so they
+ * may be used while other threads claim blocks.
+ *
+ */
+inline void cifsFlipBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
+{
+	unsigned long long mask = cifsBitvectorMask(bitIndex % 64, bitIndex % 64 + 1);
+	__atomic_fetch_xor(cifsBitvectorWord(bitvector, bitIndex), mask, __ATOMIC_ACQ_REL);
+}
+
+inline void cifsSetBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
+{
+	unsigned long long mask = cifsBitvectorMask(bitIndex % 64, bitIndex % 64 + 1);
+	__atomic_fetch_or(cifsBitvectorWord(bitvector, bitIndex), mask, __ATOMIC_ACQ_REL);
+}
+
+inline void cifsClearBit(unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
+{
+	unsigned long long mask = cifsBitvectorMask(bitIndex % 64, bitIndex % 64 + 1);
+	__atomic_fetch_and(cifsBitvectorWord(bitvector, bitIndex), ~mask, __ATOMIC_ACQ_REL);
+}
+
+inline int cifsTestBit(const unsigned char* bitvector, CIFS_INDEX_TYPE bitIndex)
+{
+	unsigned long long mask = cifsBitvectorMask(bitIndex % 64, bitIndex % 64 + 1);
+	return (__atomic_load_n(cifsBitvectorWord(bitvector, bitIndex), __ATOMIC_ACQUIRE) & mask) != 0;
+}
+
+/***
+ *
+ * Generates random readable/printable content for testing
+ *
+ */
+
+char* cifsGenerateContent(int size)
+{
+
+	size = (size <= 0 ? rand() % 1000 : size); // arbitrarily chosen as an example
+
+	char* content = malloc(size);
+
+	int firstPrintable = ' ';
+	int len = '~' - firstPrintable;
+
+	for (int i = 0; i < size - 1; i++)
+		*(content + i) = firstPrintable + rand() % len;
+
+	content[size - 1] = '\0';
+	return content;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// registry functions
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ *
+ * Allocates an empty registry.
+ *
+ */
+CIFS_REGISTRY* cifsCreateRegistry(void)
+{
+	CIFS_REGISTRY* registry = calloc(1, sizeof(CIFS_REGISTRY));
+	if (registry == NULL)
+		return NULL;
+
+	registry->slotCount = CIFS_REGISTRY_INITIAL_SLOTS;
+	registry->slots = malloc(registry->slotCount * sizeof(CIFS_REGISTRY_SLOT_TYPE));
+	registry->names.capacity = CIFS_NAME_POOL_INITIAL_SIZE;
+	registry->names.text = malloc(registry->names.capacity);
+	registry->names.setSize = CIFS_REGISTRY_INITIAL_SLOTS;
+	registry->names.set = calloc(registry->names.setSize, sizeof(unsigned int));
+	if (registry->slots == NULL || registry->names.text == NULL || registry->names.set == NULL)
+	{
+		cifsDestroyRegistry(registry);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < registry->slotCount; i++)
+		registry->slots[i].fileHandle = CIFS_INVALID_INDEX;
+
+	return registry;
+}
+
+/***
+ *
+ * Releases the registry; the entries themselves belong to the registry slab.
+ *
+ */
+void cifsDestroyRegistry(CIFS_REGISTRY* registry)
+{
+	if (registry == NULL)
+		return;
+
+	free(registry->slots);
+	free(registry->names.text);
+	free(registry->names.set);
+	free(registry);
+}
+
+static unsigned int cifsNameHash(const char* name)
+{
+	unsigned int hash = 2166136261u; // FNV-1a
+	while (*name != '\0')
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/***
+ *
+ * Returns the hash of a name in the folder with the given file handle; the low bits select the home slot.
+ *
+ */
+unsigned long cifsRegistryHash(CIFS_FILE_HANDLE_TYPE parentFileHandle, const char* name)
+{
+	unsigned int hash = cifsNameHash(name) ^ ((unsigned int)parentFileHandle * 0x9E3779B1u);
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	return hash;
+}
+
+/***
+ *
+ * Returns the offset of the name in the pool, adding it if it is not there yet; UINT_MAX if there is no memory.
+ *
+ */
+static unsigned int cifsInternName(CIFS_NAME_POOL_TYPE* pool, const char* name)
+{
+	if ((pool->count + 1) * 4 > pool->setSize * 3)
+	{
+		unsigned int setSize = pool->setSize * 2;
+		unsigned int* set = calloc(setSize, sizeof(unsigned int));
+		if (set == NULL)
+			return UINT_MAX;
+		for (unsigned int i = 0; i < pool->setSize; i++)
+			if (pool->set[i] != 0)
+			{
+				unsigned int j = cifsNameHash(pool->text + pool->set[i] - 1) & (setSize - 1);
+				while (set[j] != 0)
+					j = (j + 1) & (setSize - 1);
+				set[j] = pool->set[i];
+			}
+		free(pool->set);
+		pool->set = set;
+		pool->setSize = setSize;
+	}
+
+	unsigned int i = cifsNameHash(name) & (pool->setSize - 1);
+	while (pool->set[i] != 0)
+	{
+		if (strcmp(pool->text + pool->set[i] - 1, name) == 0)
+			return pool->set[i] - 1;
+		i = (i + 1) & (pool->setSize - 1);
+	}
+
+	size_t length = strlen(name) + 1;
+	if (pool->used + length > pool->capacity)
+	{
+		size_t capacity = pool->capacity * 2 > pool->used + length ? pool->capacity * 2 : pool->used + length;
+		char* text = realloc(pool->text, capacity);
+		if (text == NULL)
+			return UINT_MAX;
+		pool->text = text;
+		pool->capacity = capacity;
+	}
+
+	unsigned int offset = pool->used;
+	memcpy(pool->text + offset, name, length);
+	pool->used += length;
+	pool->set[i] = offset + 1;
+	pool->count++;
+	return offset;
+}
+
+/***
+ *
+ * Doubles the number of slots of the registry; returns 0 if there is no memory.
+ *
+ */
+static int cifsGrowRegistry(CIFS_REGISTRY* registry)
+{
+	unsigned int slotCount = registry->slotCount * 2;
+	CIFS_REGISTRY_SLOT_TYPE* slots = malloc(slotCount * sizeof(CIFS_REGISTRY_SLOT_TYPE));
+	if (slots == NULL)
+		return 0;
+
+	for (unsigned int i = 0; i < slotCount; i++)
+		slots[i].fileHandle = CIFS_INVALID_INDEX;
+	for (unsigned int i = 0; i < registry->slotCount; i++)
+		if (registry->slots[i].fileHandle != CIFS_INVALID_INDEX)
+		{
+			unsigned int j = registry->slots[i].hash & (slotCount - 1);
+			while (slots[j].fileHandle != CIFS_INVALID_INDEX)
+				j = (j + 1) & (slotCount - 1);
+			slots[j] = registry->slots[i];
+		}
+
+	free(registry->slots);
+	registry->slots = slots;
+	registry->slotCount = slotCount;
+	return 1;
+}
+
+/***
+ *
+ * Finds the registry entry for a name in the folder with the given file handle; NULL if there is none.
+ *
+ */
+CIFS_REGISTRY_ENTRY_TYPE* cifsRegistryFind(CIFS_FILE_HANDLE_TYPE parentFileHandle, const char* name)
+{
+	CIFS_REGISTRY* registry = cifsContext->registry;
+	unsigned int hash = cifsRegistryHash(parentFileHandle, name);
+	unsigned int mask = registry->slotCount - 1;
+
+	CIFS_REGISTRY_ENTRY_TYPE* found = NULL;
+	unsigned int probes = 0;
+	for (unsigned int i = hash & mask; registry->slots[i].fileHandle != CIFS_INVALID_INDEX; i = (i + 1) & mask)
+	{
+		CIFS_REGISTRY_SLOT_TYPE* slot = &registry->slots[i];
+		probes++;
+		if (slot->hash == hash && slot->parentFileHandle == (CIFS_INDEX_TYPE)parentFileHandle
+			&& strcmp(registry->names.text + slot->nameOffset, name) == 0)
+		{
+			found = cifsContext->handles[slot->fileHandle];
+			break;
+		}
+	}
+	CIFS_STATS_ADD(registryLookups, 1);
+	CIFS_STATS_ADD(registryProbes, probes);
+
+	return found;
+}
+
+/***
+ *
+ * Unlinks the entry from the registry and releases it.
+ *
+ */
+void cifsRegistryRemove(CIFS_REGISTRY_ENTRY_TYPE* entry)
+{
+	CIFS_REGISTRY* registry = cifsContext->registry;
+	CIFS_INDEX_TYPE fileHandle = entry->fileDescriptor.file_block_ref;
+	unsigned int mask = registry->slotCount - 1;
+
+	unsigned int hole = cifsRegistryHash(entry->parentFileHandle, entry->fileDescriptor.name) & mask;
+	while (registry->slots[hole].fileHandle != fileHandle)
+		hole = (hole + 1) & mask;
+
+	// move back every later slot of the run that may live in the hole, so that the probes still find them
+	for (unsigned int i = (hole + 1) & mask; registry->slots[i].fileHandle != CIFS_INVALID_INDEX; i = (i + 1) & mask)
+	{
+		unsigned int home = registry->slots[i].hash & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask))
+		{
+			registry->slots[hole] = registry->slots[i];
+			hole = i;
+		}
+	}
+	registry->slots[hole].fileHandle = CIFS_INVALID_INDEX;
+	registry->count--;
+
+	cifsContext->handles[fileHandle] = NULL;
+	pthread_rwlock_destroy(&entry->lock);
+	free(entry->blockMap);
+	cifsSlabFree(&cifsContext->registrySlab, entry);
+
+	// cached paths may lead to the removed entry
+	cifsContext->dentryPositiveGeneration++;
+}
+
+/***
+ *
+ * Walks the path from the root, one registry probe per component; NULL if a component is missing or a
+ * component other than the last is not a folder. Leading, trailing, and repeated slashes are ignored.
+ *
+ */
+static CIFS_REGISTRY_ENTRY_TYPE* cifsWalkPath(const char* filePath)
+{
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[cifsContext->superblock->cifsRootNodeIndex];
+	CIFS_NAME_TYPE component;
+
+	while (entry != NULL)
+	{
+		while (*filePath == '/')
+			filePath++;
+		if (*filePath == '\0')
+			break;
+
+		size_t length = strcspn(filePath, "/");
+		if (length >= CIFS_MAX_NAME_LENGTH || entry->fileDescriptor.type != CIFS_FOLDER_CONTENT_TYPE)
+			return NULL;
+		memcpy(component, filePath, length);
+		component[length] = '\0';
+		filePath += length;
+
+		entry = cifsRegistryFind(entry->fileDescriptor.file_block_ref, component);
+	}
+
+	return entry;
+}
+
+/***
+ *
+ * Resolves a path to its registry entry; NULL if the path does not name an existing file or folder.
+ *
+ * Paths are relative to the root, with or without the leading slash; "/" is the root. Recent outcomes, both
+ * hits and misses, are remembered in the path cache.
+ *
+ */
+CIFS_REGISTRY_ENTRY_TYPE* cifsResolvePath(const char* filePath)
+{
+	size_t length = strnlen(filePath, CIFS_MAX_NAME_LENGTH);
+	if (length == 0)
+		return NULL;
+	if (cifsContext->dentries == NULL || length >= CIFS_MAX_NAME_LENGTH)
+		return cifsWalkPath(filePath);
+
+	unsigned int hash = cifsNameHash(filePath);
+	CIFS_DENTRY_TYPE* dentry = &cifsContext->dentries[hash & (CIFS_DENTRY_CACHE_SIZE - 1)];
+	pthread_mutex_lock(&cifsContext->dentryLock);
+	if (dentry->hash == hash && strcmp(dentry->path, filePath) == 0)
+	{
+		int hit = 0;
+		CIFS_REGISTRY_ENTRY_TYPE* entry = NULL;
+		if (dentry->fileHandle != CIFS_INVALID_INDEX)
+		{
+			if ((hit = dentry->generation == cifsContext->dentryPositiveGeneration))
+				entry = cifsContext->handles[dentry->fileHandle];
+		}
+		else
+			hit = dentry->generation == cifsContext->dentryNegativeGeneration;
+		if (hit)
+		{
+			pthread_mutex_unlock(&cifsContext->dentryLock);
+			return entry;
+		}
+	}
+	pthread_mutex_unlock(&cifsContext->dentryLock);
+
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsWalkPath(filePath);
+
+	pthread_mutex_lock(&cifsContext->dentryLock);
+	dentry->hash = hash;
+	memcpy(dentry->path, filePath, length + 1);
+	if (entry != NULL)
+	{
+		dentry->fileHandle = entry->fileDescriptor.file_block_ref;
+		dentry->generation = cifsContext->dentryPositiveGeneration;
+	}
+	else
+	{
+		dentry->fileHandle = CIFS_INVALID_INDEX;
+		dentry->generation = cifsContext->dentryNegativeGeneration;
+	}
+	pthread_mutex_unlock(&cifsContext->dentryLock);
+
+	return entry;
+}
+
+/***
+ *
+ * Resolves the folder that holds (or would hold) the file at the given path and copies the last component
+ * of the path to name; NULL if there is no such folder or the path has no last component.
+ *
+ */
+CIFS_REGISTRY_ENTRY_TYPE* cifsResolveParent(const char* filePath, CIFS_NAME_TYPE name)
+{
+	size_t end = strnlen(filePath, CIFS_MAX_NAME_LENGTH);
+	if (end >= CIFS_MAX_NAME_LENGTH)
+		return NULL;
+	while (end > 0 && filePath[end - 1] == '/')
+		end--;
+	size_t start = end;
+	while (start > 0 && filePath[start - 1] != '/')
+		start--;
+	if (start == end)
+		return NULL;
+
+	memcpy(name, filePath + start, end - start);
+	name[end - start] = '\0';
+
+	CIFS_NAME_TYPE folderPath;
+	memcpy(folderPath, filePath, start);
+	folderPath[start] = '\0';
+
+	CIFS_REGISTRY_ENTRY_TYPE* parent = cifsResolvePath(start == 0 ? "/" : folderPath);
+	if (parent == NULL || parent->fileDescriptor.type != CIFS_FOLDER_CONTENT_TYPE)
+		return NULL;
+
+	return parent;
+}
+
+/***
+ *
+ * Returns the access rights that the user from the FUSE context has to the file expressed as owner
+ * bits (S_IRUSR, S_IWUSR, S_IXUSR).
+ *
+ */
+mode_t cifsGrantedAccessRights(const CIFS_FILE_DESCRIPTOR_TYPE* fd)
+{
+	if (fd->owner == fuseContext->uid)
+		return fd->accessRights & S_IRWXU;
+
+	return (fd->accessRights & S_IRWXO) << 6; // shift the "others" bits into the owner position
+}
+
+/*******
+ * Some extra helper functions
+ */
+int doesFileExist(char* filePath) {
+	return cifsResolvePath(filePath) != NULL;
+}
+
+/***
+ *
+ * A file descriptor to be read while the registry is built, and the folder that lists it.
+ *
+ */
+typedef struct cifs_mount_request_type
+{
+	CIFS_INDEX_TYPE blockNumber;
+	CIFS_FILE_HANDLE_TYPE parentFileHandle;
+	CIFS_REGISTRY_ENTRY_TYPE* entry; // set once the descriptor is in the registry
+} CIFS_MOUNT_REQUEST_TYPE;
+
+/***
+ *
+ * The descriptors of one level of the tree, shared by the mount workers; each worker claims
+ * CIFS_MOUNT_CHUNK requests at a time.
+ *
+ */
+typedef struct cifs_mount_work_type
+{
+	CIFS_MOUNT_REQUEST_TYPE* requests;
+	int count;
+	int next; // first request not claimed yet
+	CIFS_ERROR failed; // of the first worker that failed
+	int fd;
+} CIFS_MOUNT_WORK_TYPE;
+
+static int cifsCompareMountRequests(const void* a, const void* b)
+{
+	const CIFS_MOUNT_REQUEST_TYPE* x = a;
+	const CIFS_MOUNT_REQUEST_TYPE* y = b;
+	return (x->blockNumber > y->blockNumber) - (x->blockNumber < y->blockNumber);
+}
+
+/***
+ *
+ * Reads the claimed descriptors with positional I/O (or straight from the mapping) and adds them to the
+ * registry. Runs on the mount workers as well as on the mounting thread.
+ *
+ * A descriptor that cannot be read fails the work with CIFS_READ_ERROR, and is not registered; so does one listed
+ * a second time, by another folder or by one of its own descendants, since its handle is taken already.
+ *
+ */
+static void* cifsMountWorker(void* arg)
+{
+	CIFS_MOUNT_WORK_TYPE* work = arg;
+	CIFS_BLOCK_TYPE blocks[CIFS_MOUNT_CHUNK];
+	CIFS_BLOCK_REQUEST_TYPE blockRequests[CIFS_MOUNT_CHUNK];
+	struct iovec iov[CIFS_MOUNT_CHUNK];
+
+	for (;;)
+	{
+		int first = __atomic_fetch_add(&work->next, CIFS_MOUNT_CHUNK, __ATOMIC_RELAXED);
+		if (first >= work->count)
+			break;
+		int count = work->count - first < CIFS_MOUNT_CHUNK ? work->count - first : CIFS_MOUNT_CHUNK;
+
+		for (int i = 0; i < count; i++)
+		{
+			blockRequests[i].blockNumber = work->requests[first + i].blockNumber;
+			blockRequests[i].position = i;
+			blockRequests[i].buffer = (unsigned char*)&blocks[i];
+		}
+		if (cifsVolumeMap != NULL)
+			for (int i = 0; i < count; i++)
+				cifsDeviceReadBlock(blockRequests[i].buffer, blockRequests[i].blockNumber);
+		else
+			cifsTransferSortedBlocks(0, work->fd, blockRequests, count, iov);
+
+		for (int i = 0; i < count; i++)
+		{
+			CIFS_FILE_DESCRIPTOR_TYPE descriptor = blocks[i].content.fileDescriptor;
+			CIFS_ERROR error = CIFS_NO_ERROR;
+			if (cifsVolumeMap == NULL && blockRequests[i].missing)
+				error = CIFS_READ_ERROR;
+			else if (descriptor.file_block_ref != blockRequests[i].blockNumber)
+				error = CIFS_READ_ERROR; // not a descriptor; it would be registered under another handle
+			else if ((work->requests[first + i].entry =
+						  addToHashTable(work->requests[first + i].parentFileHandle, &descriptor)) == NULL)
+				// the handle was claimed under the registry lock, which this thread has taken since
+				error = cifsContext->handles[descriptor.file_block_ref] != NULL ? CIFS_READ_ERROR : CIFS_ALLOC_ERROR;
+			if (error != CIFS_NO_ERROR)
+			{
+				CIFS_ERROR none = CIFS_NO_ERROR;
+				__atomic_compare_exchange_n(&work->failed, &none, error, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/***
+ *
+ * Adds everything below the given folder to the registry, one level of the tree at a time.
+ *
+ * For each level the index chains of all folders are walked together, fetching one index block of every
+ * folder in a single batch, so the reads of different folders overlap. The descriptors listed by the level
+ * are then sorted by the block number and read by a pool of workers that fill the registry concurrently
+ * under the bucket locks; the folders among them make up the next level. Levels smaller than one chunk
+ * per worker are read by the mounting thread alone.
+ *
+ */
+CIFS_ERROR traverseDisk(CIFS_FILE_DESCRIPTOR_TYPE* root)
+{
+	CIFS_ERROR error = CIFS_NO_ERROR;
+
+	// block numbers read from the volume are checked before anything is looked up by them
+	CIFS_FILE_DESCRIPTOR_TYPE** folders = malloc(sizeof(*folders));
+	int folderCount = 0;
+	if (folders == NULL)
+		return CIFS_ALLOC_ERROR;
+	folders[folderCount++] = root;
+
+	while (folderCount > 0 && error == CIFS_NO_ERROR)
+	{
+		// 1) list the children of the level; walk the index chains of all folders side by side
+		CIFS_INDEX_TYPE* indexRefs = malloc(folderCount * sizeof(CIFS_INDEX_TYPE));
+		size_t* remaining = malloc(folderCount * sizeof(size_t));
+		int* active = malloc(folderCount * sizeof(int));
+		CIFS_BLOCK_TYPE* indexBlocks = malloc(folderCount * sizeof(CIFS_BLOCK_TYPE));
+		unsigned char** buffers = malloc(folderCount * sizeof(unsigned char*));
+		size_t total = 0;
+		int activeCount = 0;
+		if (indexRefs != NULL && remaining != NULL && active != NULL && indexBlocks != NULL && buffers != NULL)
+		{
+			for (int f = 0; f < folderCount; f++)
+				if (folders[f]->size > 0 && folders[f]->block_ref >= CIFS_NUMBER_OF_BLOCKS
+					&& folders[f]->block_ref != CIFS_INVALID_INDEX)
+					error = CIFS_READ_ERROR;
+				else if (folders[f]->size > 0 && folders[f]->block_ref != CIFS_INVALID_INDEX)
+				{
+					indexRefs[activeCount] = folders[f]->block_ref;
+					remaining[activeCount] = folders[f]->size;
+					active[activeCount++] = f;
+					total += folders[f]->size;
+				}
+		}
+		else
+			error = CIFS_ALLOC_ERROR;
+
+		CIFS_MOUNT_REQUEST_TYPE* requests = error == CIFS_NO_ERROR && total > 0
+			? malloc(total * sizeof(CIFS_MOUNT_REQUEST_TYPE)) : NULL;
+		if (total > 0 && requests == NULL)
+			error = CIFS_ALLOC_ERROR;
+		int count = 0;
+
+		while (activeCount > 0 && error == CIFS_NO_ERROR)
+		{
+			for (int a = 0; a < activeCount; a++)
+				buffers[a] = (unsigned char*)&indexBlocks[a];
+			cifsReadBlocks(indexRefs, buffers, activeCount);
+
+			int stillActive = 0;
+			for (int a = 0; a < activeCount; a++)
+			{
+				CIFS_INDEX_TYPE* index = indexBlocks[a].content.index;
+				size_t listed = remaining[a] < CIFS_INDEX_SIZE - 1 ? remaining[a] : CIFS_INDEX_SIZE - 1;
+				for (size_t i = 0; i < listed; i++)
+				{
+					if (index[i] >= CIFS_NUMBER_OF_BLOCKS)
+					{
+						error = CIFS_READ_ERROR;
+						break;
+					}
+					requests[count].blockNumber = index[i];
+					requests[count].parentFileHandle = folders[active[a]]->file_block_ref;
+					requests[count++].entry = NULL;
+				}
+
+				CIFS_INDEX_TYPE next = index[CIFS_INDEX_SIZE - 1];
+				if (remaining[a] > listed && next >= CIFS_NUMBER_OF_BLOCKS && next != CIFS_INVALID_INDEX)
+					error = CIFS_READ_ERROR;
+				else if (remaining[a] > listed && next != CIFS_INVALID_INDEX)
+				{
+					indexRefs[stillActive] = next;
+					remaining[stillActive] = remaining[a] - listed;
+					active[stillActive++] = active[a];
+				}
+			}
+			activeCount = stillActive;
+		}
+
+		free(indexRefs);
+		free(remaining);
+		free(active);
+		free(indexBlocks);
+		free(buffers);
+
+		// 2) read the descriptors of the level and add them to the registry
+		if (error == CIFS_NO_ERROR && count > 0)
+		{
+			qsort(requests, count, sizeof(CIFS_MOUNT_REQUEST_TYPE), cifsCompareMountRequests);
+
+			CIFS_MOUNT_WORK_TYPE work = { .requests = requests, .count = count, .next = 0, .failed = 0, .fd = -1 };
+			if (cifsVolumeMap == NULL)
+				work.fd = fileno(cifsVolume);
+
+			int threadCount = count / CIFS_MOUNT_CHUNK < CIFS_MOUNT_THREADS ? count / CIFS_MOUNT_CHUNK : CIFS_MOUNT_THREADS;
+			pthread_t threads[CIFS_MOUNT_THREADS];
+			int started = 0;
+			if (threadCount > 1)
+				while (started < threadCount && pthread_create(&threads[started], NULL, cifsMountWorker, &work) == 0)
+					started++;
+			if (started == 0)
+				cifsMountWorker(&work);
+			for (int t = 0; t < started; t++)
+				pthread_join(threads[t], NULL);
+
+			error = work.failed;
+		}
+
+		// 3) the folders of this level are listed next
+		free(folders);
+		folders = NULL;
+		folderCount = 0;
+		if (error == CIFS_NO_ERROR && count > 0)
+		{
+			folders = malloc(count * sizeof(*folders));
+			if (folders == NULL)
+				error = CIFS_ALLOC_ERROR;
+			else
+				for (int i = 0; i < count; i++)
+					if (requests[i].entry->fileDescriptor.type == CIFS_FOLDER_CONTENT_TYPE)
+						folders[folderCount++] = &requests[i].entry->fileDescriptor;
+		}
+		free(requests);
+	}
+
+	free(folders);
+	return error;
+}
+
+/***
+ *
+ * Returns the malloc'd name of the registry snapshot kept next to the volume.
+ *
+ */
+static char* cifsSnapshotFileName(const char* cifsFileName)
+{
+	char* name = malloc(strlen(cifsFileName) + sizeof(CIFS_SNAPSHOT_SUFFIX));
+	if (name != NULL)
+	{
+		strcpy(name, cifsFileName);
+		strcat(name, CIFS_SNAPSHOT_SUFFIX);
+	}
+	return name;
+}
+
+/***
+ *
+ * Writes the registry to the snapshot file under the current generation of the superblock; the file is on
+ * the disk when this returns CIFS_NO_ERROR.
+ *
+ */
+CIFS_ERROR cifsSaveRegistrySnapshot(char* cifsFileName)
+{
+	unsigned int recordCount = 0;
+	size_t namesSize = 0;
+	for (CIFS_INDEX_TYPE handle = 0; handle < CIFS_NUMBER_OF_BLOCKS; handle++)
+		if (cifsContext->handles[handle] != NULL)
+		{
+			recordCount++;
+			namesSize += strnlen(cifsContext->handles[handle]->fileDescriptor.name, CIFS_MAX_NAME_LENGTH - 1) + 1;
+		}
+
+	size_t size = sizeof(CIFS_SNAPSHOT_HEADER_TYPE) + recordCount * sizeof(CIFS_SNAPSHOT_RECORD_TYPE) + namesSize;
+	unsigned char* image = calloc(1, size); // zeroed, so the padding of the records is predictable
+	char* snapshotName = cifsSnapshotFileName(cifsFileName);
+	if (image == NULL || snapshotName == NULL)
+	{
+		free(image);
+		free(snapshotName);
+		return CIFS_ALLOC_ERROR;
+	}
+
+	CIFS_SNAPSHOT_HEADER_TYPE* header = (CIFS_SNAPSHOT_HEADER_TYPE*)image;
+	header->magic = CIFS_SNAPSHOT_MAGIC;
+	header->generation = cifsContext->superblock->cifsGeneration;
+	header->recordCount = recordCount;
+	header->namesSize = namesSize;
+
+	CIFS_SNAPSHOT_RECORD_TYPE* records = (CIFS_SNAPSHOT_RECORD_TYPE*)(header + 1);
+	char* names = (char*)(records + recordCount);
+	unsigned int record = 0;
+	size_t nameOffset = 0;
+	for (CIFS_INDEX_TYPE handle = 0; handle < CIFS_NUMBER_OF_BLOCKS; handle++)
+	{
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[handle];
+		if (entry == NULL)
+			continue;
+
+		CIFS_FILE_DESCRIPTOR_TYPE* fd = &entry->fileDescriptor;
+		records[record].identifier = fd->identifier;
+		records[record].parentFileHandle = entry->parentFileHandle;
+		records[record].nameOffset = nameOffset;
+		records[record].descriptorBlock = handle;
+		records[record].type = fd->type;
+		records[record].creationTime = fd->creationTime;
+		records[record].lastAccessTime = fd->lastAccessTime;
+		records[record].lastModificationTime = fd->lastModificationTime;
+		records[record].accessRights = fd->accessRights;
+		records[record].owner = fd->owner;
+		records[record].size = fd->size;
+		records[record].block_ref = fd->block_ref;
+		records[record].inlined = fd->inlined;
+		record++;
+
+		size_t length = strnlen(fd->name, CIFS_MAX_NAME_LENGTH - 1);
+		memcpy(names + nameOffset, fd->name, length); // the terminator is already there
+		nameOffset += length + 1;
+	}
+
+	CIFS_ERROR error = CIFS_WRITE_ERROR;
+	FILE* snapshot = fopen(snapshotName, "w");
+	if (snapshot != NULL)
+	{
+		if (fwrite(image, size, 1, snapshot) == 1 && fflush(snapshot) == 0 && fsync(fileno(snapshot)) == 0)
+			error = CIFS_NO_ERROR;
+		if (fclose(snapshot) != 0)
+			error = CIFS_WRITE_ERROR;
+	}
+	if (error != CIFS_NO_ERROR)
+		CIFS_TRACE(CIFS_TRACE_ERROR, "SNAPSHOT: cannot write \"%s\"\n", snapshotName);
+
+	free(image);
+	free(snapshotName);
+	return error;
+}
+
+/***
+ *
+ * Fills the registry from the snapshot file with a single read. Returns CIFS_NOT_FOUND_ERROR, leaving the
+ * registry empty, if there is no snapshot or it does not match the volume.
+ *
+ * Every record is checked as the traversal would check the descriptor: a block is described once, by a file
+ * or a folder whose block numbers are on the volume and whose inline content fits in the descriptor block, and
+ * the parent is another folder of the snapshot; only the root has none.
+ *
+ */
+CIFS_ERROR cifsLoadRegistrySnapshot(char* cifsFileName)
+{
+	if (cifsContext->superblock->cifsSnapshotGeneration == 0)
+		return CIFS_NOT_FOUND_ERROR;
+
+	char* snapshotName = cifsSnapshotFileName(cifsFileName);
+	if (snapshotName == NULL)
+		return CIFS_ALLOC_ERROR;
+	FILE* snapshot = fopen(snapshotName, "r");
+	free(snapshotName);
+	if (snapshot == NULL)
+		return CIFS_NOT_FOUND_ERROR;
+
+	struct stat status;
+	unsigned char* image = NULL;
+	size_t size = 0;
+	if (fstat(fileno(snapshot), &status) == 0 && status.st_size >= (off_t)sizeof(CIFS_SNAPSHOT_HEADER_TYPE))
+	{
+		size = status.st_size;
+		image = malloc(size);
+		if (image != NULL && fread(image, size, 1, snapshot) != 1)
+		{
+			free(image);
+			image = NULL;
+		}
+	}
+	fclose(snapshot);
+	if (image == NULL)
+		return CIFS_NOT_FOUND_ERROR;
+
+	// check everything before touching the registry
+	CIFS_SNAPSHOT_HEADER_TYPE* header = (CIFS_SNAPSHOT_HEADER_TYPE*)image;
+	CIFS_SNAPSHOT_RECORD_TYPE* records = (CIFS_SNAPSHOT_RECORD_TYPE*)(header + 1);
+	int valid = header->magic == CIFS_SNAPSHOT_MAGIC
+		&& header->generation == cifsContext->superblock->cifsSnapshotGeneration
+		&& header->recordCount <= CIFS_NUMBER_OF_BLOCKS
+		&& size == sizeof(*header) + (size_t)header->recordCount * sizeof(*records) + header->namesSize;
+	char* names = valid ? (char*)(records + header->recordCount) : NULL;
+	unsigned char* described = valid ? calloc(CIFS_NUMBER_OF_BLOCKS, 1) : NULL; // the type + 1 of each block
+	if (valid && described == NULL)
+	{
+		free(image);
+		return CIFS_ALLOC_ERROR;
+	}
+	CIFS_INDEX_TYPE rootIndex = cifsContext->superblock->cifsRootNodeIndex;
+	int hasRoot = 0;
+	for (unsigned int i = 0; valid && i < header->recordCount; i++)
+	{
+		CIFS_SNAPSHOT_RECORD_TYPE* record = &records[i];
+		valid = record->descriptorBlock < CIFS_NUMBER_OF_BLOCKS
+			&& !described[record->descriptorBlock]
+			&& (record->type == CIFS_FOLDER_CONTENT_TYPE || record->type == CIFS_FILE_CONTENT_TYPE)
+			&& (record->block_ref < CIFS_NUMBER_OF_BLOCKS || record->block_ref == CIFS_INVALID_INDEX)
+			&& (record->inlined == 0
+				|| (record->inlined == 1 && record->type == CIFS_FILE_CONTENT_TYPE
+					&& record->block_ref == CIFS_INVALID_INDEX && record->size <= CIFS_INLINE_SIZE))
+			&& (record->descriptorBlock == rootIndex
+				? record->parentFileHandle == CIFS_INVALID_INDEX
+				: record->parentFileHandle >= 0 && record->parentFileHandle < CIFS_NUMBER_OF_BLOCKS
+				  && record->parentFileHandle != record->descriptorBlock)
+			&& record->nameOffset < header->namesSize
+			&& memchr(names + record->nameOffset, '\0', header->namesSize - record->nameOffset) != NULL
+			&& strlen(names + record->nameOffset) < CIFS_MAX_NAME_LENGTH;
+		if (valid)
+			described[record->descriptorBlock] = record->type + 1;
+		if (valid && record->descriptorBlock == rootIndex)
+			hasRoot = 1;
+	}
+	for (unsigned int i = 0; valid && i < header->recordCount; i++)
+		if (records[i].descriptorBlock != rootIndex)
+			valid = described[records[i].parentFileHandle] == CIFS_FOLDER_CONTENT_TYPE + 1;
+	free(described);
+	if (!valid || !hasRoot)
+	{
+		CIFS_TRACE(CIFS_TRACE_INFO, "SNAPSHOT: ignoring a snapshot that does not match the volume\n");
+		free(image);
+		return CIFS_NOT_FOUND_ERROR;
+	}
+
+	for (unsigned int i = 0; i < header->recordCount; i++)
+	{
+		CIFS_SNAPSHOT_RECORD_TYPE* record = &records[i];
+		CIFS_FILE_DESCRIPTOR_TYPE fd;
+		memset(&fd, 0, sizeof(fd));
+		fd.identifier = record->identifier;
+		fd.type = record->type;
+		strcpy(fd.name, names + record->nameOffset);
+		fd.creationTime = record->creationTime;
+		fd.lastAccessTime = record->lastAccessTime;
+		fd.lastModificationTime = record->lastModificationTime;
+		fd.accessRights = record->accessRights;
+		fd.owner = record->owner;
+		fd.size = record->size;
+		fd.block_ref = record->block_ref;
+		fd.inlined = record->inlined;
+		fd.parent_block_ref = record->parentFileHandle;
+		fd.file_block_ref = record->descriptorBlock;
+		if (addToHashTable(record->parentFileHandle, &fd) == NULL)
+		{
+			free(image);
+			return CIFS_ALLOC_ERROR;
+		}
+	}
+
+	CIFS_TRACE(CIFS_TRACE_INFO, "SNAPSHOT: loaded %u registry entries\n", header->recordCount);
+	free(image);
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Adds a copy of the descriptor to the registry under the given parent; returns the new entry or NULL.
+ * The registry is locked while the entry is added, so the mount workers may add entries concurrently.
+ *
+ * The handle of the descriptor is claimed under the same lock; NULL is also returned if a descriptor of its block
+ * is in the registry already, which the caller tells by the handle being taken.
+ *
+ */
+CIFS_REGISTRY_ENTRY_TYPE* addToHashTable(CIFS_FILE_HANDLE_TYPE parentFileHandle, CIFS_FILE_DESCRIPTOR_TYPE* fd)
+{
+	CIFS_REGISTRY_ENTRY_TYPE* node = cifsSlabAlloc(&cifsContext->registrySlab);
+	if (!node) return NULL;
+	node->fileDescriptor = *fd;
+	node->parentFileHandle = parentFileHandle;
+	node->referenceCount = 0;
+	node->openFile = NULL;
+	pthread_rwlock_init(&node->lock, NULL);
+	node->blockMap = NULL;
+	node->readAheadOffset = 0;
+	node->readAheadWindow = 0;
+	node->readAheadEnd = 0;
+
+	CIFS_REGISTRY* registry = cifsContext->registry;
+	unsigned int hash = cifsRegistryHash(parentFileHandle, fd->name);
+
+	pthread_mutex_lock(&cifsContext->registryLock);
+	unsigned int nameOffset = UINT_MAX;
+	if (cifsContext->handles[fd->file_block_ref] != NULL
+		|| (nameOffset = cifsInternName(&registry->names, fd->name)) == UINT_MAX
+		|| ((registry->count + 1) * 4 > registry->slotCount * 3 && !cifsGrowRegistry(registry)))
+	{
+		pthread_mutex_unlock(&cifsContext->registryLock);
+		pthread_rwlock_destroy(&node->lock);
+		cifsSlabFree(&cifsContext->registrySlab, node);
+		return NULL;
+	}
+
+	unsigned int mask = registry->slotCount - 1;
+	unsigned int i = hash & mask;
+	while (registry->slots[i].fileHandle != CIFS_INVALID_INDEX)
+		i = (i + 1) & mask;
+	registry->slots[i].hash = hash;
+	registry->slots[i].nameOffset = nameOffset;
+	registry->slots[i].parentFileHandle = parentFileHandle;
+	registry->slots[i].fileHandle = fd->file_block_ref;
+	registry->count++;
+	cifsContext->dentryNegativeGeneration++; // cached misses may name the new entry
+	cifsContext->handles[fd->file_block_ref] = node;
+	pthread_mutex_unlock(&cifsContext->registryLock);
+
+	return node;
+}
+
+/***
+ *
+ * Saves the in-memory bitvector and superblock on the volume.
+ *
+ */
+void writeBvSb(void) {
+	pthread_mutex_lock(&cifsContext->bitvectorLock);
+
+	// write bitvector (Bv); only the blocks holding bits that changed since the last write
+	for (unsigned i = 0; i < CIFS_SUPERBLOCK_INDEX; i++)
+	{
+		// a bit changed after the mark is cleared marks the block again, so it is saved by the next write
+		if (!__atomic_exchange_n(&cifsContext->bitvectorDirty[i], 0, __ATOMIC_ACQ_REL))
+			continue;
+
+		// other threads keep claiming blocks, so the block is copied a word at a time
+		// the blocks freed by the running transaction are free in the bitvector it commits
+		unsigned long long words[CIFS_BLOCK_SIZE / sizeof(unsigned long long)];
+		const unsigned long long* bits = (const unsigned long long*)(cifsContext->bitvector + i * CIFS_BLOCK_SIZE);
+		const unsigned long long* freed = cifsContext->journal != NULL
+										  ? (const unsigned long long*)(cifsContext->journal->freed + i * CIFS_BLOCK_SIZE)
+										  : NULL;
+		for (unsigned j = 0; j < CIFS_BLOCK_SIZE / sizeof(unsigned long long); j++)
+		{
+			words[j] = __atomic_load_n(&bits[j], __ATOMIC_RELAXED);
+			if (freed != NULL)
+				words[j] &= ~__atomic_load_n(&freed[j], __ATOMIC_RELAXED);
+		}
+		cifsWriteBlock((const unsigned char*)words, i);
+	}
+
+	// write superblock (Sb)
+	cifsWriteBlock((const unsigned char*)cifsContext->superblock, CIFS_SUPERBLOCK_INDEX);
+
+	pthread_mutex_unlock(&cifsContext->bitvectorLock);
+}
+
+/***
+ *
+ * Marks the bitvector blocks holding the bits for the blocks [first, last) as dirty.
+ *
+ */
+static void cifsMarkBitvectorDirty(unsigned int first, unsigned int last)
+{
+	for (unsigned int i = first / (CIFS_BLOCK_SIZE * 8); i <= (last - 1) / (CIFS_BLOCK_SIZE * 8); i++)
+		__atomic_store_n(&cifsContext->bitvectorDirty[i], 1, __ATOMIC_RELEASE);
+}
+
+/***
+ *
+ * Marks a block as taken or free in the in-memory bitvector, and the bitvector block holding its bit as dirty.
+ *
+ * With a journal, a freed block stays taken until the running transaction commits (see cifsJournalRelease()).
+ *
+ */
+static void cifsMarkBlock(CIFS_INDEX_TYPE blockNumber, int taken)
+{
+	if (taken)
+		cifsSetBit(cifsContext->bitvector, blockNumber);
+	else if (cifsContext->journal != NULL)
+		cifsSetBit(cifsContext->journal->freed, blockNumber);
+	else
+		cifsClearBit(cifsContext->bitvector, blockNumber);
+	cifsMarkBitvectorDirty(blockNumber, blockNumber + 1);
+}
+
+/***
+ *
+ * Marks a block as taken in the in-memory bitvector, and the bitvector block holding its bit as dirty.
+ *
+ */
+void cifsTakeBlock(CIFS_INDEX_TYPE blockNumber)
+{
+	cifsMarkBlock(blockNumber, 1);
+}
+
+/***
+ *
+ * Marks a block as free in the in-memory bitvector, and the bitvector block holding its bit as dirty.
+ *
+ */
+void cifsReleaseBlock(CIFS_INDEX_TYPE blockNumber)
+{
+	cifsMarkBlock(blockNumber, 0);
+}
+
+/***
+ *
+ * Frees the blocks [first, last) in the in-memory bitvector with one atomic operation per word.
+ *
+ */
+static void cifsReleaseRun(unsigned int first, unsigned int last)
+{
+	for (unsigned int bit = first; bit < last; )
+	{
+		unsigned int wordEnd = (bit / 64 + 1) * 64 < last ? (bit / 64 + 1) * 64 : last;
+		__atomic_fetch_and(cifsBitvectorWord(cifsContext->bitvector, bit),
+						   ~cifsBitvectorMask(bit % 64, (wordEnd - 1) % 64 + 1), __ATOMIC_ACQ_REL);
+		bit = wordEnd;
+	}
+	cifsMarkBitvectorDirty(first, last);
+}
+
+/***
+ *
+ * Takes the free blocks [first, last) in the in-memory bitvector, unless another thread took any of them first.
+ *
+ * Every word is claimed with a compare-and-swap that succeeds only if none of the bits are set, so two threads
+ * can never both take a block. If a bit turns out to be taken, the words claimed so far are freed again.
+ *
+ * Returns 1 if all blocks were taken, and 0 if none were.
+ *
+ */
+static int cifsClaimRun(unsigned int first, unsigned int last)
+{
+	for (unsigned int bit = first; bit < last; )
+	{
+		unsigned int wordEnd = (bit / 64 + 1) * 64 < last ? (bit / 64 + 1) * 64 : last;
+		unsigned long long mask = cifsBitvectorMask(bit % 64, (wordEnd - 1) % 64 + 1);
+		unsigned long long* word = cifsBitvectorWord(cifsContext->bitvector, bit);
+
+		unsigned long long expected = __atomic_load_n(word, __ATOMIC_RELAXED);
+		do
+		{
+			if (expected & mask)
+			{
+				if (bit > first)
+					cifsReleaseRun(first, bit);
+				return 0;
+			}
+		} while (!__atomic_compare_exchange_n(word, &expected, expected | mask, 1,
+											  __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+		bit = wordEnd;
+	}
+	cifsMarkBitvectorDirty(first, last);
+
+	return 1;
+}
+
+/***
+ *
+ * Where the calling thread continues searching for free blocks; CIFS_INVALID_INDEX until it allocates for
+ * the first time.
+ *
+ * Each thread starts in its own region of the volume (see cifsAllocationStart()), so concurrent writers
+ * normally claim bits in different words and do not contend for them.
+ *
+ */
+static _Thread_local CIFS_INDEX_TYPE cifsAllocationCursor = CIFS_INVALID_INDEX;
+
+// the number of threads that started allocating; it selects the region of the next one
+static unsigned int cifsAllocatingThreads;
+
+/***
+ *
+ * Returns the block where the calling thread's search for free blocks starts.
+ *
+ */
+static CIFS_INDEX_TYPE cifsAllocationStart(void)
+{
+	if (cifsAllocationCursor == CIFS_INVALID_INDEX)
+	{
+		unsigned int region = __atomic_fetch_add(&cifsAllocatingThreads, 1, __ATOMIC_RELAXED) % CIFS_ALLOCATION_REGIONS;
+		cifsAllocationCursor = region * (CIFS_BITVECTOR_BITS / CIFS_ALLOCATION_REGIONS);
+	}
+	else if (cifsAllocationCursor >= CIFS_BITVECTOR_BITS)
+		cifsAllocationCursor = 0; // the previous search ended at the last block
+
+	return cifsAllocationCursor;
+}
+
+/***
+ *
+ * Saves a file descriptor in its block on the volume; the inline content of the file stays in the block.
+ *
+ */
+void cifsWriteFileDescriptor(const CIFS_FILE_DESCRIPTOR_TYPE* fd)
+{
+	CIFS_BLOCK_TYPE block;
+	if (fd->inlined)
+		cifsReadBlock((unsigned char*)&block, fd->file_block_ref);
+	else
+		memset(&block, 0, sizeof(block));
+	block.type = fd->type;
+	block.content.fileDescriptor = *fd;
+	cifsWriteBlock((const unsigned char*)&block, fd->file_block_ref);
+}
+
+/***
+ *
+ * Takes a free block from the in-memory bitvector; returns CIFS_INVALID_INDEX if there is none.
+ *
+ * The search starts where the previous one of the same thread ended, so the full blocks in front are not
+ * rescanned. No lock is taken; if another thread claims the block found first, the search goes on after it.
+ *
+ */
+CIFS_INDEX_TYPE cifsAllocateBlock(void)
+{
+	CIFS_INDEX_TYPE start = cifsAllocationStart();
+	for (;;)
+	{
+		CIFS_INDEX_TYPE blockNumber = cifsFindFreeBlockFrom(cifsContext->bitvector, start);
+		if (blockNumber == CIFS_INVALID_INDEX)
+			return CIFS_INVALID_INDEX;
+
+		if (cifsClaimRun(blockNumber, blockNumber + 1))
+		{
+			cifsAllocationCursor = blockNumber + 1;
+			return blockNumber;
+		}
+		start = blockNumber + 1;
+	}
+}
+
+/***
+ *
+ * Compares free runs by decreasing length for sorting.
+ *
+ */
+static int cifsCompareExtentsByLength(const void* a, const void* b)
+{
+	CIFS_INDEX_TYPE x = ((const CIFS_EXTENT_TYPE*)a)->length;
+	CIFS_INDEX_TYPE y = ((const CIFS_EXTENT_TYPE*)b)->length;
+	return (y > x) - (y < x);
+}
+
+/***
+ *
+ * Chooses the given number of free blocks of the in-memory bitvector as runs of consecutive blocks, without
+ * taking them (see cifsAllocateExtents()).
+ *
+ * If there is a single free run that is long enough, the first such run (searching from the given block)
+ * is used, so the blocks are contiguous. Otherwise, the blocks are gathered from the longest runs,
+ * and the remainder is taken from the shortest run that still fits it (best fit), so the number
+ * of fragments stays low.
+ *
+ * Returns an allocated array of runs (to be freed by the caller) and sets numberOfExtents to its
+ * length. Returns NULL if there is not enough free space.
+ *
+ */
+static CIFS_EXTENT_TYPE* cifsFindExtents(unsigned int start, unsigned int numberOfBlocks, int* numberOfExtents)
+{
+	const unsigned char* bitvector = cifsContext->bitvector;
+	CIFS_EXTENT_TYPE* extents;
+
+	// first fit of the whole request in a single run
+	for (int pass = 0; pass < 2; pass++)
+	{
+		unsigned int first = pass == 0 ? start : 0;
+		unsigned int last = pass == 0 ? CIFS_BITVECTOR_BITS : start;
+		for (unsigned int bit = first; bit < last; )
+		{
+			CIFS_INDEX_TYPE runStart = cifsFindFreeBlockInRange(bitvector, bit, last);
+			if (runStart == CIFS_INVALID_INDEX)
+				break;
+			unsigned int runEnd = cifsFindTakenBlockInRange(bitvector, runStart, last);
+			if (runEnd - runStart >= numberOfBlocks)
+			{
+				extents = malloc(sizeof(CIFS_EXTENT_TYPE));
+				if (extents == NULL)
+					return NULL;
+				extents[0].start = runStart;
+				extents[0].length = numberOfBlocks;
+				*numberOfExtents = 1;
+				return extents;
+			}
+			bit = runEnd;
+		}
+	}
+
+	// no single run is long enough, so collect all free runs
+	int numberOfRuns = 0;
+	int capacity = 64;
+	CIFS_EXTENT_TYPE* runs = malloc(capacity * sizeof(CIFS_EXTENT_TYPE));
+	if (runs == NULL)
+		return NULL;
+
+	unsigned int available = 0;
+	for (unsigned int bit = 0; bit < CIFS_BITVECTOR_BITS; )
+	{
+		CIFS_INDEX_TYPE runStart = cifsFindFreeBlockInRange(bitvector, bit, CIFS_BITVECTOR_BITS);
+		if (runStart == CIFS_INVALID_INDEX)
+			break;
+		unsigned int runEnd = cifsFindTakenBlockInRange(bitvector, runStart, CIFS_BITVECTOR_BITS);
+
+		if (numberOfRuns == capacity)
+		{
+			capacity *= 2;
+			CIFS_EXTENT_TYPE* grown = realloc(runs, capacity * sizeof(CIFS_EXTENT_TYPE));
+			if (grown == NULL)
+			{
+				free(runs);
+				return NULL;
+			}
+			runs = grown;
+		}
+		runs[numberOfRuns].start = runStart;
+		runs[numberOfRuns].length = runEnd - runStart;
+		numberOfRuns++;
+		available += runEnd - runStart;
+		bit = runEnd;
+	}
+
+	if (available < numberOfBlocks)
+	{
+		free(runs);
+		return NULL;
+	}
+
+	qsort(runs, numberOfRuns, sizeof(CIFS_EXTENT_TYPE), cifsCompareExtentsByLength);
+
+	// the chosen runs are moved to the front of the array
+	int chosen = 0;
+	unsigned int remaining = numberOfBlocks;
+	while (remaining > 0)
+	{
+		// the shortest of the remaining runs that fits (they are sorted by decreasing length)
+		int fit = -1;
+		for (int i = chosen; i < numberOfRuns && runs[i].length >= remaining; i++)
+			fit = i;
+
+		if (fit < 0)
+			fit = chosen; // nothing fits, so take the longest run whole
+
+		CIFS_EXTENT_TYPE run = runs[fit];
+		runs[fit] = runs[chosen];
+		if (run.length > remaining)
+			run.length = remaining;
+		runs[chosen++] = run;
+		remaining -= run.length;
+	}
+
+	*numberOfExtents = chosen;
+
+	return runs;
+}
+
+/***
+ *
+ * Takes the given number of free blocks from the in-memory bitvector as runs of consecutive blocks, chosen
+ * as described for cifsFindExtents() starting from the calling thread's cursor.
+ *
+ * No lock is taken: the chosen runs are claimed one at a time (see cifsClaimRun()), and if another thread
+ * took a block of one of them in the meantime, the runs claimed so far are released and the runs are
+ * chosen again.
+ *
+ * Returns an allocated array of runs (to be freed by the caller) and sets numberOfExtents to its
+ * length. Returns NULL, and takes nothing, if there is not enough free space.
+ *
+ */
+CIFS_EXTENT_TYPE* cifsAllocateExtents(unsigned int numberOfBlocks, int* numberOfExtents)
+{
+	for (;;)
+	{
+		CIFS_EXTENT_TYPE* extents = cifsFindExtents(cifsAllocationStart(), numberOfBlocks, numberOfExtents);
+		if (extents == NULL)
+			return NULL;
+
+		int claimed = 0;
+		while (claimed < *numberOfExtents
+			   && cifsClaimRun(extents[claimed].start, extents[claimed].start + extents[claimed].length))
+			claimed++;
+
+		if (claimed == *numberOfExtents)
+		{
+			CIFS_EXTENT_TYPE* last = &extents[*numberOfExtents - 1];
+			cifsAllocationCursor = last->start + last->length;
+			return extents;
+		}
+
+		cifsFreeExtents(extents, claimed);
+		free(extents);
+	}
+}
+
+/***
+ *
+ * Returns runs of blocks to the in-memory bitvector.
+ *
+ */
+void cifsFreeExtents(const CIFS_EXTENT_TYPE* extents, int numberOfExtents)
+{
+	for (int i = 0; i < numberOfExtents; i++)
+		cifsReleaseRun(extents[i].start, extents[i].start + extents[i].length);
+}
+
+/***
+ *
+ * Finds the entry for the file handle in the open file table of the process from the FUSE context; NULL if
+ * the process does not have the file open. The caller holds the process lock.
+ *
+ * The registry entry of an open file points to its entry, so this takes constant time however many
+ * processes have files open.
+ *
+ */
+OPEN_FILE_TYPE* cifsFindOpenFile(CIFS_FILE_HANDLE_TYPE fileHandle)
+{
+	if (fileHandle < 0 || fileHandle >= CIFS_NUMBER_OF_BLOCKS || cifsContext->handles[fileHandle] == NULL)
+		return NULL;
+
+	OPEN_FILE_TYPE* openFile = cifsContext->handles[fileHandle]->openFile;
+	if (openFile == NULL || openFile->process->pid != fuseContext->pid)
+		return NULL;
+
+	return openFile;
+}
+
+static unsigned int cifsProcessBucket(pid_t pid, unsigned int buckets)
+{
+	return ((unsigned int)pid * 2654435761u) & (buckets - 1); // Fibonacci hashing spreads consecutive pids
+}
+
+/***
+ *
+ * Finds the process in the process table; if it is not there and adding is set, then a process with no open
+ * files is added. Returns NULL if the process is not found, or cannot be added. The caller holds the process
+ * lock.
+ *
+ * The table is doubled when it would hold more processes than it has buckets, so the chains stay short.
+ *
+ */
+static CIFS_PROCESS_CONTROL_BLOCK_TYPE* cifsFindProcess(pid_t pid, int adding)
+{
+	CIFS_PROCESS_CONTROL_BLOCK_TYPE* pcb = cifsContext->processTable[cifsProcessBucket(pid, cifsContext->processBuckets)];
+	while (pcb != NULL && pcb->pid != pid)
+		pcb = pcb->next;
+
+	if (pcb != NULL || !adding)
+		return pcb;
+
+	if (cifsContext->processCount == cifsContext->processBuckets)
+	{
+		unsigned int buckets = 2 * cifsContext->processBuckets;
+		CIFS_PROCESS_CONTROL_BLOCK_TYPE** table = calloc(buckets, sizeof(*table));
+		if (table == NULL)
+			return NULL;
+		for (unsigned int bucket = 0; bucket < cifsContext->processBuckets; bucket++)
+			while (cifsContext->processTable[bucket] != NULL)
+			{
+				CIFS_PROCESS_CONTROL_BLOCK_TYPE* moved = cifsContext->processTable[bucket];
+				cifsContext->processTable[bucket] = moved->next;
+				unsigned int target = cifsProcessBucket(moved->pid, buckets);
+				moved->next = table[target];
+				table[target] = moved;
+			}
+		free(cifsContext->processTable);
+		cifsContext->processTable = table;
+		cifsContext->processBuckets = buckets;
+	}
+
+	pcb = cifsSlabAlloc(&cifsContext->processSlab);
+	if (pcb == NULL)
+		return NULL;
+	pcb->pid = pid;
+	pcb->openFiles = NULL;
+	pcb->openFileCount = 0;
+	pcb->openFileCapacity = 0;
+
+	unsigned int bucket = cifsProcessBucket(pid, cifsContext->processBuckets);
+	pcb->next = cifsContext->processTable[bucket];
+	cifsContext->processTable[bucket] = pcb;
+	cifsContext->processCount++;
+
+	return pcb;
+}
+
+/***
+ *
+ * Removes a process with no open files from the process table. The caller holds the process lock.
+ *
+ */
+static void cifsReleaseProcess(CIFS_PROCESS_CONTROL_BLOCK_TYPE* pcb)
+{
+	CIFS_PROCESS_CONTROL_BLOCK_TYPE** link = &cifsContext->processTable[cifsProcessBucket(pcb->pid, cifsContext->processBuckets)];
+	while (*link != pcb)
+		link = &(*link)->next;
+	*link = pcb->next;
+	cifsContext->processCount--;
+
+	free(pcb->openFiles);
+	cifsSlabFree(&cifsContext->processSlab, pcb);
+}
+
+/***
+ *
+ * Returns the access rights the process from the FUSE context was granted when opening the file; 0 if the
+ * process does not have the file open.
+ *
+ */
+mode_t cifsOpenFileAccessRights(CIFS_FILE_HANDLE_TYPE fileHandle)
+{
+	pthread_mutex_lock(&cifsContext->processLock);
+	OPEN_FILE_TYPE* openFile = cifsFindOpenFile(fileHandle);
+	mode_t rights = openFile != NULL ? openFile->processAccessRights : 0;
+	pthread_mutex_unlock(&cifsContext->processLock);
+
+	return rights;
+}
+
+/***
+ *
+ * Initializes an index block with no references.
+ *
+ */
+static void cifsInitIndexBlock(CIFS_BLOCK_TYPE* block)
+{
+	memset(block, 0, sizeof(*block));
+	block->type = CIFS_INDEX_CONTENT_TYPE;
+	for (int i = 0; i < CIFS_INDEX_SIZE; i++)
+		block->content.index[i] = CIFS_INVALID_INDEX;
+}
+
+/***
+ *
+ * Returns the index block holding the given position of a folder's list of children.
+ *
+ */
+static CIFS_INDEX_TYPE cifsFolderIndexBlock(const CIFS_FILE_DESCRIPTOR_TYPE* folder, size_t position)
+{
+	CIFS_INDEX_TYPE blockNumber = folder->block_ref;
+	CIFS_BLOCK_TYPE block;
+	for (size_t i = position / (CIFS_INDEX_SIZE - 1); i > 0; i--)
+	{
+		cifsReadBlock((unsigned char*)&block, blockNumber);
+		blockNumber = block.content.index[CIFS_INDEX_SIZE - 1];
+	}
+
+	return blockNumber;
+}
+
+/***
+ *
+ * Appends a descriptor block to the folder's index, extending the index chain as needed, and saves
+ * the folder descriptor with the new size.
+ *
+ */
+CIFS_ERROR cifsAddToFolder(CIFS_FILE_DESCRIPTOR_TYPE* folder, CIFS_INDEX_TYPE blockNumber)
+{
+	size_t position = folder->size;
+	CIFS_BLOCK_TYPE block;
+	CIFS_INDEX_TYPE indexBlock;
+
+	if (folder->block_ref == CIFS_INVALID_INDEX)
+	{
+		// the first entry of a folder that has never had any content
+		indexBlock = cifsAllocateBlock();
+		if (indexBlock == CIFS_INVALID_INDEX)
+			return CIFS_ALLOC_ERROR;
+		folder->block_ref = indexBlock;
+		cifsInitIndexBlock(&block);
+	}
+	else if (position > 0 && position % (CIFS_INDEX_SIZE - 1) == 0)
+	{
+		// the last index block is full, so chain a new one
+		CIFS_INDEX_TYPE lastBlock = cifsFolderIndexBlock(folder, position - 1);
+		indexBlock = cifsAllocateBlock();
+		if (indexBlock == CIFS_INVALID_INDEX)
+			return CIFS_ALLOC_ERROR;
+		cifsReadBlock((unsigned char*)&block, lastBlock);
+		block.content.index[CIFS_INDEX_SIZE - 1] = indexBlock;
+		cifsWriteBlock((const unsigned char*)&block, lastBlock);
+		cifsInitIndexBlock(&block);
+	}
+	else
+	{
+		indexBlock = cifsFolderIndexBlock(folder, position);
+		cifsReadBlock((unsigned char*)&block, indexBlock);
+	}
+
+	block.content.index[position % (CIFS_INDEX_SIZE - 1)] = blockNumber;
+	cifsWriteBlock((const unsigned char*)&block, indexBlock);
+
+	folder->size++;
+	cifsWriteFileDescriptor(folder);
+
+	return CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Removes a descriptor block from the folder's index by moving the last entry into its place, and saves
+ * the folder descriptor with the new size. An index block that becomes empty is released (except the first).
+ *
+ */
+void cifsRemoveFromFolder(CIFS_FILE_DESCRIPTOR_TYPE* folder, CIFS_INDEX_TYPE blockNumber)
+{
+	if (folder->size == 0)
+		return;
+
+	size_t last = folder->size - 1;
+	CIFS_INDEX_TYPE lastBlock = cifsFolderIndexBlock(folder, last);
+	CIFS_BLOCK_TYPE block;
+	cifsReadBlock((unsigned char*)&block, lastBlock);
+	CIFS_INDEX_TYPE lastEntry = block.content.index[last % (CIFS_INDEX_SIZE - 1)];
+	block.content.index[last % (CIFS_INDEX_SIZE - 1)] = CIFS_INVALID_INDEX;
+	cifsWriteBlock((const unsigned char*)&block, lastBlock);
+
+	if (lastEntry != blockNumber)
+	{
+		// find the removed entry and fill the hole with the last entry
+		CIFS_INDEX_TYPE indexBlock = folder->block_ref;
+		for (size_t i = 0; i < last; i++)
+		{
+			if (i % (CIFS_INDEX_SIZE - 1) == 0)
+			{
+				if (i > 0)
+					indexBlock = block.content.index[CIFS_INDEX_SIZE - 1];
+				cifsReadBlock((unsigned char*)&block, indexBlock);
+			}
+
+			if (block.content.index[i % (CIFS_INDEX_SIZE - 1)] == blockNumber)
+			{
+				block.content.index[i % (CIFS_INDEX_SIZE - 1)] = lastEntry;
+				cifsWriteBlock((const unsigned char*)&block, indexBlock);
+				break;
+			}
+		}
+	}
+
+	if (last > 0 && last % (CIFS_INDEX_SIZE - 1) == 0)
+	{
+		CIFS_INDEX_TYPE previousBlock = cifsFolderIndexBlock(folder, last - 1);
+		cifsReadBlock((unsigned char*)&block, previousBlock);
+		block.content.index[CIFS_INDEX_SIZE - 1] = CIFS_INVALID_INDEX;
+		cifsWriteBlock((const unsigned char*)&block, previousBlock);
+		cifsReleaseBlock(lastBlock);
+	}
+
+	folder->size--;
+	cifsWriteFileDescriptor(folder);
+}
+
+/***
+ *
+ * Releases a chain of index blocks and all data blocks they refer to in the in-memory bitvector.
+ *
+ */
+void cifsFreeIndexChain(CIFS_INDEX_TYPE indexBlock)
+{
+	CIFS_BLOCK_TYPE block;
+	while (indexBlock != CIFS_INVALID_INDEX)
+	{
+		cifsReadBlock((unsigned char*)&block, indexBlock);
+		for (int i = 0; i < CIFS_INDEX_SIZE - 1 && block.content.index[i] != CIFS_INVALID_INDEX; i++)
+			cifsMarkBlock(block.content.index[i], 0);
+
+		cifsMarkBlock(indexBlock, 0);
+		indexBlock = block.content.index[CIFS_INDEX_SIZE - 1];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+///
+/// Offline check of a volume
+///
+//////////////////////////////////////////////////////////////////////////
+
+/***
+
+ Adds one to a counter of the report of a check; the workers count concurrently.
+
+*/
+#define CIFS_FSCK_COUNT(fsck, counter) __atomic_fetch_add(&(fsck)->report->counter, 1, __ATOMIC_RELAXED)
+
+/***
+ *
+ * A descriptor to be checked by the walk, and the folder listing it (CIFS_INVALID_INDEX for the root).
+ *
+ */
+typedef struct cifs_fsck_item_type
+{
+	CIFS_INDEX_TYPE blockNumber;
+	CIFS_INDEX_TYPE parent;
+} CIFS_FSCK_ITEM_TYPE;
+
+/***
+ *
+ * The state of a check, shared by its workers.
+ *
+ */
+typedef struct cifs_fsck_type
+{
+	int fd;
+	CIFS_SUPERBLOCK_TYPE superblock;
+	unsigned char* bitvector; // as it is on the volume
+	unsigned char* shadow; // the blocks referenced by the tree
+	CIFS_BLOCK_TYPE** blocks; // the copies of the folder, file, and index blocks; NULL for all others
+	CIFS_BLOCK_TYPE** chunks; // the copies by the chunk of the volume they were read from
+	unsigned int chunkCount;
+	unsigned int nextChunk; // first chunk not claimed by a worker yet
+	CIFS_FSCK_ITEM_TYPE* items; // the level being walked
+	int count;
+	int next; // first item not claimed by a worker yet
+	CIFS_FSCK_ITEM_TYPE* children; // the next level
+	int childCount;
+	int childCapacity;
+	CIFS_FSCK_ITEM_TYPE* fixes; // the descriptors whose back-pointers are repaired
+	int fixCount;
+	int fixCapacity;
+	int repair;
+	unsigned long long largestIdentifier;
+	CIFS_ERROR error; // the first failure of a worker
+	pthread_mutex_t lock; // the next level, the fixes, and the error
+	CIFS_FSCK_REPORT_TYPE* report;
+} CIFS_FSCK_TYPE;
+
+/***
+ *
+ * Transfers a range of the volume with positional I/O; a read past the end of the volume gives zeros.
+ *
+ * Returns 0 on success.
+ *
+ */
+static int cifsFsckTransfer(int writing, int fd, unsigned char* buffer, size_t length, off_t offset)
+{
+	while (length > 0)
+	{
+		ssize_t done = writing ? pwrite(fd, buffer, length, offset) : pread(fd, buffer, length, offset);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done < 0 || (done == 0 && writing))
+			return -1;
+		if (done == 0)
+		{
+			memset(buffer, 0, length);
+			return 0;
+		}
+		buffer += done;
+		length -= done;
+		offset += done;
+	}
+
+	return 0;
+}
+
+static void cifsFsckFail(CIFS_FSCK_TYPE* fsck, CIFS_ERROR error)
+{
+	pthread_mutex_lock(&fsck->lock);
+	if (fsck->error == CIFS_NO_ERROR)
+		fsck->error = error;
+	pthread_mutex_unlock(&fsck->lock);
+}
+
+/***
+ *
+ * Tells whether the block belongs to the bitvector, the superblock, or the journal.
+ *
+ */
+static int cifsFsckReserved(const CIFS_FSCK_TYPE* fsck, CIFS_INDEX_TYPE blockNumber)
+{
+	return blockNumber <= CIFS_SUPERBLOCK_INDEX
+		   || (blockNumber >= fsck->superblock.cifsJournalIndex
+			   && blockNumber - fsck->superblock.cifsJournalIndex < fsck->superblock.cifsJournalBlocks);
+}
+
+/***
+ *
+ * Tells whether the walk may need the block: an index block, or a descriptor (blocks of zeros look like
+ * folders, so a descriptor must have a name).
+ *
+ */
+static int cifsFsckIsMetadata(const CIFS_FSCK_TYPE* fsck, const CIFS_BLOCK_TYPE* block, CIFS_INDEX_TYPE blockNumber)
+{
+	if (cifsFsckReserved(fsck, blockNumber))
+		return 0;
+
+	return block->type == CIFS_INDEX_CONTENT_TYPE
+		   || ((block->type == CIFS_FOLDER_CONTENT_TYPE || block->type == CIFS_FILE_CONTENT_TYPE)
+			   && block->content.fileDescriptor.name[0] != '\0');
+}
+
+/***
+ *
+ * Reads the chunks of the volume claimed one at a time, and keeps copies of the blocks the walk may need.
+ *
+ */
+static void* cifsFsckScanWorker(void* arg)
+{
+	CIFS_FSCK_TYPE* fsck = arg;
+	const unsigned int perChunk = CIFS_FSCK_CHUNK_SIZE / CIFS_BLOCK_SIZE;
+	CIFS_BLOCK_TYPE* buffer = malloc(CIFS_FSCK_CHUNK_SIZE);
+	if (buffer == NULL)
+	{
+		cifsFsckFail(fsck, CIFS_ALLOC_ERROR);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		unsigned int chunk = __atomic_fetch_add(&fsck->nextChunk, 1, __ATOMIC_RELAXED);
+		if (chunk >= fsck->chunkCount)
+			break;
+
+		unsigned int first = chunk * perChunk;
+		unsigned int count = CIFS_NUMBER_OF_BLOCKS - first < perChunk ? CIFS_NUMBER_OF_BLOCKS - first : perChunk;
+		if (cifsFsckTransfer(0, fsck->fd, (unsigned char*)buffer, (size_t)count * CIFS_BLOCK_SIZE,
+							 (off_t)first * CIFS_BLOCK_SIZE) != 0)
+		{
+			cifsFsckFail(fsck, CIFS_READ_ERROR);
+			break;
+		}
+
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < count; i++)
+			kept += cifsFsckIsMetadata(fsck, &buffer[i], first + i);
+		if (kept == 0)
+			continue;
+
+		CIFS_BLOCK_TYPE* copies = malloc(kept * sizeof(CIFS_BLOCK_TYPE));
+		if (copies == NULL)
+		{
+			cifsFsckFail(fsck, CIFS_ALLOC_ERROR);
+			break;
+		}
+		fsck->chunks[chunk] = copies;
+		for (unsigned int i = 0; i < count; i++)
+			if (cifsFsckIsMetadata(fsck, &buffer[i], first + i))
+			{
+				memcpy(copies, &buffer[i], sizeof(CIFS_BLOCK_TYPE));
+				fsck->blocks[first + i] = copies++;
+			}
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+/***
+ *
+ * Marks a block in the shadow bitvector for the block referring to it; returns 0 if the block is outside of the
+ * bitvector or reserved, or if it is referenced already, so the caller does not follow it.
+ *
+ */
+static int cifsFsckClaim(CIFS_FSCK_TYPE* fsck, CIFS_INDEX_TYPE blockNumber, CIFS_INDEX_TYPE owner)
+{
+	if (blockNumber >= CIFS_BITVECTOR_BITS || cifsFsckReserved(fsck, blockNumber))
+	{
+		CIFS_FSCK_COUNT(fsck, badReferences);
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: block %u refers to block %u, which no file can use\n",
+				   (unsigned)owner, (unsigned)blockNumber);
+		return 0;
+	}
+
+	unsigned long long mask = cifsBitvectorMask(blockNumber % 64, blockNumber % 64 + 1);
+	if (__atomic_fetch_or(cifsBitvectorWord(fsck->shadow, blockNumber), mask, __ATOMIC_RELAXED) & mask)
+	{
+		CIFS_FSCK_COUNT(fsck, crossLinkedBlocks);
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: block %u refers to block %u, which is referenced elsewhere too\n",
+				   (unsigned)owner, (unsigned)blockNumber);
+		return 0;
+	}
+
+	return 1;
+}
+
+/***
+ *
+ * Adds the children listed by an index block of a folder to the next level of the walk.
+ *
+ */
+static void cifsFsckAddChildren(CIFS_FSCK_TYPE* fsck, const CIFS_FSCK_ITEM_TYPE* children, int count)
+{
+	pthread_mutex_lock(&fsck->lock);
+	if (fsck->childCount + count > fsck->childCapacity)
+	{
+		int capacity = fsck->childCapacity ? 2 * fsck->childCapacity : 1024;
+		while (capacity < fsck->childCount + count)
+			capacity *= 2;
+		CIFS_FSCK_ITEM_TYPE* grown = realloc(fsck->children, capacity * sizeof(CIFS_FSCK_ITEM_TYPE));
+		if (grown == NULL)
+		{
+			if (fsck->error == CIFS_NO_ERROR)
+				fsck->error = CIFS_ALLOC_ERROR;
+			pthread_mutex_unlock(&fsck->lock);
+			return;
+		}
+		fsck->children = grown;
+		fsck->childCapacity = capacity;
+	}
+	memcpy(fsck->children + fsck->childCount, children, count * sizeof(CIFS_FSCK_ITEM_TYPE));
+	fsck->childCount += count;
+	pthread_mutex_unlock(&fsck->lock);
+}
+
+/***
+ *
+ * Remembers a descriptor whose back-pointers are repaired once the walk is done.
+ *
+ */
+static void cifsFsckAddFix(CIFS_FSCK_TYPE* fsck, const CIFS_FSCK_ITEM_TYPE* item)
+{
+	pthread_mutex_lock(&fsck->lock);
+	if (fsck->fixCount == fsck->fixCapacity)
+	{
+		int capacity = fsck->fixCapacity ? 2 * fsck->fixCapacity : 64;
+		CIFS_FSCK_ITEM_TYPE* grown = realloc(fsck->fixes, capacity * sizeof(CIFS_FSCK_ITEM_TYPE));
+		if (grown == NULL)
+		{
+			if (fsck->error == CIFS_NO_ERROR)
+				fsck->error = CIFS_ALLOC_ERROR;
+			pthread_mutex_unlock(&fsck->lock);
+			return;
+		}
+		fsck->fixes = grown;
+		fsck->fixCapacity = capacity;
+	}
+	fsck->fixes[fsck->fixCount++] = *item;
+	pthread_mutex_unlock(&fsck->lock);
+}
+
+/***
+ *
+ * Follows the index chain of the descriptor in the given block, which lists the given number of entries (data
+ * blocks of a file, or children of a folder): marks the index and data blocks, checks that the chain ends with
+ * the entries, and adds the children of a folder to the next level. A folder keeps its first index block while
+ * it is empty.
+ *
+ */
+static void cifsFsckChain(CIFS_FSCK_TYPE* fsck, const CIFS_FILE_DESCRIPTOR_TYPE* fd, CIFS_INDEX_TYPE blockNumber,
+						  size_t entries)
+{
+	const size_t perIndexBlock = CIFS_INDEX_SIZE - 1;
+	if (fd->block_ref == CIFS_INVALID_INDEX)
+	{
+		if (entries > 0)
+		{
+			CIFS_FSCK_COUNT(fsck, badSizes);
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: \"%.*s\" (block %u) has %zu entries, but no index block\n",
+					   CIFS_MAX_NAME_LENGTH, fd->name, (unsigned)blockNumber, entries);
+		}
+		return;
+	}
+
+	int folder = fd->type == CIFS_FOLDER_CONTENT_TYPE;
+	size_t indexBlocks = entries > 0 ? (entries - 1) / perIndexBlock + 1 : 1;
+	CIFS_INDEX_TYPE indexBlock = fd->block_ref;
+	CIFS_INDEX_TYPE owner = blockNumber;
+	CIFS_FSCK_ITEM_TYPE children[CIFS_INDEX_SIZE - 1];
+	for (size_t k = 0; k < indexBlocks; k++)
+	{
+		if (!cifsFsckClaim(fsck, indexBlock, owner))
+			return;
+		const CIFS_BLOCK_TYPE* block = fsck->blocks[indexBlock];
+		if (block == NULL || block->type != CIFS_INDEX_CONTENT_TYPE)
+		{
+			CIFS_FSCK_COUNT(fsck, badReferences);
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: block %u in the chain of \"%.*s\" (block %u) is not an index block\n",
+					   (unsigned)indexBlock, CIFS_MAX_NAME_LENGTH, fd->name, (unsigned)blockNumber);
+			return;
+		}
+
+		size_t listed = entries - k * perIndexBlock < perIndexBlock ? entries - k * perIndexBlock : perIndexBlock;
+		int childCount = 0;
+		for (size_t i = 0; i < listed; i++)
+		{
+			CIFS_INDEX_TYPE entry = block->content.index[i];
+			if (folder)
+				children[childCount++] = (CIFS_FSCK_ITEM_TYPE){ .blockNumber = entry, .parent = blockNumber };
+			else if (cifsFsckClaim(fsck, entry, indexBlock) && fsck->blocks[entry] != NULL)
+			{
+				CIFS_FSCK_COUNT(fsck, badReferences);
+				CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: index block %u of \"%.*s\" (block %u) lists block %u, which is "
+						   "not a data block\n", (unsigned)indexBlock, CIFS_MAX_NAME_LENGTH, fd->name,
+						   (unsigned)blockNumber, (unsigned)entry);
+			}
+		}
+		if (childCount > 0)
+			cifsFsckAddChildren(fsck, children, childCount);
+
+		// the entries past the size would be freed with the chain
+		size_t stray = listed;
+		while (stray < perIndexBlock && block->content.index[stray] == CIFS_INVALID_INDEX)
+			stray++;
+		if (stray < perIndexBlock)
+		{
+			CIFS_FSCK_COUNT(fsck, badSizes);
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: index block %u of \"%.*s\" (block %u) lists more than the size\n",
+					   (unsigned)indexBlock, CIFS_MAX_NAME_LENGTH, fd->name, (unsigned)blockNumber);
+		}
+
+		CIFS_INDEX_TYPE next = block->content.index[CIFS_INDEX_SIZE - 1];
+		if (k + 1 == indexBlocks && next != CIFS_INVALID_INDEX)
+		{
+			CIFS_FSCK_COUNT(fsck, badSizes);
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: the chain of \"%.*s\" (block %u) is longer than its size\n",
+					   CIFS_MAX_NAME_LENGTH, fd->name, (unsigned)blockNumber);
+		}
+		else if (k + 1 < indexBlocks && next == CIFS_INVALID_INDEX)
+		{
+			CIFS_FSCK_COUNT(fsck, badSizes);
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: the chain of \"%.*s\" (block %u) is shorter than its size\n",
+					   CIFS_MAX_NAME_LENGTH, fd->name, (unsigned)blockNumber);
+			return;
+		}
+		owner = indexBlock;
+		indexBlock = next;
+	}
+}
+
+/***
+ *
+ * Checks a descriptor of the walk and marks all blocks of its file or folder.
+ *
+ */
+static void cifsFsckDescriptor(CIFS_FSCK_TYPE* fsck, const CIFS_FSCK_ITEM_TYPE* item)
+{
+	// the superblock refers to the root
+	if (!cifsFsckClaim(fsck, item->blockNumber, item->parent != CIFS_INVALID_INDEX ? item->parent : CIFS_SUPERBLOCK_INDEX))
+		return;
+
+	const CIFS_BLOCK_TYPE* block = fsck->blocks[item->blockNumber];
+	if (block == NULL || block->type == CIFS_INDEX_CONTENT_TYPE || block->content.fileDescriptor.type != block->type
+		|| (item->parent == CIFS_INVALID_INDEX && block->type != CIFS_FOLDER_CONTENT_TYPE))
+	{
+		CIFS_FSCK_COUNT(fsck, badReferences);
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: block %u listed by block %u is not a %s\n", (unsigned)item->blockNumber,
+				   (unsigned)(item->parent != CIFS_INVALID_INDEX ? item->parent : CIFS_SUPERBLOCK_INDEX),
+				   item->parent != CIFS_INVALID_INDEX ? "descriptor" : "folder");
+		return;
+	}
+	CIFS_FILE_DESCRIPTOR_TYPE fd = block->content.fileDescriptor;
+
+	if (fd.file_block_ref != item->blockNumber || fd.parent_block_ref != item->parent)
+	{
+		CIFS_FSCK_COUNT(fsck, badBackPointers);
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: \"%.*s\" (block %u) names block %u as its own and block %u as its folder, "
+				   "instead of block %u\n", CIFS_MAX_NAME_LENGTH, fd.name, (unsigned)item->blockNumber,
+				   (unsigned)fd.file_block_ref, (unsigned)fd.parent_block_ref, (unsigned)item->parent);
+		if (fsck->repair)
+			cifsFsckAddFix(fsck, item);
+	}
+
+	if (fd.identifier >= fsck->superblock.cifsNextUniqueIdentifier)
+	{
+		CIFS_FSCK_COUNT(fsck, badIdentifiers);
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: \"%.*s\" (block %u) has the identifier %llu, which is still to be handed "
+				   "out\n", CIFS_MAX_NAME_LENGTH, fd.name, (unsigned)item->blockNumber, fd.identifier);
+	}
+	unsigned long long largest = __atomic_load_n(&fsck->largestIdentifier, __ATOMIC_RELAXED);
+	while (fd.identifier > largest
+		   && !__atomic_compare_exchange_n(&fsck->largestIdentifier, &largest, fd.identifier, 1, __ATOMIC_RELAXED,
+										   __ATOMIC_RELAXED))
+		;
+
+	if (fd.type == CIFS_FOLDER_CONTENT_TYPE)
+	{
+		CIFS_FSCK_COUNT(fsck, folders);
+		cifsFsckChain(fsck, &fd, item->blockNumber, fd.size);
+	}
+	else
+	{
+		CIFS_FSCK_COUNT(fsck, files);
+		if (!fd.inlined)
+			cifsFsckChain(fsck, &fd, item->blockNumber, fd.size / CIFS_DATA_SIZE + (fd.size % CIFS_DATA_SIZE != 0));
+		else if (fd.block_ref != CIFS_INVALID_INDEX || fd.size > CIFS_INLINE_SIZE)
+		{
+			CIFS_FSCK_COUNT(fsck, badSizes);
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: \"%.*s\" (block %u) is inline with %zu bytes and index block %u\n",
+					   CIFS_MAX_NAME_LENGTH, fd.name, (unsigned)item->blockNumber, fd.size, (unsigned)fd.block_ref);
+		}
+	}
+}
+
+/***
+ *
+ * Checks the descriptors of a level claimed CIFS_MOUNT_CHUNK at a time, like the mount workers read them.
+ *
+ */
+static void* cifsFsckWalkWorker(void* arg)
+{
+	CIFS_FSCK_TYPE* fsck = arg;
+	for (;;)
+	{
+		int first = __atomic_fetch_add(&fsck->next, CIFS_MOUNT_CHUNK, __ATOMIC_RELAXED);
+		if (first >= fsck->count)
+			break;
+		int last = fsck->count - first < CIFS_MOUNT_CHUNK ? fsck->count : first + CIFS_MOUNT_CHUNK;
+		for (int i = first; i < last; i++)
+			cifsFsckDescriptor(fsck, &fsck->items[i]);
+	}
+
+	return NULL;
+}
+
+/***
+ *
+ * Runs the worker on the given number of threads, or on the calling one if none can be started.
+ *
+ */
+static void cifsFsckRun(void* (*worker)(void*), CIFS_FSCK_TYPE* fsck, int threadCount)
+{
+	pthread_t threads[CIFS_FSCK_MAX_THREADS];
+	int started = 0;
+	if (threadCount > 1)
+		while (started < threadCount && pthread_create(&threads[started], NULL, worker, fsck) == 0)
+			started++;
+	if (started == 0)
+		worker(fsck);
+	for (int t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+}
+
+/***
+ *
+ * Traces a run of blocks whose bits on the volume are wrong.
+ *
+ */
+static void cifsFsckTraceRun(int leaked, unsigned int first, unsigned int last)
+{
+	const char* problem = leaked ? "taken, but referenced by nothing" : "referenced, but free";
+	if (first == last)
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: block %u is %s\n", first, problem);
+	else
+		CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: blocks %u to %u are %s\n", first, last, problem);
+}
+
+/***
+ *
+ * Tells whether the journal holds a committed transaction; only the replay verifies that it is complete.
+ *
+ */
+static int cifsFsckJournalPending(const CIFS_FSCK_TYPE* fsck)
+{
+	if (fsck->superblock.cifsJournalBlocks < 2 || fsck->superblock.cifsJournalIndex >= CIFS_NUMBER_OF_BLOCKS - 1)
+		return 0;
+
+	unsigned char block[CIFS_BLOCK_SIZE];
+	CIFS_JOURNAL_HEADER_TYPE header;
+	CIFS_JOURNAL_RECORD_TYPE record;
+	if (cifsFsckTransfer(0, fsck->fd, block, CIFS_BLOCK_SIZE, (off_t)fsck->superblock.cifsJournalIndex * CIFS_BLOCK_SIZE) != 0)
+		return 0;
+	memcpy(&header, block, sizeof header);
+	if (cifsFsckTransfer(0, fsck->fd, block, CIFS_BLOCK_SIZE,
+						 (off_t)(fsck->superblock.cifsJournalIndex + 1) * CIFS_BLOCK_SIZE) != 0)
+		return 0;
+	memcpy(&record, block, sizeof record);
+
+	return header.magic == CIFS_JOURNAL_MAGIC && record.magic == CIFS_JOURNAL_MAGIC
+		   && record.sequence == header.sequence && record.count > 0;
+}
+
+/***
+ *
+ * Applies the repairs found by the walk to the volume: the bitvector from the shadow, the back-pointers of the
+ * descriptors, and the next unique identifier. The snapshot of the registry no longer matches after any of them.
+ *
+ */
+static CIFS_ERROR cifsFsckRepair(CIFS_FSCK_TYPE* fsck)
+{
+	CIFS_FSCK_REPORT_TYPE* report = fsck->report;
+	int failed = 0;
+
+	if (report->leakedBlocks + report->freeReferencedBlocks > 0)
+	{
+		for (unsigned int i = 0; i < CIFS_SUPERBLOCK_INDEX; i++)
+			if (memcmp(fsck->shadow + (size_t)i * CIFS_BLOCK_SIZE, fsck->bitvector + (size_t)i * CIFS_BLOCK_SIZE,
+					   CIFS_BLOCK_SIZE) != 0)
+				failed |= cifsFsckTransfer(1, fsck->fd, fsck->shadow + (size_t)i * CIFS_BLOCK_SIZE, CIFS_BLOCK_SIZE,
+										   (off_t)i * CIFS_BLOCK_SIZE);
+		report->repaired += report->leakedBlocks + report->freeReferencedBlocks;
+	}
+
+	for (int i = 0; i < fsck->fixCount; i++)
+	{
+		CIFS_BLOCK_TYPE block;
+		off_t position = (off_t)fsck->fixes[i].blockNumber * CIFS_BLOCK_SIZE;
+		failed |= cifsFsckTransfer(0, fsck->fd, (unsigned char*)&block, sizeof block, position);
+		block.content.fileDescriptor.file_block_ref = fsck->fixes[i].blockNumber;
+		block.content.fileDescriptor.parent_block_ref = fsck->fixes[i].parent;
+		failed |= cifsFsckTransfer(1, fsck->fd, (unsigned char*)&block, sizeof block, position);
+	}
+	report->repaired += fsck->fixCount;
+
+	if (report->badIdentifiers > 0)
+	{
+		fsck->superblock.cifsNextUniqueIdentifier = fsck->largestIdentifier + 1;
+		report->repaired += report->badIdentifiers;
+	}
+
+	if (report->repaired > 0)
+	{
+		unsigned char block[CIFS_BLOCK_SIZE];
+		off_t position = (off_t)CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE;
+		fsck->superblock.cifsSnapshotGeneration = 0;
+		failed |= cifsFsckTransfer(0, fsck->fd, block, CIFS_BLOCK_SIZE, position);
+		memcpy(block, &fsck->superblock, sizeof fsck->superblock);
+		failed |= cifsFsckTransfer(1, fsck->fd, block, CIFS_BLOCK_SIZE, position);
+		failed |= fdatasync(fsck->fd) != 0;
+	}
+
+	return failed ? CIFS_WRITE_ERROR : CIFS_NO_ERROR;
+}
+
+/***
+ *
+ * Checks the volume in the file, which must not be mounted, on the given number of workers (CIFS_FSCK_THREADS if
+ * 0); the problems are counted in the report. With repair, the journal is replayed first, and the repairable
+ * problems are corrected on the volume (see cifsCheckVolume() in cifs.h).
+ *
+ * The function returns CIFS_IN_USE_ERROR while a volume is mounted, CIFS_OPEN_ERROR if the file cannot be
+ * opened, CIFS_GEOMETRY_ERROR if the volume has the geometry of another build, and CIFS_READ_ERROR or
+ * CIFS_WRITE_ERROR if the volume cannot be read or repaired; the problems of the volume are no error.
+ *
+ */
+CIFS_ERROR cifsCheckVolume(char* cifsFileName, int repair, int threads, CIFS_FSCK_REPORT_TYPE* report)
+{
+	memset(report, 0, sizeof *report);
+	if (cifsContext != NULL)
+		return CIFS_IN_USE_ERROR;
+	if (threads <= 0)
+		threads = CIFS_FSCK_THREADS;
+	if (threads > CIFS_FSCK_MAX_THREADS)
+		threads = CIFS_FSCK_MAX_THREADS;
+
+	// the geometry check and the replay use the device functions
+	cifsVolume = fopen(cifsFileName, repair ? "r+" : "r");
+	if (cifsVolume == NULL)
+		return CIFS_OPEN_ERROR;
+	if (!cifsCheckGeometry())
+	{
+		fclose(cifsVolume);
+		cifsVolume = NULL;
+		return CIFS_GEOMETRY_ERROR;
+	}
+
+	CIFS_FSCK_TYPE fsck = { .fd = fileno(cifsVolume), .repair = repair, .error = CIFS_NO_ERROR, .report = report };
+	pthread_mutex_init(&fsck.lock, NULL);
+	unsigned char block[CIFS_BLOCK_SIZE];
+	CIFS_ERROR error = CIFS_NO_ERROR;
+	if (cifsFsckTransfer(0, fsck.fd, block, CIFS_BLOCK_SIZE, (off_t)CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE) != 0)
+		error = CIFS_READ_ERROR;
+	memcpy(&fsck.superblock, block, sizeof fsck.superblock);
+
+	// the volume is checked as the next mount would find it
+	if (error == CIFS_NO_ERROR && cifsFsckJournalPending(&fsck))
+	{
+		report->pendingJournal = 1;
+		if (!repair)
+			CIFS_TRACE(CIFS_TRACE_ERROR, "FSCK: the journal holds a transaction that the next mount replays\n");
+		else
+		{
+			unsigned long long sequence;
+			error = cifsJournalReplay(&sequence);
+			if (error == CIFS_NO_ERROR
+				&& cifsFsckTransfer(0, fsck.fd, block, CIFS_BLOCK_SIZE, (off_t)CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE) != 0)
+				error = CIFS_READ_ERROR;
+			memcpy(&fsck.superblock, block, sizeof fsck.superblock);
+		}
+	}
+
+	fsck.chunkCount = ((size_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE + CIFS_FSCK_CHUNK_SIZE - 1) / CIFS_FSCK_CHUNK_SIZE;
+	fsck.bitvector = malloc(CIFS_BITVECTOR_SIZE);
+	fsck.shadow = calloc(1, CIFS_BITVECTOR_SIZE);
+	fsck.blocks = calloc(CIFS_NUMBER_OF_BLOCKS, sizeof(CIFS_BLOCK_TYPE*));
+	fsck.chunks = calloc(fsck.chunkCount, sizeof(CIFS_BLOCK_TYPE*));
+	fsck.items = malloc(sizeof(CIFS_FSCK_ITEM_TYPE));
+	if (error == CIFS_NO_ERROR
+		&& (fsck.bitvector == NULL || fsck.shadow == NULL || fsck.blocks == NULL || fsck.chunks == NULL || fsck.items == NULL))
+		error = CIFS_ALLOC_ERROR;
+	if (error == CIFS_NO_ERROR && cifsFsckTransfer(0, fsck.fd, fsck.bitvector, CIFS_BITVECTOR_SIZE, 0) != 0)
+		error = CIFS_READ_ERROR;
+
+	// 1) read the whole volume in large transfers, keeping the folder, file, and index blocks
+	if (error == CIFS_NO_ERROR)
+	{
+		cifsFsckRun(cifsFsckScanWorker, &fsck, fsck.chunkCount < (unsigned int)threads ? (int)fsck.chunkCount : threads);
+		error = fsck.error;
+	}
+
+	// 2) walk the tree from the root a level at a time
+	if (error == CIFS_NO_ERROR)
+	{
+		for (unsigned int b = 0; b < CIFS_BITVECTOR_BITS; b++)
+			if (cifsFsckReserved(&fsck, b))
+				cifsSetBit(fsck.shadow, b);
+
+		fsck.items[0] = (CIFS_FSCK_ITEM_TYPE){ .blockNumber = fsck.superblock.cifsRootNodeIndex, .parent = CIFS_INVALID_INDEX };
+		fsck.count = 1;
+		while (fsck.count > 0 && fsck.error == CIFS_NO_ERROR)
+		{
+			fsck.next = 0;
+			int threadCount = fsck.count / CIFS_MOUNT_CHUNK < threads ? fsck.count / CIFS_MOUNT_CHUNK : threads;
+			cifsFsckRun(cifsFsckWalkWorker, &fsck, threadCount);
+
+			// the children become the next level
+			free(fsck.items);
+			fsck.items = fsck.children;
+			fsck.count = fsck.childCount;
+			fsck.children = NULL;
+			fsck.childCount = fsck.childCapacity = 0;
+		}
+		error = fsck.error;
+	}
+
+	// 3) compare the blocks referenced with the blocks taken on the volume
+	if (error == CIFS_NO_ERROR)
+	{
+		int runKind = 0; // 1 for leaked blocks, 2 for referenced blocks that are free
+		unsigned int runStart = 0;
+		for (unsigned int b = 0; b <= CIFS_BITVECTOR_BITS; b++)
+		{
+			int kind = 0;
+			if (b < CIFS_BITVECTOR_BITS)
+			{
+				int taken = cifsTestBit(fsck.bitvector, b);
+				int referenced = cifsTestBit(fsck.shadow, b);
+				report->referencedBlocks += referenced;
+				kind = taken && !referenced ? 1 : !taken && referenced ? 2 : 0;
+				report->leakedBlocks += kind == 1;
+				report->freeReferencedBlocks += kind == 2;
+			}
+			if (kind != runKind)
+			{
+				if (runKind != 0)
+					cifsFsckTraceRun(runKind == 1, runStart, b - 1);
+				runKind = kind;
+				runStart = b;
+			}
+		}
+	}
+
+	if (error == CIFS_NO_ERROR && repair)
+		error = cifsFsckRepair(&fsck);
+
+	for (unsigned int i = 0; fsck.chunks != NULL && i < fsck.chunkCount; i++)
+		free(fsck.chunks[i]);
+	free(fsck.chunks);
+	free(fsck.blocks);
+	free(fsck.shadow);
+	free(fsck.bitvector);
+	free(fsck.items);
+	free(fsck.children);
+	free(fsck.fixes);
+	pthread_mutex_destroy(&fsck.lock);
+	fclose(cifsVolume);
+	cifsVolume = NULL;
+
+	return error;
+}
@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////
+///
+/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
+///
+//////////////////////////////////////////////////////////////////////////
+/*
+ * Rafael Diaz
+ * Spring 2025
+ * COMP 362 Section 1 - Operating Systems
+ */
+///
+/// This source contains the offline checker of the volumes; it runs without
+/// FUSE, on a volume that is not mounted (e.g., before mounting it).
+///
+/// The checker reads the whole volume, walks the tree from the root on
+/// several threads, and compares the blocks in use with the bitvector; see
+/// cifsCheckVolume() in cifs.h for what it checks and repairs.
+///
+//////////////////////////////////////////////////////////////////////////
+///
+/// The program is run with the volume file:
+///
+///      ./cifs_fsck [-r] [-j threads] [-q] volume
+///
+///    -r  repairs the volume: replays the journal, and corrects the bitvector,
+///        the back-pointers of the descriptors, and the next unique identifier
+///    -j  the number of worker threads; 8 by default
+///    -q  prints only the summary, not every problem
+///
+/// The exit status tells the outcome, like the one of fsck(8):
+///
+///    0   no problems
+///    1   all problems were repaired
+///    4   problems are left on the volume
+///    8   the volume could not be checked
+///
+//////////////////////////////////////////////////////////////////////////
+#define NO_FUSE_DEBUG
+#ifdef NO_FUSE_DEBUG
+
+#include "cifs.h"
+
+#define FSCK_CLEAN 0
+#define FSCK_REPAIRED 1
+#define FSCK_UNREPAIRED 4
+#define FSCK_FAILED 8
+
+static void fsckUsage(const char* program)
+{
+	fprintf(stderr, "usage: %s [-r] [-j threads] [-q] volume\n", program);
+}
+
+static double fsckSeconds(const struct timespec* from, const struct timespec* to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+	int repair = 0;
+	int threads = CIFS_FSCK_THREADS;
+	int option;
+	while ((option = getopt(argc, argv, "rj:q")) != -1)
+		switch (option)
+		{
+			case 'r':
+				repair = 1;
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				break;
+			case 'q':
+				cifsTraceLevel = CIFS_TRACE_NONE;
+				break;
+			default:
+				fsckUsage(argv[0]);
+				return FSCK_FAILED;
+		}
+	if (optind != argc - 1 || threads <= 0)
+	{
+		fsckUsage(argv[0]);
+		return FSCK_FAILED;
+	}
+	char* volume = argv[optind];
+
+	struct timespec started, finished;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	CIFS_FSCK_REPORT_TYPE report;
+	CIFS_ERROR error = cifsCheckVolume(volume, repair, threads, &report);
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+
+	if (error != CIFS_NO_ERROR)
+	{
+		fprintf(stderr, "%s: cannot %s %s (error %d)\n", argv[0], repair ? "repair" : "check", volume, error);
+		return FSCK_FAILED;
+	}
+
+	unsigned long long problems = report.leakedBlocks + report.freeReferencedBlocks + report.crossLinkedBlocks
+								  + report.badReferences + report.badBackPointers + report.badSizes
+								  + report.badIdentifiers;
+
+	printf("%s: %llu folders, %llu files, %llu of %u blocks in use\n", volume, report.folders, report.files,
+		   report.referencedBlocks, (unsigned)CIFS_BITVECTOR_BITS);
+	printf("  leaked blocks:            %llu\n", report.leakedBlocks);
+	printf("  free referenced blocks:   %llu\n", report.freeReferencedBlocks);
+	printf("  cross-linked blocks:      %llu\n", report.crossLinkedBlocks);
+	printf("  bad references:           %llu\n", report.badReferences);
+	printf("  bad back-pointers:        %llu\n", report.badBackPointers);
+	printf("  bad sizes:                %llu\n", report.badSizes);
+	printf("  bad identifiers:          %llu\n", report.badIdentifiers);
+	if (report.pendingJournal)
+		printf("  journal transaction:      %s\n", repair ? "replayed" : "pending");
+	printf("%llu problems, %llu repaired, in %.3f s\n", problems, report.repaired, fsckSeconds(&started, &finished));
+
+	if (problems == 0)
+		return FSCK_CLEAN;
+	return report.repaired == problems ? FSCK_REPAIRED : FSCK_UNREPAIRED;
+}
+
+#endif
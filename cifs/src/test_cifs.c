@@ -1,298 +1,2314 @@
-//////////////////////////////////////////////////////////////////////////
-///
-/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
-///
-//////////////////////////////////////////////////////////////////////////
-/*
- * Rafael Diaz
- * Spring 2025
- * COMP 362 Section 1 - Operating Systems
- */
-///
-/// This source contains code that can be used only during testing without
-/// FUSE.
-///
-/// Integration with fuse requires that you utilize the code from cifs.c
-/// as needed in the FUSE framework.
-///
-//////////////////////////////////////////////////////////////////////////
-///
-/// The program can be run in three different ways:
-///
-/// A) with a regular file name as a command line argument:
-///
-///      ./cifs cifs.vol
-///
-/// B) Run with real block device:
-///
-///      sudo ./cifs /dev/sdaN  # where /dev/sdaN is the name of a real disk (which is a block device)
-///
-///      WARNING!
-///           DO NOT RUN IT WITH YOUR MAIN DISK!!
-///           PLUG IN AN EMPTY USB STICK AND FIGURE OUT WHICH DEVICE IT IS, AND THEN USE IT.
-///           YOU CAN USE 'df' COMMAND TO SEE WHICH DEVICE IS ADDED AFTER YOU PLUG IN THE USB STICK.
-///
-/// C) Run with a simulated block device.
-///
-///    This way needs some preparation:
-///
-///    1) create a file to simulate a block device with a desired block size and a desired number (count) of blocks
-///
-///      dd bs=256 count=65536 if=/dev/zero of=/tmp/cifs.vol
-///
-///    2) find a free "loop" to interface with the file
-///
-///      losetup -f
-///
-///    3) link the loop with the file (assuming that loop11 is free)
-///
-///      sudo losetup /dev/loop11 /tmp/cifs.vol
-///
-///    4) run this program with /dev/loop11 as the command line argument
-///
-///      sudo ./cifs /dev/loop11
-///
-//////////////////////////////////////////////////////////////////////////
-#define NO_FUSE_DEBUG
-#ifdef NO_FUSE_DEBUG
-
-#include "cifs.h"
-
-extern struct fuse_context* fuseContext;
-/// must use
-// fuseContext = fuse_get_context();
-/// when the cifs is integrated with FUSE
-
-int main(int argc, char** argv)
-{
-#ifdef RUN_ONLY_STEP2
-    testStep2();
-    return 0;
-#endif
-	printf("sizeof(CIFS_BLOCK_TYPE) = %ld\n\n", sizeof(CIFS_BLOCK_TYPE));
-
-	printf("sizeof(CIFS_CONTENT_TYPE) = %ld\n", sizeof(CIFS_CONTENT_TYPE));
-	printf("sizeof(CIFS_DATA_TYPE) = %ld\n", sizeof(CIFS_DATA_TYPE));
-	printf("sizeof(CIFS_INDEX_TYPE) = %ld\n\n", sizeof(CIFS_INDEX_TYPE));
-
-	printf("sizeof(CIFS_FILE_DESCRIPTOR_TYPE) = %ld\n\n", sizeof(CIFS_FILE_DESCRIPTOR_TYPE));
-
-	printf("sizeof(unsigned long long) = %ld\n", sizeof(unsigned long long));
-	printf("sizeof(CIFS_CONTENT_TYPE) = %ld\n", sizeof(CIFS_CONTENT_TYPE));
-	printf("sizeof(CIFS_NAME_TYPE) = %ld\n", sizeof(CIFS_NAME_TYPE));
-	printf("sizeof(time_t) = %ld\n", sizeof(time_t));
-	printf("sizeof(mode_t) = %ld\n", sizeof(mode_t));
-	printf("sizeof(uid_t) = %ld\n", sizeof(uid_t));
-	printf("sizeof(size_t) = %ld\n", sizeof(size_t));
-	printf("sizeof(CIFS_INDEX_TYPE) = %ld\n", sizeof(CIFS_INDEX_TYPE));
-
-
-	srand(time(NULL)); // uncomment to get true random values in get_context()
-
-	// the following is just some sample code for simulating user and process identifiers that are
-	// needed in the cifs functions
-	fuseContext = (struct fuse_context*)malloc(sizeof(struct fuse_context));
-	fuseContext->fuse = NULL;                   // struct fuse   *fuse
-	fuseContext->uid = 1000 + (uid_t)rand() % 10 + 1;  // uid_t  uid
-	fuseContext->gid = 1000 + (gid_t)rand() % 10 + 1;  // gid_t  gid
-	fuseContext->pid = 1000 + (pid_t)rand() % 10 + 1;  // pid_t  pid
-	fuseContext->private_data = NULL;                   // void   *private_data
-	fuseContext->umask = S_IRUSR | S_IWUSR;             // mode_t umask
-
-	printf("FUSE CONTEXT:\nuser ID = %02i\nprocess ID = %02i\ngroup ID = %02i\numask = %04o\n\n",
-			fuseContext->uid, fuseContext->pid, fuseContext->gid, fuseContext->umask);
-
-	if (cifsCreateFileSystem("cifs.vol") != CIFS_NO_ERROR)
-		exit(EXIT_FAILURE);
-
-	if (cifsMountFileSystem("cifs.vol") != CIFS_NO_ERROR)
-		exit(EXIT_FAILURE);
-
-	testSamples();
-
-	// TODO: implement thorough testing of all the functionality
-
-	testStep1();
-	testStep2();
-	fuseContext = (struct fuse_context*)malloc(sizeof(struct fuse_context));
-	fuseContext->fuse = NULL;                   // struct fuse   *fuse
-	fuseContext->uid = 1000 + (uid_t)rand() % 10 + 1;  // uid_t  uid
-	fuseContext->gid = 1000 + (gid_t)rand() % 10 + 1;  // gid_t  gid
-	fuseContext->pid = 1000 + (pid_t)rand() % 10 + 1;  // pid_t  pid
-	fuseContext->private_data = NULL;                   // void   *private_data
-	fuseContext->umask = S_IRUSR | S_IWUSR;             // mode_t umask
-
-	testStep3();
-
-	if (cifsUmountFileSystem("cifs.vol") != CIFS_NO_ERROR)
-		exit(EXIT_FAILURE);
-
-	return EXIT_SUCCESS;
-}
-
-/***
- *
- * develop this test function successively as you test the development of step 1
- *
- */
-void testSamples()
-{
-	printf("\n\nSAMPLE TESTS\n============\n\n");
-
-	unsigned long long test = INT_MAX;
-	printf("MAX unique identifier: %llu\n", test);
-
-	int count = 10;
-	char* content;
-	for (int i = 0; i < count; i++)
-	{
-		content = cifsGenerateContent(i * 10);
-		printf("content = \"%s\"\nhash(content) = %ld\n", content, hash((char*)content));
-	}
-
-	unsigned char testBitVector[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
-	cifsFlipBit(testBitVector, 44);
-	printf("Found free block at %d\n", cifsFindFreeBlock(testBitVector));
-	cifsClearBit(testBitVector, 33);
-	printf("Found free block at %d\n", cifsFindFreeBlock(testBitVector));
-	cifsSetBit(testBitVector, 33);
-	printf("Found free block at %d\n", cifsFindFreeBlock(testBitVector));
-
-}
-
-/***
- *
- * develop this test function successively as you test the development of step 1
- *
- */
-void testStep1()
-{
-	printf("\n\nTESTS FOR STEP #1\n=================\n\n");
-
-	// TODO: implement
-
-	CIFS_ERROR err;
-    CIFS_FILE_DESCRIPTOR_TYPE info;
-    unlink("cifs.vol");
-
-	err = cifsCreateFileSystem("cifs.vol");
-    printf("  create filesystem:      %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-	err = cifsMountFileSystem("cifs.vol");
-    printf("  mount filesystem:       %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    err = cifsCreateFile("alpha.txt", CIFS_FILE_CONTENT_TYPE);
-    printf("  create file alpha.txt:  %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-	err = cifsGetFileInfo("alpha.txt", &info);
-    printf("  get info alpha.txt:     %s   (type=%s, name=\"%s\")\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL",
-           info.type == CIFS_FILE_CONTENT_TYPE ? "FILE" : "FOLDER",
-           info.name);
-
-	err = cifsCreateFile("data", CIFS_FOLDER_CONTENT_TYPE);
-    printf("  create folder data:     %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-	err = cifsGetFileInfo("data", &info);
-    printf("  get info data:          %s   (type=%s)\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL",
-           info.type == CIFS_FOLDER_CONTENT_TYPE ? "FOLDER" : "FILE");
-
-	err = cifsCreateFile("alpha.txt", CIFS_FILE_CONTENT_TYPE); //duplicate fail
-    printf("  dup create alpha.txt:   %s\n",
-           err == CIFS_DUPLICATE_ERROR ? "PASS" : "FAIL");
-
-	err = cifsCreateFile("bad/name", CIFS_FILE_CONTENT_TYPE); //invalid name should fail
-    printf("  invalid name slash:     %s\n",
-           err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
-
-	err = cifsGetFileInfo("ghost", &info); //should fail bc non existent
-    printf("  get info ghost:         %s\n",
-           err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
-
-	printf("\n");
-}
-
-
-/***
- *
- * develop this test function successively as you test the development of step 2
- *
- */
-void testStep2()
-{
-	printf("\n\nTESTS FOR STEP #2\n=================\n\n");
-
-	// TODO: implement
-
-	CIFS_ERROR err;
-    CIFS_FILE_DESCRIPTOR_TYPE info;
-
-    // 1) clean up any old volume
-    unlink("cifs.vol");
-
-    // 2) create a fresh filesystem
-    err = cifsCreateFileSystem("cifs.vol");
-    printf("  create filesystem:           %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    // 3) mount it
-    err = cifsMountFileSystem("cifs.vol");
-    printf("  mount filesystem:            %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    // 4) add a file and a folder
-    err = cifsCreateFile("TEST2.txt", CIFS_FILE_CONTENT_TYPE);
-    printf("  create file TEST2.txt:         %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-    err = cifsCreateFile("docs", CIFS_FOLDER_CONTENT_TYPE);
-    printf("  create folder docs:          %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    // 5) verify they exist in this mount
-    err = cifsGetFileInfo("TEST2.txt", &info);
-    printf("  get info TEST2.txt:            %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-    err = cifsGetFileInfo("docs", &info);
-    printf("  get info docs:               %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    // 6) unmount
-    err = cifsUmountFileSystem("cifs.vol");
-    printf("  unmount filesystem:          %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    // 7) remount to test persistence
-    err = cifsMountFileSystem("cifs.vol");
-    printf("  remount filesystem:          %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    // 8) entries should still be there
-    err = cifsGetFileInfo("TEST2.txt", &info);
-    printf("  get info after remount TEST2:  %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-    err = cifsGetFileInfo("docs", &info);
-    printf("  get info after remount docs: %s\n",
-           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
-
-    printf("\n");
-
-}
-
-/***
- *
- * develop this test function successively as you test the development of step 3
- *
- */
-void testStep3()
-{
-	printf("\n\nTESTS FOR STEP #3\n=================\n\n");
-
-	// TODO: implement
-}
-
-#endif
+//////////////////////////////////////////////////////////////////////////
+///
+/// Copyright (c) 2020 Prof. AJ Bieszczad. All rights reserved.
+///
+//////////////////////////////////////////////////////////////////////////
+/*
+ * Rafael Diaz
+ * Spring 2025
+ * COMP 362 Section 1 - Operating Systems
+ */
+///
+/// This source contains code that can be used only during testing without
+/// FUSE.
+///
+/// Integration with fuse requires that you utilize the code from cifs.c
+/// as needed in the FUSE framework.
+///
+//////////////////////////////////////////////////////////////////////////
+///
+/// The program can be run in three different ways:
+///
+/// A) with a regular file name as a command line argument:
+///
+///      ./cifs cifs.vol
+///
+/// B) Run with real block device:
+///
+///      sudo ./cifs /dev/sdaN  # where /dev/sdaN is the name of a real disk (which is a block device)
+///
+///      WARNING!
+///           DO NOT RUN IT WITH YOUR MAIN DISK!!
+///           PLUG IN AN EMPTY USB STICK AND FIGURE OUT WHICH DEVICE IT IS, AND THEN USE IT.
+///           YOU CAN USE 'df' COMMAND TO SEE WHICH DEVICE IS ADDED AFTER YOU PLUG IN THE USB STICK.
+///
+/// C) Run with a simulated block device.
+///
+///    This way needs some preparation:
+///
+///    1) create a file to simulate a block device with a desired block size and a desired number (count) of blocks
+///
+///      dd bs=256 count=65536 if=/dev/zero of=/tmp/cifs.vol
+///
+///    2) find a free "loop" to interface with the file
+///
+///      losetup -f
+///
+///    3) link the loop with the file (assuming that loop11 is free)
+///
+///      sudo losetup /dev/loop11 /tmp/cifs.vol
+///
+///    4) run this program with /dev/loop11 as the command line argument
+///
+///      sudo ./cifs /dev/loop11
+///
+//////////////////////////////////////////////////////////////////////////
+#define NO_FUSE_DEBUG
+#ifdef NO_FUSE_DEBUG
+
+#include "cifs.h"
+
+extern _Thread_local struct fuse_context* fuseContext;
+extern CIFS_CONTEXT_TYPE* cifsContext;
+/// must use
+// fuseContext = fuse_get_context();
+/// when the cifs is integrated with FUSE
+
+/***
+ *
+ * simulates the FUSE context with random user and process identifiers
+ *
+ * cifsUmountFileSystem() releases the context, so it must be simulated again after each unmount
+ *
+ */
+static void simulateFuseContext()
+{
+	fuseContext = (struct fuse_context*)malloc(sizeof(struct fuse_context));
+	fuseContext->fuse = NULL;                   // struct fuse   *fuse
+	fuseContext->uid = 1000 + (uid_t)rand() % 10 + 1;  // uid_t  uid
+	fuseContext->gid = 1000 + (gid_t)rand() % 10 + 1;  // gid_t  gid
+	fuseContext->pid = 1000 + (pid_t)rand() % 10 + 1;  // pid_t  pid
+	fuseContext->private_data = NULL;                   // void   *private_data
+	fuseContext->umask = S_IRUSR | S_IWUSR;             // mode_t umask
+}
+
+int main(int argc, char** argv)
+{
+#ifdef RUN_ONLY_STEP2
+    testStep2();
+    return 0;
+#endif
+	printf("sizeof(CIFS_BLOCK_TYPE) = %ld\n\n", sizeof(CIFS_BLOCK_TYPE));
+
+	printf("sizeof(CIFS_CONTENT_TYPE) = %ld\n", sizeof(CIFS_CONTENT_TYPE));
+	printf("sizeof(CIFS_DATA_TYPE) = %ld\n", sizeof(CIFS_DATA_TYPE));
+	printf("sizeof(CIFS_INDEX_TYPE) = %ld\n\n", sizeof(CIFS_INDEX_TYPE));
+
+	printf("sizeof(CIFS_FILE_DESCRIPTOR_TYPE) = %ld\n\n", sizeof(CIFS_FILE_DESCRIPTOR_TYPE));
+
+	printf("sizeof(unsigned long long) = %ld\n", sizeof(unsigned long long));
+	printf("sizeof(CIFS_CONTENT_TYPE) = %ld\n", sizeof(CIFS_CONTENT_TYPE));
+	printf("sizeof(CIFS_NAME_TYPE) = %ld\n", sizeof(CIFS_NAME_TYPE));
+	printf("sizeof(time_t) = %ld\n", sizeof(time_t));
+	printf("sizeof(mode_t) = %ld\n", sizeof(mode_t));
+	printf("sizeof(uid_t) = %ld\n", sizeof(uid_t));
+	printf("sizeof(size_t) = %ld\n", sizeof(size_t));
+	printf("sizeof(CIFS_INDEX_TYPE) = %ld\n", sizeof(CIFS_INDEX_TYPE));
+
+
+	srand(time(NULL)); // uncomment to get true random values in get_context()
+
+	// the following is just some sample code for simulating user and process identifiers that are
+	// needed in the cifs functions
+	simulateFuseContext();
+
+	printf("FUSE CONTEXT:\nuser ID = %02i\nprocess ID = %02i\ngroup ID = %02i\numask = %04o\n\n",
+			fuseContext->uid, fuseContext->pid, fuseContext->gid, fuseContext->umask);
+
+	if (cifsCreateFileSystem("cifs.vol") != CIFS_NO_ERROR)
+		exit(EXIT_FAILURE);
+
+	if (cifsMountFileSystem("cifs.vol") != CIFS_NO_ERROR)
+		exit(EXIT_FAILURE);
+
+	testSamples();
+
+	// TODO: implement thorough testing of all the functionality
+
+	testStep1();
+	testStep2();
+	simulateFuseContext(); // unmounting in step 2 released the context
+
+	testStep3();
+	testBlockCache();
+	testRegistry();
+	testHierarchy();
+	testMappedVolume();
+	testIOBackend();
+	testRegistrySnapshot();
+	testJournal();
+	testGeometry();
+	testRangeIO();
+	testReadAhead();
+	testReadVector();
+	testInlineData();
+	testStats();
+	testOpenFileTable();
+	testReclaim();
+	testFsck();
+	testConcurrency();
+
+	if (cifsUmountFileSystem("cifs.vol") != CIFS_NO_ERROR)
+		exit(EXIT_FAILURE);
+
+	return EXIT_SUCCESS;
+}
+
+/***
+ *
+ * develop this test function successively as you test the development of step 1
+ *
+ */
+void testSamples()
+{
+	printf("\n\nSAMPLE TESTS\n============\n\n");
+
+	unsigned long long test = INT_MAX;
+	printf("MAX unique identifier: %llu\n", test);
+
+	int count = 10;
+	char* content;
+	for (int i = 0; i < count; i++)
+	{
+		content = cifsGenerateContent(i * 10);
+		printf("content = \"%s\"\nhash(content) = %ld\n", content, hash((char*)content));
+	}
+
+	// the search covers the whole volume, so the test vector must be as large as the volume bitvector,
+	// and aligned like an allocated one, since the bits are changed a word at a time
+	static _Alignas(unsigned long long) unsigned char testBitVector[CIFS_BITVECTOR_SIZE] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	cifsFlipBit(testBitVector, 44);
+	printf("Found free block at %d\n", cifsFindFreeBlock(testBitVector));
+	cifsClearBit(testBitVector, 33);
+	printf("Found free block at %d\n", cifsFindFreeBlock(testBitVector));
+	cifsSetBit(testBitVector, 33);
+	printf("Found free block at %d\n", cifsFindFreeBlock(testBitVector));
+
+	memset(testBitVector, 0xFF, CIFS_BITVECTOR_SIZE);
+	printf("  full bitvector:              %s\n",
+		   cifsFindFreeBlock(testBitVector) == CIFS_INVALID_INDEX ? "PASS" : "FAIL");
+	cifsClearBit(testBitVector, CIFS_BITVECTOR_BITS - 1);
+	cifsClearBit(testBitVector, 100);
+	printf("  free block after the hint:   %s\n",
+		   cifsFindFreeBlockFrom(testBitVector, 101) == CIFS_BITVECTOR_BITS - 1 ? "PASS" : "FAIL");
+	printf("  free block wrapping around:  %s\n",
+		   cifsFindFreeBlockFrom(testBitVector, CIFS_BITVECTOR_BITS - 1) == CIFS_BITVECTOR_BITS - 1
+		   && cifsFindFreeBlockFrom(testBitVector, 0) == 100
+		   && cifsFindFreeBlockInRange(testBitVector, 101, CIFS_BITVECTOR_BITS - 1) == CIFS_INVALID_INDEX
+		   ? "PASS" : "FAIL");
+
+}
+
+/***
+ *
+ * develop this test function successively as you test the development of step 1
+ *
+ */
+void testStep1()
+{
+	printf("\n\nTESTS FOR STEP #1\n=================\n\n");
+
+	// TODO: implement
+
+	CIFS_ERROR err;
+    CIFS_FILE_DESCRIPTOR_TYPE info;
+    unlink("cifs.vol");
+
+	err = cifsCreateFileSystem("cifs.vol");
+    printf("  create filesystem:      %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsMountFileSystem("cifs.vol");
+    printf("  mount filesystem:       %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    err = cifsCreateFile("alpha.txt", CIFS_FILE_CONTENT_TYPE);
+    printf("  create file alpha.txt:  %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("alpha.txt", &info);
+    printf("  get info alpha.txt:     %s   (type=%s, name=\"%s\")\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL",
+           info.type == CIFS_FILE_CONTENT_TYPE ? "FILE" : "FOLDER",
+           info.name);
+
+	err = cifsCreateFile("data", CIFS_FOLDER_CONTENT_TYPE);
+    printf("  create folder data:     %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("data", &info);
+    printf("  get info data:          %s   (type=%s)\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL",
+           info.type == CIFS_FOLDER_CONTENT_TYPE ? "FOLDER" : "FILE");
+
+	err = cifsCreateFile("alpha.txt", CIFS_FILE_CONTENT_TYPE); //duplicate fail
+    printf("  dup create alpha.txt:   %s\n",
+           err == CIFS_DUPLICATE_ERROR ? "PASS" : "FAIL");
+
+	err = cifsCreateFile("bad/name", CIFS_FILE_CONTENT_TYPE); //invalid name should fail
+    printf("  invalid name slash:     %s\n",
+           err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("ghost", &info); //should fail bc non existent
+    printf("  get info ghost:         %s\n",
+           err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+
+/***
+ *
+ * develop this test function successively as you test the development of step 2
+ *
+ */
+void testStep2()
+{
+	printf("\n\nTESTS FOR STEP #2\n=================\n\n");
+
+	// TODO: implement
+
+	CIFS_ERROR err;
+    CIFS_FILE_DESCRIPTOR_TYPE info;
+
+    // 1) clean up any old volume
+    unlink("cifs.vol");
+
+    // 2) create a fresh filesystem
+    err = cifsCreateFileSystem("cifs.vol");
+    printf("  create filesystem:           %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    // 3) mount it
+    err = cifsMountFileSystem("cifs.vol");
+    printf("  mount filesystem:            %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    // 4) add a file and a folder
+    err = cifsCreateFile("TEST2.txt", CIFS_FILE_CONTENT_TYPE);
+    printf("  create file TEST2.txt:         %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+    err = cifsCreateFile("docs", CIFS_FOLDER_CONTENT_TYPE);
+    printf("  create folder docs:          %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    // 5) verify they exist in this mount
+    err = cifsGetFileInfo("TEST2.txt", &info);
+    printf("  get info TEST2.txt:            %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+    err = cifsGetFileInfo("docs", &info);
+    printf("  get info docs:               %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    // 6) unmount
+    err = cifsUmountFileSystem("cifs.vol");
+    printf("  unmount filesystem:          %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    // 7) remount to test persistence
+    err = cifsMountFileSystem("cifs.vol");
+    printf("  remount filesystem:          %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    // 8) entries should still be there
+    err = cifsGetFileInfo("TEST2.txt", &info);
+    printf("  get info after remount TEST2:  %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+    err = cifsGetFileInfo("docs", &info);
+    printf("  get info after remount docs: %s\n",
+           err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+    printf("\n");
+
+}
+
+/***
+ *
+ * develop this test function successively as you test the development of step 3
+ *
+ */
+void testStep3()
+{
+	printf("\n\nTESTS FOR STEP #3\n=================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle, other;
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+
+	err = cifsCreateFile("step3.txt", CIFS_FILE_CONTENT_TYPE);
+	printf("  create file step3.txt:       %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	int dirty = 0;
+	for (int i = 0; i < CIFS_SUPERBLOCK_INDEX; i++)
+		dirty += cifsContext->bitvectorDirty[i];
+	CIFS_INDEX_TYPE taken = cifsAllocateBlock();
+	int dirtyAfter = 0;
+	for (int i = 0; i < CIFS_SUPERBLOCK_INDEX; i++)
+		dirtyAfter += cifsContext->bitvectorDirty[i];
+	cifsReleaseBlock(taken);
+	writeBvSb();
+	printf("  one dirty bitvector block:   %s\n",
+		   dirty == 0 && dirtyAfter == 1 && cifsContext->bitvectorDirty[taken / (CIFS_BLOCK_SIZE * 8)] == 0
+		   ? "PASS" : "FAIL");
+
+	err = cifsOpenFile("step3.txt", S_IRUSR | S_IWUSR, &handle);
+	printf("  open step3.txt:              %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsOpenFile("step3.txt", S_IRUSR, &other);
+	printf("  open step3.txt again:        %s\n",
+		   err == CIFS_OPEN_ERROR ? "PASS" : "FAIL");
+
+	err = cifsOpenFile("ghost", S_IRUSR, &other);
+	printf("  open ghost:                  %s\n",
+		   err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+
+	err = cifsDeleteFile("step3.txt");
+	printf("  delete open step3.txt:       %s\n",
+		   err == CIFS_IN_USE_ERROR ? "PASS" : "FAIL");
+
+	char* content = cifsGenerateContent(3 * CIFS_DATA_SIZE * CIFS_INDEX_SIZE); // spans several index blocks
+	char* readBack = NULL;
+	err = cifsWriteFile(handle, content);
+	printf("  write step3.txt:             %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsReadFile(handle, &readBack);
+	printf("  read step3.txt:              %s\n",
+		   err == CIFS_NO_ERROR && strcmp(readBack, content) == 0 ? "PASS" : "FAIL");
+	free(readBack);
+
+	err = cifsWriteFile(handle, "short");
+	cifsGetFileInfo("step3.txt", &info);
+	printf("  overwrite step3.txt:         %s\n",
+		   err == CIFS_NO_ERROR && info.size == 5 ? "PASS" : "FAIL");
+
+	err = cifsReadFile(handle, &readBack);
+	printf("  read overwritten step3.txt:  %s\n",
+		   err == CIFS_NO_ERROR && strcmp(readBack, "short") == 0 ? "PASS" : "FAIL");
+	free(readBack);
+	free(content);
+
+	int numberOfExtents;
+	CIFS_EXTENT_TYPE* extents = cifsAllocateExtents(500, &numberOfExtents);
+	printf("  allocate contiguous extent:  %s\n",
+		   extents != NULL && numberOfExtents == 1 && extents[0].length == 500 ? "PASS" : "FAIL");
+	if (extents != NULL)
+	{
+		cifsFreeExtents(extents, numberOfExtents);
+		free(extents);
+	}
+
+	err = cifsCloseFile(handle);
+	printf("  close step3.txt:             %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsWriteFile(handle, "closed");
+	printf("  write closed step3.txt:      %s\n",
+		   err == CIFS_ACCESS_ERROR ? "PASS" : "FAIL");
+
+	err = cifsCloseFile(handle);
+	printf("  close step3.txt again:       %s\n",
+		   err == CIFS_ACCESS_ERROR ? "PASS" : "FAIL");
+
+	err = cifsDeleteFile("step3.txt");
+	printf("  delete step3.txt:            %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("step3.txt", &info);
+	printf("  get info deleted step3.txt:  %s\n",
+		   err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+
+	// more children than a single index block holds
+	char name[CIFS_MAX_NAME_LENGTH];
+	int created = 0;
+	for (int i = 0; i < 2 * CIFS_INDEX_SIZE; i++)
+	{
+		snprintf(name, sizeof(name), "many%03d", i);
+		created += cifsCreateFile(name, CIFS_FILE_CONTENT_TYPE) == CIFS_NO_ERROR;
+	}
+	printf("  create %3d files:            %s\n", 2 * CIFS_INDEX_SIZE,
+		   created == 2 * CIFS_INDEX_SIZE ? "PASS" : "FAIL");
+
+	err = cifsDeleteFile("many000");
+	printf("  delete many000:              %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	cifsMountFileSystem("cifs.vol");
+
+	int found = 0;
+	for (int i = 1; i < 2 * CIFS_INDEX_SIZE; i++)
+	{
+		snprintf(name, sizeof(name), "many%03d", i);
+		found += cifsGetFileInfo(name, &info) == CIFS_NO_ERROR;
+	}
+	printf("  files found after remount:   %s\n",
+		   found == 2 * CIFS_INDEX_SIZE - 1 && cifsGetFileInfo("many000", &info) == CIFS_NOT_FOUND_ERROR
+		   ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+typedef struct
+{
+	CIFS_INDEX_TYPE blockNumber;
+	unsigned char content[CIFS_BLOCK_SIZE];
+	int done;
+} LOADING_READER_TYPE;
+
+static void* loadingReader(void* argument)
+{
+	LOADING_READER_TYPE* reader = argument;
+	cifsReadBlock(reader->content, reader->blockNumber);
+	__atomic_store_n(&reader->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/***
+ *
+ * checks that blocks written while mounted are held in the cache until the file system is synchronized
+ *
+ */
+void testBlockCache()
+{
+	printf("\n\nTESTS FOR THE BLOCK CACHE\n=========================\n\n");
+
+	unsigned char written[CIFS_BLOCK_SIZE];
+	unsigned char read[CIFS_BLOCK_SIZE];
+	unsigned char onVolume[CIFS_BLOCK_SIZE];
+	CIFS_INDEX_TYPE blockNumber = CIFS_NUMBER_OF_BLOCKS - 2; // far from anything in use
+
+	memset(written, 0xA5, CIFS_BLOCK_SIZE);
+	cifsWriteBlock(written, blockNumber);
+
+	cifsReadBlock(read, blockNumber);
+	printf("  read back from cache:        %s\n",
+		   memcmp(read, written, CIFS_BLOCK_SIZE) == 0 ? "PASS" : "FAIL");
+
+	cifsDeviceReadBlock(onVolume, blockNumber);
+	printf("  volume unchanged before sync: %s\n",
+		   memcmp(onVolume, written, CIFS_BLOCK_SIZE) != 0 ? "PASS" : "FAIL");
+
+	CIFS_ERROR err = cifsSyncFileSystem();
+	cifsDeviceReadBlock(onVolume, blockNumber);
+	printf("  volume updated after sync:   %s\n",
+		   err == CIFS_NO_ERROR && memcmp(onVolume, written, CIFS_BLOCK_SIZE) == 0 ? "PASS" : "FAIL");
+
+	// more blocks than the cache holds forces evictions that must write the dirty blocks back
+	for (int i = 0; i < CIFS_CACHE_SIZE + 16; i++)
+	{
+		memset(written, i & 0xFF, CIFS_BLOCK_SIZE);
+		cifsWriteBlock(written, (CIFS_INDEX_TYPE)(CIFS_NUMBER_OF_BLOCKS - 3 - i));
+	}
+	memset(written, 0, CIFS_BLOCK_SIZE);
+	cifsReadBlock(read, CIFS_NUMBER_OF_BLOCKS - 3);
+	printf("  evicted block reloaded:      %s\n",
+		   memcmp(read, written, CIFS_BLOCK_SIZE) == 0 ? "PASS" : "FAIL");
+
+	// a batch mixing cached and uncached, consecutive and scattered blocks, out of order
+	CIFS_INDEX_TYPE blockNumbers[] = { CIFS_NUMBER_OF_BLOCKS - 4, CIFS_NUMBER_OF_BLOCKS - 3,
+		CIFS_SUPERBLOCK_INDEX, 0, 1, 2, CIFS_NUMBER_OF_BLOCKS - 500 };
+	int count = sizeof(blockNumbers) / sizeof(blockNumbers[0]);
+	unsigned char batch[sizeof(blockNumbers) / sizeof(blockNumbers[0])][CIFS_BLOCK_SIZE];
+	unsigned char* buffers[sizeof(blockNumbers) / sizeof(blockNumbers[0])];
+	for (int i = 0; i < count; i++)
+		buffers[i] = batch[i];
+	cifsReadBlocks(blockNumbers, buffers, count);
+	int same = 1;
+	for (int i = 0; i < count; i++)
+	{
+		cifsReadBlock(read, blockNumbers[i]);
+		same &= memcmp(read, batch[i], CIFS_BLOCK_SIZE) == 0;
+	}
+	printf("  batched read:                %s\n", same ? "PASS" : "FAIL");
+
+	cifsSyncFileSystem();
+	for (int i = 0; i < count; i++)
+		memset(batch[i], 0x40 + i, CIFS_BLOCK_SIZE);
+	CIFS_INDEX_TYPE scratch[] = { CIFS_NUMBER_OF_BLOCKS - 10, CIFS_NUMBER_OF_BLOCKS - 12, CIFS_NUMBER_OF_BLOCKS - 11 };
+	cifsDeviceWriteBlocks(scratch, (const unsigned char* const*)buffers, 3);
+	same = 1;
+	for (int i = 0; i < 3; i++)
+	{
+		cifsDeviceReadBlock(read, scratch[i]);
+		same &= memcmp(read, batch[i], CIFS_BLOCK_SIZE) == 0;
+	}
+	printf("  batched device write:        %s\n", same ? "PASS" : "FAIL");
+
+	// a reader of a block that is loading waits for it without the cache lock, and gets the published content
+	CIFS_BLOCK_CACHE_TYPE* cache = cifsContext->blockCache;
+	static LOADING_READER_TYPE reader;
+	reader.blockNumber = CIFS_NUMBER_OF_BLOCKS - 600;
+	reader.done = 0;
+	pthread_mutex_lock(&cache->lock);
+	int slot = cifsCacheLookup(cache, reader.blockNumber);
+	while (slot < 0)
+		if ((slot = cifsCacheAcquireSlot(cache, reader.blockNumber)) < 0)
+			slot = cifsCacheLookup(cache, reader.blockNumber);
+	cache->slots[slot].loading = 1;
+	cache->busySlots++;
+	pthread_mutex_unlock(&cache->lock);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, loadingReader, &reader);
+	usleep(50000);
+	int waiting = !__atomic_load_n(&reader.done, __ATOMIC_ACQUIRE) && pthread_mutex_trylock(&cache->lock) == 0;
+	if (!waiting)
+		pthread_mutex_lock(&cache->lock);
+	memset(cache->slots[slot].content, 0x5C, CIFS_BLOCK_SIZE);
+	cache->slots[slot].dirty = 1; // goes to the volume like any write
+	cache->slots[slot].loading = 0;
+	cache->busySlots--;
+	pthread_cond_broadcast(&cache->settled);
+	pthread_mutex_unlock(&cache->lock);
+	pthread_join(thread, NULL);
+	memset(written, 0x5C, CIFS_BLOCK_SIZE);
+	printf("  reader waits for a load:     %s\n",
+		   waiting && memcmp(reader.content, written, CIFS_BLOCK_SIZE) == 0 ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+/***
+ *
+ * checks the registry table with many entries: growing, and finding the entries left after removing
+ * others from the same probe runs
+ *
+ */
+void testRegistry()
+{
+	printf("\n\nTESTS FOR THE REGISTRY\n======================\n\n");
+
+	// the entries are registered under a folder and handles that the volume does not use
+	enum { COUNT = 3000 };
+	static CIFS_INDEX_TYPE handles[COUNT];
+	CIFS_FILE_HANDLE_TYPE folder = CIFS_NUMBER_OF_BLOCKS - 1;
+	int count = 0;
+	for (CIFS_INDEX_TYPE h = CIFS_NUMBER_OF_BLOCKS - 2; count < COUNT; h--)
+		if (cifsContext->handles[h] == NULL)
+			handles[count++] = h;
+
+	unsigned int slotsBefore = cifsContext->registry->slotCount;
+	int added = 1;
+	for (int i = 0; i < COUNT; i++)
+	{
+		CIFS_FILE_DESCRIPTOR_TYPE fd;
+		memset(&fd, 0, sizeof(fd));
+		sprintf(fd.name, "entry%04d", i % (COUNT / 2)); // every name twice, under different parents
+		fd.file_block_ref = handles[i];
+		added &= addToHashTable(i < COUNT / 2 ? folder : folder - 1, &fd) != NULL;
+	}
+	printf("  add %d entries:            %s\n", COUNT,
+		   added && cifsContext->registry->slotCount > slotsBefore ? "PASS" : "FAIL");
+
+	int found = 1;
+	for (int i = 0; i < COUNT; i++)
+	{
+		char name[CIFS_MAX_NAME_LENGTH];
+		sprintf(name, "entry%04d", i % (COUNT / 2));
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsRegistryFind(i < COUNT / 2 ? folder : folder - 1, name);
+		found &= entry != NULL && entry->fileDescriptor.file_block_ref == handles[i];
+	}
+	printf("  find all entries:            %s\n", found ? "PASS" : "FAIL");
+
+	for (int i = 0; i < COUNT; i += 2)
+		cifsRegistryRemove(cifsContext->handles[handles[i]]);
+
+	found = 1;
+	for (int i = 0; i < COUNT; i++)
+	{
+		char name[CIFS_MAX_NAME_LENGTH];
+		sprintf(name, "entry%04d", i % (COUNT / 2));
+		CIFS_REGISTRY_ENTRY_TYPE* entry = cifsRegistryFind(i < COUNT / 2 ? folder : folder - 1, name);
+		found &= i % 2 == 0 ? entry == NULL : entry != NULL && entry->fileDescriptor.file_block_ref == handles[i];
+	}
+	printf("  find after removing half:    %s\n", found ? "PASS" : "FAIL");
+
+	for (int i = 1; i < COUNT; i += 2)
+		cifsRegistryRemove(cifsContext->handles[handles[i]]);
+
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+	printf("  volume entries unaffected:   %s\n",
+		   cifsGetFileInfo("TEST2.txt", &info) == CIFS_NO_ERROR && cifsRegistryFind(folder, "entry0001") == NULL
+		   ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+/***
+ *
+ * checks files and folders below the root: creating, resolving through the path cache, and finding them
+ * again after the registry is rebuilt by traversing the volume
+ *
+ */
+void testHierarchy()
+{
+	printf("\n\nTESTS FOR FOLDERS\n=================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+
+	err = cifsCreateFile("nested", CIFS_FOLDER_CONTENT_TYPE);
+	err |= cifsCreateFile("/nested/deeper", CIFS_FOLDER_CONTENT_TYPE);
+	printf("  create nested folders:       %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("nested/deeper/leaf.txt", &info);
+	printf("  missing file (cached):       %s\n", err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+
+	err = cifsCreateFile("nested/deeper/leaf.txt", CIFS_FILE_CONTENT_TYPE);
+	printf("  create nested file:          %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("nested/deeper/leaf.txt", &info);
+	printf("  miss invalidated by create:  %s\n",
+		   err == CIFS_NO_ERROR && strcmp(info.name, "leaf.txt") == 0 ? "PASS" : "FAIL");
+
+	CIFS_FILE_DESCRIPTOR_TYPE deeper;
+	cifsGetFileInfo("nested/deeper", &deeper);
+	printf("  parent of the nested file:   %s\n",
+		   info.parent_block_ref == deeper.file_block_ref && deeper.size == 1 ? "PASS" : "FAIL");
+
+	printf("  duplicate nested file:       %s\n",
+		   cifsCreateFile("/nested/deeper/leaf.txt", CIFS_FILE_CONTENT_TYPE) == CIFS_DUPLICATE_ERROR ? "PASS" : "FAIL");
+	printf("  create in a missing folder:  %s\n",
+		   cifsCreateFile("nested/none/x", CIFS_FILE_CONTENT_TYPE) == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+	printf("  create below a file:         %s\n",
+		   cifsCreateFile("nested/deeper/leaf.txt/x", CIFS_FILE_CONTENT_TYPE) == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+	printf("  delete a non-empty folder:   %s\n",
+		   cifsDeleteFile("nested/deeper") == CIFS_NOT_EMPTY_ERROR ? "PASS" : "FAIL");
+
+	CIFS_FILE_HANDLE_TYPE handle;
+	char content[] = "below the root";
+	err = cifsOpenFile("nested/deeper/leaf.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, content);
+	char* read = NULL;
+	err |= cifsReadFile(handle, &read);
+	err |= cifsCloseFile(handle);
+	printf("  write and read nested file:  %s\n",
+		   err == CIFS_NO_ERROR && read != NULL && strcmp(read, content) == 0 ? "PASS" : "FAIL");
+	free(read);
+
+	// rebuild the registry from the volume itself
+	cifsRegistrySnapshot = 0;
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	cifsMountFileSystem("cifs.vol");
+	cifsRegistrySnapshot = 1;
+
+	err = cifsGetFileInfo("nested/deeper/leaf.txt", &info);
+	printf("  nested file after traversal: %s\n",
+		   err == CIFS_NO_ERROR && info.size == strlen(content) ? "PASS" : "FAIL");
+
+	err = cifsDeleteFile("nested/deeper/leaf.txt");
+	printf("  delete nested file:          %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("nested/deeper/leaf.txt", &info);
+	printf("  hit invalidated by delete:   %s\n", err == CIFS_NOT_FOUND_ERROR ? "PASS" : "FAIL");
+
+	err = cifsDeleteFile("nested/deeper");
+	err |= cifsDeleteFile("nested");
+	printf("  delete the emptied folders:  %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+/***
+ *
+ * checks that a volume mounted through a memory mapping is interchangeable with the stdio access
+ *
+ */
+void testMappedVolume()
+{
+	printf("\n\nTESTS FOR THE MAPPED VOLUME\n===========================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	err = cifsMountFileSystemMode("cifs.vol", CIFS_MOUNT_MMAP);
+	printf("  mount mapped:                %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("TEST2.txt", &info);
+	printf("  get info TEST2.txt:          %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	err = cifsCreateFile("mapped.txt", CIFS_FILE_CONTENT_TYPE);
+	printf("  create file mapped.txt:      %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	CIFS_BLOCK_TYPE* block = (CIFS_BLOCK_TYPE*)cifsGetBlockPtr(info.file_block_ref);
+	printf("  block pointer into mapping:  %s\n",
+		   block != NULL && block->content.fileDescriptor.identifier == info.identifier ? "PASS" : "FAIL");
+
+	err = cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	printf("  unmount mapped:              %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	// a volume too short to be mapped is not left half mounted
+	FILE* volume = fopen("cifs.vol", "r");
+	FILE* shortened = fopen("short.vol", "w");
+	int copied = volume != NULL && shortened != NULL;
+	static char head[CIFS_BITVECTOR_SIZE + CIFS_BLOCK_SIZE * (1 + CIFS_JOURNAL_BLOCKS + 1)];
+	if (copied)
+	{
+		size_t length = fread(head, 1, sizeof head, volume);
+		copied = fwrite(head, 1, length, shortened) == length;
+	}
+	if (volume != NULL)
+		fclose(volume);
+	if (shortened != NULL)
+		fclose(shortened);
+	err = cifsMountFileSystemMode("short.vol", CIFS_MOUNT_MMAP);
+	printf("  short volume not mapped:     %s\n",
+		   copied && err == CIFS_SYSTEM_ERROR && cifsContext == NULL ? "PASS" : "FAIL");
+	remove("short.vol");
+
+	cifsMountFileSystem("cifs.vol");
+	err = cifsGetFileInfo("mapped.txt", &info);
+	printf("  get info mapped.txt (stdio): %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	printf("  no block pointer via stdio:  %s\n",
+		   cifsGetBlockPtr(info.file_block_ref) == NULL ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+static int completedRuns;
+static ssize_t lastRunResult;
+
+static void countCompletedRun(CIFS_IO_RUN_TYPE* run, ssize_t result)
+{
+	lastRunResult = result;
+	if (result == (ssize_t)run->iovCount * CIFS_BLOCK_SIZE)
+		completedRuns++;
+}
+
+/***
+ *
+ * checks that a volume mounted with the io_uring backend is interchangeable with the posix one, and that a
+ * backend completes every run of a batch
+ *
+ */
+void testIOBackend()
+{
+	printf("\n\nTESTS FOR THE I/O BACKENDS\n==========================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	// the posix backend takes over if the kernel has no io_uring
+	err = cifsMountFileSystemMode("cifs.vol", CIFS_MOUNT_URING);
+	CIFS_IO_BACKEND_TYPE* backend = cifsIOBackend();
+	printf("  mount with io_uring:         %s", err == CIFS_NO_ERROR && backend != NULL ? "PASS" : "FAIL");
+	if (backend != NULL)
+		printf(" (%s backend)", backend->name);
+	printf("\n");
+
+	// a batch of runs, some of them in flight together
+	enum { RUNS = 5, RUN_BLOCKS = 3 };
+	static unsigned char blocks[RUNS * RUN_BLOCKS][CIFS_BLOCK_SIZE];
+	struct iovec iov[RUNS * RUN_BLOCKS];
+	CIFS_IO_RUN_TYPE runs[RUNS];
+	for (int b = 0; b < RUNS * RUN_BLOCKS; b++)
+	{
+		memset(blocks[b], b + 1, CIFS_BLOCK_SIZE);
+		iov[b].iov_base = blocks[b];
+		iov[b].iov_len = CIFS_BLOCK_SIZE;
+	}
+	FILE* scratch = fopen("backend.bin", "w+");
+	int fd = scratch != NULL ? fileno(scratch) : -1;
+	for (int writing = 1; writing >= 0; writing--)
+	{
+		for (int r = 0; r < RUNS; r++)
+		{
+			runs[r].writing = writing;
+			runs[r].offset = (off_t)(RUNS - r) * 2 * RUN_BLOCKS * CIFS_BLOCK_SIZE; // with holes, descending
+			runs[r].iov = iov + r * RUN_BLOCKS;
+			runs[r].iovCount = RUN_BLOCKS;
+			runs[r].complete = countCompletedRun;
+			runs[r].arg = NULL;
+		}
+		completedRuns = 0;
+		backend->transfer(backend, fd, runs, RUNS);
+		if (writing)
+		{
+			printf("  all written runs completed:  %s\n", completedRuns == RUNS ? "PASS" : "FAIL");
+			memset(blocks, 0, sizeof blocks);
+		}
+	}
+	int same = 1;
+	for (int b = 0; b < RUNS * RUN_BLOCKS; b++)
+		same &= blocks[b][0] == b + 1 && blocks[b][CIFS_BLOCK_SIZE - 1] == b + 1;
+	printf("  runs read back:              %s\n", completedRuns == RUNS && same ? "PASS" : "FAIL");
+
+	// a run past the end of the file is read up to the end, and no further
+	off_t end = (off_t)(2 * RUNS * RUN_BLOCKS + 1) * CIFS_BLOCK_SIZE + CIFS_BLOCK_SIZE / 2;
+	int truncated = fd >= 0 && ftruncate(fd, end) == 0;
+	runs[0].offset = end - CIFS_BLOCK_SIZE;
+	runs[0].iov = iov;
+	for (int b = 0; b < RUN_BLOCKS; b++)
+	{
+		iov[b].iov_base = blocks[b];
+		iov[b].iov_len = CIFS_BLOCK_SIZE;
+	}
+	lastRunResult = -1;
+	backend->transfer(backend, fd, runs, 1);
+	printf("  run ends with the file:      %s\n", truncated && lastRunResult == CIFS_BLOCK_SIZE ? "PASS" : "FAIL");
+	if (scratch != NULL)
+		fclose(scratch);
+	remove("backend.bin");
+
+	// the block cache writes a file of many blocks through the backend
+	size_t length = 40 * CIFS_DATA_SIZE + 17;
+	unsigned char* expected = malloc(length);
+	unsigned char* actual = malloc(length);
+	for (size_t i = 0; i < length; i++)
+		expected[i] = (unsigned char)(i * 13);
+	err = cifsCreateFile("uring.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("uring.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, expected, length, 0);
+	err |= cifsCloseFile(handle);
+	err |= cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	size_t bytesRead = 0;
+	err |= cifsMountFileSystem("cifs.vol");
+	err |= cifsOpenFile("uring.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPread(handle, actual, length, 0, &bytesRead);
+	err |= cifsCloseFile(handle);
+	printf("  file read back via posix:    %s\n",
+		   err == CIFS_NO_ERROR && bytesRead == length && memcmp(actual, expected, length) == 0 ? "PASS" : "FAIL");
+	printf("  posix backend after umount:  %s\n", strcmp(cifsIOBackend()->name, "posix") == 0 ? "PASS" : "FAIL");
+
+	free(expected);
+	free(actual);
+	printf("\n");
+}
+
+/***
+ *
+ * checks that a clean unmount leaves a registry snapshot that the next mount uses, and that a stale one is
+ * not trusted
+ *
+ */
+/***
+ *
+ * breaks the snapshot record of the named entry in one of the ways the mount must not trust
+ *
+ */
+static int corruptSnapshotRecord(const char* snapshotName, const char* name, int kind)
+{
+	FILE* snapshot = fopen(snapshotName, "r+");
+	if (snapshot == NULL)
+		return 0;
+	CIFS_SNAPSHOT_HEADER_TYPE header;
+	CIFS_SNAPSHOT_RECORD_TYPE* records = NULL;
+	char* names = NULL;
+	int corrupted = fread(&header, sizeof header, 1, snapshot) == 1 && header.recordCount > 1
+					&& (records = malloc(header.recordCount * sizeof(*records))) != NULL
+					&& (names = malloc(header.namesSize)) != NULL
+					&& fread(records, sizeof(*records), header.recordCount, snapshot) == header.recordCount
+					&& fread(names, 1, header.namesSize, snapshot) == header.namesSize;
+	unsigned int target = 0;
+	while (corrupted && target < header.recordCount && strcmp(names + records[target].nameOffset, name) != 0)
+		target++;
+	corrupted = corrupted && target < header.recordCount;
+	if (corrupted)
+	{
+		CIFS_SNAPSHOT_RECORD_TYPE* record = &records[target];
+		switch (kind)
+		{
+		case 0:
+			record->parentFileHandle = CIFS_NUMBER_OF_BLOCKS + 1;
+			break;
+		case 1:
+			record->descriptorBlock = records[target == 0 ? 1 : 0].descriptorBlock;
+			break;
+		case 2:
+			record->type = CIFS_INVALID_CONTENT_TYPE;
+			break;
+		case 3:
+			record->inlined = 1;
+			record->size = CIFS_INLINE_SIZE + 1;
+			break;
+		default:
+			// 16-bit block numbers have no room for a block beyond the volume
+			record->block_ref = (CIFS_INDEX_TYPE)(CIFS_NUMBER_OF_BLOCKS + 1);
+			corrupted = record->block_ref > CIFS_NUMBER_OF_BLOCKS;
+			break;
+		}
+		fseek(snapshot, sizeof header + target * sizeof(*records), SEEK_SET);
+		corrupted &= fwrite(record, sizeof(*record), 1, snapshot) == 1;
+	}
+	free(records);
+	free(names);
+	fclose(snapshot);
+	return corrupted;
+}
+
+void testRegistrySnapshot()
+{
+	printf("\n\nTESTS FOR THE REGISTRY SNAPSHOT\n===============================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_DESCRIPTOR_TYPE before, after;
+
+	cifsGetFileInfo("mapped.txt", &before);
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	CIFS_SNAPSHOT_HEADER_TYPE header = { 0 };
+	FILE* snapshot = fopen("cifs.vol" CIFS_SNAPSHOT_SUFFIX, "r");
+	if (snapshot != NULL)
+	{
+		if (fread(&header, sizeof(header), 1, snapshot) != 1)
+			header.magic = 0;
+		fclose(snapshot);
+	}
+	CIFS_SUPERBLOCK_TYPE superblock = { 0 };
+	FILE* volume = fopen("cifs.vol", "r");
+	if (volume != NULL)
+	{
+		fseek(volume, CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE, SEEK_SET);
+		if (fread(&superblock, sizeof(superblock), 1, volume) != 1)
+			superblock.cifsSnapshotGeneration = 0;
+		fclose(volume);
+	}
+	printf("  snapshot saved at unmount:   %s\n",
+		   header.magic == CIFS_SNAPSHOT_MAGIC && header.generation != 0
+		   && header.generation == superblock.cifsSnapshotGeneration ? "PASS" : "FAIL");
+
+	err = cifsMountFileSystem("cifs.vol");
+	printf("  mount from the snapshot:     %s\n",
+		   err == CIFS_NO_ERROR && cifsContext->superblock->cifsSnapshotGeneration == 0 ? "PASS" : "FAIL");
+
+	err = cifsGetFileInfo("mapped.txt", &after);
+	printf("  same entry after mount:      %s\n",
+		   err == CIFS_NO_ERROR && after.identifier == before.identifier && after.size == before.size
+		   && after.file_block_ref == before.file_block_ref && strcmp(after.name, before.name) == 0 ? "PASS" : "FAIL");
+
+	// leave the volume without a snapshot, as a crash would; the one on the disk does not know fresh.txt
+	cifsCreateFile("fresh.txt", CIFS_FILE_CONTENT_TYPE);
+	cifsRegistrySnapshot = 0;
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	cifsRegistrySnapshot = 1;
+
+	cifsMountFileSystem("cifs.vol");
+	err = cifsGetFileInfo("fresh.txt", &after);
+	printf("  stale snapshot ignored:      %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	// a snapshot with a record that does not describe a descriptor is given up for the traversal
+	CIFS_FILE_DESCRIPTOR_TYPE fresh, checked;
+	int kinds = CIFS_INDEX_BITS > 16 ? 5 : 4;
+	int ignored = cifsGetFileInfo("fresh.txt", &fresh) == CIFS_NO_ERROR;
+	for (int kind = 0; kind < kinds; kind++)
+	{
+		cifsUmountFileSystem("cifs.vol");
+		simulateFuseContext();
+		ignored &= corruptSnapshotRecord("cifs.vol" CIFS_SNAPSHOT_SUFFIX, "fresh.txt", kind);
+
+		err = cifsMountFileSystem("cifs.vol");
+		err |= cifsGetFileInfo("fresh.txt", &checked);
+		err |= cifsGetFileInfo("mapped.txt", &after);
+		ignored &= err == CIFS_NO_ERROR && checked.file_block_ref == fresh.file_block_ref
+				   && checked.type == fresh.type && checked.parent_block_ref == fresh.parent_block_ref
+				   && checked.block_ref == fresh.block_ref && checked.inlined == fresh.inlined
+				   && checked.size == fresh.size && after.file_block_ref == before.file_block_ref;
+	}
+	printf("  invalid records ignored:     %s\n", ignored ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+/***
+ *
+ * copies a volume file as it is on the disk now; the copy is what a crash at this point would leave
+ *
+ */
+static int copyVolume(const char* volumeName, const char* copyName)
+{
+	FILE* volume = fopen(volumeName, "r");
+	FILE* copy = fopen(copyName, "w");
+	int copied = volume != NULL && copy != NULL;
+	if (copied)
+	{
+		char buffer[64 * CIFS_BLOCK_SIZE];
+		size_t length;
+		while ((length = fread(buffer, 1, sizeof buffer, volume)) > 0)
+			copied &= fwrite(buffer, 1, length, copy) == length;
+	}
+	if (volume != NULL)
+		fclose(volume);
+	if (copy != NULL)
+		fclose(copy);
+	return copied;
+}
+
+/***
+ *
+ * checks that committed metadata survives a crash in the journal, and that volumes can go without one
+ *
+ */
+void testJournal()
+{
+	printf("\n\nTESTS FOR THE METADATA JOURNAL\n==============================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+	char* content = NULL;
+
+	const CIFS_SUPERBLOCK_TYPE* superblock = cifsContext->superblock;
+	printf("  journal after the superblock: %s\n",
+		   cifsContext->journal != NULL && superblock->cifsJournalIndex == CIFS_SUPERBLOCK_INDEX + 1
+		   && superblock->cifsJournalBlocks == CIFS_JOURNAL_BLOCKS
+		   && superblock->cifsRootNodeIndex == CIFS_SUPERBLOCK_INDEX + 1 + CIFS_JOURNAL_BLOCKS ? "PASS" : "FAIL");
+
+	err = cifsCreateFile("journaled.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("journaled.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, "committed before the crash");
+	err |= cifsCloseFile(handle);
+	err |= cifsJournalCommit();
+	err |= cifsGetFileInfo("journaled.txt", &info);
+	printf("  commit the transaction:       %s\n",
+		   err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	// the volume as a crash would leave it: the descriptor is in the journal, but not at home yet
+	CIFS_BLOCK_TYPE home;
+	int copied = copyVolume("cifs.vol", "crash.vol");
+	FILE* volume = fopen("cifs.vol", "r");
+	copied &= volume != NULL;
+	if (volume != NULL)
+	{
+		fseek(volume, (long)info.file_block_ref * CIFS_BLOCK_SIZE, SEEK_SET);
+		copied &= fread(&home, sizeof home, 1, volume) == 1;
+		fclose(volume);
+	}
+	printf("  descriptor only in journal:   %s\n",
+		   copied && strcmp(home.content.fileDescriptor.name, "journaled.txt") != 0 ? "PASS" : "FAIL");
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	err = cifsMountFileSystem("crash.vol");
+	err |= cifsGetFileInfo("journaled.txt", &info);
+	err |= cifsOpenFile("journaled.txt", S_IRUSR, &handle);
+	err |= cifsReadFile(handle, &content);
+	printf("  replayed at mount:            %s\n",
+		   err == CIFS_NO_ERROR && content != NULL && strcmp(content, "committed before the crash") == 0 ? "PASS" : "FAIL");
+	free(content);
+	cifsCloseFile(handle);
+	cifsUmountFileSystem("crash.vol");
+	simulateFuseContext();
+	remove("crash.vol");
+	remove("crash.vol" CIFS_SNAPSHOT_SUFFIX);
+
+	// blocks replaced by a rewrite are not reused before the rewrite commits
+	size_t length = 4 * CIFS_DATA_SIZE;
+	char* oldContent = malloc(length + 1);
+	char* newContent = malloc(length + 1);
+	char* otherContent = malloc(length + 1);
+	memset(oldContent, 'o', length);
+	memset(newContent, 'n', length);
+	memset(otherContent, 'x', length);
+	oldContent[length] = newContent[length] = '\0';
+	otherContent[length - CIFS_DATA_SIZE] = '\0'; // takes as many blocks as the old content with its descriptor
+	err = cifsCreateFileSystem("reuse.vol");
+	err |= cifsMountFileSystem("reuse.vol");
+	err |= cifsCreateFile("rewritten.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("rewritten.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, oldContent);
+	err |= cifsJournalCommit();
+	err |= cifsGetFileInfo("rewritten.txt", &info);
+	CIFS_BLOCK_TYPE index;
+	cifsReadBlock((unsigned char*)&index, info.block_ref);
+	err |= cifsWriteFile(handle, newContent);
+	err |= cifsCloseFile(handle);
+	cifsReclaimWait();
+
+	// only the replaced blocks could be handed out to another file now
+	for (unsigned int b = 0; b < CIFS_BITVECTOR_BITS; b++)
+	{
+		int replaced = b == info.block_ref;
+		for (int i = 0; i < 4; i++)
+			replaced |= b == index.content.index[i];
+		if (!replaced && !cifsTestBit(cifsContext->bitvector, b))
+			cifsSetBit(cifsContext->bitvector, b);
+	}
+	CIFS_ERROR reuseError = cifsCreateFile("other.txt", CIFS_FILE_CONTENT_TYPE);
+	if (reuseError == CIFS_NO_ERROR)
+	{
+		reuseError = cifsOpenFile("other.txt", S_IRUSR | S_IWUSR, &handle);
+		reuseError |= cifsWriteFile(handle, otherContent);
+		reuseError |= cifsCloseFile(handle);
+	}
+
+	// a crash before the commit leaves the blocks written in place, but none of those in the journal
+	cifsFlushBlockCache(cifsContext->blockCache);
+	copied = copyVolume("reuse.vol", "crash.vol");
+	err |= cifsJournalCommit();
+	CIFS_ERROR afterCommit = cifsCreateFile("other.txt", CIFS_FILE_CONTENT_TYPE);
+	afterCommit |= cifsOpenFile("other.txt", S_IRUSR | S_IWUSR, &handle);
+	afterCommit |= cifsWriteFile(handle, otherContent);
+	afterCommit |= cifsCloseFile(handle);
+	cifsUmountFileSystem("reuse.vol");
+	simulateFuseContext();
+
+	err |= cifsMountFileSystem("crash.vol");
+	err |= cifsOpenFile("rewritten.txt", S_IRUSR, &handle);
+	err |= cifsReadFile(handle, &content);
+	err |= cifsCloseFile(handle);
+	printf("  replaced blocks kept:         %s\n",
+		   err == CIFS_NO_ERROR && copied && reuseError != CIFS_NO_ERROR && content != NULL
+		   && (strcmp(content, oldContent) == 0 || strcmp(content, newContent) == 0) ? "PASS" : "FAIL");
+	printf("  reused after the commit:      %s\n", afterCommit == CIFS_NO_ERROR ? "PASS" : "FAIL");
+	free(content);
+	content = NULL;
+	cifsUmountFileSystem("crash.vol");
+	simulateFuseContext();
+	remove("crash.vol");
+	remove("crash.vol" CIFS_SNAPSHOT_SUFFIX);
+	remove("reuse.vol");
+	remove("reuse.vol" CIFS_SNAPSHOT_SUFFIX);
+	free(oldContent);
+	free(newContent);
+	free(otherContent);
+
+	cifsJournalBlocks = 0;
+	err = cifsCreateFileSystem("plain.vol");
+	err |= cifsMountFileSystem("plain.vol");
+	err |= cifsCreateFile("plain.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsGetFileInfo("plain.txt", &info);
+	printf("  volume without a journal:     %s\n",
+		   err == CIFS_NO_ERROR && cifsContext->journal == NULL && cifsContext->superblock->cifsJournalBlocks == 0
+		   && cifsContext->superblock->cifsRootNodeIndex == CIFS_SUPERBLOCK_INDEX + 1 ? "PASS" : "FAIL");
+	cifsUmountFileSystem("plain.vol");
+	simulateFuseContext();
+	cifsJournalBlocks = CIFS_JOURNAL_BLOCKS;
+	remove("plain.vol");
+	remove("plain.vol" CIFS_SNAPSHOT_SUFFIX);
+
+	cifsMountFileSystem("cifs.vol");
+
+	printf("\n");
+}
+
+/***
+ *
+ * checks that the geometry of the build is recorded on the volume, and that volumes of another one are refused
+ *
+ */
+void testGeometry()
+{
+	printf("\n\nTESTS FOR THE VOLUME GEOMETRY\n=============================\n\n");
+
+	CIFS_ERROR err;
+	const CIFS_SUPERBLOCK_TYPE* superblock = cifsContext->superblock;
+	printf("  geometry in the superblock:  %s\n",
+		   superblock->cifsDataBlockSize == CIFS_BLOCK_SIZE && superblock->cifsIndexBits == CIFS_INDEX_BITS
+		   && superblock->cifsNumberOfBlocks == CIFS_NUMBER_OF_BLOCKS - 1 ? "PASS" : "FAIL");
+
+	printf("  index blocks fill a block:   %s\n",
+		   CIFS_INDEX_SIZE * sizeof(CIFS_INDEX_TYPE) + sizeof(CIFS_CONTENT_TYPE) == CIFS_BLOCK_SIZE
+		   && CIFS_DATA_SIZE + sizeof(CIFS_CONTENT_TYPE) == CIFS_BLOCK_SIZE ? "PASS" : "FAIL");
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	// the same volume as formatted with the other width of the block numbers
+	cifsCreateFileSystem("other.vol");
+	CIFS_INDEX_TYPE otherBits = CIFS_INDEX_BITS == 16 ? 32 : 16;
+	FILE* volume = fopen("other.vol", "r+");
+	if (volume != NULL)
+	{
+		fseek(volume, (long)CIFS_SUPERBLOCK_INDEX * CIFS_BLOCK_SIZE + offsetof(CIFS_SUPERBLOCK_TYPE, cifsIndexBits), SEEK_SET);
+		fwrite(&otherBits, sizeof otherBits, 1, volume);
+		fclose(volume);
+	}
+	err = cifsMountFileSystem("other.vol");
+	printf("  other geometry refused:      %s\n",
+		   err == CIFS_GEOMETRY_ERROR && cifsContext == NULL ? "PASS" : "FAIL");
+	remove("other.vol");
+
+	// a fresh volume has its full size, but only the metadata at its head is allocated
+	struct stat status;
+	err = cifsCreateFileSystem("format.vol");
+	int sparse = err == CIFS_NO_ERROR && stat("format.vol", &status) == 0
+				 && status.st_size == (off_t)CIFS_NUMBER_OF_BLOCKS * CIFS_BLOCK_SIZE
+				 && (off_t)status.st_blocks * 512 < status.st_size / 2;
+	printf("  sparse volume formatted:     %s\n", sparse ? "PASS" : "FAIL");
+
+	CIFS_FILE_HANDLE_TYPE handle;
+	err = cifsMountFileSystem("format.vol");
+	err |= cifsCreateFile("fresh.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("fresh.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, "fresh");
+	err |= cifsCloseFile(handle);
+	err |= cifsUmountFileSystem("format.vol");
+	simulateFuseContext();
+	err |= cifsMountFileSystem("format.vol");
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+	err |= cifsGetFileInfo("fresh.txt", &info);
+	printf("  formatted volume mounts:     %s\n", err == CIFS_NO_ERROR && info.size == 5 ? "PASS" : "FAIL");
+	cifsUmountFileSystem("format.vol");
+	simulateFuseContext();
+	remove("format.vol");
+
+	cifsMountFileSystem("cifs.vol");
+
+	printf("\n");
+}
+
+/***
+ *
+ * tells whether the block is in the block cache
+ *
+ */
+static int isCached(CIFS_INDEX_TYPE blockNumber)
+{
+	CIFS_BLOCK_CACHE_TYPE* cache = cifsContext->blockCache;
+	pthread_mutex_lock(&cache->lock);
+	int cached = cifsCacheLookup(cache, blockNumber) >= 0;
+	pthread_mutex_unlock(&cache->lock);
+	return cached;
+}
+
+/***
+ *
+ * checks that sequential reads prefetch the following data blocks with a growing window, and that other
+ * reads close the window
+ *
+ */
+void testReadAhead()
+{
+	printf("\n\nTESTS FOR THE READ-AHEAD\n========================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+	unsigned int blocks = 3 * (CIFS_INDEX_SIZE - 1) - 20; // three index blocks
+	size_t length = (size_t)blocks * CIFS_DATA_SIZE;
+	unsigned char* expected = malloc(length);
+	unsigned char* actual = malloc(length);
+	for (size_t i = 0; i < length; i++)
+		expected[i] = (unsigned char)(i * 31 + i / CIFS_DATA_SIZE);
+
+	err = cifsCreateFile("ahead.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("ahead.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, expected, length, 0);
+	err |= cifsCloseFile(handle);
+	err |= cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	err |= cifsMountFileSystem("cifs.vol"); // nothing of the file is cached
+	err |= cifsOpenFile("ahead.bin", S_IRUSR | S_IWUSR, &handle);
+
+	size_t bytesRead;
+	err |= cifsPread(handle, actual, CIFS_DATA_SIZE, 0, &bytesRead);
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[handle];
+	const CIFS_BLOCK_MAP_TYPE* map = entry->blockMap;
+	int prefetched = map != NULL && entry->readAheadWindow == CIFS_READ_AHEAD_MIN;
+	for (unsigned int b = 1; prefetched && b <= CIFS_READ_AHEAD_MIN; b++)
+		prefetched &= isCached(map->data[b]);
+	printf("  first read prefetches:       %s\n",
+		   err == CIFS_NO_ERROR && prefetched && !isCached(map->data[CIFS_READ_AHEAD_MIN + 1]) ? "PASS" : "FAIL");
+
+	// small sequential reads up to the last index block
+	int same = 1;
+	size_t offset = CIFS_DATA_SIZE;
+	size_t step = CIFS_DATA_SIZE / 2 + 1;
+	while (offset < 2 * (CIFS_INDEX_SIZE - 1) * (size_t)CIFS_DATA_SIZE)
+	{
+		err |= cifsPread(handle, actual + offset, step, offset, &bytesRead);
+		same &= bytesRead == step && memcmp(actual + offset, expected + offset, step) == 0;
+		offset += step;
+	}
+	unsigned int next = (offset - 1) / CIFS_DATA_SIZE + 1;
+	printf("  window grows to the maximum: %s\n",
+		   err == CIFS_NO_ERROR && same && entry->readAheadWindow == CIFS_READ_AHEAD_MAX
+		   && entry->readAheadEnd > next && isCached(map->data[entry->readAheadEnd - 1]) ? "PASS" : "FAIL");
+
+	err |= cifsPread(handle, actual, CIFS_DATA_SIZE, 7, &bytesRead);
+	printf("  other read closes window:    %s\n",
+		   err == CIFS_NO_ERROR && entry->readAheadWindow == 0 && memcmp(actual, expected + 7, CIFS_DATA_SIZE) == 0
+		   ? "PASS" : "FAIL");
+
+	// the whole file through the index chain, each next index block with the data blocks before it
+	err |= cifsCloseFile(handle);
+	err |= cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	err |= cifsMountFileSystem("cifs.vol");
+	char* content = NULL;
+	err |= cifsOpenFile("ahead.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsReadFile(handle, &content);
+	printf("  chained read of the file:    %s\n",
+		   err == CIFS_NO_ERROR && content != NULL && memcmp(content, expected, length) == 0 ? "PASS" : "FAIL");
+	free(content);
+	cifsCloseFile(handle);
+	cifsDeleteFile("ahead.bin");
+
+	free(expected);
+	free(actual);
+	printf("\n");
+}
+
+/***
+ *
+ * checks that read vectors describe the content in the block cache, keep it while a block gets new content, and
+ * are limited in the number of slots they hold
+ *
+ */
+void testReadVector()
+{
+	printf("\n\nTESTS FOR THE READ VECTORS\n==========================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+	CIFS_BLOCK_CACHE_TYPE* cache = cifsContext->blockCache;
+	unsigned int blocks = 5 * CIFS_READ_VECTOR_BLOCKS;
+	size_t length = (size_t)blocks * CIFS_DATA_SIZE;
+	unsigned char* expected = malloc(length);
+	unsigned char* actual = malloc(length);
+	for (size_t i = 0; i < length; i++)
+		expected[i] = (unsigned char)(i * 11 + i / 1000);
+
+	err = cifsCreateFile("vector.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("vector.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, expected, length, 0);
+
+	// a range starting and ending inside data blocks
+	CIFS_READ_VECTOR_TYPE* vector = NULL;
+	size_t offset = CIFS_DATA_SIZE + 17;
+	size_t size = 9 * CIFS_DATA_SIZE;
+	err |= cifsPreadv(handle, size, offset, &vector);
+	size_t gathered = 0;
+	for (int i = 0; vector != NULL && i < vector->count; i++)
+	{
+		memcpy(actual + gathered, vector->iov[i].iov_base, vector->iov[i].iov_len);
+		gathered += vector->iov[i].iov_len;
+	}
+	printf("  vector describes the range:  %s\n",
+		   err == CIFS_NO_ERROR && vector != NULL && vector->count == 10 && vector->length == size && gathered == size
+		   && memcmp(actual, expected + offset, size) == 0 ? "PASS" : "FAIL");
+
+	pthread_mutex_lock(&cache->lock);
+	int held = cache->heldSlots == 10 && cache->slots[vector->slots[0]].holders == 1;
+	pthread_mutex_unlock(&cache->lock);
+	printf("  vector holds cache slots:    %s\n", held ? "PASS" : "FAIL");
+
+	// new content for a held block goes to another slot
+	CIFS_INDEX_TYPE blockNumber = cifsContext->handles[handle]->blockMap->data[2];
+	CIFS_BLOCK_TYPE saved, changed, current;
+	cifsReadBlock((unsigned char*)&saved, blockNumber);
+	changed = saved;
+	memset(changed.content.data, '#', CIFS_DATA_SIZE);
+	cifsWriteBlock((const unsigned char*)&changed, blockNumber);
+	cifsReadBlock((unsigned char*)&current, blockNumber);
+	int slot = vector->slots[1];
+	printf("  held content kept on write:  %s\n",
+		   memcmp(vector->iov[1].iov_base, expected + 2 * CIFS_DATA_SIZE, CIFS_DATA_SIZE) == 0
+		   && current.content.data[0] == '#' && cache->slots[slot].detached ? "PASS" : "FAIL");
+	cifsWriteBlock((const unsigned char*)&saved, blockNumber);
+
+	cifsReleaseReadVector(vector);
+	pthread_mutex_lock(&cache->lock);
+	int released = cache->heldSlots == 0 && cache->slots[slot].blockNumber == CIFS_INVALID_INDEX;
+	pthread_mutex_unlock(&cache->lock);
+	printf("  release empties detached:    %s\n", released ? "PASS" : "FAIL");
+
+	// the vectors may hold only part of the cache
+	CIFS_READ_VECTOR_TYPE* vectors[5] = { NULL };
+	int full = 0;
+	for (int v = 0; v < 5; v++)
+	{
+		err = cifsPreadv(handle, CIFS_READ_VECTOR_BLOCKS * CIFS_DATA_SIZE, (size_t)v * CIFS_READ_VECTOR_BLOCKS * CIFS_DATA_SIZE,
+						 &vectors[v]);
+		full += err == CIFS_IN_USE_ERROR || (vectors[v] != NULL && vectors[v]->count < CIFS_READ_VECTOR_BLOCKS);
+	}
+	size_t bytesRead = 0;
+	err = cifsPread(handle, actual, length, 0, &bytesRead);
+	printf("  held slots are limited:      %s\n",
+		   full && err == CIFS_NO_ERROR && bytesRead == length && memcmp(actual, expected, length) == 0 ? "PASS" : "FAIL");
+	for (int v = 0; v < 5; v++)
+		cifsReleaseReadVector(vectors[v]);
+
+	err = cifsPreadv(handle, 100, length, &vector);
+	printf("  empty vector past the end:   %s\n",
+		   err == CIFS_NO_ERROR && vector != NULL && vector->count == 0 && vector->length == 0 ? "PASS" : "FAIL");
+	cifsReleaseReadVector(vector);
+	cifsCloseFile(handle);
+	cifsDeleteFile("vector.bin");
+
+	// the content of an inline file is copied into the vector
+	err = cifsCreateFile("tiny.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("tiny.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, "tiny content");
+	err |= cifsPreadv(handle, 100, 5, &vector);
+	printf("  inline file vector:          %s\n",
+		   err == CIFS_NO_ERROR && vector != NULL && vector->count == 1 && vector->length == 7
+		   && memcmp(vector->iov[0].iov_base, "content", 7) == 0 && vector->cache == NULL ? "PASS" : "FAIL");
+	cifsReleaseReadVector(vector);
+	cifsCloseFile(handle);
+	cifsDeleteFile("tiny.txt");
+
+	// the vector of a mapped volume owns a copy, which stays the same while the file gets new blocks
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	err = cifsMountFileSystemMode("cifs.vol", CIFS_MOUNT_MMAP);
+	err |= cifsCreateFile("vector.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("vector.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, expected, 4 * CIFS_DATA_SIZE, 0);
+	err |= cifsPreadv(handle, 2 * CIFS_DATA_SIZE, CIFS_DATA_SIZE, &vector);
+	unsigned char* mapped = err == CIFS_NO_ERROR ? cifsGetBlockPtr(cifsContext->handles[handle]->blockMap->data[1]) : NULL;
+	int copiedOut = vector != NULL && vector->count == 2 && vector->cache == NULL
+					&& ((unsigned char*)vector->iov[0].iov_base < mapped
+						|| (unsigned char*)vector->iov[0].iov_base >= mapped + CIFS_BLOCK_SIZE);
+	memset(actual, '#', 4 * CIFS_DATA_SIZE);
+	err |= cifsPwrite(handle, actual, 4 * CIFS_DATA_SIZE, 0);
+	cifsReclaimWait();
+	printf("  mapped vector owns a copy:   %s\n",
+		   err == CIFS_NO_ERROR && copiedOut && vector->length == 2 * CIFS_DATA_SIZE
+		   && memcmp(vector->iov[0].iov_base, expected + CIFS_DATA_SIZE, CIFS_DATA_SIZE) == 0
+		   && memcmp(vector->iov[1].iov_base, expected + 2 * CIFS_DATA_SIZE, CIFS_DATA_SIZE) == 0 ? "PASS" : "FAIL");
+	cifsReleaseReadVector(vector);
+	cifsCloseFile(handle);
+	cifsDeleteFile("vector.bin");
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	cifsMountFileSystem("cifs.vol");
+
+	free(expected);
+	free(actual);
+	printf("\n");
+}
+
+/***
+ *
+ * checks reading and writing ranges of binary content, across index blocks and past the end of the file
+ *
+ */
+void testRangeIO()
+{
+	printf("\n\nTESTS FOR RANGE READS AND WRITES\n================================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+	size_t length = 3 * CIFS_DATA_SIZE * (CIFS_INDEX_SIZE - 1) / 2; // spans two index blocks
+	size_t grown = length + 1000;
+	unsigned char* expected = calloc(grown, 1);
+	unsigned char* actual = malloc(grown);
+	for (size_t i = 0; i < length; i++)
+		expected[i] = (unsigned char)(i * 7); // includes '\0' bytes
+
+	err = cifsCreateFile("range.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("range.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, expected, length, 0);
+	size_t bytesRead = 0;
+	err |= cifsPread(handle, actual, length, 0, &bytesRead);
+	printf("  write and read binary data:  %s\n",
+		   err == CIFS_NO_ERROR && bytesRead == length && memcmp(actual, expected, length) == 0 ? "PASS" : "FAIL");
+
+	CIFS_REGISTRY_ENTRY_TYPE* entry = cifsContext->handles[handle];
+	const CIFS_BLOCK_MAP_TYPE* map = entry->blockMap;
+	printf("  block map built by a read:   %s\n",
+		   map != NULL && map->dataBlocks == (length + CIFS_DATA_SIZE - 1) / CIFS_DATA_SIZE && map->indexBlocks == 2
+		   && map->index[0] == entry->fileDescriptor.block_ref ? "PASS" : "FAIL");
+
+	// reads through the map, from the second index block and across the boundary of the two
+	int mapped = 1;
+	for (size_t at = 17; at < length; at += 4099)
+	{
+		mapped &= cifsPread(handle, actual, 1000, at, &bytesRead) == CIFS_NO_ERROR
+				  && bytesRead == (length - at < 1000 ? length - at : 1000)
+				  && memcmp(actual, expected + at, bytesRead) == 0;
+	}
+	printf("  reads through the block map: %s\n", mapped ? "PASS" : "FAIL");
+
+	// a range across the boundary of the first two index blocks, starting and ending inside data blocks
+	size_t offset = CIFS_DATA_SIZE * (CIFS_INDEX_SIZE - 1) - 100;
+	unsigned char patch[300];
+	memset(patch, 0xA5, sizeof(patch));
+	memcpy(expected + offset, patch, sizeof(patch));
+	err = cifsPwrite(handle, patch, sizeof(patch), offset);
+	err |= cifsPread(handle, actual, 50 + sizeof(patch) + 50, offset - 50, &bytesRead);
+	printf("  overwrite inside the file:   %s\n",
+		   err == CIFS_NO_ERROR && bytesRead == sizeof(patch) + 100
+		   && memcmp(actual, expected + offset - 50, bytesRead) == 0 ? "PASS" : "FAIL");
+	printf("  map kept by an overwrite:    %s\n", entry->blockMap == map ? "PASS" : "FAIL");
+
+	memset(patch, 0x5A, 200);
+	memcpy(expected + grown - 200, patch, 200);
+	err = cifsPwrite(handle, patch, 200, grown - 200);
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+	printf("  map dropped when growing:    %s\n", entry->blockMap == NULL ? "PASS" : "FAIL");
+	err |= cifsGetFileInfo("range.bin", &info);
+	err |= cifsPread(handle, actual, grown, 0, &bytesRead);
+	printf("  write past the end:          %s\n",
+		   err == CIFS_NO_ERROR && info.size == grown && bytesRead == grown
+		   && memcmp(actual, expected, grown) == 0 ? "PASS" : "FAIL");
+
+	err = cifsPread(handle, actual, 10, grown - 4, &bytesRead);
+	size_t atEnd = 1;
+	err |= cifsPread(handle, actual, 10, grown, &atEnd);
+	printf("  read at the end:             %s\n",
+		   err == CIFS_NO_ERROR && bytesRead == 4 && atEnd == 0 ? "PASS" : "FAIL");
+
+	char* whole = NULL;
+	err = cifsReadFile(handle, &whole);
+	printf("  whole-file read agrees:      %s\n",
+		   err == CIFS_NO_ERROR && whole != NULL && memcmp(whole, expected, grown) == 0 ? "PASS" : "FAIL");
+	free(whole);
+
+	cifsCloseFile(handle);
+	printf("  map dropped by the close:    %s\n", entry->blockMap == NULL ? "PASS" : "FAIL");
+	printf("  read from a closed file:     %s\n",
+		   cifsPread(handle, actual, 10, 0, &bytesRead) == CIFS_ACCESS_ERROR ? "PASS" : "FAIL");
+	err = cifsDeleteFile("range.bin");
+	printf("  delete range.bin:            %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	// a small change of a large file copies only the data block holding it and the index block referring to it
+	char* content = cifsGenerateContent(3 * CIFS_DATA_SIZE * (CIFS_INDEX_SIZE - 1));
+	err = cifsCreateFile("cow.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("cow.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, content);
+	err |= cifsPread(handle, actual, 1, 0, &bytesRead); // builds the block map
+	entry = cifsContext->handles[handle];
+	unsigned int dataBlocks = entry->blockMap->dataBlocks;
+	CIFS_INDEX_TYPE* before = malloc((dataBlocks + 3) * sizeof(CIFS_INDEX_TYPE));
+	memcpy(before, entry->blockMap->data, dataBlocks * sizeof(CIFS_INDEX_TYPE));
+	memcpy(before + dataBlocks, entry->blockMap->index, 3 * sizeof(CIFS_INDEX_TYPE));
+	unsigned int takenBefore = 0, takenAfter = 0;
+	cifsReclaimWait(); // released blocks are freed in the background
+	cifsJournalCommit(); // and reused once the transaction that freed them commits
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		takenBefore += cifsTestBit(cifsContext->bitvector, i);
+
+	content[CIFS_DATA_SIZE * (CIFS_INDEX_SIZE - 1) + 10] ^= 1; // in the first data block of the second index block
+	err |= cifsWriteFile(handle, content);
+	int changedData = 0;
+	for (unsigned int i = 0; i < dataBlocks; i++)
+		changedData += entry->blockMap->data[i] != before[i];
+	cifsReclaimWait();
+	cifsJournalCommit();
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		takenAfter += cifsTestBit(cifsContext->bitvector, i);
+	printf("  rewrite copies changed only: %s\n",
+		   err == CIFS_NO_ERROR && changedData == 1 && entry->blockMap->index[0] != before[dataBlocks]
+		   && entry->blockMap->index[1] != before[dataBlocks + 1] && entry->blockMap->index[2] == before[dataBlocks + 2]
+		   && takenAfter == takenBefore ? "PASS" : "FAIL");
+
+	char* rewritten = NULL;
+	err = cifsReadFile(handle, &rewritten);
+	printf("  rewritten content:           %s\n",
+		   err == CIFS_NO_ERROR && rewritten != NULL && strcmp(rewritten, content) == 0 ? "PASS" : "FAIL");
+	free(rewritten);
+
+	// a shorter content releases the blocks it no longer needs
+	content[CIFS_DATA_SIZE + 1] = '\0';
+	err = cifsWriteFile(handle, content);
+	err |= cifsReadFile(handle, &rewritten);
+	takenAfter = 0;
+	cifsReclaimWait();
+	cifsJournalCommit();
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		takenAfter += cifsTestBit(cifsContext->bitvector, i);
+	printf("  truncating rewrite:          %s\n",
+		   err == CIFS_NO_ERROR && rewritten != NULL && strcmp(rewritten, content) == 0
+		   && takenAfter == takenBefore - (dataBlocks + 3) + (2 + 1) ? "PASS" : "FAIL"); // two data blocks left
+	free(rewritten);
+	free(before);
+	free(content);
+
+	cifsCloseFile(handle);
+	err = cifsDeleteFile("cow.txt");
+	printf("  delete cow.txt:              %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	free(expected);
+	free(actual);
+
+	printf("\n");
+}
+
+/***
+ *
+ * checks that small files keep their content in the descriptor block, and move it to blocks when they grow
+ *
+ */
+void testInlineData()
+{
+	printf("\n\nTESTS FOR INLINE DATA\n=====================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+	CIFS_FILE_DESCRIPTOR_TYPE info;
+	char* content = NULL;
+	const char* snippet = "verbose=1\nretries=3\n";
+
+	unsigned int takenBefore = 0, takenAfter = 0;
+	cifsReclaimWait(); // released blocks are freed in the background
+	cifsJournalCommit(); // and reused once the transaction that freed them commits
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		takenBefore += cifsTestBit(cifsContext->bitvector, i);
+
+	err = cifsCreateFile("small.cfg", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("small.cfg", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, (char*)snippet);
+	err |= cifsGetFileInfo("small.cfg", &info);
+	cifsReclaimWait();
+	cifsJournalCommit();
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		takenAfter += cifsTestBit(cifsContext->bitvector, i);
+	printf("  small content stored inline: %s\n",
+		   err == CIFS_NO_ERROR && info.inlined && info.block_ref == CIFS_INVALID_INDEX && info.size == strlen(snippet)
+		   && takenAfter == takenBefore + 1 ? "PASS" : "FAIL"); // only the descriptor block
+
+	err = cifsReadFile(handle, &content);
+	printf("  read inline content:         %s\n",
+		   err == CIFS_NO_ERROR && content != NULL && strcmp(content, snippet) == 0 ? "PASS" : "FAIL");
+	free(content);
+
+	char part[8] = { 0 };
+	size_t bytesRead = 0;
+	err = cifsPwrite(handle, "5", 1, 18);
+	err |= cifsPread(handle, part, sizeof(part), 10, &bytesRead);
+	printf("  range in inline content:     %s\n",
+		   err == CIFS_NO_ERROR && bytesRead == 8 && memcmp(part, "retries=", 8) == 0 ? "PASS" : "FAIL");
+
+	// growing past the descriptor block moves the content to blocks; the gap is zeros
+	size_t offset = CIFS_INLINE_SIZE + 100;
+	unsigned char expected[CIFS_INLINE_SIZE + 108] = { 0 };
+	memcpy(expected, snippet, strlen(snippet));
+	expected[18] = '5';
+	memcpy(expected + offset, "appended", 8);
+	unsigned char actual[sizeof(expected)];
+	err = cifsPwrite(handle, "appended", 8, offset);
+	err |= cifsPread(handle, actual, sizeof(actual), 0, &bytesRead);
+	err |= cifsGetFileInfo("small.cfg", &info);
+	printf("  grown content in blocks:     %s\n",
+		   err == CIFS_NO_ERROR && !info.inlined && info.block_ref != CIFS_INVALID_INDEX && bytesRead == sizeof(expected)
+		   && memcmp(actual, expected, sizeof(expected)) == 0 ? "PASS" : "FAIL");
+
+	// and a short rewrite brings it back, releasing the blocks
+	err = cifsWriteFile(handle, (char*)snippet);
+	err |= cifsGetFileInfo("small.cfg", &info);
+	takenAfter = 0;
+	cifsReclaimWait();
+	cifsJournalCommit();
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		takenAfter += cifsTestBit(cifsContext->bitvector, i);
+	printf("  shrunk content inline again: %s\n",
+		   err == CIFS_NO_ERROR && info.inlined && info.block_ref == CIFS_INVALID_INDEX
+		   && takenAfter == takenBefore + 1 ? "PASS" : "FAIL");
+	cifsCloseFile(handle);
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	cifsMountFileSystem("cifs.vol");
+	content = NULL;
+	err = cifsOpenFile("small.cfg", S_IRUSR, &handle);
+	err |= cifsReadFile(handle, &content);
+	printf("  inline content after mount:  %s\n",
+		   err == CIFS_NO_ERROR && content != NULL && strcmp(content, snippet) == 0 ? "PASS" : "FAIL");
+	free(content);
+	cifsCloseFile(handle);
+
+	printf("\n");
+}
+
+#define CONCURRENCY_THREADS 8
+#define CONCURRENCY_ROUNDS 50
+
+typedef struct concurrency_worker_type
+{
+	int index;
+	struct fuse_context* context;
+	int failures;
+} CONCURRENCY_WORKER_TYPE;
+
+/***
+ *
+ * runs in its own thread as a separate process: creates a file in the shared folder and rewrites and reads it
+ * back repeatedly while looking up the files of the other workers
+ *
+ */
+void testStats()
+{
+	printf("\n\nTESTS FOR THE INSTRUMENTATION\n=============================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FILE_HANDLE_TYPE handle;
+	CIFS_STATS_TYPE before, after;
+	size_t length = 10 * CIFS_DATA_SIZE;
+	unsigned char* content = malloc(length);
+	memset(content, 's', length);
+
+	err = cifsGetStats(&before);
+	err |= cifsCreateFile("stats.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("stats.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, content, length, 0);
+	size_t bytesRead = 0;
+	err |= cifsPread(handle, content, length, 0, &bytesRead);
+	err |= cifsPread(handle, content, CIFS_DATA_SIZE, 0, &bytesRead);
+	err |= cifsCloseFile(handle);
+	err |= cifsDeleteFile("stats.bin");
+	err |= cifsGetStats(&after);
+
+	CIFS_OPERATION_STATS_TYPE* operations = after.operations;
+	printf("  operations are counted:      %s\n",
+		   err == CIFS_NO_ERROR
+		   && operations[CIFS_STATS_CREATE_FILE].calls == before.operations[CIFS_STATS_CREATE_FILE].calls + 1
+		   && operations[CIFS_STATS_OPEN_FILE].calls == before.operations[CIFS_STATS_OPEN_FILE].calls + 1
+		   && operations[CIFS_STATS_PWRITE].calls == before.operations[CIFS_STATS_PWRITE].calls + 1
+		   && operations[CIFS_STATS_PREAD].calls == before.operations[CIFS_STATS_PREAD].calls + 2
+		   && operations[CIFS_STATS_DELETE_FILE].calls == before.operations[CIFS_STATS_DELETE_FILE].calls + 1
+		   && operations[CIFS_STATS_PREAD].nanoseconds > before.operations[CIFS_STATS_PREAD].nanoseconds ? "PASS" : "FAIL");
+
+	int histograms = 1;
+	for (int operation = 0; operation < CIFS_STATS_OPERATIONS; operation++)
+	{
+		unsigned long long sum = 0;
+		for (int bucket = 0; bucket < CIFS_STATS_BUCKETS; bucket++)
+			sum += operations[operation].latency[bucket];
+		histograms &= sum == operations[operation].calls;
+	}
+	printf("  histograms hold every call:  %s\n", histograms ? "PASS" : "FAIL");
+
+	printf("  volume counters advance:     %s\n",
+		   after.cacheHits > before.cacheHits && after.cacheHits + after.cacheMisses > before.cacheHits + before.cacheMisses
+		   && after.bitvectorScans > before.bitvectorScans && after.registryLookups > before.registryLookups
+		   && after.registryProbes >= after.registryLookups - before.registryLookups + before.registryProbes ? "PASS" : "FAIL");
+
+	char* text = NULL;
+	err = cifsReadStatsFile(&text);
+	printf("  stats file renders counters: %s\n",
+		   err == CIFS_NO_ERROR && text != NULL && strstr(text, "cacheHits ") != NULL
+		   && strstr(text, "pread calls=") != NULL && text[strlen(text) - 1] == '\n' ? "PASS" : "FAIL");
+	free(text);
+	free(content);
+}
+
+void testOpenFileTable()
+{
+	printf("\n\nTESTS FOR THE OPEN FILE TABLES\n==============================\n\n");
+
+	enum { PROCESSES = 3000, FILES = 20 };
+	CIFS_ERROR err = CIFS_NO_ERROR;
+	CIFS_FILE_HANDLE_TYPE handles[PROCESSES];
+	char name[32];
+	pid_t pid = fuseContext->pid;
+
+	// every process opens a file of its own
+	for (int i = 0; i < PROCESSES; i++)
+	{
+		sprintf(name, "table%04d.txt", i);
+		err |= cifsCreateFile(name, CIFS_FILE_CONTENT_TYPE);
+		fuseContext->pid = 20000 + i;
+		err |= cifsOpenFile(name, S_IRUSR | S_IWUSR, &handles[i]);
+		fuseContext->pid = pid;
+	}
+	printf("  thousands of processes open: %s\n",
+		   err == CIFS_NO_ERROR && cifsContext->processCount == PROCESSES
+		   && cifsContext->processBuckets >= PROCESSES ? "PASS" : "FAIL");
+
+	// only the process that opened a file can use or close it
+	int owned = 1;
+	for (int i = 0; i < PROCESSES; i += 97)
+	{
+		fuseContext->pid = 20000 + (i + 1) % PROCESSES;
+		owned &= cifsOpenFileAccessRights(handles[i]) == 0 && cifsCloseFile(handles[i]) == CIFS_ACCESS_ERROR;
+		fuseContext->pid = 20000 + i;
+		owned &= cifsOpenFileAccessRights(handles[i]) == (S_IRUSR | S_IWUSR);
+	}
+	fuseContext->pid = pid;
+	printf("  files belong to the opener:  %s\n", owned ? "PASS" : "FAIL");
+
+	err = CIFS_NO_ERROR;
+	for (int i = 0; i < PROCESSES; i++)
+	{
+		fuseContext->pid = 20000 + i;
+		err |= cifsCloseFile(handles[i]);
+		fuseContext->pid = pid;
+		sprintf(name, "table%04d.txt", i);
+		err |= cifsDeleteFile(name);
+	}
+	printf("  closing releases processes:  %s\n",
+		   err == CIFS_NO_ERROR && cifsContext->processCount == 0 ? "PASS" : "FAIL");
+
+	// one process with more files than its table first holds, closed out of order
+	err = CIFS_NO_ERROR;
+	for (int i = 0; i < FILES; i++)
+	{
+		sprintf(name, "table%04d.txt", i);
+		err |= cifsCreateFile(name, CIFS_FILE_CONTENT_TYPE);
+		err |= cifsOpenFile(name, S_IRUSR, &handles[i]);
+	}
+	for (int i = 0; i < FILES; i += 3)
+		err |= cifsCloseFile(handles[i]);
+	int open = 1;
+	for (int i = 0; i < FILES; i++)
+		open &= (cifsOpenFileAccessRights(handles[i]) == S_IRUSR) == (i % 3 != 0);
+	for (int i = 0; i < FILES; i++)
+	{
+		if (i % 3 != 0)
+			err |= cifsCloseFile(handles[i]);
+		sprintf(name, "table%04d.txt", i);
+		err |= cifsDeleteFile(name);
+	}
+	printf("  table keeps the open files:  %s\n",
+		   err == CIFS_NO_ERROR && open && cifsContext->processCount == 0 ? "PASS" : "FAIL");
+}
+
+static unsigned int countTakenBlocks()
+{
+	cifsJournalCommit(); // the blocks freed by a transaction stay taken until it commits
+	unsigned int taken = 0;
+	for (unsigned int i = 0; i < CIFS_BITVECTOR_BITS; i++)
+		taken += cifsTestBit(cifsContext->bitvector, i);
+	return taken;
+}
+
+static CIFS_ERROR writeReclaimFile(const unsigned char* content, size_t length)
+{
+	CIFS_FILE_HANDLE_TYPE handle;
+	CIFS_ERROR err = cifsCreateFile("reclaim.bin", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("reclaim.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsPwrite(handle, content, length, 0);
+	err |= cifsCloseFile(handle);
+	return err;
+}
+
+void testReclaim()
+{
+	printf("\n\nTESTS FOR THE BLOCK RECLAMATION\n===============================\n\n");
+
+	CIFS_ERROR err;
+	size_t length = 3 * CIFS_RECLAIM_BATCH * CIFS_DATA_SIZE; // several batches of the reclaimer
+	unsigned char* content = malloc(length);
+	memset(content, 'r', length);
+
+	cifsReclaimWait();
+	unsigned int takenBefore = countTakenBlocks();
+	err = writeReclaimFile(content, length);
+	unsigned int takenFile = countTakenBlocks();
+	err |= cifsDeleteFile("reclaim.bin");
+	cifsReclaimWait();
+	printf("  deleted blocks are freed:    %s\n",
+		   err == CIFS_NO_ERROR && cifsContext->reclaimer != NULL && takenFile > takenBefore + 3 * CIFS_RECLAIM_BATCH
+		   && countTakenBlocks() == takenBefore && cifsContext->reclaimer->reclaimed == cifsContext->reclaimer->queued
+		   ? "PASS" : "FAIL");
+
+	// a rewrite hands the replaced blocks over, too
+	CIFS_FILE_HANDLE_TYPE handle;
+	err = writeReclaimFile(content, length);
+	err |= cifsOpenFile("reclaim.bin", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, "short");
+	err |= cifsCloseFile(handle);
+	cifsReclaimWait();
+	printf("  replaced blocks are freed:   %s\n",
+		   err == CIFS_NO_ERROR && countTakenBlocks() == takenBefore + 1 ? "PASS" : "FAIL");
+	err = cifsDeleteFile("reclaim.bin");
+
+	// unmounting frees everything still queued before the bitvector is saved
+	err |= writeReclaimFile(content, length);
+	err |= cifsDeleteFile("reclaim.bin");
+	err |= cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	err |= cifsMountFileSystem("cifs.vol");
+	printf("  unmount frees the queue:     %s\n",
+		   err == CIFS_NO_ERROR && countTakenBlocks() == takenBefore ? "PASS" : "FAIL");
+
+	// without the reclaimer, deleting frees the blocks before it returns
+	cifsDeferredReclaim = 0;
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	err = cifsMountFileSystem("cifs.vol");
+	err |= writeReclaimFile(content, length);
+	err |= cifsDeleteFile("reclaim.bin");
+	printf("  synchronous reclamation:     %s\n",
+		   err == CIFS_NO_ERROR && cifsContext->reclaimer == NULL && countTakenBlocks() == takenBefore ? "PASS" : "FAIL");
+	cifsDeferredReclaim = 1;
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+
+	// formatting over a mounted volume finishes its reclaimer before the volume is replaced
+	err = cifsCreateFileSystem("reformat.vol");
+	err |= cifsMountFileSystem("reformat.vol");
+	unsigned int takenFresh = countTakenBlocks();
+	err |= writeReclaimFile(content, length);
+	err |= cifsDeleteFile("reclaim.bin");
+	CIFS_CONTEXT_TYPE* mounted = cifsContext; // abandoned by the format, but not released
+	err |= cifsCreateFileSystem("reformat.vol");
+	int abandoned = cifsContext == NULL && mounted->reclaimer == NULL;
+	err |= cifsMountFileSystem("reformat.vol");
+	printf("  format stops the reclaimer:  %s\n",
+		   err == CIFS_NO_ERROR && abandoned && countTakenBlocks() == takenFresh ? "PASS" : "FAIL");
+	cifsUmountFileSystem("reformat.vol");
+	simulateFuseContext();
+	remove("reformat.vol");
+	remove("reformat.vol" CIFS_SNAPSHOT_SUFFIX);
+	cifsMountFileSystem("cifs.vol");
+
+	free(content);
+}
+
+/***
+ *
+ * flips the bit of the block in the bitvector on the volume, which must not be mounted
+ *
+ */
+static void flipVolumeBit(const char* volumeName, unsigned int blockNumber)
+{
+	FILE* volume = fopen(volumeName, "r+");
+	if (volume == NULL)
+		return;
+	unsigned char byte = 0;
+	fseek(volume, blockNumber / 8, SEEK_SET);
+	if (fread(&byte, 1, 1, volume) == 1)
+	{
+		byte ^= 0x80 >> blockNumber % 8; // the lowest block is in the most significant bit
+		fseek(volume, blockNumber / 8, SEEK_SET);
+		fwrite(&byte, 1, 1, volume);
+	}
+	fclose(volume);
+}
+
+/***
+ *
+ * reads the blocks at the front of the volume, up to the given one; the caller frees the copy
+ *
+ */
+static unsigned char* readVolumeFront(const char* volumeName, CIFS_INDEX_TYPE blocks)
+{
+	FILE* volume = fopen(volumeName, "r");
+	if (volume == NULL)
+		return NULL;
+	unsigned char* front = malloc((size_t)blocks * CIFS_BLOCK_SIZE);
+	if (front != NULL && fread(front, CIFS_BLOCK_SIZE, blocks, volume) != blocks)
+	{
+		free(front);
+		front = NULL;
+	}
+	fclose(volume);
+	return front;
+}
+
+/***
+ *
+ * checks the offline checker on a clean volume, and on one whose bitvector and back-pointers are broken
+ *
+ */
+void testFsck()
+{
+	printf("\n\nTESTS FOR THE VOLUME CHECK\n==========================\n\n");
+
+	CIFS_ERROR err;
+	CIFS_FSCK_REPORT_TYPE report;
+	err = cifsCheckVolume("cifs.vol", 0, 0, &report);
+	printf("  mounted volume refused:      %s\n", err == CIFS_IN_USE_ERROR ? "PASS" : "FAIL");
+
+	cifsUmountFileSystem("cifs.vol");
+	simulateFuseContext();
+	err = cifsCheckVolume("cifs.vol", 0, 0, &report);
+	printf("  test volume is consistent:   %s\n",
+		   err == CIFS_NO_ERROR && report.folders > 0 && report.files > 0 && report.leakedBlocks == 0
+		   && report.freeReferencedBlocks == 0 && report.crossLinkedBlocks == 0 && report.badReferences == 0
+		   && report.badBackPointers == 0 && report.badSizes == 0 && report.badIdentifiers == 0 ? "PASS" : "FAIL");
+
+	// a volume with a long file in a folder, and a file next to it
+	size_t length = 3 * (CIFS_INDEX_SIZE - 1) * CIFS_DATA_SIZE;
+	char* content = malloc(length + 1);
+	memset(content, 'k', length);
+	content[length] = '\0';
+	CIFS_FILE_HANDLE_TYPE handle;
+	CIFS_FILE_DESCRIPTOR_TYPE longFile, nextFile;
+	err = cifsCreateFileSystem("fsck.vol");
+	err |= cifsMountFileSystem("fsck.vol");
+	err |= cifsCreateFile("/folder", CIFS_FOLDER_CONTENT_TYPE);
+	err |= cifsCreateFile("/folder/long.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsOpenFile("/folder/long.txt", S_IRUSR | S_IWUSR, &handle);
+	err |= cifsWriteFile(handle, content);
+	err |= cifsCloseFile(handle);
+	err |= cifsCreateFile("/next.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsGetFileInfo("/folder/long.txt", &longFile);
+	err |= cifsGetFileInfo("/next.txt", &nextFile);
+	err |= cifsUmountFileSystem("fsck.vol");
+	simulateFuseContext();
+	err |= cifsCheckVolume("fsck.vol", 0, 2, &report);
+	printf("  fresh volume is consistent:  %s\n",
+		   err == CIFS_NO_ERROR && report.folders == 2 && report.files == 2 && report.leakedBlocks == 0
+		   && report.freeReferencedBlocks == 0 && report.badBackPointers == 0 && report.badSizes == 0 ? "PASS" : "FAIL");
+
+	// a leaked block, a free index block of the long file, and a descriptor naming the wrong folder
+	flipVolumeBit("fsck.vol", CIFS_BITVECTOR_BITS - 1);
+	flipVolumeBit("fsck.vol", longFile.block_ref);
+	FILE* volume = fopen("fsck.vol", "r+");
+	if (volume != NULL)
+	{
+		CIFS_INDEX_TYPE wrongParent = longFile.parent_block_ref;
+		fseek(volume, (long)nextFile.file_block_ref * CIFS_BLOCK_SIZE + offsetof(CIFS_BLOCK_TYPE, content)
+			  + offsetof(CIFS_FILE_DESCRIPTOR_TYPE, parent_block_ref), SEEK_SET);
+		fwrite(&wrongParent, sizeof wrongParent, 1, volume);
+		fclose(volume);
+	}
+	int traceLevel = cifsTraceLevel;
+	cifsTraceLevel = CIFS_TRACE_NONE;
+	err = cifsCheckVolume("fsck.vol", 0, 2, &report);
+	printf("  problems are found:          %s\n",
+		   err == CIFS_NO_ERROR && report.leakedBlocks == 1 && report.freeReferencedBlocks == 1
+		   && report.badBackPointers == 1 && report.repaired == 0 ? "PASS" : "FAIL");
+
+	err = cifsCheckVolume("fsck.vol", 1, 2, &report);
+	printf("  problems are repaired:       %s\n",
+		   err == CIFS_NO_ERROR && report.leakedBlocks == 1 && report.freeReferencedBlocks == 1
+		   && report.badBackPointers == 1 && report.repaired == 3 ? "PASS" : "FAIL");
+	cifsTraceLevel = traceLevel;
+
+	err = cifsCheckVolume("fsck.vol", 0, 1, &report);
+	int clean = err == CIFS_NO_ERROR && report.leakedBlocks == 0 && report.freeReferencedBlocks == 0
+				&& report.badBackPointers == 0;
+	char* readBack = NULL;
+	err = cifsMountFileSystem("fsck.vol");
+	err |= cifsGetFileInfo("/next.txt", &nextFile);
+	err |= cifsOpenFile("/folder/long.txt", S_IRUSR, &handle);
+	err |= cifsReadFile(handle, &readBack);
+	err |= cifsCloseFile(handle);
+	printf("  repaired volume mounts:      %s\n",
+		   clean && err == CIFS_NO_ERROR && nextFile.parent_block_ref == cifsContext->superblock->cifsRootNodeIndex
+		   && readBack != NULL && strcmp(readBack, content) == 0 ? "PASS" : "FAIL");
+	free(readBack);
+	cifsUmountFileSystem("fsck.vol");
+	simulateFuseContext();
+	remove("fsck.vol");
+	remove("fsck.vol" CIFS_SNAPSHOT_SUFFIX);
+	free(content);
+
+	// the mount refuses a folder listing a block outside of the volume, and a descriptor it cannot read
+	CIFS_FILE_DESCRIPTOR_TYPE root;
+	CIFS_INDEX_TYPE rootIndex = CIFS_INVALID_INDEX;
+	err = cifsCreateFileSystem("broken.vol");
+	err |= cifsMountFileSystem("broken.vol");
+	err |= cifsCreateFile("/victim.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsGetFileInfo("/victim.txt", &nextFile);
+	err |= cifsGetFileInfo("/", &root);
+	err |= cifsUmountFileSystem("broken.vol");
+	simulateFuseContext();
+	remove("broken.vol" CIFS_SNAPSHOT_SUFFIX); // the mount traverses the volume
+	volume = fopen("broken.vol", "r+");
+	if (volume != NULL)
+	{
+		CIFS_INDEX_TYPE outside = CIFS_INVALID_INDEX;
+		fseek(volume, (long)root.block_ref * CIFS_BLOCK_SIZE + offsetof(CIFS_BLOCK_TYPE, content), SEEK_SET);
+		err |= fread(&rootIndex, sizeof rootIndex, 1, volume) != 1;
+		fseek(volume, (long)root.block_ref * CIFS_BLOCK_SIZE + offsetof(CIFS_BLOCK_TYPE, content), SEEK_SET);
+		fwrite(&outside, sizeof outside, 1, volume);
+		fclose(volume);
+	}
+	// the bitvector, the superblock, and the journal are what a mount writes
+	unsigned char* frontBefore = readVolumeFront("broken.vol", root.file_block_ref);
+	CIFS_ERROR outsideError = cifsMountFileSystem("broken.vol");
+	unsigned char* frontAfter = readVolumeFront("broken.vol", root.file_block_ref);
+	int outsideRefused = cifsContext == NULL && frontBefore != NULL && frontAfter != NULL
+						 && memcmp(frontBefore, frontAfter, (size_t)root.file_block_ref * CIFS_BLOCK_SIZE) == 0;
+	free(frontBefore);
+	free(frontAfter);
+	printf("  block outside refused:       %s\n",
+		   err == CIFS_NO_ERROR && rootIndex == nextFile.file_block_ref && outsideError == CIFS_READ_ERROR
+		   && outsideRefused ? "PASS" : "FAIL");
+
+	volume = fopen("broken.vol", "r+");
+	if (volume != NULL)
+	{
+		fseek(volume, (long)root.block_ref * CIFS_BLOCK_SIZE + offsetof(CIFS_BLOCK_TYPE, content), SEEK_SET);
+		fwrite(&rootIndex, sizeof rootIndex, 1, volume);
+		fflush(volume);
+		err |= ftruncate(fileno(volume), (off_t)nextFile.file_block_ref * CIFS_BLOCK_SIZE) != 0;
+		fclose(volume);
+	}
+	CIFS_ERROR missingError = cifsMountFileSystem("broken.vol");
+	int missingRefused = cifsContext == NULL;
+	printf("  unreadable descriptor:       %s\n",
+		   err == CIFS_NO_ERROR && nextFile.file_block_ref > root.file_block_ref && missingError == CIFS_READ_ERROR
+		   && missingRefused ? "PASS" : "FAIL");
+
+	// the mount also refuses a folder that lists its own parent, instead of registering the parent again
+	CIFS_FILE_DESCRIPTOR_TYPE sub;
+	err = cifsCreateFileSystem("broken.vol");
+	err |= cifsMountFileSystem("broken.vol");
+	err |= cifsCreateFile("/sub", CIFS_FOLDER_CONTENT_TYPE);
+	err |= cifsCreateFile("/sub/child.txt", CIFS_FILE_CONTENT_TYPE);
+	err |= cifsGetFileInfo("/sub", &sub);
+	err |= cifsGetFileInfo("/", &root);
+	err |= cifsUmountFileSystem("broken.vol");
+	simulateFuseContext();
+	remove("broken.vol" CIFS_SNAPSHOT_SUFFIX);
+	volume = fopen("broken.vol", "r+");
+	if (volume != NULL)
+	{
+		fseek(volume, (long)sub.block_ref * CIFS_BLOCK_SIZE + offsetof(CIFS_BLOCK_TYPE, content), SEEK_SET);
+		fwrite(&root.file_block_ref, sizeof root.file_block_ref, 1, volume);
+		fclose(volume);
+	}
+	CIFS_ERROR cycleError = cifsMountFileSystem("broken.vol");
+	printf("  parent listed again refused: %s\n",
+		   err == CIFS_NO_ERROR && sub.size == 1 && cycleError == CIFS_READ_ERROR && cifsContext == NULL
+		   ? "PASS" : "FAIL");
+	remove("broken.vol");
+	remove("broken.vol" CIFS_SNAPSHOT_SUFFIX);
+
+	cifsMountFileSystem("cifs.vol");
+
+	printf("\n");
+}
+
+static void* concurrencyWorker(void* argument)
+{
+	CONCURRENCY_WORKER_TYPE* worker = (CONCURRENCY_WORKER_TYPE*)argument;
+	fuseContext = worker->context;
+
+	char path[CIFS_MAX_NAME_LENGTH];
+	snprintf(path, sizeof(path), "shared/worker%d.txt", worker->index);
+	if (cifsCreateFile(path, CIFS_FILE_CONTENT_TYPE) != CIFS_NO_ERROR)
+		worker->failures++;
+
+	CIFS_FILE_HANDLE_TYPE handle;
+	if (cifsOpenFile(path, S_IRUSR | S_IWUSR, &handle) != CIFS_NO_ERROR)
+	{
+		worker->failures++;
+		return NULL;
+	}
+
+	for (int round = 0; round < CONCURRENCY_ROUNDS; round++)
+	{
+		char* content = cifsGenerateContent(1 + (worker->index * 131 + round * 37) % 700);
+		char* read = NULL;
+		if (cifsWriteFile(handle, content) != CIFS_NO_ERROR
+			|| cifsReadFile(handle, &read) != CIFS_NO_ERROR || read == NULL || strcmp(read, content) != 0)
+			worker->failures++;
+		free(read);
+		free(content);
+
+		char other[CIFS_MAX_NAME_LENGTH];
+		CIFS_FILE_DESCRIPTOR_TYPE info;
+		snprintf(other, sizeof(other), "shared/worker%d.txt", (worker->index + round) % CONCURRENCY_THREADS);
+		CIFS_ERROR err = cifsGetFileInfo(other, &info);
+		if (err != CIFS_NO_ERROR && err != CIFS_NOT_FOUND_ERROR)
+			worker->failures++;
+	}
+
+	if (cifsCloseFile(handle) != CIFS_NO_ERROR)
+		worker->failures++;
+
+	return NULL;
+}
+
+#define CONCURRENCY_CLAIMS 200
+
+/***
+ *
+ * runs in its own thread: takes single blocks and a run of blocks, all of which must differ from those of
+ * the other threads
+ *
+ */
+static void* claimWorker(void* argument)
+{
+	CIFS_INDEX_TYPE* blocks = (CIFS_INDEX_TYPE*)argument;
+	for (int i = 0; i < CONCURRENCY_CLAIMS; i++)
+		blocks[i] = cifsAllocateBlock();
+
+	int numberOfExtents = 0;
+	CIFS_EXTENT_TYPE* extents = cifsAllocateExtents(CONCURRENCY_CLAIMS, &numberOfExtents);
+	for (int i = 0, k = CONCURRENCY_CLAIMS; extents != NULL && i < numberOfExtents; i++)
+		for (unsigned int j = 0; j < extents[i].length; j++)
+			blocks[k++] = extents[i].start + j;
+	free(extents);
+
+	return NULL;
+}
+
+/***
+ *
+ * checks that the file system stays consistent when several processes use it from concurrent threads
+ *
+ */
+void testConcurrency()
+{
+	printf("\n\nTESTS FOR CONCURRENT ACCESS\n===========================\n\n");
+
+	CIFS_ERROR err = cifsCreateFile("shared", CIFS_FOLDER_CONTENT_TYPE);
+	printf("  create the shared folder:    %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	pthread_t threads[CONCURRENCY_THREADS];
+	CONCURRENCY_WORKER_TYPE workers[CONCURRENCY_THREADS];
+	struct fuse_context contexts[CONCURRENCY_THREADS];
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+	{
+		contexts[i] = *fuseContext;
+		contexts[i].pid = 2000 + i; // every worker is a separate process of the same user
+		workers[i] = (CONCURRENCY_WORKER_TYPE){ .index = i, .context = &contexts[i], .failures = 0 };
+		pthread_create(&threads[i], NULL, concurrencyWorker, &workers[i]);
+	}
+
+	int failures = 0;
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+		failures += workers[i].failures;
+	}
+	printf("  concurrent writes and reads: %s\n", failures == 0 ? "PASS" : "FAIL");
+
+	// the blocks taken by all threads together, checked against a private bitvector
+	static CIFS_INDEX_TYPE claims[CONCURRENCY_THREADS][2 * CONCURRENCY_CLAIMS];
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+		pthread_create(&threads[i], NULL, claimWorker, claims[i]);
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	static _Alignas(unsigned long long) unsigned char seen[CIFS_BITVECTOR_SIZE];
+	memset(seen, 0, sizeof(seen));
+	int duplicates = 0;
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+		for (int j = 0; j < 2 * CONCURRENCY_CLAIMS; j++)
+		{
+			CIFS_INDEX_TYPE block = claims[i][j];
+			if (block >= CIFS_BITVECTOR_BITS || cifsTestBit(seen, block) || !cifsTestBit(cifsContext->bitvector, block))
+				duplicates++;
+			else
+				cifsSetBit(seen, block);
+		}
+	printf("  concurrent block claims:     %s\n", duplicates == 0 ? "PASS" : "FAIL");
+
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+		for (int j = 0; j < 2 * CONCURRENCY_CLAIMS; j++)
+			if (claims[i][j] < CIFS_BITVECTOR_BITS)
+				cifsReleaseBlock(claims[i][j]);
+	writeBvSb();
+
+	CIFS_FILE_DESCRIPTOR_TYPE folder;
+	err = cifsGetFileInfo("shared", &folder);
+	printf("  all files registered:        %s\n",
+		   err == CIFS_NO_ERROR && folder.size == CONCURRENCY_THREADS ? "PASS" : "FAIL");
+
+	err = CIFS_NO_ERROR;
+	for (int i = 0; i < CONCURRENCY_THREADS; i++)
+	{
+		char path[CIFS_MAX_NAME_LENGTH];
+		snprintf(path, sizeof(path), "shared/worker%d.txt", i);
+		err |= cifsDeleteFile(path);
+	}
+	err |= cifsDeleteFile("shared");
+	printf("  delete the shared files:     %s\n", err == CIFS_NO_ERROR ? "PASS" : "FAIL");
+
+	printf("\n");
+}
+
+#endif